@@ -0,0 +1,1710 @@
+// Author(s): Matthew Speranza
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "include/direct.h"
+#include "include/induce.h"
+#include "include/multipoleFrame.h"
+#include "../common/include/batch.h"
+#include "../common/include/commandInterpreter.h"
+#include "../common/include/dynamics.h"
+#include "../common/include/energy.h"
+#include "../common/include/forceFieldReader.h"
+#include "../common/include/neighborList.h"
+#include "../common/include/replicaExchange.h"
+#include "../common/include/xyz.h"
+
+#ifdef MIXED_PRECISION
+// direct.c compiled again in double precision (DIRECT_DOUBLE)
+DirectWorkspace* directWorkspaceCreateDouble(System* system);
+void directWorkspaceDestroyDouble(DirectWorkspace* work);
+REAL multipoleRealSpaceDouble(System* system, DirectWorkspace* work, REAL* grad, REAL* torque, REAL* virial);
+#endif
+
+static double elapsed(struct timespec start, struct timespec end) {
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+static REAL randomReal(REAL lo, REAL hi) {
+  return lo + (hi - lo) * (REAL) rand() / RAND_MAX;
+}
+
+/**
+ * Random traceless multipoles (with the force field file's 1/3 quadrupole convention) in one flat block.
+ */
+static void randomMultipoles(System* system) {
+  REAL* flat = malloc(sizeof(REAL)*system->nAtoms*10);
+  system->multipoles = malloc(sizeof(REAL*)*system->nAtoms);
+  for(int i = 0; i < system->nAtoms; i++) {
+    REAL* m = system->multipoles[i] = flat + i*10;
+    m[0] = randomReal(-0.5, 0.5);
+    for(int j = 1; j < 4; j++) {
+      m[j] = randomReal(-0.2, 0.2);
+    }
+    m[4] = randomReal(-0.2, 0.2);
+    m[5] = randomReal(-0.2, 0.2);
+    m[6] = -(m[4] + m[5]);
+    for(int j = 7; j < 10; j++) {
+      m[j] = randomReal(-0.2, 0.2);
+    }
+  }
+}
+
+/**
+ * Cubic box of random atoms where atoms 2a and 2a+1 are bonded 1 ANG apart so that exclusions get exercised.
+ */
+static System* testSystem(int nAtoms, REAL boxLen, REAL cutoff) {
+  System* system = calloc(1, sizeof(System));
+  systemDefaults(system);
+  system->nAtoms = nAtoms;
+  system->realspaceCutoff = cutoff;
+  system->X = malloc(sizeof(REAL)*nAtoms*3);
+  system->list12 = malloc(sizeof(IntVector)*nAtoms);
+  for(int i = 0; i < 3; i++) {
+    system->boxDim[i][i] = boxLen;
+    system->minDim[i] = 0.0;
+  }
+  for(int i = 0; i < nAtoms; i++) {
+    intVectorInit(&system->list12[i], 2, MEMORY_STRUCTURE);
+    if(i % 2 == 1) {
+      system->X[i*3] = system->X[(i-1)*3] + 1.0;
+      system->X[i*3+1] = system->X[(i-1)*3+1];
+      system->X[i*3+2] = system->X[(i-1)*3+2];
+      int bonded = i-1;
+      intVectorPush(&system->list12[i], bonded);
+      bonded = i;
+      intVectorPush(&system->list12[i-1], bonded);
+    } else {
+      for(int j = 0; j < 3; j++) {
+        system->X[i*3+j] = randomReal(0.0, boxLen - 1.0);
+      }
+    }
+  }
+  randomMultipoles(system);
+  buildLists(system);
+  return system;
+}
+
+static void testSystemDestroy(System* system) {
+  for(int i = 0; i < system->nAtoms; i++) {
+    intVectorFree(&system->list12[i]);
+  }
+  free(system->list12);
+  bondedDestroy(system);
+  verletDestroy(system);
+  free(system->multipoles[0]);
+  free(system->multipoles);
+  free(system->X);
+  free(system);
+}
+
+static REAL realSpaceEnergy(System* system, DirectWorkspace* work, REAL* grad, REAL* torque) {
+  memset(grad, 0, sizeof(REAL)*system->nAtoms*3);
+  memset(torque, 0, sizeof(REAL)*system->nAtoms*3);
+  return multipoleRealSpace(system, work, grad, torque, NULL);
+}
+
+/**
+ * Rotates atom i's dipole and quadrupole by angle about a coordinate axis (Q' = R Q R^T).
+ */
+static void rotateMultipole(REAL* m, int axis, REAL angle) {
+  REAL R[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+  int a = (axis + 1) % 3, b = (axis + 2) % 3;
+  R[a][a] = cos(angle);
+  R[a][b] = -sin(angle);
+  R[b][a] = sin(angle);
+  R[b][b] = cos(angle);
+  REAL d[3] = {m[1], m[2], m[3]};
+  REAL Q[3][3] = {{m[4], m[7]/2, m[8]/2}, {m[7]/2, m[5], m[9]/2}, {m[8]/2, m[9]/2, m[6]}};
+  REAL Qr[3][3] = {{0}};
+  for(int j = 0; j < 3; j++) {
+    m[1+j] = R[j][0]*d[0] + R[j][1]*d[1] + R[j][2]*d[2];
+    for(int k = 0; k < 3; k++) {
+      for(int l = 0; l < 3; l++) {
+        for(int n = 0; n < 3; n++) {
+          Qr[j][k] += R[j][l]*Q[l][n]*R[k][n];
+        }
+      }
+    }
+  }
+  m[4] = Qr[0][0];
+  m[5] = Qr[1][1];
+  m[6] = Qr[2][2];
+  m[7] = 2*Qr[0][1];
+  m[8] = 2*Qr[0][2];
+  m[9] = 2*Qr[1][2];
+}
+
+/**
+ * Plain double precision real space energy straight from libm erfc, the reference for the kernel in any precision.
+ */
+static double referenceEnergy(System* system) {
+  const double f = ELECTRIC, alpha = system->ewaldAlpha;
+  const double cut2 = system->realspaceCutoff*system->realspaceCutoff;
+  double* scale = malloc(sizeof(double)*system->nAtoms);
+  for(int k = 0; k < system->nAtoms; k++) {
+    scale[k] = 1.0;
+  }
+  double energy = 0.0;
+  for(int i = 0; i < system->nAtoms; i++) {
+    IntVector* lists[3] = {&system->list12[i], &system->list13[i], &system->list14[i]};
+    for(int l = 0; l < 3; l++) {
+      for(int n = 0; n < lists[l]->size; n++) {
+        scale[((int*) lists[l]->array)[n]] = system->mpoleScale[l];
+      }
+    }
+    const REAL* mi = system->multipoles[i];
+    double di[3] = {mi[1], mi[2], mi[3]};
+    double qi[3][3] = {{mi[4], mi[7]/2, mi[8]/2}, {mi[7]/2, mi[5], mi[9]/2}, {mi[8]/2, mi[9]/2, mi[6]}};
+    int* neighbors = system->verletList[i].array;
+    for(int n = 0; n < system->verletList[i].size; n++) {
+      int k = neighbors[n];
+      double x[3], r2 = 0.0;
+      for(int j = 0; j < 3; j++) {
+        x[j] = imageDx(system->X[k*3+j] - system->X[i*3+j], system->boxDim[j][j]);
+        r2 += x[j]*x[j];
+      }
+      if(r2 > cut2) {
+        continue;
+      }
+      const REAL* mk = system->multipoles[k];
+      double dk[3] = {mk[1], mk[2], mk[3]};
+      double qk[3][3] = {{mk[4], mk[7]/2, mk[8]/2}, {mk[7]/2, mk[5], mk[9]/2}, {mk[8]/2, mk[9]/2, mk[6]}};
+      double r = sqrt(r2), sk = 1.0 - scale[k];
+      // B functions and the undamped 1/r^n series, (2n-1)!! / r^(2n+1)
+      double bn[5], rr[5];
+      double expTerm = exp(-alpha*alpha*r2)/(sqrt(M_PI)*alpha), alsq2n = 1.0;
+      bn[0] = erfc(alpha*r)/r;
+      rr[0] = 1.0/r;
+      for(int m = 1; m < 5; m++) {
+        alsq2n *= 2.0*alpha*alpha;
+        bn[m] = ((2*m-1)*bn[m-1] + alsq2n*expTerm)/r2;
+        rr[m] = (2*m-1)*rr[m-1]/r2;
+      }
+      double dir = 0, dkr = 0, dik = 0, qir = 0, qkr = 0, qik = 0, diqk = 0, dkqi = 0, qiqk = 0;
+      double qix[3] = {0}, qkx[3] = {0};
+      for(int a = 0; a < 3; a++) {
+        for(int b = 0; b < 3; b++) {
+          qix[a] += qi[a][b]*x[b];
+          qkx[a] += qk[a][b]*x[b];
+          qiqk += qi[a][b]*qk[a][b];
+        }
+      }
+      for(int a = 0; a < 3; a++) {
+        dir += di[a]*x[a];
+        dkr += dk[a]*x[a];
+        dik += di[a]*dk[a];
+        qir += qix[a]*x[a];
+        qkr += qkx[a]*x[a];
+        qik += qix[a]*qkx[a];
+        diqk += di[a]*qkx[a];
+        dkqi += dk[a]*qix[a];
+      }
+      double terms[5] = {mi[0]*mk[0], mk[0]*dir - mi[0]*dkr + dik,
+        mi[0]*qkr + mk[0]*qir - dir*dkr + 2.0*(dkqi - diqk + qiqk), dir*qkr - dkr*qir - 4.0*qik, qir*qkr};
+      for(int m = 0; m < 5; m++) {
+        energy += f*terms[m]*(bn[m] - sk*rr[m]);
+      }
+    }
+    for(int l = 0; l < 3; l++) {
+      for(int n = 0; n < lists[l]->size; n++) {
+        scale[((int*) lists[l]->array)[n]] = 1.0;
+      }
+    }
+  }
+  free(scale);
+  return energy;
+}
+
+void directTest(bool verbose, char* benchmarkXYZ) {
+  srand(11);
+  // erfc table against libm
+  ErfcTable* table = erfcTableCreate(0.4, 12.0);
+  double maxErr = 0.0;
+  for(int k = 0; k < 10000; k++) {
+    double x = 0.4*12.0*k/10000.0;
+    double s = x*table->invDx;
+    int idx = (int) s;
+    double u = s - idx;
+    REAL* c = table->coefficients + 4*idx;
+    maxErr = fmax(maxErr, fabs(c[0] + u*(c[1] + u*(c[2] + u*c[3])) - erfc(x)));
+  }
+  assert(maxErr < 1e-11);
+  erfcTableDestroy(table);
+  assert(fabs(ewaldCoefficient(9.0, 1e-8) - 0.4200) < 1e-3);
+
+  // Neighbor list against all pairs
+  System* system = testSystem(400, 20.0, 7.0);
+  DirectWorkspace* work = directWorkspaceCreate(system);
+  REAL* grad = malloc(sizeof(REAL)*system->nAtoms*3);
+  REAL* torque = malloc(sizeof(REAL)*system->nAtoms*3);
+  long listPairs = 0, bruteForcePairs = 0;
+  REAL rList2 = pow(system->realspaceCutoff + system->realspaceBuffer, 2);
+  for(int i = 0; i < system->nAtoms; i++) {
+    listPairs += system->verletList[i].size;
+    for(int j = i+1; j < system->nAtoms; j++) {
+      REAL r2 = 0.0;
+      for(int k = 0; k < 3; k++) {
+        REAL dx = imageDx(system->X[i*3+k] - system->X[j*3+k], system->boxDim[k][k]);
+        r2 += dx*dx;
+      }
+      bruteForcePairs += r2 < rList2;
+    }
+  }
+  if(verbose) {
+    printf("Verlet pairs %ld, all-pairs search %ld\n", listPairs, bruteForcePairs);
+  }
+  assert(listPairs == bruteForcePairs);
+
+  // Energy against the double precision reference, gradient and torque against its finite differences. Mixed
+  // precision builds check their gradients against a double run of the kernel instead (mixedPrecisionTest).
+  const bool mixed = sizeof(PREAL) < sizeof(double);
+  REAL energy = realSpaceEnergy(system, work, grad, torque);
+  double reference = referenceEnergy(system);
+  double energyError = fabs(energy - reference)/fabs(reference);
+  assert(energyError < (mixed ? 1e-5 : 1e-10));
+  double gradScale = 0.0;
+  for(int a = 0; a < system->nAtoms*3; a++) {
+    gradScale = fmax(gradScale, fabs(grad[a]));
+  }
+  double gradError = 0.0, torqueError = 0.0;
+  REAL h = 1e-4;
+  for(int a = 0; a < (mixed ? 0 : 4); a++) {
+    for(int k = 0; k < 3; k++) {
+      system->X[a*3+k] += h;
+      double ePlus = referenceEnergy(system);
+      system->X[a*3+k] -= 2*h;
+      double eMinus = referenceEnergy(system);
+      system->X[a*3+k] += h;
+      double fd = (ePlus - eMinus) / (2*h);
+      if(verbose) {
+        printf("Atom %d grad[%d] analytic %12.6f finite difference %12.6f\n", a, k, grad[a*3+k], fd);
+      }
+      gradError = fmax(gradError, fabs(fd - grad[a*3+k])/gradScale);
+      assert(fabs(fd - grad[a*3+k]) < 1e-4 + 1e-6*gradScale);
+      // Torque is -dE/dangle for a rotation of the atom's multipole about axis k
+      rotateMultipole(system->multipoles[a], k, h);
+      ePlus = referenceEnergy(system);
+      rotateMultipole(system->multipoles[a], k, -2*h);
+      eMinus = referenceEnergy(system);
+      rotateMultipole(system->multipoles[a], k, h);
+      fd = -(ePlus - eMinus) / (2*h);
+      if(verbose) {
+        printf("Atom %d torque[%d] analytic %12.6f finite difference %12.6f\n", a, k, torque[a*3+k], fd);
+      }
+      torqueError = fmax(torqueError, fabs(fd - torque[a*3+k])/gradScale);
+      assert(fabs(fd - torque[a*3+k]) < 1e-4 + 1e-6*gradScale);
+    }
+  }
+  if(verbose) {
+    printf("Multipole real space against the reference: energy %.2e, finite difference gradient %.2e, torque %.2e "
+      "(relative to the largest gradient)\n", energyError, gradError, torqueError);
+  }
+  // Newton's third law: total gradient vanishes
+  REAL total[3] = {0.0, 0.0, 0.0};
+  for(int i = 0; i < system->nAtoms; i++) {
+    for(int k = 0; k < 3; k++) {
+      total[k] += grad[i*3+k];
+    }
+  }
+  assert(fabs(total[0]) + fabs(total[1]) + fabs(total[2]) < (mixed ? 1e-6*gradScale*system->nAtoms : 1e-6));
+  if(verbose) {
+    printf("Real space energy %.6f self energy %.6f\n", energy, multipoleSelfEnergy(system));
+  }
+  // Atoms go to threads in fixed chunks and the buffers are reduced in thread order: repeated runs agree bitwise
+  REAL* grad2 = malloc(sizeof(REAL)*system->nAtoms*3);
+  REAL* torque2 = malloc(sizeof(REAL)*system->nAtoms*3);
+  energy = realSpaceEnergy(system, work, grad, torque);
+  for(int run = 0; run < 3; run++) {
+    REAL again = realSpaceEnergy(system, work, grad2, torque2);
+    assert(again == energy);
+    assert(memcmp(grad, grad2, sizeof(REAL)*system->nAtoms*3) == 0);
+    assert(memcmp(torque, torque2, sizeof(REAL)*system->nAtoms*3) == 0);
+  }
+  // Near and far parts of a split sum add up to the whole, the switch is part of the gradient
+  REAL* gradFar = malloc(sizeof(REAL)*system->nAtoms*3);
+  REAL* torqueFar = malloc(sizeof(REAL)*system->nAtoms*3);
+  work->switchStart = 3.0;
+  work->switchEnd = 5.0;
+  work->part = REAL_SPACE_NEAR;
+  REAL near = realSpaceEnergy(system, work, grad2, torque2);
+  work->part = REAL_SPACE_FAR;
+  REAL far = realSpaceEnergy(system, work, gradFar, torqueFar);
+  assert(fabs(near + far - energy) < (mixed ? 1e-5 : 1e-10)*fabs(energy));
+  for(int a = 0; a < system->nAtoms*3; a++) {
+    assert(fabs(grad2[a] + gradFar[a] - grad[a]) < (mixed ? 1e-5 : 1e-10)*gradScale);
+    assert(fabs(torque2[a] + torqueFar[a] - torque[a]) < (mixed ? 1e-5 : 1e-10)*gradScale);
+  }
+  if(!mixed) { // Single precision energies are too coarse for finite differences of the kernel itself
+    work->part = REAL_SPACE_NEAR;
+    for(int a = 0; a < 4; a++) {
+      for(int k = 0; k < 3; k++) {
+        system->X[a*3+k] += h;
+        double ePlus = realSpaceEnergy(system, work, gradFar, torqueFar);
+        system->X[a*3+k] -= 2*h;
+        double eMinus = realSpaceEnergy(system, work, gradFar, torqueFar);
+        system->X[a*3+k] += h;
+        assert(fabs((ePlus - eMinus)/(2*h) - grad2[a*3+k]) < 1e-6*gradScale);
+      }
+    }
+  }
+  work->part = REAL_SPACE_ALL;
+  free(gradFar);
+  free(torqueFar);
+  free(grad2);
+  free(torque2);
+  free(grad);
+  free(torque);
+  directWorkspaceDestroy(work);
+  testSystemDestroy(system);
+
+  // Throughput at DHFR size and density (23,558 atoms, 62.23 ANG box, 12 ANG cutoff) or on the given xyz file
+  if(benchmarkXYZ != NULL) {
+    system = calloc(1, sizeof(System));
+    systemDefaults(system);
+    readXYZ(system, benchmarkXYZ);
+    for(int i = 0; i < 3; i++) {
+      system->boxDim[i][i] = 62.23;
+    }
+    system->realspaceCutoff = 12.0;
+    randomMultipoles(system);
+    buildLists(system);
+  } else {
+    system = testSystem(23558, 62.23, 12.0);
+  }
+  work = directWorkspaceCreate(system);
+  grad = malloc(sizeof(REAL)*system->nAtoms*3);
+  torque = malloc(sizeof(REAL)*system->nAtoms*3);
+  long cutoffPairs = 0;
+  REAL cut2 = system->realspaceCutoff*system->realspaceCutoff;
+  for(int i = 0; i < system->nAtoms; i++) {
+    int* list = system->verletList[i].array;
+    for(int n = 0; n < system->verletList[i].size; n++) {
+      REAL r2 = 0.0;
+      for(int k = 0; k < 3; k++) {
+        REAL dx = imageDx(system->X[i*3+k] - system->X[list[n]*3+k], system->boxDim[k][k]);
+        r2 += dx*dx;
+      }
+      cutoffPairs += r2 <= cut2;
+    }
+  }
+  struct timespec start, end;
+  int reps = 3;
+  realSpaceEnergy(system, work, grad, torque); // warm up
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int r = 0; r < reps; r++) {
+    realSpaceEnergy(system, work, grad, torque);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double t = elapsed(start, end) / reps;
+  printf("Multipole real space (%s, %d atoms, %.0f ANG cutoff): %ld pairs, %.3f s/eval, %.2f Mpairs/s on %d thread(s)\n",
+    benchmarkXYZ != NULL ? benchmarkXYZ : "DHFR-sized random box", system->nAtoms, system->realspaceCutoff,
+    cutoffPairs, t, cutoffPairs / t / 1e6, work->nThreads);
+  free(grad);
+  free(torque);
+  directWorkspaceDestroy(work);
+  if(benchmarkXYZ == NULL) {
+    testSystemDestroy(system);
+  }
+  printf("All tests of direct.c passed!\n");
+}
+
+/**
+ * Random traceless local multipole for one force field entry.
+ */
+static Multipole frameParameter(int type, int z, int x, int y, enum MultipoleFrameDef frameDef) {
+  Multipole parameter = {0};
+  Multipole* mpole = &parameter;
+  int frame[4] = {type, z, x, y};
+  memcpy(mpole->frameAtomTypes, frame, sizeof(frame));
+  mpole->frameDef = frameDef;
+  REAL* m = mpole->multipole;
+  m[0] = randomReal(-0.5, 0.5);
+  if(frameDef != MPOL_NONE) {
+    for(int j = 1; j < 10; j++) {
+      m[j] = randomReal(-0.2, 0.2);
+    }
+    m[6] = -(m[4] + m[5]);
+  }
+  return parameter;
+}
+
+/**
+ * Copies of four small molecules covering every frame definition, each randomly rotated, jittered and placed in a
+ * cubic box. Per copy (15 atoms):
+ * <p>
+ * methylamine N(1) Z-then-bisector, C(2) three-fold, H(3) on N Z-then-X with X 1-3, H(4) on C Z-only
+ * <p>
+ * water O(5) bisector, H(6) Z-then-X with the other H as X
+ * <p>
+ * ion(7) no frame
+ * <p>
+ * chiral center(8) Z-then-X with a Y atom, substituents 9, 10, 11 Z-only
+ */
+static System* frameTestSystem(int nCopies, REAL boxLen, REAL cutoff) {
+  const int nTemplate = 15;
+  const int types[15] = {1, 2, 3, 3, 4, 4, 4, 5, 6, 6, 7, 8, 9, 10, 11};
+  const REAL coords[15][3] = {
+    {0.0, 0.0, 0.0}, {1.47, 0.0, 0.0}, {-0.34, 0.94, 0.0}, {-0.34, -0.47, 0.81},
+    {1.83, 1.03, 0.0}, {1.83, -0.51, 0.89}, {1.83, -0.51, -0.89},
+    {0.0, 0.0, 0.0}, {0.96, 0.0, 0.0}, {-0.24, 0.93, 0.0},
+    {0.0, 0.0, 0.0},
+    {0.0, 0.0, 0.0}, {1.0, 0.1, 0.0}, {-0.3, 0.95, 0.1}, {-0.35, -0.4, 0.85}};
+  const int bonds[12][2] = {{0, 1}, {0, 2}, {0, 3}, {1, 4}, {1, 5}, {1, 6}, {7, 8}, {7, 9}, {11, 12}, {11, 13},
+    {11, 14}};
+  const int nBonds = 11;
+  const int molecule[15] = {0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 2, 3, 3, 3, 3};
+  System* system = calloc(1, sizeof(System));
+  systemDefaults(system);
+  int nAtoms = system->nAtoms = nCopies*nTemplate;
+  system->realspaceCutoff = cutoff;
+  system->X = malloc(sizeof(REAL)*nAtoms*3);
+  system->atomTypes = malloc(sizeof(int)*nAtoms);
+  system->list12 = malloc(sizeof(IntVector)*nAtoms);
+  for(int i = 0; i < 3; i++) {
+    system->boxDim[i][i] = boxLen;
+  }
+  for(int i = 0; i < nAtoms; i++) {
+    intVectorInit(&system->list12[i], 4, MEMORY_STRUCTURE);
+    system->atomTypes[i] = types[i % nTemplate];
+  }
+  for(int c = 0; c < nCopies; c++) {
+    int first = c*nTemplate;
+    for(int b = 0; b < nBonds; b++) {
+      int a1 = first + bonds[b][0], a2 = first + bonds[b][1];
+      intVectorPush(&system->list12[a1], a2);
+      intVectorPush(&system->list12[a2], a1);
+    }
+    // One random rotation and position per molecule
+    REAL R[4][3][3], center[4][3];
+    for(int m = 0; m < 4; m++) {
+      REAL a = randomReal(0, 2*M_PI), b = randomReal(0, M_PI), g = randomReal(0, 2*M_PI);
+      REAL Rz[3][3] = {{cos(a), -sin(a), 0}, {sin(a), cos(a), 0}, {0, 0, 1}};
+      REAL Ry[3][3] = {{cos(b), 0, sin(b)}, {0, 1, 0}, {-sin(b), 0, cos(b)}};
+      REAL Rx[3][3] = {{1, 0, 0}, {0, cos(g), -sin(g)}, {0, sin(g), cos(g)}};
+      for(int j = 0; j < 3; j++) {
+        center[m][j] = randomReal(0.0, boxLen);
+        for(int k = 0; k < 3; k++) {
+          REAL sum = 0.0;
+          for(int l = 0; l < 3; l++) {
+            for(int n = 0; n < 3; n++) {
+              sum += Rz[j][l]*Ry[l][n]*Rx[n][k];
+            }
+          }
+          R[m][j][k] = sum;
+        }
+      }
+    }
+    for(int t = 0; t < nTemplate; t++) {
+      int m = molecule[t];
+      for(int j = 0; j < 3; j++) {
+        REAL x = center[m][j] + randomReal(-0.05, 0.05);
+        for(int k = 0; k < 3; k++) {
+          x += R[m][j][k]*coords[t][k];
+        }
+        system->X[(first + t)*3 + j] = x;
+      }
+    }
+  }
+  ForceField* ff = calloc(1, sizeof(ForceField));
+  multipoleVectorInit(&ff->multipole, 11, MEMORY_FORCE_FIELD);
+  Multipole params[11] = {
+    frameParameter(1, 2, -3, -3, ZTHENBISECTOR), frameParameter(2, -4, -4, -4, THREEFOLD),
+    frameParameter(3, 1, 2, 0, ZTHENX), frameParameter(4, 2, 0, 0, ZONLY),
+    frameParameter(5, -6, -6, 0, BISECTOR), frameParameter(6, 5, 6, 0, ZTHENX),
+    frameParameter(7, 0, 0, 0, MPOL_NONE), frameParameter(8, 9, 10, 11, ZTHENX),
+    frameParameter(9, 8, 0, 0, ZONLY), frameParameter(10, 8, 0, 0, ZONLY), frameParameter(11, 8, 0, 0, ZONLY)};
+  for(int k = 0; k < 11; k++) {
+    multipoleVectorPush(&ff->multipole, params[k]);
+  }
+  system->forceField = ff;
+  return system;
+}
+
+static void frameTestSystemDestroy(System* system) {
+  for(int i = 0; i < system->nAtoms; i++) {
+    intVectorFree(&system->list12[i]);
+  }
+  multipoleVectorFree(&system->forceField->multipole);
+  polarizeVectorFree(&system->forceField->polarize);
+  free(system->forceField);
+  free(system->list12);
+  bondedDestroy(system);
+  verletDestroy(system);
+  free(system->multipoles);
+  free(system->atomTypes);
+  free(system->X);
+  free(system->M);
+  free(system->protons);
+  free(system->V);
+  free(system->A);
+  free(system->F);
+  free(system);
+}
+
+/**
+ * Rotates, evaluates real space and folds the torques into the gradient and virial (zeroed here unless NULL).
+ */
+static REAL frameEnergy(System* system, MultipoleFrames* frames, DirectWorkspace* work, REAL* grad, REAL* torque,
+    REAL* virial) {
+  rotateMultipoles(system, frames);
+  memset(grad, 0, sizeof(REAL)*system->nAtoms*3);
+  memset(torque, 0, sizeof(REAL)*system->nAtoms*3);
+  if(virial != NULL) {
+    memset(virial, 0, sizeof(REAL)*9);
+  }
+  REAL energy = multipoleRealSpace(system, work, grad, torque, virial);
+  torqueToGradient(system, frames, torque, grad, virial);
+  return energy;
+}
+
+void multipoleFrameTest(bool verbose, char* xyzFile, char* forceFieldFile) {
+  srand(5);
+  System* system = frameTestSystem(12, 20.0, 7.0);
+  buildLists(system);
+  MultipoleFrames* frames = multipoleFramesCreate(system);
+  // Every frame definition was matched the expected number of times
+  int expected[THREEFOLD+1] = {1, 6, 5, 1, 1, 1};
+  for(int g = 0; g <= THREEFOLD; g++) {
+    assert(frames->groupStart[g+1] - frames->groupStart[g] == 12*expected[g]);
+  }
+  assert(frames->nChiral == 12);
+  // Rotations are proper and orthonormal
+  for(int i = 0; i < system->nAtoms; i++) {
+    REAL* R = frames->rotation + i*9;
+    for(int a = 0; a < 3; a++) {
+      for(int b = 0; b < 3; b++) {
+        REAL d = R[a*3]*R[b*3] + R[a*3+1]*R[b*3+1] + R[a*3+2]*R[b*3+2];
+        assert(fabs(d - (a == b)) < 1e-12);
+      }
+    }
+    REAL det = R[0]*(R[4]*R[8] - R[5]*R[7]) - R[1]*(R[3]*R[8] - R[5]*R[6]) + R[2]*(R[3]*R[7] - R[4]*R[6]);
+    assert(fabs(det - 1.0) < 1e-12);
+  }
+
+  // Total gradient (positions and torques) against finite differences for one copy of every molecule
+  DirectWorkspace* work = directWorkspaceCreate(system);
+  int n3 = system->nAtoms*3;
+  REAL* grad = malloc(sizeof(REAL)*n3);
+  REAL* torque = malloc(sizeof(REAL)*n3);
+  // The finite differences use the double precision reference so they hold in mixed precision builds as well
+  REAL virial[9];
+  frameEnergy(system, frames, work, grad, torque, virial);
+  const double relTolerance = sizeof(PREAL) < sizeof(double) ? 1e-4 : 1e-6;
+  double gradScale = 0.0;
+  for(int a = 0; a < n3; a++) {
+    gradScale = fmax(gradScale, fabs(grad[a]));
+  }
+  REAL h = 1e-5;
+  for(int a = 0; a < 15; a++) {
+    for(int k = 0; k < 3; k++) {
+      system->X[a*3+k] += h;
+      rotateMultipoles(system, frames);
+      double ePlus = referenceEnergy(system);
+      system->X[a*3+k] -= 2*h;
+      rotateMultipoles(system, frames);
+      double eMinus = referenceEnergy(system);
+      system->X[a*3+k] += h;
+      REAL fd = (ePlus - eMinus) / (2*h);
+      if(verbose) {
+        printf("Atom %d (type %d) grad[%d] analytic %12.6f finite difference %12.6f\n", a, system->atomTypes[a], k,
+          grad[a*3+k], fd);
+      }
+      assert(fabs(fd - grad[a*3+k]) < 1e-4 + relTolerance*gradScale);
+    }
+  }
+  rotateMultipoles(system, frames);
+
+  // Virial: stretching the box and the frames along a, dE/d(ln L_a) = W_aa with the torque part included
+  REAL* saved = malloc(sizeof(REAL)*n3);
+  memcpy(saved, system->X, sizeof(REAL)*n3);
+  double virialScale = 0.0;
+  for(int k = 0; k < 9; k++) {
+    virialScale = fmax(virialScale, fabs(virial[k]));
+  }
+  for(int a = 0; a < 3; a++) {
+    REAL length = system->boxDim[a][a];
+    double energies[2];
+    for(int s = 0; s < 2; s++) {
+      REAL stretch = s == 0 ? 1.0 + h : 1.0 - h;
+      for(int i = 0; i < system->nAtoms; i++) {
+        system->X[i*3+a] = saved[i*3+a]*stretch;
+      }
+      system->boxDim[a][a] = length*stretch;
+      rotateMultipoles(system, frames);
+      energies[s] = referenceEnergy(system);
+    }
+    memcpy(system->X, saved, sizeof(REAL)*n3);
+    system->boxDim[a][a] = length;
+    REAL fd = (energies[0] - energies[1]) / (2*h);
+    if(verbose) {
+      printf("Virial[%d][%d] analytic %12.6f finite difference %12.6f\n", a, a, virial[a*4], fd);
+    }
+    assert(fabs(fd - virial[a*4]) < 1e-4 + relTolerance*virialScale);
+  }
+  rotateMultipoles(system, frames);
+  free(saved);
+
+  // A mirror image of the system has mirror image multipoles on the chiral centers (x -> -x)
+  REAL* original = malloc(sizeof(REAL)*system->nAtoms*10);
+  memcpy(original, frames->global, sizeof(REAL)*system->nAtoms*10);
+  for(int i = 0; i < system->nAtoms; i++) {
+    system->X[i*3] = -system->X[i*3];
+  }
+  rotateMultipoles(system, frames);
+  const REAL mirror[10] = {1, -1, 1, 1, 1, 1, 1, -1, -1, 1};
+  for(int i = 11; i < system->nAtoms; i += 15) {
+    for(int j = 0; j < 10; j++) {
+      assert(fabs(frames->global[i*10+j] - mirror[j]*original[i*10+j]) < 1e-10);
+    }
+  }
+  free(original);
+  free(grad);
+  free(torque);
+  directWorkspaceDestroy(work);
+  multipoleFramesDestroy(frames);
+  frameTestSystemDestroy(system);
+
+  // Cost next to the pair loop at DHFR size: the given system, or a box of the test molecules
+  if(xyzFile != NULL && forceFieldFile != NULL) {
+    system = calloc(1, sizeof(System));
+    systemDefaults(system);
+    readXYZ(system, xyzFile);
+    system->forceField = memoryMalloc(sizeof(ForceField), MEMORY_FORCE_FIELD);
+    readForceFieldFile(system->forceField, forceFieldFile);
+    for(int i = 0; i < 3; i++) {
+      system->boxDim[i][i] = 62.23;
+    }
+    system->realspaceCutoff = 12.0;
+    buildLists(system);
+  } else {
+    system = frameTestSystem(1571, 62.23, 12.0);
+    buildBonded(system);
+  }
+  frames = multipoleFramesCreate(system);
+  n3 = system->nAtoms*3;
+  grad = calloc(n3, sizeof(REAL));
+  torque = malloc(sizeof(REAL)*n3);
+  for(int i = 0; i < n3; i++) {
+    torque[i] = randomReal(-1.0, 1.0);
+  }
+  struct timespec start, end;
+  int reps = 20;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int r = 0; r < reps; r++) {
+    rotateMultipoles(system, frames);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double tRotate = elapsed(start, end) / reps;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int r = 0; r < reps; r++) {
+    torqueToGradient(system, frames, torque, grad, NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double tTorque = elapsed(start, end) / reps;
+  printf("Multipole frames (%s, %d atoms): rotation %.3f ms (%.1f ns/atom), torque to gradient %.3f ms on %d thread(s)\n",
+    xyzFile != NULL ? xyzFile : "DHFR-sized box of test molecules", system->nAtoms, tRotate*1e3,
+    tRotate/system->nAtoms*1e9, tTorque*1e3, frames->nThreads);
+  if(xyzFile != NULL) {
+    work = directWorkspaceCreate(system);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    REAL energy = realSpaceEnergy(system, work, grad, torque);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double tReal = elapsed(start, end);
+    printf("Permanent real space energy %.4f kcal/mol in %.3f s, frames are %.2f%% of it\n", energy, tReal,
+      100.0*(tRotate + tTorque)/tReal);
+    directWorkspaceDestroy(work);
+    multipoleFramesDestroy(frames);
+    systemDestroy(system);
+  } else {
+    multipoleFramesDestroy(frames);
+    frameTestSystemDestroy(system);
+  }
+  free(grad);
+  free(torque);
+  printf("All tests of multipoleFrame.c passed!\n");
+}
+
+/**
+ * AMOEBA water (Ren and Ponder 2003) force field entries in the units multipoleLines and polarizeLine produce.
+ */
+static ForceField* waterForceField() {
+  const REAL local[2][10] = {
+    {-0.51966, 0.0, 0.0, 0.14279, 0.37928, -0.41809, 0.03881, 0.0, 0.0, 0.0},
+    {0.25983, -0.03859, 0.0, -0.05818, -0.03673, -0.10739, 0.14412, 0.0, -0.00203, 0.0}};
+  const int frames[2][4] = {{1, -2, -2, 0}, {2, 1, 2, 0}};
+  const REAL polarizability[2] = {0.837, 0.496};
+  const int groups[2] = {2, 1};
+  ForceField* ff = calloc(1, sizeof(ForceField));
+  multipoleVectorInit(&ff->multipole, 2, MEMORY_FORCE_FIELD);
+  polarizeVectorInit(&ff->polarize, 2, MEMORY_FORCE_FIELD);
+  for(int t = 0; t < 2; t++) {
+    Multipole* mpole = multipoleVectorEmplace(&ff->multipole);
+    memcpy(mpole->frameAtomTypes, frames[t], sizeof(frames[t]));
+    mpole->frameDef = t == 0 ? BISECTOR : ZTHENX;
+    mpole->multipole[0] = local[t][0];
+    for(int j = 1; j < 4; j++) {
+      mpole->multipole[j] = BOHR*local[t][j];
+    }
+    for(int j = 4; j < 7; j++) {
+      mpole->multipole[j] = BOHR*BOHR*local[t][j]/3;
+    }
+    for(int j = 7; j < 10; j++) {
+      mpole->multipole[j] = BOHR*BOHR*2*local[t][j]/3;
+    }
+    Polarize* polarize = polarizeVectorEmplace(&ff->polarize);
+    polarize->atomType = t + 1;
+    for(int j = 0; j < 3; j++) {
+      polarize->polarizabilityTensor[j][j] = polarizability[t];
+    }
+    polarize->thole = 0.39;
+    polarize->polarizationGroup[0] = groups[t];
+  }
+  return ff;
+}
+
+/**
+ * nSide^3 randomly oriented waters on a jittered cubic lattice at liquid density, O first then both H.
+ */
+static System* waterTestSystem(int nSide, REAL cutoff) {
+  const REAL spacing = 3.107;
+  const REAL angle = 104.52*M_PI/180.0;
+  const REAL geometry[3][3] = {{0.0, 0.0, 0.0}, {0.9572, 0.0, 0.0}, {0.9572*cos(angle), 0.9572*sin(angle), 0.0}};
+  System* system = calloc(1, sizeof(System));
+  systemDefaults(system);
+  int nAtoms = system->nAtoms = nSide*nSide*nSide*3;
+  system->realspaceCutoff = cutoff;
+  system->X = malloc(sizeof(REAL)*nAtoms*3);
+  system->atomTypes = malloc(sizeof(int)*nAtoms);
+  system->list12 = malloc(sizeof(IntVector)*nAtoms);
+  for(int i = 0; i < 3; i++) {
+    system->boxDim[i][i] = nSide*spacing;
+  }
+  for(int w = 0; w < nAtoms/3; w++) {
+    REAL a = randomReal(0, 2*M_PI), b = acos(randomReal(-1, 1)), g = randomReal(0, 2*M_PI);
+    REAL Rz[3][3] = {{cos(a), -sin(a), 0}, {sin(a), cos(a), 0}, {0, 0, 1}};
+    REAL Ry[3][3] = {{cos(b), 0, sin(b)}, {0, 1, 0}, {-sin(b), 0, cos(b)}};
+    REAL Rx[3][3] = {{1, 0, 0}, {0, cos(g), -sin(g)}, {0, sin(g), cos(g)}};
+    REAL site[3] = {w % nSide, (w/nSide) % nSide, w/(nSide*nSide)};
+    REAL oxygen[3];
+    for(int j = 0; j < 3; j++) {
+      oxygen[j] = (site[j] + 0.5)*spacing + randomReal(-0.3, 0.3);
+    }
+    for(int t = 0; t < 3; t++) {
+      int i = w*3 + t;
+      system->atomTypes[i] = t == 0 ? 1 : 2;
+      intVectorInit(&system->list12[i], 2, MEMORY_STRUCTURE);
+      for(int j = 0; j < 3; j++) {
+        REAL x = oxygen[j];
+        for(int k = 0; k < 3; k++) {
+          for(int l = 0; l < 3; l++) {
+            for(int n = 0; n < 3; n++) {
+              x += Rz[j][l]*Ry[l][n]*Rx[n][k]*geometry[t][k];
+            }
+          }
+        }
+        system->X[i*3+j] = x;
+      }
+    }
+    for(int h = 1; h < 3; h++) {
+      int o = w*3, hydrogen = w*3 + h;
+      intVectorPush(&system->list12[o], hydrogen);
+      intVectorPush(&system->list12[hydrogen], o);
+    }
+  }
+  system->forceField = waterForceField();
+  return system;
+}
+
+/**
+ * Damped Jacobi (Tinker's SOR with omega 0.7) reference solution of mu = alpha*(E_direct + T*mu).
+ */
+static void jacobiDipoles(System* system, InducedDipoles* ind, DirectWorkspace* work, REAL* mu) {
+  int n3 = system->nAtoms*3;
+  REAL* field = malloc(sizeof(REAL)*n3);
+  for(int a = 0; a < n3; a++) {
+    mu[a] = ind->polarizability[a/3]*ind->fieldDirect[a];
+  }
+  REAL change = 1.0;
+  for(int iter = 0; iter < 1000 && change > 1e-12; iter++) {
+    mutualField(system, ind, work, mu, field);
+    change = 0.0;
+    for(int a = 0; a < n3; a++) {
+      REAL next = 0.3*mu[a] + 0.7*ind->polarizability[a/3]*(ind->fieldDirect[a] + field[a]);
+      change = fmax(change, fabs(next - mu[a]));
+      mu[a] = next;
+    }
+  }
+  assert(change <= 1e-12);
+  free(field);
+}
+
+void induceTest(bool verbose) {
+  srand(3);
+  REAL h = 1e-5;
+  System* system = waterTestSystem(6, 7.0);
+  buildLists(system);
+  MultipoleFrames* frames = multipoleFramesCreate(system);
+  DirectWorkspace* work = directWorkspaceCreate(system);
+  InducedDipoles* ind = inducedDipolesCreate(system);
+  int nAtoms = system->nAtoms, n3 = nAtoms*3;
+  // Each water is one polarization group
+  for(int i = 0; i < nAtoms; i++) {
+    assert(ind->group[i] == ind->group[i - i % 3]);
+    assert(i < 3 || ind->group[i] != ind->group[i - 3]);
+  }
+  REAL* field = malloc(sizeof(REAL)*n3);
+  REAL* field2 = malloc(sizeof(REAL)*n3);
+  REAL* mu = malloc(sizeof(REAL)*n3);
+  REAL* reference = malloc(sizeof(REAL)*n3);
+
+  // Undamped, ungrouped direct field is -dE/dd of the permanent real space plus self energy
+  REAL mpoleScale[3];
+  memcpy(mpoleScale, system->mpoleScale, sizeof(mpoleScale));
+  int* groups = malloc(sizeof(int)*nAtoms);
+  REAL* pdamp = malloc(sizeof(REAL)*nAtoms);
+  memcpy(groups, ind->group, sizeof(int)*nAtoms);
+  memcpy(pdamp, ind->pdamp, sizeof(REAL)*nAtoms);
+  for(int i = 0; i < 3; i++) {
+    system->mpoleScale[i] = 1.0;
+  }
+  for(int i = 0; i < nAtoms; i++) {
+    ind->group[i] = i;
+    ind->pdamp[i] = 1e-3;
+  }
+  directField(system, ind, work, field);
+  for(int i = 0; i < 12; i++) {
+    for(int k = 0; k < 3; k++) {
+      system->multipoles[i][1+k] += h;
+      double ePlus = referenceEnergy(system) + multipoleSelfEnergy(system);
+      system->multipoles[i][1+k] -= 2*h;
+      double eMinus = referenceEnergy(system) + multipoleSelfEnergy(system);
+      system->multipoles[i][1+k] += h;
+      REAL fd = -(ePlus - eMinus)/(2*h)/ELECTRIC;
+      if(verbose) {
+        printf("Atom %d field[%d] analytic %12.8f finite difference %12.8f\n", i, k, field[i*3+k], fd);
+      }
+      assert(fabs(fd - field[i*3+k]) < 1e-6 + 1e-6*fabs(fd));
+    }
+  }
+  memcpy(system->mpoleScale, mpoleScale, sizeof(mpoleScale));
+  memcpy(ind->pdamp, pdamp, sizeof(REAL)*nAtoms);
+
+  // With damping and no groups, the field of pure dipoles is the mutual field T*mu
+  for(int a = 0; a < n3; a++) {
+    mu[a] = randomReal(-0.1, 0.1);
+  }
+  REAL* saved = malloc(sizeof(REAL)*nAtoms*10);
+  memcpy(saved, frames->global, sizeof(REAL)*nAtoms*10);
+  memset(frames->global, 0, sizeof(REAL)*nAtoms*10);
+  for(int i = 0; i < nAtoms; i++) {
+    memcpy(system->multipoles[i] + 1, mu + i*3, sizeof(REAL)*3);
+  }
+  directField(system, ind, work, field);
+  mutualField(system, ind, work, mu, field2);
+  for(int a = 0; a < n3; a++) {
+    assert(fabs(field[a] - field2[a]) < 1e-10);
+  }
+  memcpy(frames->global, saved, sizeof(REAL)*nAtoms*10);
+  memcpy(ind->group, groups, sizeof(int)*nAtoms);
+  free(saved);
+  free(groups);
+  free(pdamp);
+
+  // T is symmetric: a.(T b) = b.(T a)
+  for(int a = 0; a < n3; a++) {
+    reference[a] = randomReal(-0.1, 0.1);
+  }
+  mutualField(system, ind, work, mu, field);
+  mutualField(system, ind, work, reference, field2);
+  REAL ab = 0.0, ba = 0.0;
+  for(int a = 0; a < n3; a++) {
+    ab += reference[a]*field[a];
+    ba += mu[a]*field2[a];
+  }
+  assert(fabs(ab - ba) < 1e-10*fabs(ab));
+
+  // Preconditioned CG agrees with the Jacobi reference, and the preconditioner cuts the iterations
+  system->polarization = MUTUAL;
+  system->polarEps = 1e-8;
+  ind->maxHistory = 0;
+  ind->preconditionerCutoff = 0.0;
+  REAL energyDiagonal = induceDipoles(system, ind, work);
+  int diagonalIterations = ind->iterations;
+  ind->preconditionerCutoff = 4.5;
+  REAL energy = induceDipoles(system, ind, work);
+  int preconditionedIterations = ind->iterations;
+  jacobiDipoles(system, ind, work, reference);
+  for(int a = 0; a < n3; a++) {
+    assert(fabs(ind->mu[a] - reference[a]) < 1e-7);
+  }
+  assert(fabs(energy - energyDiagonal) < 1e-5);
+  assert(preconditionedIterations < diagonalIterations);
+  printf("Induced dipoles (%d waters): polarization energy %.4f kcal/mol, %d CG iterations with the diagonal "
+    "preconditioner, %d with the %.1f ANG pair preconditioner\n", nAtoms/3, energy, diagonalIterations,
+    preconditionedIterations, ind->preconditionerCutoff);
+
+  // Direct polarization is one field evaluation, none is zero
+  system->polarization = DIRECT;
+  induceDipoles(system, ind, work);
+  for(int a = 0; a < n3; a++) {
+    assert(ind->mu[a] == ind->polarizability[a/3]*ind->fieldDirect[a]);
+  }
+  system->polarization = NONE;
+  assert(induceDipoles(system, ind, work) == 0.0 && ind->mu[0] == 0.0);
+
+  // Along a smooth trajectory the predictor starts close enough to save most of the iterations
+  system->polarization = MUTUAL;
+  system->polarEps = 1e-6;
+  REAL* velocity = malloc(sizeof(REAL)*n3);
+  REAL* start = malloc(sizeof(REAL)*n3);
+  memcpy(start, system->X, sizeof(REAL)*n3);
+  for(int a = 0; a < n3; a++) {
+    velocity[a] = randomReal(-0.01, 0.01);
+  }
+  const int steps = 30;
+  double average[2];
+  for(int run = 0; run < 2; run++) {
+    ind->maxHistory = run == 0 ? 0 : system->polarPredict;
+    ind->nHistory = 0;
+    ind->nSolves = 0;
+    ind->totalIterations = 0;
+    memcpy(system->X, start, sizeof(REAL)*n3);
+    long warmup = 0;
+    for(int step = 0; step < steps; step++) {
+      for(int a = 0; a < n3; a++) {
+        system->X[a] += velocity[a];
+      }
+      rotateMultipoles(system, frames);
+      induceDipoles(system, ind, work);
+      if(step < system->polarPredict) {
+        warmup += ind->iterations;
+      }
+    }
+    average[run] = (double) (ind->totalIterations - warmup)/(steps - system->polarPredict);
+  }
+  printf("Induced dipoles along a %d step trajectory: %.2f iterations per step from alpha*E_direct, %.2f with "
+    "%d step prediction\n", steps, average[0], average[1], system->polarPredict);
+  assert(average[1] < average[0]);
+
+  free(velocity);
+  free(start);
+  free(field);
+  free(field2);
+  free(mu);
+  free(reference);
+  inducedDipolesDestroy(ind);
+  directWorkspaceDestroy(work);
+  multipoleFramesDestroy(frames);
+  frameTestSystemDestroy(system);
+  printf("All tests of induce.c passed!\n");
+}
+
+#ifdef MIXED_PRECISION
+/**
+ * Largest error of any component relative to its reference value, with references below floor counted as floor.
+ */
+static double componentError(const REAL* values, const REAL* reference, int n, double floor) {
+  double error = 0.0;
+  for(int a = 0; a < n; a++) {
+    error = fmax(error, fabs(values[a] - reference[a])/fmax(fabs(reference[a]), floor));
+  }
+  return error;
+}
+#endif
+
+/**
+ * The MIXED_PRECISION kernel against a double precision run of the same kernel on liquid water: energy and every
+ * gradient, torque and virial component. Nothing to compare in double builds.
+ */
+static void mixedPrecisionTest(bool verbose) {
+#ifdef MIXED_PRECISION
+  srand(5);
+  System* system = waterTestSystem(8, 7.0);
+  buildLists(system);
+  MultipoleFrames* frames = multipoleFramesCreate(system);
+  DirectWorkspace* work = directWorkspaceCreate(system);
+  DirectWorkspace* workDouble = directWorkspaceCreateDouble(system);
+  const int n3 = system->nAtoms*3;
+  REAL* grad[2] = {calloc(n3, sizeof(REAL)), calloc(n3, sizeof(REAL))};
+  REAL* torque[2] = {calloc(n3, sizeof(REAL)), calloc(n3, sizeof(REAL))};
+  REAL virial[2][9] = {{0.0}};
+  const REAL energy = multipoleRealSpace(system, work, grad[0], torque[0], virial[0]);
+  const REAL reference = multipoleRealSpaceDouble(system, workDouble, grad[1], torque[1], virial[1]);
+  // Components below 1 kcal/mol/ANG (or 1e-3 of the energy for the virial) are differences of larger pair terms
+  // and only keep float's epsilon of those, so they are measured against the floor
+  const double energyError = fabs(energy - reference)/fabs(reference);
+  const double gradError = componentError(grad[0], grad[1], n3, 1.0);
+  const double torqueError = componentError(torque[0], torque[1], n3, 1.0);
+  const double virialError = componentError(virial[0], virial[1], 9, 1e-3*fabs(reference));
+  if(verbose) {
+    for(int a = 0; a < 6; a++) {
+      printf("grad[%d] mixed %14.8f double %14.8f, torque mixed %14.8f double %14.8f\n", a, grad[0][a], grad[1][a],
+        torque[0][a], torque[1][a]);
+    }
+  }
+  printf("Multipole real space in mixed precision against double (%d waters): energy %.2e, gradient %.2e, torque "
+    "%.2e, virial %.2e (largest relative error of a component)\n", system->nAtoms/3, energyError, gradError,
+    torqueError, virialError);
+  assert(energyError < 1e-5);
+  assert(gradError < 1e-4);
+  assert(torqueError < 1e-4);
+  assert(virialError < 1e-4);
+  for(int p = 0; p < 2; p++) {
+    free(grad[p]);
+    free(torque[p]);
+  }
+  directWorkspaceDestroyDouble(workDouble);
+  directWorkspaceDestroy(work);
+  multipoleFramesDestroy(frames);
+  frameTestSystemDestroy(system);
+  printf("All tests of the mixed precision kernel passed!\n");
+#else
+  (void) verbose;
+#endif
+}
+
+/**
+ * Largest change of the total energy over steps velocity Verlet steps of dtAtto from the same start.
+ */
+static REAL energyDrift(System* system, const REAL* X0, const REAL* V0, int dtAtto, long steps) {
+  int n3 = system->nAtoms*3;
+  memcpy(system->X, X0, sizeof(REAL)*n3);
+  memcpy(system->V, V0, sizeof(REAL)*n3);
+  system->dtAtto = dtAtto;
+  buildVerlet(system);
+  Dynamics* md = dynamicsCreate(system);
+  REAL start = md->kinetic + md->potentialEnergy;
+  REAL drift = 0.0;
+  for(long s = 0; s < steps; s++) {
+    dynamicsRun(system, md, 1);
+    drift = fmax(drift, fabs(md->kinetic + md->potentialEnergy - start));
+  }
+  dynamicsDestroy(md);
+  return drift;
+}
+
+/**
+ * NVE dynamics of unbonded AMOEBA waters (permanent multipoles only): masses from the atom definitions,
+ * initial velocities, second order energy conservation, time reversibility and lazy neighbor list updates.
+ */
+static void dynamicsTest(bool verbose) {
+  srand(7);
+  System* system = waterTestSystem(6, 7.0);
+  int nAtoms = system->nAtoms, n3 = nAtoms*3;
+  // Without bonds or repulsion close waters collapse onto each other, so spread the lattice out to a gas
+  const REAL expand = 1.6;
+  for(int w = 0; w < nAtoms/3; w++) {
+    REAL shift[3];
+    for(int j = 0; j < 3; j++) {
+      shift[j] = (expand - 1.0)*system->X[w*9+j];
+    }
+    for(int a = w*9; a < w*9 + 9; a++) {
+      system->X[a] += shift[a % 3];
+    }
+  }
+  for(int j = 0; j < 3; j++) {
+    system->boxDim[j][j] *= expand;
+  }
+  buildLists(system);
+  const int types[2] = {1, 2}, numbers[2] = {8, 1};
+  const REAL masses[2] = {15.999, 1.008};
+  atomVectorInit(&system->forceField->atom, 2, MEMORY_FORCE_FIELD);
+  for(int t = 0; t < 2; t++) {
+    Atom* atom = atomVectorEmplace(&system->forceField->atom);
+    atom->type = atom->aClass = types[t];
+    atom->atomicNum = numbers[t];
+    atom->atomicMass = masses[t];
+  }
+  assignMasses(system);
+  for(int i = 0; i < nAtoms; i++) {
+    assert(system->M[i] == (i % 3 == 0 ? 15.999 : 1.008));
+    assert(system->protons[i] == (i % 3 == 0 ? 8 : 1));
+  }
+
+  // Exact temperature, no center of mass motion
+  initVelocities(system, 300.0);
+  REAL momentum[3] = {0.0, 0.0, 0.0};
+  for(int i = 0; i < nAtoms; i++) {
+    for(int j = 0; j < 3; j++) {
+      momentum[j] += system->M[i]*system->V[i*3+j];
+    }
+  }
+  Dynamics* md = dynamicsCreate(system);
+  assert(fabs(md->temperature - 300.0) < 1e-8);
+  for(int j = 0; j < 3; j++) {
+    assert(fabs(momentum[j]) < 1e-6);
+  }
+  dynamicsDestroy(md);
+
+  // Velocity Verlet is second order: halving the step quarters the energy error
+  REAL* X0 = malloc(sizeof(REAL)*n3);
+  REAL* V0 = malloc(sizeof(REAL)*n3);
+  memcpy(X0, system->X, sizeof(REAL)*n3);
+  memcpy(V0, system->V, sizeof(REAL)*n3);
+  system->printThermoEvery = verbose ? 20 : 0;
+  REAL drift = energyDrift(system, X0, V0, 400, 50);
+  REAL driftHalf = energyDrift(system, X0, V0, 200, 100);
+  if(verbose) {
+    printf("Largest energy error over 20 fs: %.3e kcal/mol at 0.4 fs, %.3e at 0.2 fs\n", drift, driftHalf);
+  }
+  assert(drift/driftHalf > 3.0 && drift/driftHalf < 5.0);
+
+  // RESPA with one inner step is velocity Verlet with the forces split in two
+  memcpy(system->X, X0, sizeof(REAL)*n3);
+  memcpy(system->V, V0, sizeof(REAL)*n3);
+  system->dtAtto = 400;
+  buildVerlet(system);
+  md = dynamicsCreate(system);
+  dynamicsRun(system, md, 20);
+  dynamicsDestroy(md);
+  REAL* X1 = malloc(sizeof(REAL)*n3);
+  memcpy(X1, system->X, sizeof(REAL)*n3);
+  memcpy(system->X, X0, sizeof(REAL)*n3);
+  memcpy(system->V, V0, sizeof(REAL)*n3);
+  system->integrator = RESPA;
+  system->dtInnerAtto = 400;
+  system->respaCutoff = 5.0;
+  system->respaSwitch = 1.0;
+  buildVerlet(system);
+  md = dynamicsCreate(system);
+  assert(md->nInner == 1);
+  dynamicsRun(system, md, 20);
+  dynamicsDestroy(md);
+  const bool mixed = sizeof(PREAL) < sizeof(double);
+  for(int a = 0; a < n3; a++) {
+    assert(fabs(system->X[a] - X1[a]) < (mixed ? 1e-5 : 1e-9));
+  }
+  free(X1);
+  // Fast forces on a 0.2 fs inner step keep the energy error of 0.8 fs steps well below velocity Verlet's
+  system->dtInnerAtto = 200;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  REAL driftRespa = energyDrift(system, X0, V0, 800, 25);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double tRespa = elapsed(start, end);
+  system->integrator = VERLET;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  REAL driftSmall = energyDrift(system, X0, V0, 200, 100);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double tVerlet = elapsed(start, end);
+  REAL driftLarge = energyDrift(system, X0, V0, 800, 25);
+  if(verbose) {
+    printf("Largest energy error over 20 fs: velocity Verlet %.3e kcal/mol at 0.2 fs (%.3f s) and %.3e at 0.8 fs, "
+      "RESPA 0.8/0.2 fs %.3e (%.3f s)\n", driftSmall, tVerlet, driftLarge, driftRespa, tRespa);
+  }
+  assert(driftRespa < 0.25*driftLarge);
+
+  // Forward, flip velocities, backward returns to the start. A thin buffer forces a few rebuilds on the way.
+  memcpy(system->X, X0, sizeof(REAL)*n3);
+  memcpy(system->V, V0, sizeof(REAL)*n3);
+  system->dtAtto = 500;
+  system->realspaceBuffer = 0.5;
+  buildVerlet(system);
+  md = dynamicsCreate(system);
+  int builds = system->verletCells->nBuilds;
+  void* list = system->verletList[0].array;
+  dynamicsRun(system, md, 40);
+  int rebuilds = system->verletCells->nBuilds - builds;
+  for(int a = 0; a < n3; a++) {
+    system->V[a] = -system->V[a];
+  }
+  dynamicsRun(system, md, 40);
+  REAL error = 0.0;
+  for(int a = 0; a < n3; a++) {
+    error = fmax(error, fabs(system->X[a] - X0[a]));
+  }
+  if(verbose) {
+    printf("Neighbor list rebuilds in 20 fs: %d, largest position error after reversal %.3e ANG\n", rebuilds, error);
+  }
+  assert(error < 1e-6);
+  // Lists are only rebuilt when needed, in place, and never miss a pair
+  assert(rebuilds > 0 && rebuilds < 40);
+  assert(system->verletList[0].array == list);
+  REAL lazy = potentialEnergy(system, md->potential);
+  buildVerlet(system);
+  REAL fresh = potentialEnergy(system, md->potential);
+  assert(fabs(lazy - fresh) < 1e-8*fabs(fresh));
+  dynamicsDestroy(md);
+
+  // Rigid waters: SETTLE keeps the geometry, and without the O-H vibration 2 fs steps are still second order
+  ForceField* ff = system->forceField;
+  bondVectorInit(&ff->bond, 1, MEMORY_FORCE_FIELD);
+  angleVectorInit(&ff->angle, 1, MEMORY_FORCE_FIELD);
+  Bond* bond = bondVectorEmplace(&ff->bond);
+  bond->atomClasses[0] = 1;
+  bond->atomClasses[1] = 2;
+  bond->distance = 0.9572;
+  Angle* angle = angleVectorEmplace(&ff->angle);
+  angle->aClasses[0] = angle->aClasses[2] = 2;
+  angle->aClasses[1] = 1;
+  angle->angle[0] = 104.52;
+  system->constraints = RIGID_WATER;
+  system->realspaceBuffer = 2.0;
+  memcpy(system->X, X0, sizeof(REAL)*n3);
+  memcpy(system->V, V0, sizeof(REAL)*n3);
+  buildVerlet(system);
+  md = dynamicsCreate(system);
+  assert(md->constraints->nWaters == nAtoms/3 && md->nDOF == 3*nAtoms - 3 - nAtoms);
+  REAL* XRigid = malloc(sizeof(REAL)*n3);
+  REAL* VRigid = malloc(sizeof(REAL)*n3);
+  memcpy(XRigid, system->X, sizeof(REAL)*n3);
+  memcpy(VRigid, system->V, sizeof(REAL)*n3);
+  dynamicsRun(system, md, 20);
+  REAL geometry = 0.0, along = 0.0;
+  for(int w = 0; w < nAtoms/3; w++) {
+    const int pairs[3][2] = {{0, 1}, {0, 2}, {1, 2}};
+    for(int p = 0; p < 3; p++) {
+      int i = w*3 + pairs[p][0], j = w*3 + pairs[p][1];
+      REAL r2 = 0.0, rv = 0.0;
+      for(int k = 0; k < 3; k++) {
+        REAL r = system->X[j*3+k] - system->X[i*3+k];
+        r2 += r*r;
+        rv += r*(system->V[j*3+k] - system->V[i*3+k]);
+      }
+      REAL d = p < 2 ? md->constraints->waterOH : md->constraints->waterHH;
+      geometry = fmax(geometry, fabs(sqrt(r2) - d));
+      along = fmax(along, fabs(rv)/sqrt(r2));
+    }
+  }
+  dynamicsDestroy(md);
+  assert(geometry < 1e-8 && along < 1e-5);
+  REAL driftRigid = energyDrift(system, XRigid, VRigid, 2000, 20);
+  REAL driftRigidHalf = energyDrift(system, XRigid, VRigid, 1000, 40);
+  if(verbose) {
+    printf("Rigid water: geometry error %.3e ANG, velocity along bonds %.3e ANG/ns, largest energy error over 40 fs "
+      "%.3e kcal/mol at 2 fs and %.3e at 1 fs\n", geometry, along, driftRigid, driftRigidHalf);
+  }
+  assert(driftRigid/driftRigidHalf > 3.0 && driftRigid/driftRigidHalf < 5.0);
+
+  // Hydrogen mass repartitioning leaves rigid waters alone and keeps every flexible one at 18.015 amu
+  int skipped;
+  assert(repartitionMasses(system, 3.024, &skipped) == 0 && skipped == nAtoms/3);
+  for(int i = 0; i < nAtoms; i++) {
+    assert(system->M[i] == (i % 3 == 0 ? 15.999 : 1.008));
+  }
+  system->constraints = NO_CONSTRAINTS;
+  assert(repartitionMasses(system, 3.024, &skipped) == 2*nAtoms/3 && skipped == 0);
+  for(int w = 0; w < nAtoms/3; w++) {
+    assert(system->M[w*3+1] == 3.024 && system->M[w*3+2] == 3.024);
+    assert(fabs(system->M[w*3] + system->M[w*3+1] + system->M[w*3+2] - (15.999 + 2*1.008)) < 1e-12);
+  }
+  assignMasses(system);
+  system->constraints = RIGID_WATER;
+
+  // NVT from 100 K velocities: both thermostats reach and hold the target temperature, NVE stays cold
+  const enum Thermostat thermostats[3] = {NO_THERMOSTAT, LANGEVIN, BUSSI};
+  const char* names[3] = {"NVE", "Langevin", "Bussi"};
+  const int warmup = 15, samples = 35;
+  REAL average[3];
+  double msPerStep[3], msThermostat[3];
+  system->dtAtto = 2000;
+  system->temperature = 300.0;
+  system->friction = 50.0;
+  system->tauTemperature = 0.02;
+  system->randomSeed = 17;
+  system->printThermoEvery = 0;
+  for(int t = 0; t < 3; t++) {
+    system->thermostat = thermostats[t];
+    memcpy(system->X, XRigid, sizeof(REAL)*n3);
+    initVelocities(system, 100.0);
+    buildVerlet(system);
+    md = dynamicsCreate(system);
+    dynamicsRun(system, md, warmup);
+    md->reportSeconds = md->phaseSeconds[PHASE_THERMOSTAT] = 0.0; // No reports, the whole run adds up
+    average[t] = 0.0;
+    for(int step = 0; step < samples; step++) {
+      dynamicsRun(system, md, 1);
+      average[t] += md->temperature/samples;
+    }
+    msPerStep[t] = md->reportSeconds*1e3/samples;
+    msThermostat[t] = md->phaseSeconds[PHASE_THERMOSTAT]*1e3/samples;
+    dynamicsDestroy(md);
+    if(verbose) {
+      printf("%-8s average temperature %.2f K, %.4f ms/step (%.4f thermostat)\n", names[t], average[t],
+             msPerStep[t], msThermostat[t]);
+    }
+  }
+  assert(average[0] < 250.0);
+  assert(fabs(average[1] - 300.0) < 15.0 && fabs(average[2] - 300.0) < 15.0);
+  // The noise is a function of seed, atom and step only, so a Langevin run repeats exactly
+  system->thermostat = LANGEVIN;
+  for(int run = 0; run < 2; run++) {
+    memcpy(system->X, XRigid, sizeof(REAL)*n3);
+    initVelocities(system, 300.0);
+    buildVerlet(system);
+    md = dynamicsCreate(system);
+    dynamicsRun(system, md, 10);
+    dynamicsDestroy(md);
+    if(run == 0) {
+      memcpy(VRigid, system->X, sizeof(REAL)*n3);
+    }
+  }
+  assert(memcmp(VRigid, system->X, sizeof(REAL)*n3) == 0);
+
+  // NPT: at 1e5 atm every compression is accepted and almost every expansion rejected. The trial energies reuse the
+  // neighbor lists, molecules stay rigid, and the final energy matches a fresh evaluation in the final box.
+  system->barostat = MONTE_CARLO;
+  system->pressure = 1e5;
+  system->volumeTrial = 2;
+  system->volumeMove = 2000.0;
+  memcpy(system->X, XRigid, sizeof(REAL)*n3);
+  initVelocities(system, 300.0);
+  REAL box = system->boxDim[0][0];
+  buildVerlet(system);
+  const REAL volume = system->volume;
+  md = dynamicsCreate(system);
+  assert(md->barostat->nMolecules == nAtoms/3);
+  builds = system->verletCells->nBuilds;
+  dynamicsRun(system, md, samples);
+  rebuilds = system->verletCells->nBuilds - builds;
+  long trials = md->barostat->trials, accepted = md->barostat->accepted;
+  REAL oh = 0.0;
+  for(int w = 0; w < nAtoms/3; w++) {
+    REAL r2 = 0.0;
+    for(int k = 0; k < 3; k++) {
+      REAL r = system->X[(w*3+1)*3+k] - system->X[w*9+k];
+      r2 += r*r;
+    }
+    oh = fmax(oh, fabs(sqrt(r2) - md->constraints->waterOH));
+  }
+  REAL npt = md->potentialEnergy;
+  buildVerlet(system);
+  REAL nptFresh = potentialEnergy(system, md->potential);
+  if(verbose) {
+    printf("NPT   volume %.0f -> %.0f ANG^3, %ld of %ld moves accepted, %d list rebuilds, %.4f ms/step (%.4f "
+           "barostat)\n", volume, system->volume, accepted, trials, rebuilds, md->reportSeconds*1e3/samples,
+           md->phaseSeconds[PHASE_BAROSTAT]*1e3/samples);
+  }
+  dynamicsDestroy(md);
+  assert(trials == samples/2 && accepted > 0 && accepted < trials);
+  assert(system->volume < volume && fabs(system->boxDim[0][0]/box - cbrt(system->volume/volume)) < 1e-12);
+  assert(rebuilds < trials);
+  assert(oh < 1e-8);
+  assert(fabs(npt - nptFresh) < 1e-8*fabs(nptFresh));
+  for(int j = 0; j < 3; j++) {
+    system->boxDim[j][j] = box;
+  }
+  system->barostat = NO_BAROSTAT;
+  system->thermostat = NO_THERMOSTAT;
+  system->constraints = NO_CONSTRAINTS;
+  bondVectorFree(&ff->bond);
+  angleVectorFree(&ff->angle);
+  free(XRigid);
+  free(VRigid);
+
+  atomVectorFree(&system->forceField->atom);
+  free(X0);
+  free(V0);
+  frameTestSystemDestroy(system);
+  printf("All tests of dynamics.c passed!\n");
+}
+
+/**
+ * Lambda states: one evaluation gives the energy at every state, each the same as an evaluation with the lambda
+ * atoms' multipoles scaled by that state's lambda.
+ */
+static void lambdaTest(bool verbose) {
+  srand(5);
+  System* system = waterTestSystem(6, 7.0);
+  const int nAtoms = system->nAtoms, n3 = nAtoms*3;
+  const int nLambda = 12; // Four waters
+  const REAL states[5] = {0.0, 0.25, 0.5, 0.75, 1.0};
+  const int nStates = 5;
+  system->activeLambdas = malloc(sizeof(int)*nLambda);
+  for(int l = 0; l < nLambda; l++) {
+    system->activeLambdas[l] = 3*l + 1; // Scattered through the lists
+  }
+  system->nActiveLambdas = nLambda;
+  system->lambda = 0.5;
+  system->lambdaStates = malloc(sizeof(REAL)*nStates);
+  memcpy(system->lambdaStates, states, sizeof(states));
+  system->nLambdaStates = nStates;
+  buildLists(system);
+  Potential* pot = potentialCreate(system);
+  // Lists built with lambda atoms are partitioned
+  long nPerturbed = 0;
+  for(int i = 0; i < nAtoms; i++) {
+    const int* list = system->verletList[i].array;
+    for(int n = 0; n < system->verletList[i].size; n++) {
+      bool perturbed = system->lambdas[i] != 1.0 || system->lambdas[list[n]] != 1.0;
+      assert(perturbed == (n >= system->verletPlain[i]));
+      nPerturbed += perturbed;
+    }
+  }
+  assert(nPerturbed > 0);
+  REAL energy = potentialEnergy(system, pot);
+  REAL stateEnergy[5];
+  memcpy(stateEnergy, pot->stateEnergy, sizeof(stateEnergy));
+  REAL* force = malloc(sizeof(REAL)*n3);
+  memcpy(force, system->F, sizeof(REAL)*n3);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int rep = 0; rep < 10; rep++) {
+    potentialEnergy(system, pot);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double tStates = elapsed(start, end)/10;
+  potentialDestroy(pot);
+  assert(fabs(stateEnergy[2] - energy) < 1e-9*fabs(energy));
+
+  // Reference: no lambda atoms, their local multipoles scaled instead
+  system->nActiveLambdas = 0;
+  system->nLambdaStates = 0;
+  pot = potentialCreate(system);
+  REAL* local = malloc(sizeof(REAL)*nAtoms*10);
+  memcpy(local, pot->frames->local, sizeof(REAL)*nAtoms*10);
+  const REAL tolerance = sizeof(PREAL) < sizeof(double) ? 1e-5 : 1e-10;
+  REAL worst = 0.0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int s = 0; s < nStates; s++) {
+    for(int l = 0; l < nLambda; l++) {
+      int i = system->activeLambdas[l];
+      for(int k = 0; k < 10; k++) {
+        pot->frames->local[i*10+k] = states[s]*local[i*10+k];
+      }
+    }
+    REAL reference = potentialEnergy(system, pot);
+    worst = fmax(worst, fabs(stateEnergy[s] - reference)/fabs(reference));
+    if(s == 2) {
+      for(int a = 0; a < n3; a++) {
+        assert(fabs(force[a] - system->F[a]) < tolerance*(1.0 + fabs(system->F[a])));
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double tSeparate = elapsed(start, end);
+  if(verbose) {
+    printf("%d lambda states in one evaluation: largest relative error %.3e, %.3f ms against %.3f ms for separate "
+           "evaluations (%.3f ms each), %ld perturbed pairs\n", nStates, worst, tStates*1e3, tSeparate*1e3,
+           tSeparate*1e3/nStates, nPerturbed);
+  }
+  assert(worst < tolerance);
+  assert(fabs(stateEnergy[0] - stateEnergy[4]) > 1.0); // The lambda atoms interact
+
+  potentialDestroy(pot);
+  free(local);
+  free(force);
+  free(system->activeLambdas);
+  free(system->lambdaStates);
+  free(system->lambdas);
+  frameTestSystemDestroy(system);
+  printf("All tests of lambda states passed!\n");
+}
+
+/**
+ * nSide^3 AMOEBA waters (amoebabio09.prm types 402 and 403) on a jittered lattice, written as a Tinker xyz file.
+ */
+static void writeWaterXYZ(const char* path, int nSide) {
+  const REAL spacing = 3.107;
+  const REAL angle = 104.52*M_PI/180.0;
+  FILE* file = fopen(path, "w");
+  assert(file != NULL);
+  const int nWaters = nSide*nSide*nSide;
+  fprintf(file, "%6d  Water lattice\n", nWaters*3);
+  for(int w = 0; w < nWaters; w++) {
+    REAL site[3] = {w % nSide, (w/nSide) % nSide, w/(nSide*nSide)};
+    REAL oxygen[3];
+    for(int j = 0; j < 3; j++) {
+      oxygen[j] = (site[j] + 0.5)*spacing + randomReal(-0.3, 0.3);
+    }
+    const int o = w*3 + 1;
+    fprintf(file, "%6d  O  %12.6f %12.6f %12.6f %5d %5d %5d\n", o, oxygen[0], oxygen[1], oxygen[2], 402, o + 1,
+            o + 2);
+    fprintf(file, "%6d  H  %12.6f %12.6f %12.6f %5d %5d\n", o + 1, oxygen[0] + 0.9572, oxygen[1], oxygen[2], 403, o);
+    fprintf(file, "%6d  H  %12.6f %12.6f %12.6f %5d %5d\n", o + 2, oxygen[0] + 0.9572*cos(angle),
+            oxygen[1] + 0.9572*sin(angle), oxygen[2], 403, o);
+  }
+  fclose(file);
+}
+
+/**
+ * Path of amoebabio09.prm next to this file.
+ */
+static void amoebaForceField(char* path, size_t size) {
+  snprintf(path, size, "%s", __FILE__);
+  char* slash = strrchr(path, '/');
+  assert(slash != NULL && (size_t) (slash - path) + 28 < size);
+  strcpy(slash + 1, "forcefields/amoebabio09.prm");
+}
+
+/**
+ * A manifest of repeated water jobs: repeats give the same energy, the force field is read once for all of them
+ * and the energies match systems read and run one by one.
+ */
+static void batchTest(bool verbose) {
+  srand(11);
+  char forceField[4096];
+  amoebaForceField(forceField, sizeof(forceField));
+  char dir[] = "/tmp/batchTestXXXXXX";
+  if(mkdtemp(dir) == NULL) {
+    printf("batchTest: failed to create a directory in /tmp!\n");
+    exit(1);
+  }
+  char paths[5][4200];
+  const char* names[5] = {"a.xyz", "b.xyz", "water.key", "dynamics.key", "jobs.txt"};
+  for(int f = 0; f < 5; f++) {
+    snprintf(paths[f], sizeof(paths[f]), "%s/%s", dir, names[f]);
+  }
+  writeWaterXYZ(paths[0], 4);
+  writeWaterXYZ(paths[1], 4);
+  for(int k = 2; k < 4; k++) {
+    FILE* key = fopen(paths[k], "w");
+    assert(key != NULL);
+    fprintf(key, "forcefield %s\na-axis %.4f\ncutoff 5.0\nbuffer 1.0\n", forceField, 4*3.107);
+    if(k == 3) {
+      fprintf(key, "steps 5\nprintThermoEvery 0\nrandomseed 3\n");
+    }
+    fclose(key);
+  }
+  FILE* manifest = fopen(paths[4], "w");
+  assert(manifest != NULL);
+  fprintf(manifest, "# command structure key\nenergy %s %s\nenergy %s %s\n\n", paths[0], paths[2], paths[1],
+          paths[2]);
+  fprintf(manifest, "energy %s %s\ndynamics %s %s\n", paths[0], paths[2], paths[1], paths[3]);
+  fclose(manifest);
+
+  Batch* batch = batchRead(paths[4]);
+  assert(batch->jobs.size == 4 && batch->jobs.array[3].command == BATCH_DYNAMICS && batch->jobs.array[3].line == 6);
+  batchRun(batch, 1);
+  const BatchJob* jobs = batch->jobs.array;
+  assert(jobs[0].atoms == 192 && jobs[0].energy == jobs[2].energy && jobs[0].energy != jobs[1].energy);
+  assert(isfinite(jobs[3].energy));
+  assert(batch->cache->entries.size == 1 && batch->cache->hits == 3);
+
+  // The same systems with force fields of their own
+  const REAL tolerance = sizeof(PREAL) < sizeof(double) ? 1e-5 : 1e-10;
+  for(int j = 0; j < 2; j++) {
+    System* system = systemCreate(paths[j], paths[2]);
+    const REAL reference = energy(system);
+    systemDestroy(system);
+    assert(fabs(jobs[j].energy - reference) < tolerance*fabs(reference));
+  }
+  System* system = systemCreate(paths[1], paths[3]);
+  const REAL reference = dynamics(system);
+  systemDestroy(system);
+  assert(fabs(jobs[3].energy - reference) < tolerance*fabs(reference));
+  if(verbose) {
+    batchPrint(batch);
+  }
+  batchDestroy(batch);
+  for(int f = 0; f < 5; f++) {
+    remove(paths[f]);
+  }
+  rmdir(dir);
+  printf("All tests of batch.c passed!\n");
+}
+
+/**
+ * Writes a key for the replica tests: the water lattice of writeWaterXYZ(path, 4) under a Langevin thermostat.
+ */
+static void writeReplicaKey(const char* path, const char* forceField, const char* extra) {
+  FILE* key = fopen(path, "w");
+  assert(key != NULL);
+  fprintf(key, "forcefield %s\na-axis %.4f\ncutoff 5.0\nbuffer 1.0\nthermostat langevin\nfriction 5.0\n"
+          "printThermoEvery 0\n%s", forceField, 4*3.107, extra);
+  fclose(key);
+}
+
+/**
+ * Replica exchange over a ladder of equal temperatures, where every exchange is accepted and changes nothing about
+ * the trajectories: each replica must end where a separate dynamics run with its seed does. Then a lambda ladder,
+ * whose swapped replicas re-evaluate their forces at the new lambda.
+ */
+static void replicaExchangeTest(bool verbose) {
+  srand(13);
+  char forceField[4096];
+  amoebaForceField(forceField, sizeof(forceField));
+  char dir[] = "/tmp/replicaTestXXXXXX";
+  if(mkdtemp(dir) == NULL) {
+    printf("replicaExchangeTest: failed to create a directory in /tmp!\n");
+    exit(1);
+  }
+  char paths[4][4200];
+  const char* names[4] = {"water.xyz", "temperature.key", "reference.key", "lambda.key"};
+  for(int f = 0; f < 4; f++) {
+    snprintf(paths[f], sizeof(paths[f]), "%s/%s", dir, names[f]);
+  }
+  writeWaterXYZ(paths[0], 4);
+  writeReplicaKey(paths[1], forceField, "randomseed 7\nreplica-temperatures 300 300 300\nexchange-every 2\n");
+  writeReplicaKey(paths[2], forceField, "randomseed 9\ntemperature 300\nsteps 6\n");
+  writeReplicaKey(paths[3], forceField, "randomseed 7\nlambda-atoms 1-3\nreplica-lambdas 0.0 0.0 1.0 1.0\n"
+                  "exchange-every 2\n");
+  const long long before = memoryCurrent(MEMORY_STRUCTURE);
+
+  System* system = systemParse(paths[0], paths[1], NULL);
+  buildBonded(system);
+  ReplicaExchange* rex = replicaExchangeCreate(system, 1);
+  replicaExchangeRun(rex, 6);
+  // Rounds attempt the even, odd and even pairs: 0-1 twice, 1-2 once, reversing the ladder
+  assert(rex->rounds == 3 && rex->steps == 6);
+  assert(rex->attempts[0] == 2 && rex->accepted[0] == 2 && rex->attempts[1] == 1 && rex->accepted[1] == 1);
+  assert(rex->slots[0] == &rex->replicas[2] && rex->slots[1] == &rex->replicas[1]);
+  assert(rex->slots[2] == &rex->replicas[0] && rex->replicas[0].slot == 2);
+  assert(rex->replicas[0].system->forceField == system->forceField && rex->replicas[1].system->M == system->M);
+  assert(rex->replicas[0].system->X != system->X);
+  assert(rex->replicas[0].system->multipoles != rex->replicas[1].system->multipoles);
+  const REAL replicaEnergy = rex->replicas[2].md->potentialEnergy;
+  if(verbose) {
+    replicaExchangePrint(rex);
+  }
+  replicaExchangeDestroy(rex);
+  systemDestroy(system);
+  System* reference = systemCreate(paths[0], paths[2]);
+  const REAL referenceEnergy = dynamics(reference);
+  systemDestroy(reference);
+  const REAL tolerance = sizeof(PREAL) < sizeof(double) ? 1e-5 : 1e-9;
+  if(fabs(replicaEnergy - referenceEnergy) > tolerance*fabs(referenceEnergy)) {
+    printf("replicaExchangeTest: replica with seed 9 ends at %.10f, dynamics at %.10f!\n", replicaEnergy,
+           referenceEnergy);
+    exit(1);
+  }
+
+  // Equal neighboring windows always exchange
+  system = systemParse(paths[0], paths[3], NULL);
+  buildBonded(system);
+  rex = replicaExchangeCreate(system, 1);
+  assert(system->nLambdaStates == 4 && rex->replicas[3].system->lambdaStates == system->lambdaStates);
+  replicaExchangeRun(rex, 2);
+  assert(rex->accepted[0] == 1 && rex->accepted[2] == 1 && rex->replicas[0].refresh && rex->replicas[3].refresh);
+  replicaExchangeRun(rex, 1); // Short of a round, no exchange
+  for(int r = 0; r < 4; r++) {
+    const Replica* replica = &rex->replicas[r];
+    assert(!replica->refresh && replica->system->lambda == rex->values[replica->slot]);
+    assert(replica->system->lambdas[0] == replica->system->lambda);
+    const REAL own = replica->md->potential->stateEnergy[replica->slot];
+    assert(fabs(own - replica->md->potentialEnergy) < tolerance*fabs(own));
+  }
+  assert(rex->tRefresh > 0.0);
+  replicaExchangeDestroy(rex);
+  systemDestroy(system);
+  if(memoryCurrent(MEMORY_STRUCTURE) != before) {
+    printf("replicaExchangeTest: %lld bytes of structure left!\n", memoryCurrent(MEMORY_STRUCTURE) - before);
+    exit(1);
+  }
+  for(int f = 0; f < 4; f++) {
+    remove(paths[f]);
+  }
+  rmdir(dir);
+  printf("All tests of replicaExchange.c passed!\n");
+}
+
+/**
+ * @param argv optional path to an xyz file (e.g. examples/dhfr.xyz) and its force field used for the throughput
+ * numbers
+ */
+int main(int argc, char* argv[]) {
+  directTest(false, argc > 1 ? argv[1] : NULL);
+  multipoleFrameTest(false, argc > 2 ? argv[1] : NULL, argc > 2 ? argv[2] : NULL);
+  induceTest(false);
+  mixedPrecisionTest(false);
+  dynamicsTest(false);
+  lambdaTest(false);
+  batchTest(false);
+  replicaExchangeTest(false);
+}
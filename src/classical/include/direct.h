@@ -0,0 +1,86 @@
+// Author(s): Matthew Speranza
+#ifndef DIRECT_H
+#define DIRECT_H
+#include <stdbool.h>
+#include "../../common/system/system.h"
+#include "../../common/include/threadBuffers.h"
+
+/**
+ * Real space (direct) part of the Ewald sum for permanent atomic multipoles (charge, dipole, quadrupole).
+ * <hr>
+ * The damped interaction tensors only depend on r through the Ewald "B" functions (Smith, 1998)
+ * <p>
+ * B0 = erfc(alpha*r)/r
+ * <p>
+ * Bn = ((2n-1)*B(n-1) + (2*alpha^2)^n/(sqrt(pi)*alpha) * exp(-alpha^2*r^2)) / r^2
+ * <p>
+ * so B0..B5 are computed once per pair and shared between every charge, dipole and quadrupole term of the
+ * energy, gradient and torque. erfc() is read from a cubic Hermite table so the pair loop has no libm calls
+ * other than sqrt and exp and can be vectorized. 1-2, 1-3 and 1-4 pairs are scaled by System->mpoleScale by
+ * removing the (1-scale) fraction of the undamped interaction, as in Tinker.
+ * <p>
+ * Multipoles are expected in the global frame as [q, dx, dy, dz, qxx, qyy, qzz, 2qxy, 2qxz, 2qyz] with the 1/3
+ * factor of the force field file already applied.
+ * <p>
+ * The pair math runs in PREAL (float with MIXED_PRECISION). Separations are formed in REAL while gathering, so
+ * the kernel only ever sees small relative coordinates, and energies, gradients, torques and virials are summed
+ * over pairs and atoms in REAL.
+ * <p>
+ * Alchemical lambda atoms (System->activeLambdas) have their multipoles scaled by System->lambdas, so a pair is
+ * weighted by lambda_i*lambda_k: lambda for a lambda atom and its environment, lambda^2 within the lambda atoms.
+ * DirectWorkspace->states lists further lambda values whose energies are summed in the same sweep: every pair with
+ * a lambda atom adds (lambda_s^n - lambda_i*lambda_k)*e to each state s, with n its number of lambda atoms, on top
+ * of the energy at the current lambda. Pairs without lambda atoms do no extra work.
+ */
+typedef struct ErfcTable {
+  REAL alpha; // Ewald coefficient the table was built for
+  REAL dx; // Spacing in alpha*r
+  REAL invDx;
+  int n; // Number of intervals
+  REAL* coefficients; // Cubic coefficients for each interval [n][4]
+  PREAL* kernelCoefficients; // The same in kernel precision, aliases coefficients unless MIXED_PRECISION [n][4]
+} ErfcTable;
+
+/**
+ * Pairs multipoleRealSpace evaluates. For multiple time step integration the real space sum is split smoothly at
+ * DirectWorkspace->switchStart..switchEnd with S(r) = 1 - 10x^3 + 15x^4 - 6x^5, x = (r - start)/(end - start):
+ * near pairs are weighted by S(r) and far pairs by 1 - S(r), so the two parts add up to the whole interaction
+ * with continuous forces and each part only visits the pairs it has weight on.
+ */
+enum RealSpacePart {REAL_SPACE_ALL, REAL_SPACE_NEAR, REAL_SPACE_FAR};
+
+typedef struct DirectWorkspace {
+  int nThreads;
+  int nAtoms;
+  int pairCapacity; // Longest neighbor list the pair buffers can hold
+  ErfcTable* erfcTable;
+  REAL** scale; // Per-thread exclusion scale factors [nThreads][nAtoms]
+  ThreadBuffers* buffers; // Per-thread gradient (array 0), torque (array 1), energy and virial
+  PREAL** pairs; // Per-thread structure of arrays for one atom's neighbors [nThreads][N_PAIR_ARRAYS*pairCapacity]
+  int** pairIDs; // Neighbor atom index of each slot in pairs [nThreads][pairCapacity]
+  enum RealSpacePart part; // Pairs the next evaluation includes (REAL_SPACE_ALL unless split)
+  REAL switchStart; // Near pairs end and far pairs start fading in (ANG)
+  REAL switchEnd; // Near pairs have faded out (ANG)
+  // Lambda states
+  bool* lambdaAtom; // Atoms whose multipoles are scaled by System->lambdas, NULL without lambda atoms [nAtoms]
+  int nStates; // Lambda values whose energies REAL_SPACE_ALL evaluations also sum
+  REAL* states; // [nStates]
+  REAL* stateEnergy; // Real space energy at each state from the last REAL_SPACE_ALL evaluation (kcal/mol) [nStates]
+  int stateStride; // REALs per thread in stateTally, a multiple of a cache line
+  REAL* stateTally; // Per thread state energy changes [nThreads*stateStride]
+  int** lambdaSlots; // Per thread slots in pairs with a lambda atom, 2*slot + (both atoms) [nThreads][pairCapacity]
+} DirectWorkspace;
+
+#define ELECTRIC 332.0637133 // Coulomb's constant (kcal*ANG/(mol*e^2))
+
+REAL ewaldCoefficient(REAL cutoff, REAL precision);
+ErfcTable* erfcTableCreate(REAL alpha, REAL maxR);
+void erfcTableDestroy(ErfcTable* table);
+DirectWorkspace* directWorkspaceCreate(System* system);
+void directWorkspaceDestroy(DirectWorkspace* work);
+REAL multipoleRealSpace(System* system, DirectWorkspace* work, REAL* grad, REAL* torque, REAL* virial);
+void directWorkspaceStates(DirectWorkspace* work, int nStates, const REAL* states);
+REAL multipoleSelfEnergy(System* system);
+void multipoleSelfStates(System* system, int nStates, const REAL* states, REAL* energies);
+
+#endif //DIRECT_H
@@ -0,0 +1,75 @@
+// Author(s): Matthew Speranza
+#ifndef INDUCE_H
+#define INDUCE_H
+#include <stdbool.h>
+#include "../../common/system/system.h"
+#include "direct.h"
+
+/**
+ * AMOEBA induced dipoles: mu = alpha*(E_direct + T*mu) solved with preconditioned conjugate gradient.
+ * <hr>
+ * The system solved is (1/alpha - T) mu = E_direct, which is symmetric positive definite. T is the Thole damped
+ * dipole field tensor, here the real space Ewald part plus the Ewald self field 4*alpha_ewald^3/(3*sqrt(pi)).
+ * E_direct is the field of the permanent multipoles with atoms of the same polarization group excluded.
+ * <p>
+ * The preconditioner is Tinker's: a weighted diagonal plus one Neumann term, z = 2*alpha*r + alpha*T*alpha*r. It
+ * only uses the Thole damped tensors without Ewald screening of pairs closer than preconditionerCutoff, rebuilt once
+ * per solve and stored as a sparse matrix. A cutoff of 0 falls back to the diagonal (alpha) preconditioner.
+ * <p>
+ * Initial guesses are extrapolated from the last System->polarPredict solutions with the always stable
+ * predictor-corrector coefficients of Kolafa (J. Comput. Chem. 25, 335 (2004)),
+ * <p>
+ * mu_guess = sum_j B_j*mu(n-j), B_j = (-1)^(j+1) * j * binom(2k+4, k+2-j) / binom(2k+2, k+1), k = nHistory-2
+ * <p>
+ * so along a smooth trajectory the solver starts far closer to the answer than from alpha*E_direct. Iterations
+ * stop when the RMS dipole change of one Jacobi step, |alpha*residual|, drops below System->polarEps (Debye).
+ */
+#define DEBYE 4.80321 // Debye per e*ANG
+#define POLMIN 1e-8 // Smallest polarizability used to divide by (ANG^3)
+#define POLAR_MAX_ITERATIONS 100
+
+typedef struct InducedDipoles {
+  int nAtoms;
+  int nThreads;
+  REAL* polarizability; // ANG^3 [nAtoms]
+  REAL* thole; // Thole damping parameter [nAtoms]
+  REAL* pdamp; // polarizability^(1/6) [nAtoms]
+  int* group; // Polarization group, atoms in the same group don't feel each other's permanent field [nAtoms]
+  REAL* fieldDirect; // Permanent field at each atom (e/ANG^2) [nAtoms*3]
+  REAL* mu; // Induced dipoles (e*ANG) [nAtoms*3]
+  // Predictor
+  int maxHistory; // System->polarPredict
+  int nHistory; // Solutions stored so far (up to maxHistory)
+  int newest; // Slot of the newest solution in history
+  REAL* history; // Previous solutions [maxHistory][nAtoms*3]
+  // Conjugate gradient vectors [nAtoms*3]
+  REAL* rsd;
+  REAL* zrsd;
+  REAL* conj;
+  REAL* vec;
+  // Sparse preconditioner, both directions of every pair so applying it is a gather
+  REAL preconditionerCutoff; // ANG, Tinker's usolvcut
+  int* precondStart; // Row starts [nAtoms+1]
+  int* precondIDs; // Column atoms [precondCapacity]
+  REAL* precondT; // alpha_i*T_ik*alpha_k as xx, xy, xz, yy, yz, zz [precondCapacity*6]
+  int precondCapacity;
+  // Pair loop buffers
+  int pairCapacity;
+  ThreadBuffers* fields; // Per-thread field accumulation (array 0)
+  REAL* partial; // Per-thread partial sums of dot products, one cache line each [nThreads*TALLY_STRIDE]
+  REAL** pairs; // Per-thread structure of arrays for one atom's neighbors [nThreads][N_INDUCE_ARRAYS*pairCapacity]
+  int** pairIDs; // [nThreads][pairCapacity]
+  // Statistics
+  int iterations; // Iterations of the last solve
+  REAL rms; // Final RMS dipole change of the last solve (Debye)
+  long nSolves;
+  long totalIterations;
+} InducedDipoles;
+
+InducedDipoles* inducedDipolesCreate(System* system);
+void inducedDipolesDestroy(InducedDipoles* ind);
+void directField(System* system, InducedDipoles* ind, DirectWorkspace* work, REAL* field);
+void mutualField(System* system, InducedDipoles* ind, DirectWorkspace* work, const REAL* mu, REAL* field);
+REAL induceDipoles(System* system, InducedDipoles* ind, DirectWorkspace* work);
+
+#endif //INDUCE_H
@@ -0,0 +1,52 @@
+// Author(s): Matthew Speranza
+#ifndef MULTIPOLEFRAME_H
+#define MULTIPOLEFRAME_H
+#include <stdbool.h>
+#include "../../common/system/system.h"
+
+/**
+ * Rotation of force field multipoles from their local frames into the global frame, and the conversion of
+ * multipole torques back into atomic gradients.
+ * <hr>
+ * Frame atoms are matched against the force field once (multipoleFramesCreate) following Tinker's kmpole: Z and X
+ * atoms bonded first, then X one bond further away, then Z-only, then no frame. Atoms are sorted by frame
+ * definition so every per-step pass is a branch free loop over index arrays.
+ * <p>
+ * With u, v, w the vectors from an atom to its Z, X and Y frame atoms (^ marks unit vectors) the local z axis
+ * and a reference vector for x are
+ * <p>
+ * Z-only: z = u, ref = global x (or y if u is within 30 degrees of x)
+ * <p>
+ * Z-then-X: z = u, ref = v
+ * <p>
+ * Bisector: z = u^ + v^, ref = v
+ * <p>
+ * Z-then-bisector: z = u, ref = v^ + w^
+ * <p>
+ * Three-fold: z = u^ + v^ + w^, ref = v
+ * <p>
+ * then x is ref with its z component removed and y = z cross x. The rows of each atom's rotation matrix are the
+ * local x, y and z axes in the global frame and are kept for torqueToGradient.
+ */
+typedef struct MultipoleFrames {
+  int nAtoms;
+  int nThreads;
+  int groupStart[THREEFOLD+2]; // First slot in order of each MultipoleFrameDef (MPOL_NONE..THREEFOLD) and the end
+  int* order; // Atom indices sorted by frame definition [nAtoms]
+  int* zAtom; // Frame atoms of the atom in each slot of order, -1 if unused [nAtoms]
+  int* xAtom;
+  int* yAtom;
+  int nChiral; // Z-then-X atoms with a Y atom, whose local multipole is mirrored to follow the chirality
+  int* chiral; // Slots in order of the chiral atoms [nChiral]
+  int* chiralSign; // Current handedness of each chiral atom's local multipole [nChiral]
+  REAL* local; // Local frame multipoles [nAtoms*10]
+  REAL* global; // Global frame multipoles, System->multipoles points into this block [nAtoms*10]
+  REAL* rotation; // Local x, y, z axes in the global frame (rows) [nAtoms*9]
+} MultipoleFrames;
+
+MultipoleFrames* multipoleFramesCreate(System* system);
+void multipoleFramesDestroy(MultipoleFrames* frames);
+void rotateMultipoles(System* system, MultipoleFrames* frames);
+void torqueToGradient(System* system, MultipoleFrames* frames, const REAL* torque, REAL* grad, REAL* virial);
+
+#endif //MULTIPOLEFRAME_H
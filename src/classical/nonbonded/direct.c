@@ -0,0 +1,648 @@
+// Author(s): Matthew Speranza
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h> // sqrt and exp follow the kernel precision
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// classicalTest of MIXED_PRECISION builds links a double precision copy of this file as the kernel's reference
+#ifdef DIRECT_DOUBLE
+#define ewaldCoefficient ewaldCoefficientDouble
+#define erfcTableCreate erfcTableCreateDouble
+#define erfcTableDestroy erfcTableDestroyDouble
+#define directWorkspaceCreate directWorkspaceCreateDouble
+#define directWorkspaceDestroy directWorkspaceDestroyDouble
+#define multipoleRealSpace multipoleRealSpaceDouble
+#define directWorkspaceStates directWorkspaceStatesDouble
+#define multipoleSelfEnergy multipoleSelfEnergyDouble
+#define multipoleSelfStates multipoleSelfStatesDouble
+#endif
+#include "../include/direct.h"
+#include "../../common/include/neighborList.h"
+#include "../../common/include/timers.h"
+
+// Structure of arrays slots in DirectWorkspace->pairs
+enum PairArray {P_X, P_Y, P_Z, P_C, P_DX, P_DY, P_DZ, P_QXX, P_QYY, P_QZZ, P_QXY, P_QXZ, P_QYZ, P_SCALE,
+  P_W, P_DW, P_FX, P_FY, P_FZ, P_TX, P_TY, P_TZ, P_E, N_PAIR_ARRAYS};
+
+static int threadID() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Smallest alpha where erfc(alpha*cutoff)/cutoff <= precision (Tinker's ewaldcof).
+ */
+REAL ewaldCoefficient(REAL cutoff, REAL precision) {
+  double x = 0.5;
+  while(erfc(x*cutoff)/cutoff >= precision) {
+    x *= 2.0;
+  }
+  double lo = 0.0, hi = x;
+  for(int k = 0; k < 50; k++) { // bisection
+    x = (lo + hi) / 2.0;
+    if(erfc(x*cutoff)/cutoff >= precision) {
+      lo = x;
+    } else {
+      hi = x;
+    }
+  }
+  return x;
+}
+
+/**
+ * Cubic Hermite table of erfc(x) for x in [0, alpha*maxR] matching values and slopes (-2/sqrt(pi)*exp(-x^2))
+ * at every knot. A spacing of 1/512 keeps the relative error of the B functions well under 1e-10.
+ */
+ErfcTable* erfcTableCreate(REAL alpha, REAL maxR) {
+  ErfcTable* table = malloc(sizeof(ErfcTable));
+  if(table == NULL) {
+    printf("Failed to allocate erfc table!\n");
+    exit(1);
+  }
+  table->alpha = alpha;
+  table->dx = 1.0 / 512.0;
+  table->invDx = 512.0;
+  table->n = (int) (alpha * maxR * table->invDx) + 2;
+  table->coefficients = malloc(sizeof(REAL)*4*table->n);
+  table->kernelCoefficients = sizeof(PREAL) == sizeof(REAL) ? (PREAL*) table->coefficients
+    : malloc(sizeof(PREAL)*4*table->n);
+  if(table->coefficients == NULL || table->kernelCoefficients == NULL) {
+    printf("Failed to allocate erfc table!\n");
+    exit(1);
+  }
+  double h = table->dx;
+  for(int k = 0; k < table->n; k++) {
+    double x0 = k*h, x1 = (k+1)*h;
+    double f0 = erfc(x0), f1 = erfc(x1);
+    double d0 = -2.0/sqrt(M_PI)*exp(-x0*x0), d1 = -2.0/sqrt(M_PI)*exp(-x1*x1);
+    table->coefficients[4*k] = f0;
+    table->coefficients[4*k+1] = h*d0;
+    table->coefficients[4*k+2] = 3.0*(f1 - f0) - h*(2.0*d0 + d1);
+    table->coefficients[4*k+3] = 2.0*(f0 - f1) + h*(d0 + d1);
+  }
+  for(int c = 0; c < 4*table->n; c++) {
+    table->kernelCoefficients[c] = (PREAL) table->coefficients[c];
+  }
+  return table;
+}
+
+void erfcTableDestroy(ErfcTable* table) {
+  if((void*) table->kernelCoefficients != (void*) table->coefficients) {
+    free(table->kernelCoefficients);
+  }
+  free(table->coefficients);
+  free(table);
+}
+
+static void allocatePairs(DirectWorkspace* work, int capacity) {
+  work->pairCapacity = capacity;
+  for(int t = 0; t < work->nThreads; t++) {
+    free(work->pairs[t]);
+    free(work->pairIDs[t]);
+    free(work->lambdaSlots[t]);
+    work->pairs[t] = malloc(sizeof(PREAL)*N_PAIR_ARRAYS*capacity);
+    work->pairIDs[t] = malloc(sizeof(int)*capacity);
+    work->lambdaSlots[t] = malloc(sizeof(int)*capacity);
+    if(work->pairs[t] == NULL || work->pairIDs[t] == NULL || work->lambdaSlots[t] == NULL) {
+      printf("Failed to allocate pair buffers in direct.c!\n");
+      exit(1);
+    }
+  }
+}
+
+/**
+ * Allocates everything the real space kernel needs so that evaluating it does not allocate.
+ * Sets System->ewaldAlpha from the cutoff if the key file didn't. Lambda atoms are taken from
+ * System->activeLambdas, their System->lambdas must be assigned before evaluating.
+ */
+DirectWorkspace* directWorkspaceCreate(System* system) {
+  DirectWorkspace* work = malloc(sizeof(DirectWorkspace));
+  if(work == NULL) {
+    printf("Failed to allocate direct workspace!\n");
+    exit(1);
+  }
+  if(system->ewaldAlpha <= 0.0) {
+    system->ewaldAlpha = ewaldCoefficient(system->realspaceCutoff, 1e-8);
+  }
+#ifdef _OPENMP
+  work->nThreads = omp_get_max_threads();
+#else
+  work->nThreads = 1;
+#endif
+  work->nAtoms = system->nAtoms;
+  work->erfcTable = erfcTableCreate(system->ewaldAlpha, system->realspaceCutoff + system->realspaceBuffer);
+  work->scale = malloc(sizeof(REAL*)*work->nThreads);
+  work->pairs = calloc(work->nThreads, sizeof(PREAL*));
+  work->pairIDs = calloc(work->nThreads, sizeof(int*));
+  work->lambdaSlots = calloc(work->nThreads, sizeof(int*));
+  if(work->scale == NULL || work->pairs == NULL || work->pairIDs == NULL || work->lambdaSlots == NULL) {
+    printf("Failed to allocate direct workspace!\n");
+    exit(1);
+  }
+  for(int t = 0; t < work->nThreads; t++) {
+    work->scale[t] = malloc(sizeof(REAL)*system->nAtoms);
+    if(work->scale[t] == NULL) {
+      printf("Failed to allocate direct workspace!\n");
+      exit(1);
+    }
+    for(int i = 0; i < system->nAtoms; i++) {
+      work->scale[t][i] = 1.0;
+    }
+  }
+  work->buffers = threadBuffersCreate(system->nAtoms, 2);
+  assert(work->buffers->nThreads == work->nThreads);
+  work->part = REAL_SPACE_ALL;
+  work->switchStart = system->realspaceCutoff;
+  work->switchEnd = system->realspaceCutoff;
+  work->lambdaAtom = NULL;
+  if(system->nActiveLambdas > 0) {
+    work->lambdaAtom = calloc(system->nAtoms, sizeof(bool));
+    if(work->lambdaAtom == NULL) {
+      printf("Failed to allocate direct workspace!\n");
+      exit(1);
+    }
+    for(int l = 0; l < system->nActiveLambdas; l++) {
+      work->lambdaAtom[system->activeLambdas[l]] = true;
+    }
+    assert(system->verletPlain != NULL); // Lists built after the lambda atoms were set are partitioned
+  }
+  work->nStates = 0;
+  work->states = work->stateEnergy = work->stateTally = NULL;
+  allocatePairs(work, 256);
+  return work;
+}
+
+/**
+ * Sets the lambda states whose real space energies every REAL_SPACE_ALL evaluation also sums into
+ * DirectWorkspace->stateEnergy. The workspace must have been created with lambda atoms.
+ */
+void directWorkspaceStates(DirectWorkspace* work, int nStates, const REAL* states) {
+  if(work->lambdaAtom == NULL) {
+    printf("Lambda states need lambda atoms!\n");
+    exit(1);
+  }
+  free(work->states);
+  free(work->stateEnergy);
+  free(work->stateTally);
+  work->nStates = nStates;
+  work->stateStride = (nStates + 7)/8*8;
+  work->states = malloc(sizeof(REAL)*nStates);
+  work->stateEnergy = calloc(nStates, sizeof(REAL));
+  work->stateTally = calloc((long) work->nThreads*work->stateStride, sizeof(REAL));
+  if(work->states == NULL || work->stateEnergy == NULL || work->stateTally == NULL) {
+    printf("Failed to allocate lambda states!\n");
+    exit(1);
+  }
+  memcpy(work->states, states, sizeof(REAL)*nStates);
+}
+
+void directWorkspaceDestroy(DirectWorkspace* work) {
+  for(int t = 0; t < work->nThreads; t++) {
+    free(work->scale[t]);
+    free(work->pairs[t]);
+    free(work->pairIDs[t]);
+    free(work->lambdaSlots[t]);
+  }
+  free(work->scale);
+  free(work->lambdaSlots);
+  free(work->lambdaAtom);
+  free(work->states);
+  free(work->stateEnergy);
+  free(work->stateTally);
+  threadBuffersDestroy(work->buffers);
+  free(work->pairs);
+  free(work->pairIDs);
+  erfcTableDestroy(work->erfcTable);
+  free(work);
+}
+
+static void setScale(System* system, REAL* scale, int i, REAL m12, REAL m13, REAL m14) {
+  IntVector* lists[3] = {&system->list12[i], &system->list13[i], &system->list14[i]};
+  REAL values[3] = {m12, m13, m14};
+  for(int l = 0; l < 3; l++) {
+    int* ids = lists[l]->array;
+    for(int k = 0; k < lists[l]->size; k++) {
+      scale[ids[k]] = values[l];
+    }
+  }
+}
+
+/**
+ * Weight of a pair at r2 in the given part of a split real space sum and its derivative over r (dw/dr/r).
+ * @return false if the pair has no weight in this part
+ */
+static inline bool pairWeight(enum RealSpacePart part, REAL start, REAL end, REAL r2, REAL* w, REAL* dw) {
+  *w = 1.0;
+  *dw = 0.0;
+  if(part == REAL_SPACE_ALL) {
+    return true;
+  }
+  if(r2 >= end*end) {
+    return part == REAL_SPACE_FAR;
+  }
+  if(r2 <= start*start) {
+    return part == REAL_SPACE_NEAR;
+  }
+  REAL r = sqrt(r2);
+  REAL x = (r - start)/(end - start);
+  REAL sw = 1.0 - x*x*x*(10.0 - 15.0*x + 6.0*x*x);
+  REAL dsw = -30.0*x*x*(1.0 - x)*(1.0 - x)/(end - start);
+  *w = part == REAL_SPACE_NEAR ? sw : 1.0 - sw;
+  *dw = (part == REAL_SPACE_NEAR ? dsw : -dsw)/r;
+  return true;
+}
+
+/**
+ * Real space Ewald energy of the permanent multipoles over the Verlet list. Gradients (dE/dx) and torques on each
+ * atom's multipole are added to grad and torque [nAtoms*3] - the caller zeroes them and converts torques to forces.
+ * The pair part of the virial, sum over pairs of r_ik (x) dE/dr_ik, is added to virial [9] unless it is NULL;
+ * torqueToGradient adds the rest.
+ * <p>
+ * Each thread owns whole atoms i, handed out in fixed chunks so the result doesn't depend on timing: it gathers
+ * i's neighbors inside the cutoff into structure of arrays buffers, runs the pair math in one simd loop, then
+ * scatters the neighbor gradients into its own ThreadBuffers which are reduced at the end.
+ * <p>
+ * DirectWorkspace->part restricts the sum to the near or far pairs of a split (RealSpacePart).
+ * <p>
+ * Pairs with a lambda atom are weighted by lambda_i*lambda_k (System->lambdas). Only the perturbed tail of each
+ * Verlet list (System->verletPlain, partitioned by buildVerlet) holds them, the plain pairs are gathered without
+ * looking at lambdas. The perturbed pairs' slots are also listed while gathering, and after the pair loop only those
+ * pairs add their energy change into each of DirectWorkspace->states, so a whole row of state energies costs nStates
+ * multiply-adds per lambda pair.
+ * @return real space energy (kcal/mol)
+ */
+REAL multipoleRealSpace(System* system, DirectWorkspace* work, REAL* grad, REAL* torque, REAL* virial) {
+  assert(work->nAtoms == system->nAtoms);
+  int nAtoms = system->nAtoms;
+  const REAL* X = system->X;
+  const PREAL f = ELECTRIC;
+  const PREAL alpha = system->ewaldAlpha;
+  const PREAL alsq2 = 2.0*system->ewaldAlpha*system->ewaldAlpha;
+  const PREAL pre = 1.0/(sqrt(M_PI)*system->ewaldAlpha);
+  const REAL cut2 = system->realspaceCutoff*system->realspaceCutoff;
+  const REAL boxX = system->boxDim[0][0], boxY = system->boxDim[1][1], boxZ = system->boxDim[2][2];
+  const PREAL* table = work->erfcTable->kernelCoefficients;
+  const PREAL invDx = work->erfcTable->invDx;
+  const enum RealSpacePart part = work->part;
+  const REAL switchStart = work->switchStart, switchEnd = work->switchEnd;
+  const bool* lambdaAtom = work->lambdaAtom;
+  const REAL* lambdas = system->lambdas;
+  const int nStates = part == REAL_SPACE_ALL ? work->nStates : 0;
+  const REAL* states = work->states;
+  assert(work->erfcTable->alpha == system->ewaldAlpha);
+  assert(lambdaAtom == NULL || (lambdas != NULL && system->verletPlain != NULL));
+  // Grow the neighbor buffers before entering the parallel region
+  int maxList = 0;
+  for(int i = 0; i < nAtoms; i++) {
+    maxList = system->verletList[i].size > maxList ? system->verletList[i].size : maxList;
+  }
+  if(maxList > work->pairCapacity) {
+    allocatePairs(work, maxList);
+  }
+  int cap = work->pairCapacity;
+  ThreadBuffers* buffers = work->buffers;
+#pragma omp parallel num_threads(work->nThreads)
+  {
+    int t = threadID();
+    REAL* scale = work->scale[t];
+    REAL* gt = threadArray(buffers, t, 0);
+    REAL* tt = threadArray(buffers, t, 1);
+    REAL* tally = buffers->tally + t*TALLY_STRIDE;
+    PREAL* pairs = work->pairs[t];
+    int* ids = work->pairIDs[t];
+    int* lambdaSlots = work->lambdaSlots[t];
+    REAL* stateTally = nStates > 0 ? work->stateTally + t*work->stateStride : NULL;
+    PREAL* restrict px = pairs + P_X*cap;
+    PREAL* restrict py = pairs + P_Y*cap;
+    PREAL* restrict pz = pairs + P_Z*cap;
+    PREAL* restrict pc = pairs + P_C*cap;
+    PREAL* restrict pdx = pairs + P_DX*cap;
+    PREAL* restrict pdy = pairs + P_DY*cap;
+    PREAL* restrict pdz = pairs + P_DZ*cap;
+    PREAL* restrict pqxx = pairs + P_QXX*cap;
+    PREAL* restrict pqyy = pairs + P_QYY*cap;
+    PREAL* restrict pqzz = pairs + P_QZZ*cap;
+    PREAL* restrict pqxy = pairs + P_QXY*cap;
+    PREAL* restrict pqxz = pairs + P_QXZ*cap;
+    PREAL* restrict pqyz = pairs + P_QYZ*cap;
+    PREAL* restrict ps = pairs + P_SCALE*cap;
+    PREAL* restrict pw = pairs + P_W*cap;
+    PREAL* restrict pdw = pairs + P_DW*cap;
+    PREAL* restrict pfx = pairs + P_FX*cap;
+    PREAL* restrict pfy = pairs + P_FY*cap;
+    PREAL* restrict pfz = pairs + P_FZ*cap;
+    PREAL* restrict ptx = pairs + P_TX*cap;
+    PREAL* restrict pty = pairs + P_TY*cap;
+    PREAL* restrict ptz = pairs + P_TZ*cap;
+    PREAL* restrict pe = pairs + P_E*cap;
+    long pairCount = 0; // Within the cutoff
+    TIMER_START(TIMER_PAIRS);
+#pragma omp for schedule(static, 16) nowait
+    for(int i = 0; i < nAtoms; i++) {
+      IntVector* list = &system->verletList[i];
+      if(list->size == 0) {
+        continue;
+      }
+      setScale(system, scale, i, system->mpoleScale[0], system->mpoleScale[1], system->mpoleScale[2]);
+      // Gather neighbors inside the cutoff
+      REAL xi = X[i*3], yi = X[i*3+1], zi = X[i*3+2];
+      int* neighbors = list->array;
+      const bool lambdaI = lambdaAtom != NULL && lambdaAtom[i];
+      const int nPlain = lambdaAtom != NULL ? system->verletPlain[i] : list->size;
+      int nPairs = 0, nLambda = 0;
+      for(int n = 0; n < list->size; n++) {
+        int k = neighbors[n];
+        REAL xr = X[k*3] - xi;
+        REAL yr = X[k*3+1] - yi;
+        REAL zr = X[k*3+2] - zi;
+        xr -= boxX*floor(xr/boxX + 0.5);
+        yr -= boxY*floor(yr/boxY + 0.5);
+        zr -= boxZ*floor(zr/boxZ + 0.5);
+        REAL r2 = xr*xr + yr*yr + zr*zr, w, dw;
+        if(r2 > cut2 || !pairWeight(part, switchStart, switchEnd, r2, &w, &dw)) {
+          continue;
+        }
+        if(n >= nPlain) {
+          const REAL lw = lambdas[i]*lambdas[k];
+          w *= lw;
+          dw *= lw;
+          lambdaSlots[nLambda++] = 2*nPairs + (lambdaI && lambdaAtom[k]);
+        }
+        const REAL* mk = system->multipoles[k];
+        px[nPairs] = xr;
+        py[nPairs] = yr;
+        pz[nPairs] = zr;
+        pc[nPairs] = mk[0];
+        pdx[nPairs] = mk[1];
+        pdy[nPairs] = mk[2];
+        pdz[nPairs] = mk[3];
+        pqxx[nPairs] = mk[4];
+        pqyy[nPairs] = mk[5];
+        pqzz[nPairs] = mk[6];
+        pqxy[nPairs] = 0.5*mk[7];
+        pqxz[nPairs] = 0.5*mk[8];
+        pqyz[nPairs] = 0.5*mk[9];
+        ps[nPairs] = scale[k];
+        pw[nPairs] = w;
+        pdw[nPairs] = dw;
+        ids[nPairs] = k;
+        nPairs++;
+      }
+      pairCount += nPairs;
+      const REAL* mi = system->multipoles[i];
+      const PREAL ci = mi[0], dix = mi[1], diy = mi[2], diz = mi[3];
+      const PREAL qixx = mi[4], qiyy = mi[5], qizz = mi[6];
+      const PREAL qixy = 0.5*mi[7], qixz = 0.5*mi[8], qiyz = 0.5*mi[9];
+      // Pair math is in kernel precision, every sum over pairs or atoms is accumulated in REAL
+      REAL ei = 0, gix = 0, giy = 0, giz = 0, tix = 0, tiy = 0, tiz = 0;
+#pragma omp simd reduction(+:ei,gix,giy,giz,tix,tiy,tiz)
+      for(int p = 0; p < nPairs; p++) {
+        const PREAL xr = px[p], yr = py[p], zr = pz[p];
+        const PREAL ck = pc[p], dkx = pdx[p], dky = pdy[p], dkz = pdz[p];
+        const PREAL qkxx = pqxx[p], qkyy = pqyy[p], qkzz = pqzz[p];
+        const PREAL qkxy = pqxy[p], qkxz = pqxz[p], qkyz = pqyz[p];
+        const PREAL r2 = xr*xr + yr*yr + zr*zr;
+        const PREAL r = sqrt(r2);
+        const PREAL rInv = 1/r;
+        const PREAL r2Inv = rInv*rInv;
+        // Damping: B0..B5 from tabulated erfc and one exp
+        const PREAL s = alpha*r*invDx;
+        const int idx = (int) s;
+        const PREAL u = s - idx;
+        const PREAL* cf = table + 4*idx;
+        const PREAL erfcAr = cf[0] + u*(cf[1] + u*(cf[2] + u*cf[3]));
+        const PREAL exp2a = exp(-alpha*alpha*r2);
+        PREAL alsq2n = pre;
+        const PREAL bn0 = erfcAr*rInv;
+        alsq2n *= alsq2;
+        const PREAL bn1 = (bn0 + alsq2n*exp2a)*r2Inv;
+        alsq2n *= alsq2;
+        const PREAL bn2 = (3*bn1 + alsq2n*exp2a)*r2Inv;
+        alsq2n *= alsq2;
+        const PREAL bn3 = (5*bn2 + alsq2n*exp2a)*r2Inv;
+        alsq2n *= alsq2;
+        const PREAL bn4 = (7*bn3 + alsq2n*exp2a)*r2Inv;
+        alsq2n *= alsq2;
+        const PREAL bn5 = (9*bn4 + alsq2n*exp2a)*r2Inv;
+        // Remove the excluded fraction of the undamped interaction
+        const PREAL sk = 1 - ps[p];
+        PREAL rr1 = rInv;
+        PREAL rr3 = rr1*r2Inv;
+        PREAL rr5 = 3*rr3*r2Inv;
+        PREAL rr7 = 5*rr5*r2Inv;
+        PREAL rr9 = 7*rr7*r2Inv;
+        PREAL rr11 = 9*rr9*r2Inv;
+        rr1 = f*(bn0 - sk*rr1);
+        rr3 = f*(bn1 - sk*rr3);
+        rr5 = f*(bn2 - sk*rr5);
+        rr7 = f*(bn3 - sk*rr7);
+        rr9 = f*(bn4 - sk*rr9);
+        rr11 = f*(bn5 - sk*rr11);
+        // Intermediates involving moments and separation
+        const PREAL dir = dix*xr + diy*yr + diz*zr;
+        const PREAL qix = qixx*xr + qixy*yr + qixz*zr;
+        const PREAL qiy = qixy*xr + qiyy*yr + qiyz*zr;
+        const PREAL qiz = qixz*xr + qiyz*yr + qizz*zr;
+        const PREAL qir = qix*xr + qiy*yr + qiz*zr;
+        const PREAL dkr = dkx*xr + dky*yr + dkz*zr;
+        const PREAL qkx = qkxx*xr + qkxy*yr + qkxz*zr;
+        const PREAL qky = qkxy*xr + qkyy*yr + qkyz*zr;
+        const PREAL qkz = qkxz*xr + qkyz*yr + qkzz*zr;
+        const PREAL qkr = qkx*xr + qky*yr + qkz*zr;
+        const PREAL dik = dix*dkx + diy*dky + diz*dkz;
+        const PREAL qik = qix*qkx + qiy*qky + qiz*qkz;
+        const PREAL diqk = dix*qkx + diy*qky + diz*qkz;
+        const PREAL dkqi = dkx*qix + dky*qiy + dkz*qiz;
+        const PREAL qiqk = 2*(qixy*qkxy + qixz*qkxz + qiyz*qkyz) + qixx*qkxx + qiyy*qkyy + qizz*qkzz;
+        // Cross products needed for the torques
+        const PREAL dirx = diy*zr - diz*yr, diry = diz*xr - dix*zr, dirz = dix*yr - diy*xr;
+        const PREAL dkrx = dky*zr - dkz*yr, dkry = dkz*xr - dkx*zr, dkrz = dkx*yr - dky*xr;
+        const PREAL dikx = diy*dkz - diz*dky, diky = diz*dkx - dix*dkz, dikz = dix*dky - diy*dkx;
+        const PREAL qirx = qiz*yr - qiy*zr, qiry = qix*zr - qiz*xr, qirz = qiy*xr - qix*yr;
+        const PREAL qkrx = qkz*yr - qky*zr, qkry = qkx*zr - qkz*xr, qkrz = qky*xr - qkx*yr;
+        const PREAL qikx = qky*qiz - qkz*qiy, qiky = qkz*qix - qkx*qiz, qikz = qkx*qiy - qky*qix;
+        const PREAL qixk = qixx*qkx + qixy*qky + qixz*qkz;
+        const PREAL qiyk = qixy*qkx + qiyy*qky + qiyz*qkz;
+        const PREAL qizk = qixz*qkx + qiyz*qky + qizz*qkz;
+        const PREAL qkxi = qkxx*qix + qkxy*qiy + qkxz*qiz;
+        const PREAL qkyi = qkxy*qix + qkyy*qiy + qkyz*qiz;
+        const PREAL qkzi = qkxz*qix + qkyz*qiy + qkzz*qiz;
+        const PREAL qikrx = qizk*yr - qiyk*zr, qikry = qixk*zr - qizk*xr, qikrz = qiyk*xr - qixk*yr;
+        const PREAL qkirx = qkzi*yr - qkyi*zr, qkiry = qkxi*zr - qkzi*xr, qkirz = qkyi*xr - qkxi*yr;
+        const PREAL diqkx = dix*qkxx + diy*qkxy + diz*qkxz;
+        const PREAL diqky = dix*qkxy + diy*qkyy + diz*qkyz;
+        const PREAL diqkz = dix*qkxz + diy*qkyz + diz*qkzz;
+        const PREAL dkqix = dkx*qixx + dky*qixy + dkz*qixz;
+        const PREAL dkqiy = dkx*qixy + dky*qiyy + dkz*qiyz;
+        const PREAL dkqiz = dkx*qixz + dky*qiyz + dkz*qizz;
+        const PREAL diqkrx = diqkz*yr - diqky*zr, diqkry = diqkx*zr - diqkz*xr, diqkrz = diqky*xr - diqkx*yr;
+        const PREAL dkqirx = dkqiz*yr - dkqiy*zr, dkqiry = dkqix*zr - dkqiz*xr, dkqirz = dkqiy*xr - dkqix*yr;
+        const PREAL dqikx = diy*qkz - diz*qky + dky*qiz - dkz*qiy
+          - 2*(qixy*qkxz + qiyy*qkyz + qiyz*qkzz - qixz*qkxy - qiyz*qkyy - qizz*qkyz);
+        const PREAL dqiky = diz*qkx - dix*qkz + dkz*qix - dkx*qiz
+          - 2*(qixz*qkxx + qiyz*qkxy + qizz*qkxz - qixx*qkxz - qixy*qkyz - qixz*qkzz);
+        const PREAL dqikz = dix*qky - diy*qkx + dkx*qiy - dky*qix
+          - 2*(qixx*qkxy + qixy*qkyy + qixz*qkyz - qixy*qkxx - qiyy*qkxy - qiyz*qkxz);
+        // Energy
+        PREAL term1 = ci*ck;
+        PREAL term2 = ck*dir - ci*dkr + dik;
+        PREAL term3 = ci*qkr + ck*qir - dir*dkr + 2*(dkqi - diqk + qiqk);
+        PREAL term4 = dir*qkr - dkr*qir - 4*qik;
+        PREAL term5 = qir*qkr;
+        const PREAL e = term1*rr1 + term2*rr3 + term3*rr5 + term4*rr7 + term5*rr9;
+        const PREAL w = pw[p], dwe = pdw[p]*e;
+        ei += w*e;
+        pe[p] = e;
+        // Gradient, including the weight's dependence on r for split sums
+        const PREAL de = term1*rr3 + term2*rr5 + term3*rr7 + term4*rr9 + term5*rr11;
+        term1 = -ck*rr3 + dkr*rr5 - qkr*rr7;
+        term2 = ci*rr3 + dir*rr5 + qir*rr7;
+        term3 = 2*rr5;
+        term4 = 2*(-ck*rr5 + dkr*rr7 - qkr*rr9);
+        term5 = 2*(-ci*rr5 - dir*rr7 - qir*rr9);
+        const PREAL term6 = 4*rr7;
+        const PREAL frcx = w*(de*xr + term1*dix + term2*dkx + term3*(diqkx - dkqix) + term4*qix + term5*qkx
+          + term6*(qixk + qkxi)) - dwe*xr;
+        const PREAL frcy = w*(de*yr + term1*diy + term2*dky + term3*(diqky - dkqiy) + term4*qiy + term5*qky
+          + term6*(qiyk + qkyi)) - dwe*yr;
+        const PREAL frcz = w*(de*zr + term1*diz + term2*dkz + term3*(diqkz - dkqiz) + term4*qiz + term5*qkz
+          + term6*(qizk + qkzi)) - dwe*zr;
+        gix += frcx;
+        giy += frcy;
+        giz += frcz;
+        pfx[p] = frcx;
+        pfy[p] = frcy;
+        pfz[p] = frcz;
+        // Torques
+        tix += w*(-rr3*dikx + term1*dirx + term3*(dqikx + dkqirx) - term4*qirx - term6*(qikrx + qikx));
+        tiy += w*(-rr3*diky + term1*diry + term3*(dqiky + dkqiry) - term4*qiry - term6*(qikry + qiky));
+        tiz += w*(-rr3*dikz + term1*dirz + term3*(dqikz + dkqirz) - term4*qirz - term6*(qikrz + qikz));
+        ptx[p] = w*(rr3*dikx + term2*dkrx - term3*(dqikx + diqkrx) - term5*qkrx - term6*(qkirx - qikx));
+        pty[p] = w*(rr3*diky + term2*dkry - term3*(dqiky + diqkry) - term5*qkry - term6*(qkiry - qiky));
+        ptz[p] = w*(rr3*dikz + term2*dkrz - term3*(dqikz + diqkrz) - term5*qkrz - term6*(qkirz - qikz));
+      }
+      // Pair virial, dE/dr_ik = -frc
+      REAL vxx = 0, vxy = 0, vxz = 0, vyx = 0, vyy = 0, vyz = 0, vzx = 0, vzy = 0, vzz = 0;
+#pragma omp simd reduction(+:vxx,vxy,vxz,vyx,vyy,vyz,vzx,vzy,vzz)
+      for(int p = 0; p < nPairs; p++) {
+        vxx -= px[p]*pfx[p];
+        vxy -= px[p]*pfy[p];
+        vxz -= px[p]*pfz[p];
+        vyx -= py[p]*pfx[p];
+        vyy -= py[p]*pfy[p];
+        vyz -= py[p]*pfz[p];
+        vzx -= pz[p]*pfx[p];
+        vzy -= pz[p]*pfy[p];
+        vzz -= pz[p]*pfz[p];
+      }
+      REAL* vir = tally + TALLY_VIRIAL;
+      vir[0] += vxx;
+      vir[1] += vxy;
+      vir[2] += vxz;
+      vir[3] += vyx;
+      vir[4] += vyy;
+      vir[5] += vyz;
+      vir[6] += vzx;
+      vir[7] += vzy;
+      vir[8] += vzz;
+      tally[TALLY_ENERGY] += ei;
+      // Lambda states, only the pairs with a lambda atom
+      if(nLambda > 0) {
+        for(int l = 0; l < nStates; l++) {
+          const REAL state = states[l];
+          REAL change = 0.0;
+          for(int q = 0; q < nLambda; q++) {
+            const int p = lambdaSlots[q] >> 1;
+            const REAL weight = (lambdaSlots[q] & 1) ? state*state : state;
+            change += (weight - pw[p])*pe[p];
+          }
+          stateTally[l] += change;
+        }
+      }
+      threadBuffersMark(buffers, t, i);
+      gt[i*3] += gix;
+      gt[i*3+1] += giy;
+      gt[i*3+2] += giz;
+      tt[i*3] += tix;
+      tt[i*3+1] += tiy;
+      tt[i*3+2] += tiz;
+      for(int p = 0; p < nPairs; p++) {
+        int k = ids[p];
+        threadBuffersMark(buffers, t, k);
+        gt[k*3] -= pfx[p];
+        gt[k*3+1] -= pfy[p];
+        gt[k*3+2] -= pfz[p];
+        tt[k*3] += ptx[p];
+        tt[k*3+1] += pty[p];
+        tt[k*3+2] += ptz[p];
+      }
+      setScale(system, scale, i, 1.0, 1.0, 1.0);
+    }
+    TIMER_ITEMS(pairCount);
+    TIMER_STOP(TIMER_PAIRS);
+  }
+  TIMER_START(TIMER_REDUCE);
+  REAL* out[2] = {grad, torque};
+  REAL energy = threadBuffersReduce(buffers, out, virial);
+  TIMER_ITEMS(nAtoms);
+  TIMER_STOP(TIMER_REDUCE);
+  for(int l = 0; l < nStates; l++) {
+    work->stateEnergy[l] = energy;
+    for(int t = 0; t < work->nThreads; t++) {
+      work->stateEnergy[l] += work->stateTally[t*work->stateStride + l];
+      work->stateTally[t*work->stateStride + l] = 0.0;
+    }
+  }
+  return energy;
+}
+
+static inline REAL selfTerm(const REAL* m, REAL alpha) {
+  const REAL term = 2.0*alpha*alpha;
+  const REAL fterm = -ELECTRIC*alpha/sqrt(M_PI);
+  REAL cii = m[0]*m[0];
+  REAL dii = m[1]*m[1] + m[2]*m[2] + m[3]*m[3];
+  REAL qii = 0.5*(m[7]*m[7] + m[8]*m[8] + m[9]*m[9]) + m[4]*m[4] + m[5]*m[5] + m[6]*m[6];
+  return fterm*(cii + term*(dii/3.0 + 2.0*term*qii/5.0));
+}
+
+/**
+ * Ewald self energy of the permanent multipoles, which removes each site's interaction with its own screening
+ * gaussian. Lambda atoms' multipoles are scaled by System->lambdas, so theirs by lambda^2.
+ */
+REAL multipoleSelfEnergy(System* system) {
+  const REAL alpha = system->ewaldAlpha;
+  REAL energy = 0.0;
+  for(int i = 0; i < system->nAtoms; i++) {
+    energy += selfTerm(system->multipoles[i], alpha);
+  }
+  for(int l = 0; l < system->nActiveLambdas; l++) {
+    const int i = system->activeLambdas[l];
+    energy += (system->lambdas[i]*system->lambdas[i] - 1.0)*selfTerm(system->multipoles[i], alpha);
+  }
+  return energy;
+}
+
+/**
+ * Self energy with the lambda atoms at each of the given lambda values [nStates].
+ */
+void multipoleSelfStates(System* system, int nStates, const REAL* states, REAL* energies) {
+  const REAL alpha = system->ewaldAlpha;
+  REAL environment = 0.0, lambda = 0.0;
+  for(int i = 0; i < system->nAtoms; i++) {
+    environment += selfTerm(system->multipoles[i], alpha);
+  }
+  for(int l = 0; l < system->nActiveLambdas; l++) {
+    lambda += selfTerm(system->multipoles[system->activeLambdas[l]], alpha);
+  }
+  environment -= lambda;
+  for(int s = 0; s < nStates; s++) {
+    energies[s] = environment + states[s]*states[s]*lambda;
+  }
+}
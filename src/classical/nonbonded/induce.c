@@ -0,0 +1,742 @@
+// Author(s): Matthew Speranza
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../include/induce.h"
+#include "../../common/include/timers.h"
+
+#define UDIAG 2.0 // Tinker's weight of the diagonal in the pair preconditioner, fewer iterations than 1
+
+// Structure of arrays slots in InducedDipoles->pairs
+enum InduceArray {I_X, I_Y, I_Z, I_PD, I_TH, I_DS, I_C, I_DX, I_DY, I_DZ, I_QXX, I_QYY, I_QZZ, I_QXY, I_QXZ, I_QYZ,
+  I_FX, I_FY, I_FZ, N_INDUCE_ARRAYS};
+
+static int threadID() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+static void allocatePairs(InducedDipoles* ind, int capacity) {
+  ind->pairCapacity = capacity;
+  for(int t = 0; t < ind->nThreads; t++) {
+    free(ind->pairs[t]);
+    free(ind->pairIDs[t]);
+    ind->pairs[t] = malloc(sizeof(REAL)*N_INDUCE_ARRAYS*capacity);
+    ind->pairIDs[t] = malloc(sizeof(int)*capacity);
+    if(ind->pairs[t] == NULL || ind->pairIDs[t] == NULL) {
+      printf("Failed to allocate pair buffers in induce.c!\n");
+      exit(1);
+    }
+  }
+}
+
+static int findGroup(int* parent, int i) {
+  while(parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+/**
+ * Looks up every atom's polarize parameters and joins bonded atoms listed in each other's polarization group
+ * into one group (Tinker's polargrp). Needs System->forceField and System->list12.
+ */
+InducedDipoles* inducedDipolesCreate(System* system) {
+  assert(system->forceField != NULL && system->list12 != NULL);
+  int nAtoms = system->nAtoms;
+  InducedDipoles* ind = calloc(1, sizeof(InducedDipoles));
+  if(ind == NULL) {
+    printf("Failed to allocate induced dipoles!\n");
+    exit(1);
+  }
+  ind->nAtoms = nAtoms;
+#ifdef _OPENMP
+  ind->nThreads = omp_get_max_threads();
+#else
+  ind->nThreads = 1;
+#endif
+  ind->polarizability = malloc(sizeof(REAL)*nAtoms);
+  ind->thole = malloc(sizeof(REAL)*nAtoms);
+  ind->pdamp = malloc(sizeof(REAL)*nAtoms);
+  ind->group = malloc(sizeof(int)*nAtoms);
+  ind->fieldDirect = malloc(sizeof(REAL)*nAtoms*3);
+  ind->mu = calloc(nAtoms*3, sizeof(REAL));
+  ind->rsd = malloc(sizeof(REAL)*nAtoms*3);
+  ind->zrsd = malloc(sizeof(REAL)*nAtoms*3);
+  ind->conj = malloc(sizeof(REAL)*nAtoms*3);
+  ind->vec = malloc(sizeof(REAL)*nAtoms*3);
+  ind->maxHistory = system->polarPredict;
+  ind->history = malloc(sizeof(REAL)*nAtoms*3*(ind->maxHistory > 0 ? ind->maxHistory : 1));
+  ind->precondStart = malloc(sizeof(int)*(nAtoms+1));
+  ind->partial = calloc(ind->nThreads*TALLY_STRIDE, sizeof(REAL));
+  ind->pairs = calloc(ind->nThreads, sizeof(REAL*));
+  ind->pairIDs = calloc(ind->nThreads, sizeof(int*));
+  if(ind->polarizability == NULL || ind->thole == NULL || ind->pdamp == NULL || ind->group == NULL
+    || ind->fieldDirect == NULL || ind->mu == NULL || ind->rsd == NULL || ind->zrsd == NULL || ind->conj == NULL
+    || ind->vec == NULL || ind->history == NULL || ind->precondStart == NULL || ind->partial == NULL
+    || ind->pairs == NULL || ind->pairIDs == NULL) {
+    printf("Failed to allocate induced dipoles!\n");
+    exit(1);
+  }
+  ind->fields = threadBuffersCreate(nAtoms, 1);
+  assert(ind->fields->nThreads == ind->nThreads);
+  ind->preconditionerCutoff = 4.5;
+  allocatePairs(ind, 256);
+  // Parameters by atom type
+  const PolarizeVector* params = &system->forceField->polarize;
+  Polarize* entries = params->array;
+  Polarize** atomParams = malloc(sizeof(Polarize*)*nAtoms);
+  if(atomParams == NULL) {
+    printf("Failed to allocate induced dipoles!\n");
+    exit(1);
+  }
+  for(int i = 0; i < nAtoms; i++) {
+    atomParams[i] = NULL;
+    for(int e = 0; e < params->size; e++) {
+      if(entries[e].atomType == system->atomTypes[i]) {
+        atomParams[i] = &entries[e];
+        break;
+      }
+    }
+    ind->polarizability[i] = atomParams[i] != NULL ? atomParams[i]->polarizabilityTensor[0][0] : 0.0;
+    ind->thole[i] = atomParams[i] != NULL ? atomParams[i]->thole : 0.0;
+    ind->pdamp[i] = pow(ind->polarizability[i], 1.0/6.0);
+    ind->group[i] = i;
+  }
+  // Union bonded atoms whose types are in each other's group lists
+  for(int i = 0; i < nAtoms; i++) {
+    if(atomParams[i] == NULL) {
+      continue;
+    }
+    int* bonded = system->list12[i].array;
+    for(int b = 0; b < system->list12[i].size; b++) {
+      int j = bonded[b];
+      for(int g = 0; g < 6 && atomParams[i]->polarizationGroup[g] != 0; g++) {
+        if(atomParams[i]->polarizationGroup[g] == system->atomTypes[j]) {
+          ind->group[findGroup(ind->group, j)] = findGroup(ind->group, i);
+          break;
+        }
+      }
+    }
+  }
+  for(int i = 0; i < nAtoms; i++) {
+    ind->group[i] = findGroup(ind->group, i);
+  }
+  free(atomParams);
+  return ind;
+}
+
+void inducedDipolesDestroy(InducedDipoles* ind) {
+  for(int t = 0; t < ind->nThreads; t++) {
+    free(ind->pairs[t]);
+    free(ind->pairIDs[t]);
+  }
+  threadBuffersDestroy(ind->fields);
+  free(ind->partial);
+  free(ind->pairs);
+  free(ind->pairIDs);
+  free(ind->polarizability);
+  free(ind->thole);
+  free(ind->pdamp);
+  free(ind->group);
+  free(ind->fieldDirect);
+  free(ind->mu);
+  free(ind->history);
+  free(ind->rsd);
+  free(ind->zrsd);
+  free(ind->conj);
+  free(ind->vec);
+  free(ind->precondStart);
+  free(ind->precondIDs);
+  free(ind->precondT);
+  free(ind);
+}
+
+static void growPairs(System* system, InducedDipoles* ind) {
+  int maxList = 0;
+  for(int i = 0; i < system->nAtoms; i++) {
+    maxList = system->verletList[i].size > maxList ? system->verletList[i].size : maxList;
+  }
+  if(maxList > ind->pairCapacity) {
+    allocatePairs(ind, maxList);
+  }
+}
+
+/**
+ * field = Ewald self field of the dipoles d [nAtoms*3] plus the per-thread buffers.
+ */
+static void reduceField(System* system, InducedDipoles* ind, const REAL* d, REAL* field) {
+  const REAL alpha = system->ewaldAlpha;
+  const REAL selfTerm = 4.0*alpha*alpha*alpha/(3.0*sqrt(M_PI));
+#pragma omp parallel for simd schedule(static) num_threads(ind->nThreads)
+  for(long a = 0; a < (long) ind->nAtoms*3; a++) {
+    field[a] = selfTerm*d[a];
+  }
+  threadBuffersReduce(ind->fields, &field, NULL);
+}
+
+/**
+ * Real space Ewald field of the permanent multipoles at every atom (e/ANG^2), with Thole damping and without
+ * pairs from the same polarization group, plus the self field. Overwrites field [nAtoms*3].
+ */
+void directField(System* system, InducedDipoles* ind, DirectWorkspace* work, REAL* field) {
+  int nAtoms = system->nAtoms;
+  const REAL* X = system->X;
+  const REAL alpha = system->ewaldAlpha;
+  const REAL alsq2 = 2.0*alpha*alpha;
+  const REAL pre = 1.0/(sqrt(M_PI)*alpha);
+  const REAL cut2 = system->realspaceCutoff*system->realspaceCutoff;
+  const REAL boxX = system->boxDim[0][0], boxY = system->boxDim[1][1], boxZ = system->boxDim[2][2];
+  const REAL* table = work->erfcTable->coefficients;
+  const REAL invDx = work->erfcTable->invDx;
+  assert(work->erfcTable->alpha == alpha);
+  growPairs(system, ind);
+  int cap = ind->pairCapacity;
+  // Dipoles for the self field
+  REAL* d = ind->vec;
+  for(int i = 0; i < nAtoms; i++) {
+    for(int k = 0; k < 3; k++) {
+      d[i*3+k] = system->multipoles[i][1+k];
+    }
+  }
+#pragma omp parallel num_threads(ind->nThreads)
+  {
+    int t = threadID();
+    REAL* ft = threadArray(ind->fields, t, 0);
+    REAL* pairs = ind->pairs[t];
+    int* ids = ind->pairIDs[t];
+    REAL* restrict px = pairs + I_X*cap;
+    REAL* restrict py = pairs + I_Y*cap;
+    REAL* restrict pz = pairs + I_Z*cap;
+    REAL* restrict ppd = pairs + I_PD*cap;
+    REAL* restrict pth = pairs + I_TH*cap;
+    REAL* restrict pds = pairs + I_DS*cap;
+    REAL* restrict pc = pairs + I_C*cap;
+    REAL* restrict pdx = pairs + I_DX*cap;
+    REAL* restrict pdy = pairs + I_DY*cap;
+    REAL* restrict pdz = pairs + I_DZ*cap;
+    REAL* restrict pqxx = pairs + I_QXX*cap;
+    REAL* restrict pqyy = pairs + I_QYY*cap;
+    REAL* restrict pqzz = pairs + I_QZZ*cap;
+    REAL* restrict pqxy = pairs + I_QXY*cap;
+    REAL* restrict pqxz = pairs + I_QXZ*cap;
+    REAL* restrict pqyz = pairs + I_QYZ*cap;
+    REAL* restrict pfx = pairs + I_FX*cap;
+    REAL* restrict pfy = pairs + I_FY*cap;
+    REAL* restrict pfz = pairs + I_FZ*cap;
+    long pairCount = 0; // Within the cutoff
+    TIMER_START(TIMER_FIELD_PAIRS);
+#pragma omp for schedule(static, 16) nowait
+    for(int i = 0; i < nAtoms; i++) {
+      IntVector* list = &system->verletList[i];
+      REAL xi = X[i*3], yi = X[i*3+1], zi = X[i*3+2];
+      int* neighbors = list->array;
+      int nPairs = 0;
+      for(int n = 0; n < list->size; n++) {
+        int k = neighbors[n];
+        REAL xr = X[k*3] - xi;
+        REAL yr = X[k*3+1] - yi;
+        REAL zr = X[k*3+2] - zi;
+        xr -= boxX*floor(xr/boxX + 0.5);
+        yr -= boxY*floor(yr/boxY + 0.5);
+        zr -= boxZ*floor(zr/boxZ + 0.5);
+        if(xr*xr + yr*yr + zr*zr > cut2) {
+          continue;
+        }
+        const REAL* mk = system->multipoles[k];
+        px[nPairs] = xr;
+        py[nPairs] = yr;
+        pz[nPairs] = zr;
+        ppd[nPairs] = ind->pdamp[k];
+        pth[nPairs] = ind->thole[k];
+        pds[nPairs] = ind->group[k] == ind->group[i] ? 0.0 : 1.0;
+        pc[nPairs] = mk[0];
+        pdx[nPairs] = mk[1];
+        pdy[nPairs] = mk[2];
+        pdz[nPairs] = mk[3];
+        pqxx[nPairs] = mk[4];
+        pqyy[nPairs] = mk[5];
+        pqzz[nPairs] = mk[6];
+        pqxy[nPairs] = 0.5*mk[7];
+        pqxz[nPairs] = 0.5*mk[8];
+        pqyz[nPairs] = 0.5*mk[9];
+        ids[nPairs] = k;
+        nPairs++;
+      }
+      pairCount += nPairs;
+      const REAL* mi = system->multipoles[i];
+      const REAL ci = mi[0], dix = mi[1], diy = mi[2], diz = mi[3];
+      const REAL qixx = mi[4], qiyy = mi[5], qizz = mi[6];
+      const REAL qixy = 0.5*mi[7], qixz = 0.5*mi[8], qiyz = 0.5*mi[9];
+      const REAL pdi = ind->pdamp[i], thi = ind->thole[i];
+      REAL fix = 0.0, fiy = 0.0, fiz = 0.0;
+#pragma omp simd reduction(+:fix,fiy,fiz)
+      for(int p = 0; p < nPairs; p++) {
+        const REAL xr = px[p], yr = py[p], zr = pz[p];
+        const REAL r2 = xr*xr + yr*yr + zr*zr;
+        const REAL r = sqrt(r2);
+        const REAL rInv = 1.0/r;
+        const REAL r2Inv = rInv*rInv;
+        const REAL s = alpha*r*invDx;
+        const int idx = (int) s;
+        const REAL u = s - idx;
+        const REAL* cf = table + 4*idx;
+        const REAL erfcAr = cf[0] + u*(cf[1] + u*(cf[2] + u*cf[3]));
+        const REAL exp2a = exp(-alpha*alpha*r2);
+        REAL alsq2n = pre*alsq2;
+        const REAL bn0 = erfcAr*rInv;
+        const REAL bn1 = (bn0 + alsq2n*exp2a)*r2Inv;
+        alsq2n *= alsq2;
+        const REAL bn2 = (3.0*bn1 + alsq2n*exp2a)*r2Inv;
+        alsq2n *= alsq2;
+        const REAL bn3 = (5.0*bn2 + alsq2n*exp2a)*r2Inv;
+        // Thole damping, removed from the bare field for the (1 - scale*dscale) part
+        const REAL pd = pdi*ppd[p];
+        const REAL ratio = pd > 0.0 ? r/pd : 0.0;
+        const REAL damp = pd > 0.0 ? -fmin(thi, pth[p])*ratio*ratio*ratio : -100.0;
+        const REAL expDamp = damp > -50.0 ? exp(damp) : 0.0;
+        const REAL ds = pds[p];
+        const REAL rr3 = rInv*r2Inv;
+        const REAL b1 = bn1 - (1.0 - (1.0 - expDamp)*ds)*rr3;
+        const REAL b2 = bn2 - (1.0 - (1.0 - (1.0 - damp)*expDamp)*ds)*3.0*rr3*r2Inv;
+        const REAL b3 = bn3 - (1.0 - (1.0 - (1.0 - damp + 0.6*damp*damp)*expDamp)*ds)*15.0*rr3*r2Inv*r2Inv;
+        const REAL ck = pc[p], dkx = pdx[p], dky = pdy[p], dkz = pdz[p];
+        const REAL qkx = pqxx[p]*xr + pqxy[p]*yr + pqxz[p]*zr;
+        const REAL qky = pqxy[p]*xr + pqyy[p]*yr + pqyz[p]*zr;
+        const REAL qkz = pqxz[p]*xr + pqyz[p]*yr + pqzz[p]*zr;
+        const REAL qix = qixx*xr + qixy*yr + qixz*zr;
+        const REAL qiy = qixy*xr + qiyy*yr + qiyz*zr;
+        const REAL qiz = qixz*xr + qiyz*yr + qizz*zr;
+        const REAL dir = dix*xr + diy*yr + diz*zr;
+        const REAL dkr = dkx*xr + dky*yr + dkz*zr;
+        const REAL qir = qix*xr + qiy*yr + qiz*zr;
+        const REAL qkr = qkx*xr + qky*yr + qkz*zr;
+        // Field at i from k and at k from i, r = x_k - x_i
+        const REAL fi = -(b1*ck - b2*dkr + b3*qkr);
+        const REAL fk = b1*ci + b2*dir + b3*qir;
+        fix += fi*xr - b1*dkx + 2.0*b2*qkx;
+        fiy += fi*yr - b1*dky + 2.0*b2*qky;
+        fiz += fi*zr - b1*dkz + 2.0*b2*qkz;
+        pfx[p] = fk*xr - b1*dix - 2.0*b2*qix;
+        pfy[p] = fk*yr - b1*diy - 2.0*b2*qiy;
+        pfz[p] = fk*zr - b1*diz - 2.0*b2*qiz;
+      }
+      threadBuffersMark(ind->fields, t, i);
+      ft[i*3] += fix;
+      ft[i*3+1] += fiy;
+      ft[i*3+2] += fiz;
+      for(int p = 0; p < nPairs; p++) {
+        int k = ids[p];
+        threadBuffersMark(ind->fields, t, k);
+        ft[k*3] += pfx[p];
+        ft[k*3+1] += pfy[p];
+        ft[k*3+2] += pfz[p];
+      }
+    }
+    TIMER_ITEMS(pairCount);
+    TIMER_STOP(TIMER_FIELD_PAIRS);
+  }
+  reduceField(system, ind, d, field);
+}
+
+/**
+ * T*mu: real space Ewald field of the dipoles mu at every atom with Thole damping (every pair counts), plus the
+ * self field. Overwrites field [nAtoms*3].
+ */
+void mutualField(System* system, InducedDipoles* ind, DirectWorkspace* work, const REAL* mu, REAL* field) {
+  int nAtoms = system->nAtoms;
+  const REAL* X = system->X;
+  const REAL alpha = system->ewaldAlpha;
+  const REAL alsq2 = 2.0*alpha*alpha;
+  const REAL pre = 1.0/(sqrt(M_PI)*alpha);
+  const REAL cut2 = system->realspaceCutoff*system->realspaceCutoff;
+  const REAL boxX = system->boxDim[0][0], boxY = system->boxDim[1][1], boxZ = system->boxDim[2][2];
+  const REAL* table = work->erfcTable->coefficients;
+  const REAL invDx = work->erfcTable->invDx;
+  assert(work->erfcTable->alpha == alpha);
+  growPairs(system, ind);
+  int cap = ind->pairCapacity;
+#pragma omp parallel num_threads(ind->nThreads)
+  {
+    int t = threadID();
+    REAL* ft = threadArray(ind->fields, t, 0);
+    REAL* pairs = ind->pairs[t];
+    int* ids = ind->pairIDs[t];
+    REAL* restrict px = pairs + I_X*cap;
+    REAL* restrict py = pairs + I_Y*cap;
+    REAL* restrict pz = pairs + I_Z*cap;
+    REAL* restrict ppd = pairs + I_PD*cap;
+    REAL* restrict pth = pairs + I_TH*cap;
+    REAL* restrict pux = pairs + I_DX*cap;
+    REAL* restrict puy = pairs + I_DY*cap;
+    REAL* restrict puz = pairs + I_DZ*cap;
+    REAL* restrict pfx = pairs + I_FX*cap;
+    REAL* restrict pfy = pairs + I_FY*cap;
+    REAL* restrict pfz = pairs + I_FZ*cap;
+    long pairCount = 0; // Within the cutoff
+    TIMER_START(TIMER_FIELD_PAIRS);
+#pragma omp for schedule(static, 16) nowait
+    for(int i = 0; i < nAtoms; i++) {
+      IntVector* list = &system->verletList[i];
+      REAL xi = X[i*3], yi = X[i*3+1], zi = X[i*3+2];
+      int* neighbors = list->array;
+      int nPairs = 0;
+      for(int n = 0; n < list->size; n++) {
+        int k = neighbors[n];
+        REAL xr = X[k*3] - xi;
+        REAL yr = X[k*3+1] - yi;
+        REAL zr = X[k*3+2] - zi;
+        xr -= boxX*floor(xr/boxX + 0.5);
+        yr -= boxY*floor(yr/boxY + 0.5);
+        zr -= boxZ*floor(zr/boxZ + 0.5);
+        if(xr*xr + yr*yr + zr*zr > cut2) {
+          continue;
+        }
+        px[nPairs] = xr;
+        py[nPairs] = yr;
+        pz[nPairs] = zr;
+        ppd[nPairs] = ind->pdamp[k];
+        pth[nPairs] = ind->thole[k];
+        pux[nPairs] = mu[k*3];
+        puy[nPairs] = mu[k*3+1];
+        puz[nPairs] = mu[k*3+2];
+        ids[nPairs] = k;
+        nPairs++;
+      }
+      pairCount += nPairs;
+      const REAL uix = mu[i*3], uiy = mu[i*3+1], uiz = mu[i*3+2];
+      const REAL pdi = ind->pdamp[i], thi = ind->thole[i];
+      REAL fix = 0.0, fiy = 0.0, fiz = 0.0;
+#pragma omp simd reduction(+:fix,fiy,fiz)
+      for(int p = 0; p < nPairs; p++) {
+        const REAL xr = px[p], yr = py[p], zr = pz[p];
+        const REAL r2 = xr*xr + yr*yr + zr*zr;
+        const REAL r = sqrt(r2);
+        const REAL rInv = 1.0/r;
+        const REAL r2Inv = rInv*rInv;
+        const REAL s = alpha*r*invDx;
+        const int idx = (int) s;
+        const REAL u = s - idx;
+        const REAL* cf = table + 4*idx;
+        const REAL erfcAr = cf[0] + u*(cf[1] + u*(cf[2] + u*cf[3]));
+        const REAL exp2a = exp(-alpha*alpha*r2);
+        REAL alsq2n = pre*alsq2;
+        const REAL bn0 = erfcAr*rInv;
+        const REAL bn1 = (bn0 + alsq2n*exp2a)*r2Inv;
+        alsq2n *= alsq2;
+        const REAL bn2 = (3.0*bn1 + alsq2n*exp2a)*r2Inv;
+        const REAL pd = pdi*ppd[p];
+        const REAL ratio = pd > 0.0 ? r/pd : 0.0;
+        const REAL damp = pd > 0.0 ? -fmin(thi, pth[p])*ratio*ratio*ratio : -100.0;
+        const REAL expDamp = damp > -50.0 ? exp(damp) : 0.0;
+        const REAL rr3 = rInv*r2Inv;
+        const REAL b1 = bn1 - expDamp*rr3;
+        const REAL b2 = bn2 - (1.0 - damp)*expDamp*3.0*rr3*r2Inv;
+        const REAL ukr = pux[p]*xr + puy[p]*yr + puz[p]*zr;
+        const REAL uir = uix*xr + uiy*yr + uiz*zr;
+        fix += b2*ukr*xr - b1*pux[p];
+        fiy += b2*ukr*yr - b1*puy[p];
+        fiz += b2*ukr*zr - b1*puz[p];
+        pfx[p] = b2*uir*xr - b1*uix;
+        pfy[p] = b2*uir*yr - b1*uiy;
+        pfz[p] = b2*uir*zr - b1*uiz;
+      }
+      threadBuffersMark(ind->fields, t, i);
+      ft[i*3] += fix;
+      ft[i*3+1] += fiy;
+      ft[i*3+2] += fiz;
+      for(int p = 0; p < nPairs; p++) {
+        int k = ids[p];
+        threadBuffersMark(ind->fields, t, k);
+        ft[k*3] += pfx[p];
+        ft[k*3+1] += pfy[p];
+        ft[k*3+2] += pfz[p];
+      }
+    }
+    TIMER_ITEMS(pairCount);
+    TIMER_STOP(TIMER_FIELD_PAIRS);
+  }
+  reduceField(system, ind, mu, field);
+}
+
+/**
+ * Stores alpha_i*T_ik*alpha_k for every pair within the preconditioner cutoff in both rows, with the Thole damped
+ * bare dipole tensor T = 3*scale5*r*r^T/r^5 - scale3*I/r^3.
+ */
+static void buildPreconditioner(System* system, InducedDipoles* ind) {
+  int nAtoms = system->nAtoms;
+  int* start = ind->precondStart;
+  memset(start, 0, sizeof(int)*(nAtoms+1));
+  if(ind->preconditionerCutoff <= 0.0) {
+    return;
+  }
+  const REAL* X = system->X;
+  const REAL cut2 = ind->preconditionerCutoff*ind->preconditionerCutoff;
+  const REAL boxX = system->boxDim[0][0], boxY = system->boxDim[1][1], boxZ = system->boxDim[2][2];
+  // Count both directions of every close pair, then fill rows with a cursor per atom
+  for(int pass = 0; pass < 2; pass++) {
+    for(int i = 0; i < nAtoms; i++) {
+      int* neighbors = system->verletList[i].array;
+      for(int n = 0; n < system->verletList[i].size; n++) {
+        int k = neighbors[n];
+        REAL xr = X[k*3] - X[i*3];
+        REAL yr = X[k*3+1] - X[i*3+1];
+        REAL zr = X[k*3+2] - X[i*3+2];
+        xr -= boxX*floor(xr/boxX + 0.5);
+        yr -= boxY*floor(yr/boxY + 0.5);
+        zr -= boxZ*floor(zr/boxZ + 0.5);
+        REAL r2 = xr*xr + yr*yr + zr*zr;
+        if(r2 > cut2) {
+          continue;
+        }
+        if(pass == 0) {
+          start[i+1]++;
+          start[k+1]++;
+          continue;
+        }
+        REAL r = sqrt(r2);
+        REAL pd = ind->pdamp[i]*ind->pdamp[k];
+        REAL scale3 = 1.0, scale5 = 1.0;
+        if(pd > 0.0) {
+          REAL ratio = r/pd;
+          REAL damp = -fmin(ind->thole[i], ind->thole[k])*ratio*ratio*ratio;
+          if(damp > -50.0) {
+            REAL expDamp = exp(damp);
+            scale3 = 1.0 - expDamp;
+            scale5 = 1.0 - (1.0 - damp)*expDamp;
+          }
+        }
+        REAL polik = ind->polarizability[i]*ind->polarizability[k];
+        REAL rr3 = scale3*polik/(r*r2);
+        REAL rr5 = 3.0*scale5*polik/(r*r2*r2);
+        REAL m[6] = {rr5*xr*xr - rr3, rr5*xr*yr, rr5*xr*zr, rr5*yr*yr - rr3, rr5*yr*zr, rr5*zr*zr - rr3};
+        int slots[2] = {start[i]++, start[k]++};
+        int columns[2] = {k, i};
+        for(int s = 0; s < 2; s++) {
+          ind->precondIDs[slots[s]] = columns[s];
+          memcpy(ind->precondT + slots[s]*6, m, sizeof(m));
+        }
+      }
+    }
+    if(pass == 0) {
+      for(int i = 0; i < nAtoms; i++) {
+        start[i+1] += start[i];
+      }
+      if(start[nAtoms] > ind->precondCapacity) {
+        free(ind->precondIDs);
+        free(ind->precondT);
+        ind->precondCapacity = start[nAtoms] + start[nAtoms]/4;
+        ind->precondIDs = malloc(sizeof(int)*ind->precondCapacity);
+        ind->precondT = malloc(sizeof(REAL)*ind->precondCapacity*6);
+        if(ind->precondIDs == NULL || ind->precondT == NULL) {
+          printf("Failed to allocate the polarization preconditioner!\n");
+          exit(1);
+        }
+      }
+    }
+  }
+  // Filling advanced every row start to the next row's start
+  for(int i = nAtoms; i > 0; i--) {
+    start[i] = start[i-1];
+  }
+  start[0] = 0;
+}
+
+/**
+ * z = UDIAG*alpha*r + sum_k alpha_i*T_ik*alpha_k*r_k
+ */
+static void applyPreconditioner(InducedDipoles* ind, const REAL* r, REAL* z) {
+  const int* start = ind->precondStart;
+  const int* ids = ind->precondIDs;
+  const REAL* m = ind->precondT;
+#pragma omp parallel for schedule(static) num_threads(ind->nThreads)
+  for(int i = 0; i < ind->nAtoms; i++) {
+    REAL alpha = UDIAG*ind->polarizability[i];
+    REAL zx = alpha*r[i*3], zy = alpha*r[i*3+1], zz = alpha*r[i*3+2];
+    for(int n = start[i]; n < start[i+1]; n++) {
+      const REAL* mik = m + n*6;
+      const REAL* rk = r + ids[n]*3;
+      zx += mik[0]*rk[0] + mik[1]*rk[1] + mik[2]*rk[2];
+      zy += mik[1]*rk[0] + mik[3]*rk[1] + mik[4]*rk[2];
+      zz += mik[2]*rk[0] + mik[4]*rk[1] + mik[5]*rk[2];
+    }
+    z[i*3] = zx;
+    z[i*3+1] = zy;
+    z[i*3+2] = zz;
+  }
+}
+
+/**
+ * Adds up the per-thread partial sums in thread order, unlike an OpenMP reduction, so CG takes the same steps
+ * every run.
+ */
+static REAL sumPartials(InducedDipoles* ind) {
+  REAL sum = 0.0;
+  for(int t = 0; t < ind->nThreads; t++) {
+    sum += ind->partial[t*TALLY_STRIDE];
+  }
+  return sum;
+}
+
+static REAL dot(InducedDipoles* ind, const REAL* a, const REAL* b, int n) {
+#pragma omp parallel num_threads(ind->nThreads)
+  {
+    REAL sum = 0.0;
+#pragma omp for schedule(static)
+    for(int i = 0; i < n; i++) {
+      sum += a[i]*b[i];
+    }
+    ind->partial[threadID()*TALLY_STRIDE] = sum;
+  }
+  return sumPartials(ind);
+}
+
+/**
+ * RMS over atoms of |alpha*r| in Debye, the dipole change a Jacobi step would make.
+ */
+static REAL rmsChange(InducedDipoles* ind, const REAL* r) {
+#pragma omp parallel num_threads(ind->nThreads)
+  {
+    REAL sum = 0.0;
+#pragma omp for schedule(static)
+    for(int i = 0; i < ind->nAtoms; i++) {
+      REAL alpha = ind->polarizability[i];
+      sum += alpha*alpha*(r[i*3]*r[i*3] + r[i*3+1]*r[i*3+1] + r[i*3+2]*r[i*3+2]);
+    }
+    ind->partial[threadID()*TALLY_STRIDE] = sum;
+  }
+  return DEBYE*sqrt(sumPartials(ind)/ind->nAtoms);
+}
+
+/**
+ * Initial guess: ASPC extrapolation of the stored solutions, or the direct dipoles alpha*E_direct.
+ */
+static void predict(InducedDipoles* ind) {
+  int n3 = ind->nAtoms*3;
+  int nPrevious = ind->nHistory;
+  if(nPrevious == 0) {
+    for(int a = 0; a < n3; a++) {
+      ind->mu[a] = ind->polarizability[a/3]*ind->fieldDirect[a];
+    }
+    return;
+  }
+  REAL coefficients[nPrevious];
+  if(nPrevious == 1) {
+    coefficients[0] = 1.0;
+  } else {
+    int k = nPrevious - 2;
+    // binom(2k+4, k+2-j) / binom(2k+2, k+1) built from the ratio of factorials
+    for(int j = 1; j <= nPrevious; j++) {
+      REAL c = j % 2 == 1 ? j : -j;
+      for(int m = 1; m <= 2*k+4; m++) {
+        c *= m;
+        if(m <= k+2-j) c /= m;
+        if(m <= k+2+j) c /= m;
+      }
+      for(int m = 1; m <= 2*k+2; m++) {
+        c /= m;
+        if(m <= k+1) c *= m*m;
+      }
+      coefficients[j-1] = c;
+    }
+  }
+  memset(ind->mu, 0, sizeof(REAL)*n3);
+  for(int j = 0; j < nPrevious; j++) {
+    const REAL* previous = ind->history + (long) ((ind->newest - j + ind->maxHistory) % ind->maxHistory)*n3;
+    REAL c = coefficients[j];
+#pragma omp parallel for simd schedule(static) num_threads(ind->nThreads)
+    for(int a = 0; a < n3; a++) {
+      ind->mu[a] += c*previous[a];
+    }
+  }
+}
+
+/**
+ * Solves for the induced dipoles (InducedDipoles->mu) of the current System->multipoles (global frame) and
+ * positions. Reports the iteration count when System->verbose is set and exits if it doesn't converge.
+ * @return polarization energy -1/2 sum mu.E_direct (kcal/mol)
+ */
+REAL induceDipoles(System* system, InducedDipoles* ind, DirectWorkspace* work) {
+  assert(ind->nAtoms == system->nAtoms);
+  int n3 = system->nAtoms*3;
+  ind->iterations = 0;
+  ind->rms = 0.0;
+  if(system->polarization == NONE) {
+    memset(ind->mu, 0, sizeof(REAL)*n3);
+    return 0.0;
+  }
+  directField(system, ind, work, ind->fieldDirect);
+  if(system->polarization == DIRECT) {
+    for(int a = 0; a < n3; a++) {
+      ind->mu[a] = ind->polarizability[a/3]*ind->fieldDirect[a];
+    }
+    return -0.5*ELECTRIC*dot(ind, ind->mu, ind->fieldDirect, n3);
+  }
+  predict(ind);
+  buildPreconditioner(system, ind);
+  REAL* mu = ind->mu;
+  REAL* rsd = ind->rsd;
+  REAL* zrsd = ind->zrsd;
+  REAL* conj = ind->conj;
+  REAL* vec = ind->vec;
+  // rsd = E_direct + T*mu - mu/alpha
+  mutualField(system, ind, work, mu, vec);
+  for(int a = 0; a < n3; a++) {
+    rsd[a] = ind->fieldDirect[a] + vec[a] - mu[a]/fmax(ind->polarizability[a/3], POLMIN);
+  }
+  ind->rms = rmsChange(ind, rsd);
+  applyPreconditioner(ind, rsd, zrsd);
+  memcpy(conj, zrsd, sizeof(REAL)*n3);
+  REAL rz = dot(ind, rsd, zrsd, n3);
+  while(ind->rms > system->polarEps) {
+    if(ind->iterations == POLAR_MAX_ITERATIONS) {
+      printf("Induced dipoles failed to converge in %d iterations (RMS %.3e Debye)!\n", ind->iterations, ind->rms);
+      exit(1);
+    }
+    // vec = (1/alpha - T)*conj
+    mutualField(system, ind, work, conj, vec);
+#pragma omp parallel for simd schedule(static) num_threads(ind->nThreads)
+    for(int a = 0; a < n3; a++) {
+      vec[a] = conj[a]/fmax(ind->polarizability[a/3], POLMIN) - vec[a];
+    }
+    REAL step = rz/dot(ind, conj, vec, n3);
+#pragma omp parallel for simd schedule(static) num_threads(ind->nThreads)
+    for(int a = 0; a < n3; a++) {
+      mu[a] += step*conj[a];
+      rsd[a] -= step*vec[a];
+    }
+    ind->iterations++;
+    ind->rms = rmsChange(ind, rsd);
+    applyPreconditioner(ind, rsd, zrsd);
+    REAL rzNew = dot(ind, rsd, zrsd, n3);
+    REAL beta = rzNew/rz;
+    rz = rzNew;
+#pragma omp parallel for simd schedule(static) num_threads(ind->nThreads)
+    for(int a = 0; a < n3; a++) {
+      conj[a] = zrsd[a] + beta*conj[a];
+    }
+  }
+  // Keep the solution for the next guess
+  if(ind->maxHistory > 0) {
+    ind->newest = (ind->newest + 1) % ind->maxHistory;
+    memcpy(ind->history + (long) ind->newest*n3, mu, sizeof(REAL)*n3);
+    ind->nHistory = ind->nHistory < ind->maxHistory ? ind->nHistory + 1 : ind->maxHistory;
+  }
+  ind->nSolves++;
+  ind->totalIterations += ind->iterations;
+  if(system->verbose) {
+    printf("Induced dipoles converged in %d iterations (RMS %.3e Debye, average %.2f per step)\n", ind->iterations,
+      ind->rms, (double) ind->totalIterations/ind->nSolves);
+  }
+  return -0.5*ELECTRIC*dot(ind, mu, ind->fieldDirect, n3);
+}
@@ -0,0 +1,493 @@
+// Author(s): Matthew Speranza
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../include/multipoleFrame.h"
+
+/**
+ * Minimum image of d, branch free so atom loops vectorize. invBox is 0 for a non-periodic axis.
+ */
+static inline REAL image(REAL d, REAL box, REAL invBox) {
+  return d - box*floor(d*invBox + 0.5);
+}
+
+static inline REAL dot3(const REAL* a, const REAL* b) {
+  return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+static inline void cross3(const REAL* a, const REAL* b, REAL* c) {
+  c[0] = a[1]*b[2] - a[2]*b[1];
+  c[1] = a[2]*b[0] - a[0]*b[2];
+  c[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+/**
+ * Minimum image vector from atom i to atom j, returns its length. box holds the box lengths then their inverses.
+ */
+static inline REAL frameVector(const REAL* X, const REAL* box, int i, int j, REAL* d) {
+  d[0] = image(X[j*3] - X[i*3], box[0], box[3]);
+  d[1] = image(X[j*3+1] - X[i*3+1], box[1], box[4]);
+  d[2] = image(X[j*3+2] - X[i*3+2], box[2], box[5]);
+  return sqrt(dot3(d, d));
+}
+
+/**
+ * Orthonormalizes z and the x reference into a frame, stores it in R and rotates the local multipole m into g.
+ * Dipoles go as d = sum_k m_k e_k and quadrupoles as Q = sum_kl e_k q_kl e_l^T with e_k the local axes.
+ * Written out without loops so the callers' atom loops vectorize.
+ */
+static inline void finishFrame(const REAL* z, const REAL* ref, const REAL* m, REAL* R, REAL* g) {
+  REAL inv = 1.0/sqrt(dot3(z, z));
+  REAL ez[3] = {z[0]*inv, z[1]*inv, z[2]*inv};
+  REAL dot = dot3(ref, ez);
+  REAL ex[3] = {ref[0] - dot*ez[0], ref[1] - dot*ez[1], ref[2] - dot*ez[2]};
+  inv = 1.0/sqrt(dot3(ex, ex));
+  ex[0] *= inv;
+  ex[1] *= inv;
+  ex[2] *= inv;
+  REAL ey[3];
+  cross3(ez, ex, ey);
+  R[0] = ex[0]; R[1] = ex[1]; R[2] = ex[2];
+  R[3] = ey[0]; R[4] = ey[1]; R[5] = ey[2];
+  R[6] = ez[0]; R[7] = ez[1]; R[8] = ez[2];
+  g[0] = m[0];
+  g[1] = m[1]*ex[0] + m[2]*ey[0] + m[3]*ez[0];
+  g[2] = m[1]*ex[1] + m[2]*ey[1] + m[3]*ez[1];
+  g[3] = m[1]*ex[2] + m[2]*ey[2] + m[3]*ez[2];
+  // Rows of the local quadrupole times the axes: qk = sum_l q_kl e_l
+  REAL qxy = 0.5*m[7], qxz = 0.5*m[8], qyz = 0.5*m[9];
+  REAL qx[3], qy[3], qz[3];
+  for(int c = 0; c < 3; c++) {
+    qx[c] = m[4]*ex[c] + qxy*ey[c] + qxz*ez[c];
+    qy[c] = qxy*ex[c] + m[5]*ey[c] + qyz*ez[c];
+    qz[c] = qxz*ex[c] + qyz*ey[c] + m[6]*ez[c];
+  }
+  g[4] = ex[0]*qx[0] + ey[0]*qy[0] + ez[0]*qz[0];
+  g[5] = ex[1]*qx[1] + ey[1]*qy[1] + ez[1]*qz[1];
+  g[6] = ex[2]*qx[2] + ey[2]*qy[2] + ez[2]*qz[2];
+  g[7] = 2.0*(ex[0]*qx[1] + ey[0]*qy[1] + ez[0]*qz[1]);
+  g[8] = 2.0*(ex[0]*qx[2] + ey[0]*qy[2] + ez[0]*qz[2]);
+  g[9] = 2.0*(ex[1]*qx[2] + ey[1]*qy[2] + ez[1]*qz[2]);
+}
+
+static void periodicBox(System* system, REAL* box) {
+  for(int k = 0; k < 3; k++) {
+    box[k] = system->boxDim[k][k];
+    box[k+3] = box[k] > 0.0 ? 1.0/box[k] : 0.0;
+  }
+}
+
+static int findNeighbor(System* system, IntVector* list, int type, int skip1, int skip2) {
+  int* ids = list->array;
+  for(int k = 0; k < list->size; k++) {
+    int a = ids[k];
+    if(a != skip1 && a != skip2 && system->atomTypes[a] == abs(type)) {
+      return a;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Tinker's kmpole search order: Z and X bonded, X 1-3 to the atom, Z-only, then frameless parameters.
+ * @param frame filled with the Z, X and Y atoms (-1 if unused)
+ * @return matching multipole parameters or NULL
+ */
+static Multipole* matchMultipole(System* system, int i, int frame[3]) {
+  const MultipoleVector* params = &system->forceField->multipole;
+  Multipole* entries = params->array;
+  for(int pass = 0; pass < 4; pass++) {
+    for(int e = 0; e < params->size; e++) {
+      Multipole* mpole = &entries[e];
+      if(mpole->frameAtomTypes[0] != system->atomTypes[i]) {
+        continue;
+      }
+      int kz = mpole->frameAtomTypes[1], kx = mpole->frameAtomTypes[2], ky = mpole->frameAtomTypes[3];
+      frame[0] = frame[1] = frame[2] = -1;
+      if(pass == 3) {
+        if(kz == 0) {
+          return mpole;
+        }
+        continue;
+      }
+      if(kz == 0 || (frame[0] = findNeighbor(system, &system->list12[i], kz, -1, -1)) < 0) {
+        continue;
+      }
+      if(pass == 2) {
+        if(kx == 0) {
+          return mpole;
+        }
+        continue;
+      }
+      if(kx == 0) {
+        continue;
+      }
+      IntVector* xList = pass == 0 ? &system->list12[i] : &system->list13[i];
+      if((frame[1] = findNeighbor(system, xList, kx, frame[0], -1)) < 0) {
+        continue;
+      }
+      if(ky != 0 && (frame[2] = findNeighbor(system, &system->list12[i], ky, frame[0], frame[1])) < 0) {
+        continue;
+      }
+      return mpole;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Matches every atom to its force field multipole and frame atoms and points System->multipoles into the global
+ * block, which is filled before returning. Needs System->forceField and the 1-2 and 1-3 lists.
+ * <p>
+ * Destroying the frames frees the rows of System->multipoles, so they have to outlive any energy evaluation.
+ */
+MultipoleFrames* multipoleFramesCreate(System* system) {
+  assert(system->forceField != NULL && system->list12 != NULL && system->list13 != NULL);
+  int nAtoms = system->nAtoms;
+  MultipoleFrames* frames = malloc(sizeof(MultipoleFrames));
+  int* def = malloc(sizeof(int)*nAtoms);
+  int* frameAtoms = malloc(sizeof(int)*nAtoms*3);
+  int* handedness = malloc(sizeof(int)*nAtoms);
+  if(frames == NULL || def == NULL || frameAtoms == NULL || handedness == NULL) {
+    printf("Failed to allocate multipole frames!\n");
+    exit(1);
+  }
+  frames->nAtoms = nAtoms;
+#ifdef _OPENMP
+  frames->nThreads = omp_get_max_threads();
+#else
+  frames->nThreads = 1;
+#endif
+  frames->order = malloc(sizeof(int)*nAtoms);
+  frames->zAtom = malloc(sizeof(int)*nAtoms);
+  frames->xAtom = malloc(sizeof(int)*nAtoms);
+  frames->yAtom = malloc(sizeof(int)*nAtoms);
+  frames->local = malloc(sizeof(REAL)*nAtoms*10);
+  frames->global = malloc(sizeof(REAL)*nAtoms*10);
+  frames->rotation = malloc(sizeof(REAL)*nAtoms*9);
+  if(frames->order == NULL || frames->zAtom == NULL || frames->xAtom == NULL || frames->yAtom == NULL
+    || frames->local == NULL || frames->global == NULL || frames->rotation == NULL) {
+    printf("Failed to allocate multipole frames!\n");
+    exit(1);
+  }
+  int count[THREEFOLD+1] = {0};
+  for(int i = 0; i < nAtoms; i++) {
+    Multipole* mpole = matchMultipole(system, i, frameAtoms + i*3);
+    if(mpole == NULL) {
+      printf("No multipole parameters match atom %d (type %d)!\n", i+1, system->atomTypes[i]);
+      exit(1);
+    }
+    def[i] = mpole->frameDef;
+    handedness[i] = mpole->frameAtomTypes[3] < 0 ? -1 : 1;
+    memcpy(frames->local + i*10, mpole->multipole, sizeof(REAL)*10);
+    count[def[i]]++;
+  }
+  // Counting sort by frame definition
+  frames->groupStart[0] = 0;
+  for(int g = 0; g <= THREEFOLD; g++) {
+    frames->groupStart[g+1] = frames->groupStart[g] + count[g];
+    count[g] = frames->groupStart[g];
+  }
+  frames->nChiral = 0;
+  for(int i = 0; i < nAtoms; i++) {
+    int p = count[def[i]]++;
+    frames->order[p] = i;
+    frames->zAtom[p] = frameAtoms[i*3];
+    frames->xAtom[p] = frameAtoms[i*3+1];
+    frames->yAtom[p] = frameAtoms[i*3+2];
+    frames->nChiral += def[i] == ZTHENX && frameAtoms[i*3+2] >= 0;
+  }
+  frames->chiral = malloc(sizeof(int)*(frames->nChiral + 1));
+  frames->chiralSign = malloc(sizeof(int)*(frames->nChiral + 1));
+  if(frames->chiral == NULL || frames->chiralSign == NULL) {
+    printf("Failed to allocate multipole frames!\n");
+    exit(1);
+  }
+  int c = 0;
+  for(int p = frames->groupStart[ZTHENX]; p < frames->groupStart[ZTHENX+1]; p++) {
+    if(frames->yAtom[p] >= 0) {
+      frames->chiral[c] = p;
+      frames->chiralSign[c++] = handedness[frames->order[p]];
+    }
+  }
+  // Frameless atoms keep the identity
+  memset(frames->rotation, 0, sizeof(REAL)*nAtoms*9);
+  for(int i = 0; i < nAtoms; i++) {
+    frames->rotation[i*9] = frames->rotation[i*9+4] = frames->rotation[i*9+8] = 1.0;
+  }
+  if(system->multipoles == NULL) {
+    system->multipoles = malloc(sizeof(REAL*)*nAtoms);
+    if(system->multipoles == NULL) {
+      printf("Failed to allocate multipoles!\n");
+      exit(1);
+    }
+  }
+  for(int i = 0; i < nAtoms; i++) {
+    system->multipoles[i] = frames->global + i*10;
+  }
+  free(def);
+  free(frameAtoms);
+  free(handedness);
+  rotateMultipoles(system, frames);
+  return frames;
+}
+
+void multipoleFramesDestroy(MultipoleFrames* frames) {
+  free(frames->order);
+  free(frames->zAtom);
+  free(frames->xAtom);
+  free(frames->yAtom);
+  free(frames->chiral);
+  free(frames->chiralSign);
+  free(frames->local);
+  free(frames->global);
+  free(frames->rotation);
+  free(frames);
+}
+
+/**
+ * Mirrors the local multipole of Z-then-X atoms whose Y atom is on the other side of the frame than the force
+ * field assumes (Tinker's chkpole), by flipping the sign of dy, qxy and qyz.
+ */
+static void checkChirality(System* system, MultipoleFrames* frames) {
+  const REAL* X = system->X;
+  REAL box[6];
+  periodicBox(system, box);
+  for(int c = 0; c < frames->nChiral; c++) {
+    int p = frames->chiral[c];
+    int i = frames->order[p];
+    REAL u[3], v[3], w[3], bd[3], cd[3], n[3];
+    frameVector(X, box, i, frames->zAtom[p], u);
+    frameVector(X, box, i, frames->xAtom[p], v);
+    frameVector(X, box, i, frames->yAtom[p], w);
+    for(int k = 0; k < 3; k++) {
+      bd[k] = u[k] - w[k];
+      cd[k] = v[k] - w[k];
+    }
+    cross3(bd, cd, n);
+    REAL vol = -dot3(w, n);
+    if((frames->chiralSign[c] < 0 && vol > 0.0) || (frames->chiralSign[c] > 0 && vol < 0.0)) {
+      frames->chiralSign[c] = -frames->chiralSign[c];
+      REAL* m = frames->local + i*10;
+      m[2] = -m[2];
+      m[7] = -m[7];
+      m[9] = -m[9];
+    }
+  }
+}
+
+/**
+ * Rotates every local multipole into the global frame (System->multipoles) and stores the rotation matrices.
+ * Each frame definition is one simd loop over its slice of the sorted atoms, split across threads.
+ */
+void rotateMultipoles(System* system, MultipoleFrames* frames) {
+  checkChirality(system, frames);
+  const REAL* X = system->X;
+  REAL box[6];
+  periodicBox(system, box);
+  const int* order = frames->order;
+  const int* zAtom = frames->zAtom;
+  const int* xAtom = frames->xAtom;
+  const int* yAtom = frames->yAtom;
+  const int* start = frames->groupStart;
+  const REAL* local = frames->local;
+  REAL* global = frames->global;
+  REAL* rotation = frames->rotation;
+#pragma omp parallel num_threads(frames->nThreads)
+  {
+#pragma omp for schedule(static) nowait
+    for(int p = start[MPOL_NONE]; p < start[MPOL_NONE+1]; p++) {
+      int i = order[p];
+      memcpy(global + i*10, local + i*10, sizeof(REAL)*10);
+    }
+#pragma omp for simd schedule(static) nowait
+    for(int p = start[ZONLY]; p < start[ZONLY+1]; p++) {
+      int i = order[p];
+      REAL u[3], ref[3];
+      frameVector(X, box, i, zAtom[p], u);
+      // Any fixed direction works as long as it isn't close to z
+      REAL len = sqrt(dot3(u, u));
+      bool nearX = fabs(u[0]) > 0.866*len;
+      ref[0] = nearX ? 0.0 : 1.0;
+      ref[1] = nearX ? 1.0 : 0.0;
+      ref[2] = 0.0;
+      finishFrame(u, ref, local + i*10, rotation + i*9, global + i*10);
+    }
+#pragma omp for simd schedule(static) nowait
+    for(int p = start[ZTHENX]; p < start[ZTHENX+1]; p++) {
+      int i = order[p];
+      REAL u[3], v[3];
+      frameVector(X, box, i, zAtom[p], u);
+      frameVector(X, box, i, xAtom[p], v);
+      finishFrame(u, v, local + i*10, rotation + i*9, global + i*10);
+    }
+#pragma omp for simd schedule(static) nowait
+    for(int p = start[BISECTOR]; p < start[BISECTOR+1]; p++) {
+      int i = order[p];
+      REAL u[3], v[3];
+      REAL invU = 1.0/frameVector(X, box, i, zAtom[p], u);
+      REAL invV = 1.0/frameVector(X, box, i, xAtom[p], v);
+      REAL z[3] = {u[0]*invU + v[0]*invV, u[1]*invU + v[1]*invV, u[2]*invU + v[2]*invV};
+      finishFrame(z, v, local + i*10, rotation + i*9, global + i*10);
+    }
+#pragma omp for simd schedule(static) nowait
+    for(int p = start[ZTHENBISECTOR]; p < start[ZTHENBISECTOR+1]; p++) {
+      int i = order[p];
+      REAL u[3], v[3], w[3];
+      frameVector(X, box, i, zAtom[p], u);
+      REAL invV = 1.0/frameVector(X, box, i, xAtom[p], v);
+      REAL invW = 1.0/frameVector(X, box, i, yAtom[p], w);
+      REAL ref[3] = {v[0]*invV + w[0]*invW, v[1]*invV + w[1]*invW, v[2]*invV + w[2]*invW};
+      finishFrame(u, ref, local + i*10, rotation + i*9, global + i*10);
+    }
+#pragma omp for simd schedule(static) nowait
+    for(int p = start[THREEFOLD]; p < start[THREEFOLD+1]; p++) {
+      int i = order[p];
+      REAL u[3], v[3], w[3];
+      REAL invU = 1.0/frameVector(X, box, i, zAtom[p], u);
+      REAL invV = 1.0/frameVector(X, box, i, xAtom[p], v);
+      REAL invW = 1.0/frameVector(X, box, i, yAtom[p], w);
+      REAL z[3] = {u[0]*invU + v[0]*invV + w[0]*invW, u[1]*invU + v[1]*invV + w[1]*invW,
+        u[2]*invU + v[2]*invV + w[2]*invW};
+      finishFrame(z, v, local + i*10, rotation + i*9, global + i*10);
+    }
+  }
+}
+
+/**
+ * Adds the gradient of a unit vector's length-normalized input: for e = a/|a|, dE/da = (G - (G.e)e)/|a|.
+ */
+static inline void unitGradient(const REAL* a, REAL len, const REAL* G, REAL* gA) {
+  REAL inv = 1.0/len;
+  REAL ge = dot3(G, a)*inv;
+  for(int k = 0; k < 3; k++) {
+    gA[k] += (G[k] - ge*a[k]*inv)*inv;
+  }
+}
+
+/**
+ * Converts torques on the global multipoles (-dE/dangle, as returned by the kernels) into gradients on each atom
+ * and its frame atoms, added to grad [nAtoms*3]. Uses the rotation matrices of the last rotateMultipoles call.
+ * <p>
+ * Any displacement of the frame atoms rotates the orthonormal frame rigidly, de_k = dw x e_k with
+ * dw = 1/2 sum_k e_k x de_k, so dE = -torque.dw = sum_k G_k.de_k with G_k = -(torque x e_k)/2. G_k is then
+ * pushed back through y = z x x, the Gram-Schmidt step and the normalizations of the frame construction.
+ * <p>
+ * The gradients of each atom and its frame atoms sum to zero, so their virial contribution sum_f u_f (x) g_f
+ * (u_f from the atom to frame atom f) is added to virial [9] unless it is NULL.
+ */
+void torqueToGradient(System* system, MultipoleFrames* frames, const REAL* torque, REAL* grad, REAL* virial) {
+  const REAL* X = system->X;
+  REAL box[6];
+  periodicBox(system, box);
+  for(int g = ZONLY; g <= THREEFOLD; g++) {
+    for(int p = frames->groupStart[g]; p < frames->groupStart[g+1]; p++) {
+      int i = frames->order[p];
+      const REAL* t = torque + i*3;
+      const REAL* ex = frames->rotation + i*9;
+      const REAL* ey = ex + 3;
+      const REAL* ez = ex + 6;
+      REAL Gx[3], Gy[3], Gz[3], tmp[3];
+      cross3(t, ex, Gx);
+      cross3(t, ey, Gy);
+      cross3(t, ez, Gz);
+      for(int k = 0; k < 3; k++) {
+        Gx[k] *= -0.5;
+        Gy[k] *= -0.5;
+        Gz[k] *= -0.5;
+      }
+      // y = z x x
+      cross3(ex, Gy, tmp);
+      for(int k = 0; k < 3; k++) {
+        Gz[k] += tmp[k];
+      }
+      cross3(Gy, ez, tmp);
+      for(int k = 0; k < 3; k++) {
+        Gx[k] += tmp[k];
+      }
+      // Rebuild the unnormalized z and x reference of this frame definition
+      REAL u[3], v[3] = {0.0, 0.0, 0.0}, w[3] = {0.0, 0.0, 0.0}, z[3], ref[3];
+      REAL lenU = frameVector(X, box, i, frames->zAtom[p], u);
+      REAL lenV = g == ZONLY ? 0.0 : frameVector(X, box, i, frames->xAtom[p], v);
+      REAL lenW = g == ZTHENBISECTOR || g == THREEFOLD ? frameVector(X, box, i, frames->yAtom[p], w) : 0.0;
+      for(int k = 0; k < 3; k++) {
+        switch(g) {
+          case ZONLY: z[k] = u[k];
+            ref[k] = fabs(u[0]) > 0.866*lenU ? (k == 1) : (k == 0);
+            break;
+          case ZTHENX: z[k] = u[k];
+            ref[k] = v[k];
+            break;
+          case BISECTOR: z[k] = u[k]/lenU + v[k]/lenV;
+            ref[k] = v[k];
+            break;
+          case ZTHENBISECTOR: z[k] = u[k];
+            ref[k] = v[k]/lenV + w[k]/lenW;
+            break;
+          default: z[k] = u[k]/lenU + v[k]/lenV + w[k]/lenW;
+            ref[k] = v[k];
+        }
+      }
+      // x = p/|p| with p = ref - (ref.z)z
+      REAL refZ = dot3(ref, ez);
+      REAL pVec[3];
+      for(int k = 0; k < 3; k++) {
+        pVec[k] = ref[k] - refZ*ez[k];
+      }
+      REAL Gp[3] = {0.0, 0.0, 0.0};
+      unitGradient(pVec, sqrt(dot3(pVec, pVec)), Gx, Gp);
+      REAL gpz = dot3(Gp, ez);
+      REAL Gref[3];
+      for(int k = 0; k < 3; k++) {
+        Gref[k] = Gp[k] - gpz*ez[k];
+        Gz[k] += -gpz*ref[k] - refZ*Gp[k];
+      }
+      // z = zRaw/|zRaw|
+      REAL Graw[3] = {0.0, 0.0, 0.0};
+      unitGradient(z, sqrt(dot3(z, z)), Gz, Graw);
+      // Back to the vectors u, v, w from the atom to its frame atoms
+      REAL gu[3] = {0.0, 0.0, 0.0}, gv[3] = {0.0, 0.0, 0.0}, gw[3] = {0.0, 0.0, 0.0};
+      if(g == BISECTOR || g == THREEFOLD) {
+        unitGradient(u, lenU, Graw, gu);
+        unitGradient(v, lenV, Graw, gv);
+      } else {
+        memcpy(gu, Graw, sizeof(REAL)*3);
+      }
+      if(g == THREEFOLD) {
+        unitGradient(w, lenW, Graw, gw);
+      }
+      if(g == ZTHENBISECTOR) {
+        unitGradient(v, lenV, Gref, gv);
+        unitGradient(w, lenW, Gref, gw);
+      } else if(g != ZONLY) {
+        for(int k = 0; k < 3; k++) {
+          gv[k] += Gref[k];
+        }
+      }
+      int za = frames->zAtom[p], xa = frames->xAtom[p], ya = frames->yAtom[p];
+      for(int k = 0; k < 3; k++) {
+        grad[za*3+k] += gu[k];
+        if(xa >= 0) {
+          grad[xa*3+k] += gv[k];
+        }
+        if(ya >= 0) {
+          grad[ya*3+k] += gw[k];
+        }
+        grad[i*3+k] -= gu[k] + gv[k] + gw[k];
+      }
+      if(virial != NULL) {
+        for(int a = 0; a < 3; a++) {
+          for(int b = 0; b < 3; b++) {
+            virial[a*3+b] += u[a]*gu[b] + v[a]*gv[b] + w[a]*gw[b];
+          }
+        }
+      }
+    }
+  }
+}
@@ -1,6 +1,28 @@
 // Author(s): Matthew Speranza
 #include "include/vector.h"
+#include "include/typedVector.h"
+#include "include/arena.h"
+#include "include/barostat.h"
+#include "include/bicubic.h"
+#include "include/constraints.h"
+#include "include/fft.h"
+#include "include/mbar.h"
+#include "include/memoryTracker.h"
+#include "include/philox.h"
+#include "include/threadBuffers.h"
+#include "include/timers.h"
 
 int main() {
   vectorTest(false);
-}
\ No newline at end of file
+  typedVectorTest(false);
+  arenaTest(false);
+  fftTest(false);
+  bicubicTest(false);
+  threadBuffersTest(false);
+  timersTest(false);
+  philoxTest(false);
+  constraintsTest(false);
+  barostatTest(false);
+  mbarTest(false);
+  memoryTrackerTest(false);
+}
@@ -0,0 +1,54 @@
+// Author(s): Matthew Speranza
+#ifndef ARENA_H
+#define ARENA_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "memoryTracker.h"
+#include "typedVector.h"
+#include "vector.h"
+
+/**
+ * Bump allocator for data that is freed all at once.
+ * <hr>
+ * An arena hands out pieces of large blocks (blockSize bytes, counted under its MemoryTag) by moving a pointer, so
+ * many small allocations cost a handful of mallocs, sit next to each other in memory and are released together by
+ * arenaDestroy in one free per block. Requests larger than a block get a block of their own. Pieces are aligned
+ * for any type and never move, but can't be freed or grown one by one. An arena is not thread safe.
+ * <p>
+ * arenaReset rewinds the arena and keeps its blocks, which makes it a scratch space for parsing: allocate while
+ * reading a line, reset before the next one and the blocks are reused without touching malloc again.
+ * <p>
+ * The System keeps its topology (atom names, 1-2 lists) in System->arena and its 1-3 and 1-4 lists in
+ * System->bondedArena. Vectors whose array lives in an arena (arenaVector, arenaIntVectorCopy) can't grow past
+ * their capacity or be freed.
+ */
+typedef struct ArenaBlock {
+  struct ArenaBlock* next;
+  size_t size; // Usable bytes after the header
+  size_t used;
+} ArenaBlock;
+
+typedef struct Arena {
+  ArenaBlock* first;
+  ArenaBlock* current; // Block allocations are taken from, later ones are free after a reset
+  size_t blockSize;
+  enum MemoryTag tag;
+  long allocations; // Since creation or the last reset
+} Arena;
+
+Arena* arenaCreate(size_t blockSize, enum MemoryTag tag);
+void* arenaAlloc(Arena* arena, size_t bytes);
+void* arenaCalloc(Arena* arena, size_t n, size_t bytes);
+char* arenaStrdup(Arena* arena, const char* str);
+Vector arenaVector(Arena* arena, int bytesPerElement, int capacity, enum DataType dt);
+IntVector arenaIntVectorCopy(Arena* arena, const IntVector* vec);
+void arenaReset(Arena* arena);
+void arenaDestroy(Arena* arena);
+size_t arenaUsed(const Arena* arena);
+size_t arenaReserved(const Arena* arena);
+
+/////////////////////////////////////////// TESTS
+
+void arenaTest(bool verbose);
+
+#endif //ARENA_H
@@ -0,0 +1,57 @@
+// Author(s): Matthew Speranza
+#ifndef BAROSTAT_H
+#define BAROSTAT_H
+#include <stdbool.h>
+#include "../system/system.h"
+
+/**
+ * Monte Carlo barostat for NPT dynamics (Chow and Ferguson, Comput. Phys. Commun. 91, 283 (1995); Aqvist et al.,
+ * Chem. Phys. Lett. 384, 288 (2004)).
+ * <hr>
+ * Every System->volumeTrial steps the volume changes by a uniform dV in [-volumeMove, volumeMove]. Every axis in
+ * System->boxDim is scaled by s = (V'/V)^(1/3), and so is every molecule's center of mass. Atoms move with their
+ * molecule's center, so bonds, angles and constraints stay exactly as they were. The move is accepted with the
+ * probability min(1, exp(-w/kT)), where
+ * <p>
+ * w = E' - E + P*dV - nMolecules*kT*ln(V'/V)
+ * <p>
+ * Otherwise the positions, box and forces are restored. volumeMove is adapted so that between a quarter and three
+ * quarters of the moves are accepted.
+ * <p>
+ * A move only costs one energy evaluation. The neighbor lists are kept because updateVerlet measures displacements
+ * in the box the lists were built in: a small scaling of the molecule centers barely moves atoms there. The PME grid
+ * counts (System->pmeGridspace) are kept as well. Only their spacing follows the box, which changes the reciprocal
+ * space error by far less than the volume fluctuates.
+ * <p>
+ * Molecules are the connected components of System->list12. Positions are never wrapped, so a molecule's center
+ * is taken from its atoms without minimum image, and the scaling is about the origin like the one updateVerlet
+ * undoes.
+ */
+#define ATM_TO_KCAL 1.4583972e-5 // atm -> kcal/mol/ANG^3
+#define AMU_PER_ANG3_TO_G_PER_CM3 1.66053907
+#define VOLUME_ADAPT_TRIALS 10 // Moves between adaptations of the volume move
+
+typedef struct Barostat {
+  int nMolecules;
+  int* moleculeStart; // First atom of each molecule in moleculeAtoms and the end [nMolecules+1]
+  int* moleculeAtoms; // Atoms sorted by molecule [nAtoms]
+  REAL* moleculeMass; // amu [nMolecules]
+  REAL* XSave; // Positions before the move [nAtoms*3]
+  REAL* FSave[2]; // Forces before the move, the second only for RESPA [nAtoms*3]
+  REAL volumeMove; // Largest volume change (ANG^3)
+  int windowTrials; // Moves since the last adaptation
+  int windowAccepted;
+  long trials; // Moves since the last report
+  long accepted;
+} Barostat;
+
+Barostat* barostatCreate(System* system);
+void barostatDestroy(Barostat* b);
+void scaleMolecules(System* system, Barostat* b, REAL s);
+void adaptVolumeMove(Barostat* b, REAL volume);
+
+/////////////////////////////////////////// TESTS
+
+void barostatTest(bool verbose);
+
+#endif //BAROSTAT_H
@@ -0,0 +1,58 @@
+// Author(s): Matthew Speranza
+#ifndef BATCH_H
+#define BATCH_H
+#include "forceFieldReader.h"
+#include "typedVector.h"
+#include "../system/defines.h"
+
+/**
+ * Runs many small systems from one process, several at a time.
+ * <hr>
+ * A manifest lists one job per line as "command structure key", where command is energy or dynamics and the paths
+ * are relative to the working directory. Blank lines and lines starting with # are skipped. Every command is checked
+ * before anything runs.
+ * <p>
+ * Jobs are handed out one at a time (schedule(dynamic)) to a pool of omp_get_max_threads()/threadsPerSystem
+ * threads, and each job runs its own command with a team of threadsPerSystem threads nested inside the pool. Key
+ * files naming the same force field get the one parsed copy in the ForceFieldCache, which is read-only while
+ * systems run, so a manifest of a thousand waters reads the parameter file once. The structure, key and force field
+ * readers use strtok and are run one thread at a time, list building and everything after runs in parallel.
+ * <p>
+ * Each job gets the random seed of its key file, or one from the clock plus its line in the manifest so that repeated
+ * jobs sample different trajectories. Jobs write their usual output to stdout as they go (interleaved when several
+ * run at once) and the summary table lists them in manifest order. Dynamics jobs writing MBAR samples name the file
+ * after the structure, so they need structure files of their own. The timer output keys set the whole process, so
+ * a job key with them stops the batch, the MDC_* environment variables of timers.h set them for a batch instead.
+ */
+typedef enum BatchCommand {
+  BATCH_ENERGY,
+  BATCH_DYNAMICS
+} BatchCommand;
+
+typedef struct BatchJob {
+  BatchCommand command;
+  char* structure;
+  char* key;
+  int line; // In the manifest
+  int atoms;
+  REAL energy; // Total potential, of the last step for dynamics
+  double seconds;
+} BatchJob;
+
+TYPED_VECTOR(BatchJobVector, batchJobVector, BatchJob)
+
+typedef struct Batch {
+  BatchJobVector jobs;
+  ForceFieldCache* cache;
+  int threadsPerSystem;
+  int concurrent; // Systems run at once
+  double seconds; // Wall time of batchRun
+} Batch;
+
+Batch* batchRead(char* manifest);
+void batchRun(Batch* batch, int threadsPerSystem);
+void batchPrint(Batch* batch);
+void batchDestroy(Batch* batch);
+void batch(char* manifest, int threadsPerSystem);
+
+#endif //BATCH_H
@@ -0,0 +1,49 @@
+// Author(s): Matthew Speranza
+#ifndef BICUBIC_H
+#define BICUBIC_H
+#include <stdbool.h>
+#include "../system/defines.h"
+
+/**
+ * Bicubic interpolation of 2D torsion grids (AMOEBA torsion-torsion, CHARMM CMAP) from precomputed coefficients.
+ * <hr>
+ * Grids must be uniform in both angles. A grid whose axis spans 360 degrees (first and last points equal) is
+ * periodic along that axis. Other axes get natural end conditions like Tinker's ktortor and hold their edge value
+ * outside the grid.
+ * <p>
+ * When a grid is added, the slopes df/dx, df/dy and the cross derivative d2f/dxdy at every node come from cubic
+ * splines along the grid lines, and each cell gets the 16 coefficients of
+ * <p>
+ * f(t,u) = sum_ij c[i][j]*t^i*u^j, t = (x - x_cell)/dx, u = (y - y_cell)/dy
+ * <p>
+ * so evaluating the energy and both derivatives is a cell lookup plus two Horner passes. Every grid of a force
+ * field shares one coefficient block (identical grids are stored once), so a parameter entry only keeps an index
+ * into the table.
+ */
+typedef struct BicubicGrid {
+  int nX, nY; // Grid points along each angle
+  REAL x0, y0; // First grid point (degrees)
+  REAL dx, dy; // Spacing (degrees)
+  bool periodicX, periodicY;
+  int offset; // First coefficient of this grid in BicubicTable->coefficients
+} BicubicGrid;
+
+typedef struct BicubicTable {
+  int nGrids;
+  int gridCapacity;
+  BicubicGrid* grids; // [gridCapacity]
+  int nCoefficients;
+  int coefficientCapacity;
+  REAL* coefficients; // Cell coefficients c[i][j] row major [sum over grids (nX-1)*(nY-1)][16]
+} BicubicTable;
+
+BicubicTable* bicubicTableCreate();
+void bicubicTableDestroy(BicubicTable* table);
+int bicubicTableAdd(BicubicTable* table, int nX, int nY, const REAL* x, const REAL* y, const REAL* f);
+REAL bicubicEvaluate(const BicubicTable* table, int grid, REAL x, REAL y, REAL* dfdx, REAL* dfdy);
+
+/////////////////////////////////////////// TESTS
+
+void bicubicTest(bool verbose);
+
+#endif //BICUBIC_H
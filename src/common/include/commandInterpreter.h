@@ -12,11 +12,22 @@
  * <p>
  * \Dynamics runs molecular dynamics on the system
  * <p>
+ * \MBAR solves for the free energies of the lambda states from a *.mbar file written by dynamics (no key file)
+ * <p>
+ * \Batch runs the energy and dynamics jobs of a manifest over a thread pool, optionally followed by the threads
+ * each system runs with (batch.h)
+ * <p>
+ * \Replica runs replica exchange dynamics over the key file's ladder of temperatures or lambdas, optionally followed
+ * by the threads each replica runs with (replicaExchange.h)
+ * <p>
  */
  void commandInterpreter(int argc, char *argv[]);
  void printSupportedCommands();
  void printSupportedStructureFiles();
  System* systemCreate(char* structureFileName, char* keyFileName);
+ System* systemParse(char* structureFileName, char* keyFileName, ForceFieldCache* cache);
+ System* systemReplica(System* system);
+ void systemDefaults(System* system);
  void systemDestroy(System* system); // I wanna move this to system.h but got linker errors
  char* getFileExtension(char* fileName, int extForceLen);
  void printLogo();
@@ -0,0 +1,56 @@
+// Author(s): Matthew Speranza
+#ifndef CONSTRAINTS_H
+#define CONSTRAINTS_H
+#include <stdbool.h>
+#include "../system/system.h"
+
+/**
+ * Holonomic distance constraints for dynamics: rigid 3-site waters with SETTLE and bonds to hydrogen with RATTLE.
+ * <hr>
+ * Waters are oxygens bonded to exactly two hydrogens that have no other bonds (System->list12, System->protons).
+ * Their O-H length and H-O-H angle come from the force field bond and angle parameters. SETTLE (Miyamoto and
+ * Kollman, J. Comput. Chem. 13, 952 (1992)) puts each water back on its geometry analytically, and the velocity
+ * constraint is a 3x3 linear solve per water, so both are straight-line code over all waters in one simd loop.
+ * <p>
+ * With System->constraints HBONDS every other bond to a hydrogen is held at its force field length by SHAKE for
+ * positions and RATTLE (Andersen, J. Comput. Phys. 52, 24 (1983)) for velocities. Bonds are grouped into clusters
+ * around their heavy atom (a methyl is one cluster of three), clusters never share atoms, so each one is iterated to
+ * convergence on its own and clusters are spread over threads.
+ * <p>
+ * Every call records the most iterations any cluster needed. Positions are never wrapped into the box, so bonded
+ * atoms are used without minimum image.
+ */
+#define SHAKE_TOLERANCE 1e-10 // Relative error of a constrained length
+#define RATTLE_TOLERANCE 1e-6 // Relative velocity along a constraint (ANG/ns), thermal velocities are ~1e4 ANG/ns
+#define CONSTRAINT_MAX_ITERATIONS 500
+
+typedef struct Constraints {
+  int nAtoms;
+  // SETTLE
+  int nWaters;
+  int* water; // O, H1, H2 of each water [nWaters*3]
+  REAL waterOH; // ANG
+  REAL waterHH; // ANG
+  // RATTLE
+  int nBonds;
+  int* bond; // Heavy atom, hydrogen [nBonds*2], sorted by cluster
+  REAL* bondLength; // ANG [nBonds]
+  int nClusters;
+  int* clusterStart; // First bond of each cluster and the end [nClusters+1]
+  REAL* XRef; // Positions before the drift, on the constraints, filled by the integrator [nAtoms*3]
+  int nConstraints; // 3*nWaters + nBonds, degrees of freedom removed
+  int positionIterations; // Most SHAKE iterations of any cluster in the last call
+  int velocityIterations; // Most RATTLE iterations of any cluster in the last call
+} Constraints;
+
+Constraints* constraintsCreate(System* system);
+void constraintsDestroy(Constraints* c);
+void constrainPositions(System* system, Constraints* c, REAL dt);
+void constrainVelocities(System* system, Constraints* c);
+bool isWater(System* system, int i);
+
+/////////////////////////////////////////// TESTS
+
+void constraintsTest(bool verbose);
+
+#endif //CONSTRAINTS_H
@@ -0,0 +1,102 @@
+// Author(s): Matthew Speranza
+#ifndef DYNAMICS_H
+#define DYNAMICS_H
+#include <stdbool.h>
+#include "../system/system.h"
+#include "barostat.h"
+#include "constraints.h"
+#include "energy.h"
+#include "mbar.h"
+
+/**
+ * Velocity Verlet molecular dynamics in the microcanonical (NVE), canonical (NVT) or isothermal-isobaric (NPT)
+ * ensemble.
+ * <hr>
+ * Each step of dt = System->dtAtto is
+ * <p>
+ * V += dt/2*A, X += dt*V, update neighbor lists, F = -dE/dX, A = F/M, V += dt/2*A
+ * <p>
+ * done in place on the contiguous X, V and A arrays. Masses are expanded once to an inverse mass per coordinate, so
+ * every update is a single simd loop over nAtoms*3 REALs. The neighbor lists are only rebuilt once an atom has moved
+ * half the buffer (updateVerlet). Everything is allocated by dynamicsCreate: the lists and the potential reuse their
+ * storage, so the step loop itself never allocates.
+ * <p>
+ * With System->integrator RESPA each step of dt takes dt/dtInnerAtto inner velocity Verlet steps with the fast
+ * forces between two half kicks of the slow forces (ForceLevel in energy.h), each level in its own force array.
+ * <p>
+ * With System->constraints set, every drift is followed by SHAKE/SETTLE of the positions, which also corrects the
+ * velocities, and every step ends with RATTLE/SETTLE of the velocities (constraints.h). Rigid water and X-H bonds
+ * remove the fastest motions, so 2 fs steps conserve energy.
+ * <p>
+ * System->thermostat LANGEVIN integrates Langevin dynamics with BAOAB, BUSSI rescales the velocities after every
+ * step. Their random numbers are counter-based (philox.h), keyed by System->randomSeed, stream, step and atom.
+ * <p>
+ * System->barostat MONTE_CARLO adds a volume move every System->volumeTrial steps for NPT (barostat.h), one extra
+ * energy evaluation on the existing neighbor lists.
+ * <p>
+ * Every System->printMBAREvery steps the energies of all System->lambdaStates, which the step's force evaluation
+ * already summed, are appended to <structure>.mbar in units of kT as a sample of the state at System->lambda
+ * (mbar.h).
+ * <p>
+ * Every System->printThermoEvery steps the energies, temperature, simulated ns/day and the wall time spent in each
+ * phase since the previous report are printed.
+ */
+#define KCAL_TO_ACCEL 4.184e8 // (kcal/mol/ANG)/amu -> ANG/ns^2
+#define BOLTZMANN 0.0019872041 // kcal/(mol*K)
+// Random number streams (philox.h counter word 1)
+#define STREAM_VELOCITIES 0
+#define STREAM_LANGEVIN 1
+#define STREAM_LANGEVIN_END 2 // Second half step of RESPA
+#define STREAM_BUSSI 3
+#define STREAM_BUSSI_CHI 4
+#define STREAM_BAROSTAT 5
+#define STREAM_EXCHANGE 6 // Replica exchange attempts (replicaExchange.h)
+
+// Where thermoReport says the time of the steps went, each phase a timer below TIMER_DYNAMICS
+enum ReportPhase {
+  PHASE_INTEGRATE, PHASE_NEIGHBORS, PHASE_FORCES, PHASE_ROTATE, PHASE_REAL_SPACE, PHASE_TORQUE, PHASE_THERMOSTAT,
+  PHASE_CONSTRAIN, PHASE_BAROSTAT, N_REPORT_PHASES
+};
+
+typedef struct Dynamics {
+  Potential* potential;
+  REAL dt; // ns
+  REAL* invMass; // 1/M for every coordinate, 0 for massless atoms (1/amu) [nAtoms*3]
+  // RESPA
+  int nInner; // Fast force steps per step (1 for velocity Verlet)
+  REAL* fastF; // Fast forces (kcal/mol/ANG) [nAtoms*3], NULL for velocity Verlet
+  REAL* slowF; // Slow forces [nAtoms*3]
+  REAL fastEnergy;
+  REAL slowEnergy;
+  Constraints* constraints; // NULL without System->constraints
+  Barostat* barostat; // NULL without System->barostat
+  MBARWriter* mbar; // NULL without System->printMBAREvery
+  int mbarState; // System->lambda in System->lambdaStates
+  int nDOF; // 3*nAtoms - 3 - constraints, the center of mass is at rest
+  REAL kinetic; // kcal/mol
+  REAL potentialEnergy; // kcal/mol
+  REAL temperature; // Kelvin
+  long step;
+  long reportSteps; // Steps since the last report
+  double reportSeconds; // Wall time in dynamicsRun since the last report
+  double markSeconds; // timerNow when reportSeconds was last added to
+  // Built with TIMERS, seconds of each ReportPhase since the last report, added up from the timers of each
+  // dynamicsRun because the timer trees are per thread and a replica may continue on another one
+  double phaseSeconds[N_REPORT_PHASES];
+  double phaseMark[N_REPORT_PHASES]; // Timer seconds of each phase when phaseSeconds was last added to
+  int nRebuilds; // Neighbor list rebuilds since the last report
+  long shakeIterations; // Summed over the position constraints since the last report
+  long rattleIterations; // Summed over the velocity constraints since the last report
+} Dynamics;
+
+void assignMasses(System* system);
+int repartitionMasses(System* system, REAL hydrogenMass, int* nWatersSkipped);
+void initVelocities(System* system, REAL temperature);
+Dynamics* dynamicsCreate(System* system);
+void dynamicsDestroy(Dynamics* md);
+void dynamicsRefresh(System* system, Dynamics* md);
+REAL kineticEnergy(System* system, Dynamics* md);
+void dynamicsRun(System* system, Dynamics* md, long steps);
+REAL dynamics(System* system);
+
+#endif //DYNAMICS_H
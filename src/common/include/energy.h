@@ -0,0 +1,50 @@
+// Author(s): Matthew Speranza
+#ifndef ENERGY_H
+#define ENERGY_H
+#include <stdbool.h>
+#include "../system/system.h"
+#include "../../classical/include/direct.h"
+#include "../../classical/include/induce.h"
+#include "../../classical/include/multipoleFrame.h"
+
+/**
+ * Classical potential energy and forces of a System, the single entry point of the energy and dynamics commands.
+ * <hr>
+ * Everything the terms need is allocated once by potentialCreate, so evaluating the potential never allocates. The
+ * terms implemented so far are the permanent multipoles in real space plus the Ewald self energy and, when
+ * System->polarization is set, the induced dipole energy. Forces and virial only include the permanent multipoles.
+ * <p>
+ * For multiple time step integration the terms are split into fast and slow forces (ForceLevel). Fast forces are
+ * the real space multipole pairs inside System->respaCutoff, switched off smoothly over System->respaSwitch, and
+ * slow forces are everything else: the remaining real space pairs, the self energy and polarization. Bonded terms
+ * belong on the fast level once they exist.
+ * <p>
+ * With lambda atoms (System->activeLambdas) the potential is that of their multipoles scaled by System->lambda.
+ * Every FORCE_ALL evaluation also sums the potential energy at each of System->lambdaStates in the same sweep over
+ * the neighbor lists (direct.h), one row of the reduced potential matrix MBAR needs per configuration.
+ */
+enum ForceLevel {FORCE_ALL, FORCE_FAST, FORCE_SLOW};
+
+typedef struct Potential {
+  MultipoleFrames* frames;
+  DirectWorkspace* direct;
+  InducedDipoles* induced; // NULL unless System->polarization is set
+  REAL* grad; // dE/dx (kcal/mol/ANG) [nAtoms*3]
+  REAL* torque; // Multipole torques before conversion to gradient [nAtoms*3]
+  REAL virial[9]; // sum r (x) dE/dr (kcal/mol)
+  // Terms of the last evaluation, only those of its level (kcal/mol)
+  REAL realSpace;
+  REAL self;
+  REAL polarization;
+  REAL total;
+  REAL* stateEnergy; // Potential energy at each System->lambdaStates of the last FORCE_ALL evaluation [nLambdaStates]
+} Potential;
+
+void assignLambdas(System* system);
+Potential* potentialCreate(System* system);
+void potentialDestroy(Potential* pot);
+REAL potentialEnergy(System* system, Potential* pot);
+REAL potentialLevel(System* system, Potential* pot, enum ForceLevel level, REAL* force);
+REAL energy(System* system);
+
+#endif //ENERGY_H
@@ -0,0 +1,55 @@
+// Author(s): Matthew Speranza
+#ifndef FFT_H
+#define FFT_H
+#include <stdbool.h>
+#include "../system/defines.h"
+
+/**
+ * In-house mixed radix (2, 3, 4, 5) fast fourier transform for PME grids.
+ * <hr>
+ * Complex data is interleaved (re, im) in REAL arrays. Transforms are unnormalized in both directions, so a
+ * forward transform followed by an inverse transform scales the data by n (or nX*nY*nZ in 3D).
+ * <p>
+ * 1D transforms use the Stockham autosort algorithm, which ping-pongs between the data array and a work array
+ * instead of doing a bit-reversal pass. Every stage's twiddles are computed once when the plan is created.
+ * <p>
+ * 3D transforms go real-to-complex [nX][nY][nZ] -> [nX][nY][nZ/2+1] and back. Even nZ is transformed as a
+ * half-length complex FFT with a post-processing pass. Slabs (z and y passes) and pencils (x pass) are
+ * split across OpenMP threads, each with its own scratch space held by the plan.
+ */
+enum FFTDirection {FFT_FORWARD = -1, FFT_BACKWARD = 1};
+typedef struct FFTPlan {
+  int n; // Number of complex points
+  int nFactors;
+  int factors[32]; // Radices in the order they are applied (4, 2, 3, 5)
+  int* twiddleOffset; // Start of each stage's twiddles in twiddles [nFactors]
+  REAL* twiddles; // (cos, sin) of 2*pi*j*k/nStage for each stage [sum over stages (nStage/p)*(p-1)*2]
+} FFTPlan;
+
+typedef struct FFTPlan3D {
+  int nX, nY, nZ; // Real grid dimensions
+  int nZComplex; // nZ/2+1 complex points kept along z
+  bool packedZ; // True if nZ is even and the z pass uses a half-length complex transform
+  FFTPlan* planX;
+  FFTPlan* planY;
+  FFTPlan* planZ; // Length nZ/2 if packedZ else nZ
+  REAL* zTwiddles; // (cos, sin) of 2*pi*k/nZ for the packed real post-processing [(nZ/2+1)*2]
+  int nThreads;
+  int scratchSize; // REALs of scratch per thread
+  REAL* scratch; // Per-thread pencil + Stockham work space [nThreads][scratchSize]
+} FFTPlan3D;
+
+FFTPlan* fftPlanCreate(int n);
+void fftPlanDestroy(FFTPlan* plan);
+void fft(FFTPlan* plan, REAL* data, REAL* work, enum FFTDirection direction);
+FFTPlan3D* fftPlan3DCreate(int nX, int nY, int nZ);
+void fftPlan3DDestroy(FFTPlan3D* plan);
+void fft3DR2C(FFTPlan3D* plan, REAL* in, REAL* out);
+void fft3DC2R(FFTPlan3D* plan, REAL* in, REAL* out);
+int fftGoodSize(int n);
+
+/////////////////////////////////////////// TESTS
+
+void fftTest(bool verbose);
+
+#endif //FFT_H
@@ -1,7 +1,8 @@
 // Author(s): Matthew Speranza
 #ifndef FORCEFIELDREADER_H
 #define FORCEFIELDREADER_H
-#include <vector.h>
+#include <typedVector.h>
+#include "bicubic.h"
 #include "../system/defines.h"
 
 /**
@@ -53,10 +54,11 @@ typedef struct Bond {
   enum BondFunction bondFunction;
 } Bond;
 // Includes charge as well
+#define BOHR 0.52917721067 // ANG per bohr, force field dipoles and quadrupoles are in atomic units
 enum MultipoleFrameDef {MPOL_NONE, ZONLY, ZTHENX, BISECTOR, ZTHENBISECTOR, THREEFOLD};
 typedef struct Multipole {
-  REAL multipole[10]; // quadrupole * 1/3, off diag * 2/3
-  int frameAtomTypes[4];
+  REAL multipole[10]; // e*ANG^n, quadrupole * 1/3, off diag * 2/3
+  int frameAtomTypes[4]; // [atom type, z, x, y] - signs pick the frame definition
   enum MultipoleFrameDef frameDef;
 } Multipole;
 typedef struct OPBend {
@@ -88,7 +90,7 @@ typedef struct Torsion {
 } Torsion;
 typedef struct TorTors {
   int atomClasses[5], gridPoints[2];
-  REAL torsion1[625], torsion2[625], energy[625];
+  int grid; // Index of the energy grid's spline coefficients in ForceField->torTorGrids
 } TorTors;
 typedef struct UReyBrad {
   int atomClasses[3];
@@ -120,31 +122,71 @@ typedef struct Solute {
   REAL diameters[3]; // 0 = p-b, 1 = cos, 2 = gk
   REAL sneck;
 } Solute;
+// Entries are stored by value, in the order of the file
+TYPED_VECTOR(AtomVector, atomVector, Atom)
+TYPED_VECTOR(AngleVector, angleVector, Angle)
+TYPED_VECTOR(AngTorsVector, angTorsVector, AngTors)
+TYPED_VECTOR(BioTypeVector, bioTypeVector, BioType)
+TYPED_VECTOR(BondVector, bondVector, Bond)
+TYPED_VECTOR(MultipoleVector, multipoleVector, Multipole)
+TYPED_VECTOR(OPBendVector, opBendVector, OPBend)
+TYPED_VECTOR(StrBendVector, strBendVector, StrBend)
+TYPED_VECTOR(PiTorsVector, piTorsVector, PiTors)
+TYPED_VECTOR(ImpTorsVector, impTorsVector, ImpTors)
+TYPED_VECTOR(StrTorsVector, strTorsVector, StrTors)
+TYPED_VECTOR(TorsionVector, torsionVector, Torsion)
+TYPED_VECTOR(TorTorsVector, torTorsVector, TorTors)
+TYPED_VECTOR(UReyBradVector, uReyBradVector, UReyBrad)
+TYPED_VECTOR(VdWVector, vdwVector, VdW)
+TYPED_VECTOR(VdWPairVector, vdwPairVector, VdWPair)
+TYPED_VECTOR(PolarizeVector, polarizeVector, Polarize)
+TYPED_VECTOR(RelativeSolvVector, relativeSolvVector, RelativeSolv)
+TYPED_VECTOR(SoluteVector, soluteVector, Solute)
+
 // Defines all atom types and interactions between atom types
 typedef struct ForceField {
   enum ForceFieldName name;
-  Vector* atom;
-  Vector* angle;
-  Vector* angTors;
-  Vector* bioType;
-  Vector* bond;
-  Vector* multipole;
-  Vector* opBend;
-  Vector* strBend;
-  Vector* piTors;
-  Vector* impTors;
-  Vector* strTors;
-  Vector* torsion;
-  Vector* torTors;
-  Vector* uRayBrad;
-  Vector* vdw;
-  Vector* vdwPair;
-  Vector* polarize;
-  Vector* relativeSolv;
-  Vector* solute;
+  AtomVector atom;
+  AngleVector angle;
+  AngTorsVector angTors;
+  BioTypeVector bioType;
+  BondVector bond;
+  MultipoleVector multipole;
+  OPBendVector opBend;
+  StrBendVector strBend;
+  PiTorsVector piTors;
+  ImpTorsVector impTors;
+  StrTorsVector strTors;
+  TorsionVector torsion;
+  TorTorsVector torTors;
+  BicubicTable* torTorGrids; // Spline coefficients of every torTors (and CMAP) grid
+  UReyBradVector uRayBrad;
+  VdWVector vdw;
+  VdWPairVector vdwPair;
+  PolarizeVector polarize;
+  RelativeSolvVector relativeSolv;
+  SoluteVector solute;
 } ForceField;
 
+/**
+ * Force fields read once and shared read-only by every System that names the same file (batch.h). Systems given a
+ * cache (System->forceFieldCache) borrow their ForceField from it and never free it. Lookups are not thread safe.
+ */
+typedef struct CachedForceField {
+  char* path; // Resolved with realpath where it exists
+  ForceField* forceField;
+} CachedForceField;
+TYPED_VECTOR(CachedForceFieldVector, cachedForceFieldVector, CachedForceField)
+
+typedef struct ForceFieldCache {
+  CachedForceFieldVector entries;
+  int hits; // Lookups answered without reading a file
+} ForceFieldCache;
+
 void readForceFieldFile(ForceField* forceField, char* forceFieldFile);
 void forceFieldFree(ForceField* ff);
+ForceFieldCache* forceFieldCacheCreate();
+ForceField* forceFieldCacheGet(ForceFieldCache* cache, char* forceFieldFile);
+void forceFieldCacheDestroy(ForceFieldCache* cache);
 
 #endif //FORCEFIELDREADER_H
\ No newline at end of file
@@ -13,7 +13,7 @@
  * - if only two axis are given the program will fail
  * - if only one boxDim is given, all dimensions will take on that length
  * - if only one grid count is given, all dimensions get that value
- * - grid counts must be powers of 2
+ * - grid counts must only have factors of 2, 3, and 5 (see fftGoodSize in fft.h)
  * - if grid counts are not given, they are automatically set
  * - all keywords have restrictions due to datatypes listed and are computer arch. dependent
  *
@@ -27,17 +27,43 @@
  * steps (long) - number of dynamics steps to take (default 1e9)
  * temp (float) - temperature of the system (kelvin) (default 298K)- overwrite potential
  * temperature (float) - same as above - overwrite potential
- * cutoff (float) - neighborlist cutoff (angstrom)
- * buffer (float) - neighborlist buffer (angstrom)
+ * cutoff (float) - neighborlist and real space cutoff (angstrom) (default 9)
+ * buffer (float) - neighborlist buffer (angstrom) (default 2)
  * A-axis (float,[float,float]) - A-axis (Ax,[Ay,Az]) (angstrom) - overwrite potential
  * B-axis (float,[float,float]) - B-axis (Bx,[By,Bz]) (angstrom) - overwrite potential
  * C-axis (float,[float,float]) - C-axis (Cx,[Cy,Cz]) (angstrom) - overwrite potential
  * boxDim (float,[flaot,float]) - Cubic dimensions (X,Y,Z) (angstrom) - overwrite potential
- * pmeAlpha (float) - ewald paremeter (default ___)
+ * pmeAlpha (float) - ewald paremeter (default: erfc(alpha*cutoff)/cutoff = 1e-8)
  * pmeBeta (float) - ewald paremeter (default ___)
  * pmeOrder (int) - b-spline order (default 5)
  * pmeGridCount (int,[int,int]) - PME grid nodes (nX,nY,nZ)
  * polarization (char*) - Polarization type (mutual,direct,none)
+ * polar-eps (float) - induced dipole convergence, RMS dipole change (Debye) (default 1e-6)
+ * polar-predict (int) - previous induced dipole solutions extrapolated for the initial guess, 0 is off (default 6)
+ * integrator (char*) - dynamics integrator (verlet,respa) (default verlet)
+ * dtInnerAtto (int) - RESPA inner timestep for fast forces (attoseconds), must divide dtAtto (default 250)
+ * respa-cutoff (float) - RESPA real space pairs within this distance are fast forces (angstrom) (default 5)
+ * respa-switch (float) - width of the fast to slow switch ending at respa-cutoff (angstrom) (default 1)
+ * thermostat (char*) - NVT thermostat at temperature, Langevin BAOAB or Bussi velocity rescaling (none,langevin,bussi) (default none)
+ * friction (float) - Langevin friction coefficient (1/picosecond) (default 1)
+ * tau-temperature (float) - Bussi thermostat coupling time (picoseconds) (default 0.2)
+ * barostat (char*) - NPT with Monte Carlo volume moves scaling molecular centers of mass (none,montecarlo) (default none)
+ * pressure (float) - barostat pressure (atmospheres) (default 1)
+ * volume-trial (int) - steps between Monte Carlo volume moves (default 25)
+ * volume-move (float) - largest Monte Carlo volume change (angstrom^3), adapted to the acceptance (default 100)
+ * lambda (float) - alchemical state of the lambda atoms, their multipoles are scaled by it (default 1)
+ * lambda-atoms (int,[int,...]) - lambda atoms as indices or ranges (a-b) starting at 1, repeats append (default none)
+ * lambda-states (float,[float,...]) - lambda values whose energies every evaluation also sums (default none)
+ * printMBAREvery (long) - writes the lambda states' reduced energies into *.mbar every ? dynamics steps, 0 is off (default 0)
+ * timer-json (filepath) - writes the per-phase timers and counters as JSON at the end of the run, not in batch job keys (env MDC_TIMER_JSON) (default none)
+ * perf-counters - counts cycles, instructions, cache and branch misses in every timer with perf_event_open, not in batch job keys (env MDC_PERF_COUNTERS=1) (default off)
+ * trace-json (filepath) - records every timer call per thread and writes them as a Chrome trace at the end of the run, not in batch job keys (env MDC_TRACE_JSON) (default none)
+ * randomseed (long) - seed of the thermostat and initial velocity random numbers, 0 picks one from the clock (default 0)
+ * hydrogen-mass (float) - hydrogen mass after repartitioning mass from bonded heavy atoms (amu), rigid waters keep theirs, 0 is off (default 0)
+ * constraints (char*) - rigid bonds during dynamics, water is SETTLE, hbonds also RATTLEs bonds to hydrogen (none,water,hbonds) (default none)
+ * replica-temperatures (float,[float,...]) - temperature (kelvin) of each replica of the replica command, ascending (default none)
+ * replica-lambdas (float,[float,...]) - lambda of each replica of the replica command instead, also sets lambda-states (default none)
+ * exchange-every (long) - steps between replica exchange attempts (default 100)
  * forcefield (filepath) - path to force field file - overwrite potential
  * parameters (filepath) - same as above - overwrite potential
  * params (filepath) - same as above - overwrite potential
@@ -45,7 +71,7 @@
  *
  */
 
-static char* MD_C_Keywords[25] =
+static char* MD_C_Keywords[51] =
  {"verbose",
  "dt", "dtNano", "dtAtto",
  "steps",
@@ -59,10 +85,36 @@ static char* MD_C_Keywords[25] =
  "pmeBeta",
  "pmeOrder",
  "pmeGridCount",
- "polerization",
+ "polarization",
  "forcefield", "parameters", "params",
  "patch",
- "printArchiveEvery"
+ "printArchiveEvery",
+ "polar-eps",
+ "polar-predict",
+ "integrator",
+ "dtInnerAtto",
+ "respa-cutoff",
+ "respa-switch",
+ "constraints",
+ "hydrogen-mass",
+ "thermostat",
+ "friction",
+ "tau-temperature",
+ "randomseed",
+ "barostat",
+ "pressure",
+ "volume-trial",
+ "volume-move",
+ "lambda",
+ "lambda-atoms",
+ "lambda-states",
+ "printMBAREvery",
+ "timer-json",
+ "trace-json",
+ "perf-counters",
+ "replica-temperatures",
+ "replica-lambdas",
+ "exchange-every"
 };
 
 void readKeyFile(System* system, char* keyFile);
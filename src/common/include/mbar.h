@@ -0,0 +1,66 @@
+// Author(s): Matthew Speranza
+#ifndef MBAR_H
+#define MBAR_H
+#include <stdbool.h>
+#include <stdio.h>
+#include "../system/defines.h"
+
+/**
+ * Multistate Bennett acceptance ratio free energies (Shirts and Chodera, J. Chem. Phys. 129, 124105 (2008)) from
+ * the reduced potentials u_k(x_n) = E_k(x_n)/kT of N samples evaluated at every one of K states.
+ * <hr>
+ * Samples are streamed from a binary file in chunks of MBAR_CHUNK_ROWS rows, so the matrix never has to fit in
+ * memory. The header is the magic number, K (both int32), N and the number of samples drawn from each state (all
+ * int64). Each row is K+1 doubles: the state the sample was drawn from, then u_0..u_K-1. Rows can come from the
+ * states in any order. Terms that are the same for every state (kinetic energy, PV) cancel and can be left out.
+ * <p>
+ * The free energies f of the sampled states minimize the convex function
+ * <p>
+ * F(f) = sum_n ln sum_k N_k exp(f_k - u_kn) - sum_k N_k f_k
+ * <p>
+ * whose gradient and Hessian are sums over samples of the weights p_nk = N_k exp(f_k - u_kn)/sum_j(...). Each pass
+ * over the file does a log-sum-exp per row in a simd loop over states, threads split the rows of a chunk, and adds
+ * the gradient and the p p^T outer products into per-thread sums. Newton steps with a backtracking line search
+ * start from BAR between neighboring sampled states, so a few passes converge to machine precision.
+ * <p>
+ * A last pass gives the unsampled states' free energies and the overlap matrix W^T W, from which the asymptotic
+ * covariance is Theta = V S (I - S V^T N V S)^+ S V^T with W^T W = V S^2 V^T (Shirts and Chodera eq. D8).
+ * Free energies are reported relative to state 0 in units of kT.
+ */
+#define MBAR_MAGIC 0x5241424d // "MBAR"
+#define MBAR_CHUNK_ROWS 4096
+#define MBAR_TOLERANCE 1e-10 // Largest |dF/df_k|/N_k at convergence
+#define MBAR_MAX_ITERATIONS 100
+
+typedef struct MBARWriter {
+  FILE* file;
+  int nStates;
+  long nSamples;
+  long* counts; // Samples written from each state [nStates]
+  double* row; // [nStates+1]
+} MBARWriter;
+
+typedef struct MBAR {
+  int nStates;
+  long nSamples;
+  long* counts; // Samples drawn from each state [nStates]
+  REAL* f; // Reduced free energies relative to state 0 (kT) [nStates]
+  REAL* theta; // Asymptotic covariance of f [nStates*nStates]
+  int iterations; // Newton iterations
+  int passes; // Reads of the whole file
+  REAL gradient; // Largest |dF/df_k|/N_k at the end
+} MBAR;
+
+MBARWriter* mbarWriterCreate(const char* path, int nStates);
+void mbarWrite(MBARWriter* writer, int state, const REAL* energy, REAL beta);
+void mbarWriterClose(MBARWriter* writer);
+MBAR* mbarSolve(const char* path);
+void mbarDestroy(MBAR* mbar);
+REAL mbarUncertainty(MBAR* mbar, int i, int j);
+void mbarPrint(MBAR* mbar);
+
+/////////////////////////////////////////// TESTS
+
+void mbarTest(bool verbose);
+
+#endif //MBAR_H
@@ -0,0 +1,42 @@
+// Author(s): Matthew Speranza
+#ifndef MEMORYTRACKER_H
+#define MEMORYTRACKER_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Allocation with current and peak bytes per subsystem, for sizing jobs.
+ * <hr>
+ * memoryMalloc/memoryCalloc/memoryRealloc/memoryFree behave like the C library functions, but add and subtract the
+ * block's size under a tag. Sizes are what the allocator actually handed out (malloc_usable_size), read from the
+ * block itself, so nothing is stored next to it: a tracked block may still be released with free, it is then just
+ * counted as live. Failing allocations print the tag and exit.
+ * <p>
+ * memoryReport prints the table together with the peak resident set of the process, the difference being memory
+ * that isn't tracked (the potential's workspaces, strings, the C library). The commands print it at the end of a
+ * run.
+ */
+enum MemoryTag {
+  MEMORY_STRUCTURE, // System arrays per atom
+  MEMORY_FORCE_FIELD,
+  MEMORY_BONDED_LISTS, // 1-3 and 1-4 lists
+  MEMORY_NEIGHBOR_LISTS, // Verlet lists and cells
+  MEMORY_VECTORS, // Vectors created without a tag
+  N_MEMORY_TAGS
+};
+
+void* memoryMalloc(size_t bytes, enum MemoryTag tag);
+void* memoryCalloc(size_t n, size_t bytes, enum MemoryTag tag);
+void* memoryRealloc(void* block, size_t bytes, enum MemoryTag tag);
+void memoryFree(void* block, enum MemoryTag tag);
+long long memoryCurrent(enum MemoryTag tag);
+long long memoryPeak(enum MemoryTag tag);
+long long memoryTotalPeak();
+void memoryResetPeaks();
+void memoryReport();
+
+/////////////////////////////////////////// TESTS
+
+void memoryTrackerTest(bool verbose);
+
+#endif //MEMORYTRACKER_H
@@ -1,8 +1,31 @@
 #ifndef NEIGHBORLIST_H
 #define NEIGHBORLIST_H
+#include <stdbool.h>
 #include "../system/system.h"
 
+/**
+ * Cell grid and positions of the last Verlet list build (System->verletCells), kept so that rebuilds during
+ * dynamics reuse every allocation.
+ */
+typedef struct VerletCells {
+  int nX, nY, nZ;
+  int nCells;
+  IntVector* cells; // Atoms in each cell [nCells]
+  int* atomCell; // Cell coordinates of each atom [nAtoms*3]
+  int* visited; // Cells already searched for the current atom [nCells]
+  REAL* XBuild; // Positions the lists were built from [nAtoms*3]
+  REAL boxBuild[3]; // Axis lengths the lists were built in (ANG) [a,b,c]
+  int nBuilds; // Builds so far
+  bool* lambdaAtom; // System->activeLambdas as a mask for partitioning the lists, NULL without them [nAtoms]
+} VerletCells;
+
 void buildLists(System* system);
+void buildBonded(System* system);
+void bondedDestroy(System* system);
+void buildVerlet(System* system);
+bool updateVerlet(System* system);
+void verletDestroy(System* system);
 int indexGrid(int x, int y, int z, int nx, int ny, int nz);
+REAL imageDx(REAL dx, REAL axisLen);
 
 #endif //NEIGHBORLIST_H
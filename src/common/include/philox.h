@@ -0,0 +1,76 @@
+// Author(s): Matthew Speranza
+#ifndef PHILOX_H
+#define PHILOX_H
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "../system/defines.h"
+
+/**
+ * Philox4x32-10 counter-based random numbers (Salmon, Moraes, Dror and Shaw, SC11 (2011)).
+ * <hr>
+ * A random number is a pure function of a 128 bit counter and a 64 bit key: ten rounds of two 32x32->64 bit
+ * multiplies and xors. Nothing is stored between draws. Dynamics keys every draw by (seed) and counts with
+ * (index, stream, step), so the noise of atom i at step n is the same on any number of threads, in any order, and
+ * after a restart from step n. The functions are inline so simd loops over atoms vectorize through them.
+ */
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+static inline void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+  uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+  uint32_t k0 = key[0], k1 = key[1];
+  for(int round = 0; round < 10; round++) {
+    uint64_t p0 = (uint64_t) PHILOX_M0*c0;
+    uint64_t p1 = (uint64_t) PHILOX_M1*c2;
+    uint32_t n0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+    uint32_t n2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+    c1 = (uint32_t) p1;
+    c3 = (uint32_t) p0;
+    c0 = n0;
+    c2 = n2;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+/**
+ * Four uniform deviates in (0,1) for one counter.
+ */
+static inline void philoxUniforms(uint64_t seed, uint32_t stream, uint64_t step, uint32_t index, REAL uniform[4]) {
+  const uint32_t counter[4] = {index, stream, (uint32_t) step, (uint32_t) (step >> 32)};
+  const uint32_t key[2] = {(uint32_t) seed, (uint32_t) (seed >> 32)};
+  uint32_t bits[4];
+  philox4x32(counter, key, bits);
+  for(int k = 0; k < 4; k++) {
+    uniform[k] = ((REAL) bits[k] + 0.5)*(1.0/4294967296.0);
+  }
+}
+
+/**
+ * Four standard normal deviates for one counter, two Box-Muller pairs.
+ */
+static inline void philoxNormals(uint64_t seed, uint32_t stream, uint64_t step, uint32_t index, REAL normal[4]) {
+  REAL u[4];
+  philoxUniforms(seed, stream, step, index, u);
+  REAL r0 = sqrt(-2.0*log(u[0]));
+  REAL r1 = sqrt(-2.0*log(u[2]));
+  normal[0] = r0*cos(2.0*M_PI*u[1]);
+  normal[1] = r0*sin(2.0*M_PI*u[1]);
+  normal[2] = r1*cos(2.0*M_PI*u[3]);
+  normal[3] = r1*sin(2.0*M_PI*u[3]);
+}
+
+REAL philoxChiSquared(uint64_t seed, uint32_t stream, uint64_t step, int nDOF);
+
+/////////////////////////////////////////// TESTS
+
+void philoxTest(bool verbose);
+
+#endif //PHILOX_H
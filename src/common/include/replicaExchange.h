@@ -0,0 +1,66 @@
+// Author(s): Matthew Speranza
+#ifndef REPLICAEXCHANGE_H
+#define REPLICAEXCHANGE_H
+#include "dynamics.h"
+#include "../system/system.h"
+
+/**
+ * Replica exchange (parallel tempering, Sugita and Okamoto, Chem. Phys. Lett. 314, 141 (1999)) over a ladder of
+ * temperatures or lambda windows, with every replica in the same process.
+ * <hr>
+ * The structure and key are read once into a System that owns the topology, bonded lists, masses and force field.
+ * Each of the System->nReplicas replicas is a systemReplica of it owning only coordinates, velocities, forces and
+ * neighbor lists, with a Dynamics of its own and random seed System->randomSeed + its index.
+ * <p>
+ * Replicas run System->exchangeEvery steps at a time, omp_get_max_threads()/threadsPerReplica at once with nested
+ * teams of threadsPerReplica threads (the batch command's scheduling, batch.h). Between rounds neighboring slots
+ * of the ladder, the even pairs one round and the odd pairs the next, are exchanged with probability
+ * <p>
+ * min(1, exp((1/kT_i - 1/kT_j)(U_i - U_j)))
+ * <p>
+ * for temperatures, where U is the potential energy of the last step, and
+ * <p>
+ * min(1, exp(-(U_i(x_j) + U_j(x_i) - U_i(x_i) - U_j(x_j))/kT))
+ * <p>
+ * for lambdas, whose energies U_k(x) at every window are the System->lambdaStates each force evaluation already sums.
+ * An exchange swaps which replica sits in each slot (ReplicaExchange->slots) and the temperature or lambda each one
+ * runs at: coordinates never move. Velocities are rescaled by sqrt(T_new/T_old) and a lambda swap re-evaluates the
+ * forces at the replica's next round.
+ * <p>
+ * A thermostat is required. Lambda ladders need velocity Verlet, the stateEnergy of RESPA's split evaluations would
+ * be stale. The barostat and MBAR output are not supported, the swap would need the PV term and the replicas would
+ * write the same file.
+ */
+typedef struct Replica {
+  System* system;
+  Dynamics* md;
+  int slot; // Position on the ladder
+  bool refresh; // Forces are still those of the lambda before the last exchange
+} Replica;
+
+typedef struct ReplicaExchange {
+  System* topology;
+  enum ReplicaLadder ladder;
+  int nReplicas;
+  const REAL* values; // Temperature (K) or lambda of each slot [nReplicas]
+  Replica* replicas; // [nReplicas]
+  Replica** slots; // Replica at each slot, exchanges swap these [nReplicas]
+  long exchangeEvery;
+  long rounds; // Exchange attempts so far
+  long* attempts; // Of each neighboring pair of slots [nReplicas - 1]
+  long* accepted; // [nReplicas - 1]
+  int threadsPerReplica;
+  int concurrent; // Replicas run at once
+  long steps; // Per replica so far
+  double tDynamics; // Wall time of the rounds (seconds)
+  double tExchange; // Wall time of the exchange attempts
+  double tRefresh; // Summed time of the force evaluations after lambda swaps
+} ReplicaExchange;
+
+ReplicaExchange* replicaExchangeCreate(System* system, int threadsPerReplica);
+void replicaExchangeRun(ReplicaExchange* rex, long steps);
+void replicaExchangePrint(ReplicaExchange* rex);
+void replicaExchangeDestroy(ReplicaExchange* rex);
+void replicaExchange(System* system, int threadsPerReplica);
+
+#endif //REPLICAEXCHANGE_H
@@ -0,0 +1,56 @@
+// Author(s): Matthew Speranza
+#ifndef THREADBUFFERS_H
+#define THREADBUFFERS_H
+#include <stdbool.h>
+#include "../system/defines.h"
+
+/**
+ * Per-thread accumulation of per-atom (x,y,z) quantities, energy and virial with a deterministic reduction.
+ * <hr>
+ * Each thread adds into its own nArrays arrays of nAtoms*3 REALs (gradient, torque, field...) and marks the
+ * BUFFER_BLOCK atom blocks it wrote with threadBuffersMark. The reduction is parallel over blocks: every block
+ * adds the threads that wrote it in thread order, then zeroes them again, so only written memory is touched
+ * and the buffers are ready for the next evaluation without a memset.
+ * <p>
+ * Energy and virial go into each thread's tally, one cache line apart, and are summed in thread order as well.
+ * Kernels that also hand out atoms to threads in a fixed order (static schedules) therefore give bitwise
+ * identical energies and gradients from run to run with the same number of threads.
+ */
+#define BUFFER_BLOCK 64 // Atoms per reduction block, 1.5 KB of each double array
+#define TALLY_ENERGY 0
+#define TALLY_VIRIAL 1 // xx, xy, xz, yx, yy, yz, zx, zy, zz
+#define TALLY_STRIDE 16 // REALs per thread tally, 10 used
+
+typedef struct ThreadBuffers {
+  int nThreads;
+  int nAtoms;
+  int nArrays; // Per-atom arrays each thread accumulates into
+  int nBlocks; // ceil(nAtoms/BUFFER_BLOCK)
+  REAL** arrays; // Array a of thread t starts at arrays[t] + a*nAtoms*3 [nThreads][nArrays*nAtoms*3]
+  bool** written; // Blocks each thread wrote since the last reduction [nThreads][nBlocks]
+  REAL* tally; // Energy and virial of each thread [nThreads][TALLY_STRIDE]
+} ThreadBuffers;
+
+ThreadBuffers* threadBuffersCreate(int nAtoms, int nArrays);
+void threadBuffersDestroy(ThreadBuffers* buffers);
+REAL threadBuffersReduce(ThreadBuffers* buffers, REAL** out, REAL* virial);
+
+/**
+ * Thread t's copy of array a.
+ */
+static inline REAL* threadArray(ThreadBuffers* buffers, int t, int a) {
+  return buffers->arrays[t] + (long) a*buffers->nAtoms*3;
+}
+
+/**
+ * Records that thread t wrote to atom i, in any of its arrays.
+ */
+static inline void threadBuffersMark(ThreadBuffers* buffers, int t, int i) {
+  buffers->written[t][i/BUFFER_BLOCK] = true;
+}
+
+/////////////////////////////////////////// TESTS
+
+void threadBuffersTest(bool verbose);
+
+#endif //THREADBUFFERS_H
@@ -0,0 +1,131 @@
+// Author(s): Matthew Speranza
+#ifndef TIMERS_H
+#define TIMERS_H
+#include <stdbool.h>
+
+/**
+ * Named, nested wall clock timers and event counters for the whole run, printed as a table by md.c and optionally
+ * dumped as JSON (key timer-json).
+ * <hr>
+ * TIMER_START/TIMER_STOP pairs nest: every thread keeps a tree of the timers it opened inside each other, so the
+ * same timer shows up under each caller it was reached from (a Verlet build during setup and during a step are two
+ * nodes). Starting a timer walks the children of the open node and reads CLOCK_MONOTONIC, stopping one adds the
+ * elapsed time to the node, with no locks or allocation. Threads only touch their own tree and counters, so both
+ * may be used inside parallel regions, including regions nested in the batch command's thread pool; the report sums
+ * counters over threads and lists any worker thread's timers after the main thread's.
+ * <p>
+ * With a trace file set (key trace-json) every stopped timer is also recorded as an event with its start and
+ * duration in a ring buffer of TRACE_MAX_EVENTS per thread, which keeps the latest events once it is full. Each
+ * thread only writes its own buffer, so recording takes no locks. timersWriteTrace writes them in the Chrome trace
+ * event format (one complete "X" event per call, a track per thread) for chrome://tracing or ui.perfetto.dev,
+ * where the pair loops threads run inside the force evaluation show their imbalance.
+ * <p>
+ * With the key perf-counters every thread also opens a group of hardware counters (Linux perf_event_open, user
+ * space only) the first time it starts a timer: cycles, instructions, L1 data cache read misses, last level cache
+ * misses and branch misses. Each timer then reads them when it starts and stops and adds the difference, so a phase
+ * counts what its children do as well. TIMER_ITEMS adds to the work done by the innermost running timer (pairs in
+ * the pair loops, atoms in the per-atom phases), and the report gives the IPC and the cycles and misses per item,
+ * or per call for phases that count no items. Counters a CPU or virtual machine doesn't have are left out, and if
+ * none can be opened (no PMU, perf_event_paranoid > 2, not Linux) the run just goes on with the timers.
+ * <p>
+ * Built without TIMERS (cmake -DTIMERS=OFF) the macros expand to nothing and their arguments are never evaluated.
+ * The functions stay available for tests. timerNow is the wall clock for everything that is timed in any build,
+ * like throughput.
+ * <p>
+ * The output keys are global to the process, so only energy, dynamics and replica, which run one key file, apply
+ * them. For any command the environment variables MDC_TIMER_JSON, MDC_TRACE_JSON and MDC_PERF_COUNTERS set the same
+ * once at the start (timersFromEnvironment), and batch job keys may not have them.
+ */
+#define TIMER_MAX_THREADS 256
+#define TIMER_MAX_NODES 128 // Tree nodes per thread
+#define TRACE_MAX_EVENTS 65536 // Ring buffer per thread
+
+enum TimerID {
+  TIMER_TOTAL,
+  TIMER_PARSE,
+  TIMER_BONDED,
+  TIMER_VERLET_UPDATE,
+  TIMER_VERLET_BUILD,
+  TIMER_SETUP,
+  TIMER_FORCE,
+  TIMER_ROTATE,
+  TIMER_REAL_SPACE,
+  TIMER_POLARIZE,
+  TIMER_TORQUE,
+  TIMER_PAIRS,
+  TIMER_FIELD_PAIRS,
+  TIMER_REDUCE,
+  TIMER_DYNAMICS,
+  TIMER_INTEGRATE,
+  TIMER_CONSTRAIN,
+  TIMER_THERMOSTAT,
+  TIMER_BAROSTAT,
+  TIMER_OUTPUT,
+  TIMER_MBAR,
+  TIMER_BAR,
+  TIMER_NEWTON,
+  TIMER_COVARIANCE,
+  N_TIMERS
+};
+
+enum HardwareEvent {
+  HW_CYCLES,
+  HW_INSTRUCTIONS,
+  HW_L1_MISSES,
+  HW_LLC_MISSES,
+  HW_BRANCH_MISSES,
+  N_HW_EVENTS
+};
+
+enum CounterID {
+  COUNTER_STEPS,
+  COUNTER_FORCE_EVALUATIONS,
+  COUNTER_VERLET_BUILDS,
+  COUNTER_VERLET_PAIRS,
+  COUNTER_POLARIZATION_ITERATIONS,
+  COUNTER_SHAKE_ITERATIONS,
+  COUNTER_RATTLE_ITERATIONS,
+  COUNTER_VOLUME_MOVES,
+  COUNTER_VOLUME_ACCEPTED,
+  N_COUNTERS
+};
+
+#ifdef TIMERS
+#define TIMER_START(id) timerStart(id)
+#define TIMER_STOP(id) timerStop(id)
+#define COUNTER_ADD(id, n) counterAdd(id, n)
+#define TIMER_ITEMS(n) timerItems(n)
+#else
+#define TIMER_START(id) ((void) 0)
+#define TIMER_STOP(id) ((void) 0)
+#define COUNTER_ADD(id, n) ((void) sizeof(n))
+#define TIMER_ITEMS(n) ((void) sizeof(n))
+#endif
+
+void timerStart(enum TimerID id);
+void timerStop(enum TimerID id);
+void counterAdd(enum CounterID id, long n);
+void timerItems(long n);
+const char* timerName(enum TimerID id);
+double timerSeconds(enum TimerID id);
+double timerPathSeconds(enum TimerID from, const enum TimerID* path, int depth);
+double timerNow();
+long counterTotal(enum CounterID id);
+void timersReset();
+void timersPrint();
+void timersWriteJSON(const char* path);
+void timersSetJSON(const char* path);
+const char* timersJSONPath();
+void timersWriteTrace(const char* path);
+void timersSetTrace(const char* path);
+const char* timersTracePath();
+void timersSetHardware(bool enable);
+void timersFromEnvironment();
+bool timersHardwareOpen();
+long long timerHardware(enum TimerID id, enum HardwareEvent event);
+
+/////////////////////////////////////////// TESTS
+
+void timersTest(bool verbose);
+
+#endif //TIMERS_H
@@ -0,0 +1,92 @@
+// Author(s): Matthew Speranza
+#ifndef TYPEDVECTOR_H
+#define TYPEDVECTOR_H
+#include <stdbool.h>
+#include <string.h>
+#include "memoryTracker.h"
+
+/**
+ * Dynamic arrays specialized for one element type, for the lists that are built element by element.
+ * <hr>
+ * TYPED_VECTOR(Name, name, T) defines the struct Name {T* array; int size, capacity; MemoryTag} and static inline
+ * functions around it, so an append is a capacity check and a store the compiler can inline, instead of
+ * vectorAppend's call and switch over the DataType. Elements are stored by value: structs live in the array
+ * itself, not behind a pointer each.
+ * <ul>
+ * <li>nameInit(vec, capacity, tag) allocates exactly capacity elements (none for 0) under tag. A zeroed Name is a
+ * valid empty vector as well.
+ * <li>namePush(vec, value) appends, doubling the capacity when full, so appends are amortized O(1).
+ * <li>nameEmplace(vec) appends a zeroed element and returns it to be filled in place.
+ * <li>nameReserve(vec, capacity) grows to exactly capacity if it is larger, for lists whose size is known.
+ * <li>nameShrink(vec) gives the unused capacity back with realloc, which shrinks blocks in place instead of
+ * copying them.
+ * <li>nameFree(vec) frees the array and leaves an empty vector.
+ * </ul>
+ * The struct keeps array and size under the same names as Vector so loops over either read the same.
+ */
+#define TYPED_VECTOR(Name, name, T)                                                                                 \
+typedef struct Name {                                                                                               \
+  T* array;                                                                                                         \
+  int size;                                                                                                         \
+  int capacity;                                                                                                     \
+  enum MemoryTag memoryTag;                                                                                         \
+} Name;                                                                                                             \
+                                                                                                                    \
+static inline void name##Init(Name* vec, int capacity, enum MemoryTag tag) {                                        \
+  vec->array = capacity > 0 ? memoryMalloc(sizeof(T)*(size_t) capacity, tag) : NULL;                                \
+  vec->size = 0;                                                                                                    \
+  vec->capacity = capacity > 0 ? capacity : 0;                                                                      \
+  vec->memoryTag = tag;                                                                                             \
+}                                                                                                                   \
+                                                                                                                    \
+static inline void name##Reserve(Name* vec, int capacity) {                                                         \
+  if(capacity > vec->capacity) {                                                                                    \
+    vec->array = memoryRealloc(vec->array, sizeof(T)*(size_t) capacity, vec->memoryTag);                            \
+    vec->capacity = capacity;                                                                                       \
+  }                                                                                                                 \
+}                                                                                                                   \
+                                                                                                                    \
+static inline void name##Grow(Name* vec) {                                                                          \
+  name##Reserve(vec, vec->capacity < 4 ? 8 : 2*vec->capacity);                                                      \
+}                                                                                                                   \
+                                                                                                                    \
+static inline void name##Push(Name* vec, T value) {                                                                 \
+  if(vec->size == vec->capacity) {                                                                                  \
+    name##Grow(vec);                                                                                                \
+  }                                                                                                                 \
+  vec->array[vec->size++] = value;                                                                                  \
+}                                                                                                                   \
+                                                                                                                    \
+static inline T* name##Emplace(Name* vec) {                                                                         \
+  if(vec->size == vec->capacity) {                                                                                  \
+    name##Grow(vec);                                                                                                \
+  }                                                                                                                 \
+  T* element = &vec->array[vec->size++];                                                                            \
+  memset(element, 0, sizeof(T));                                                                                   \
+  return element;                                                                                                   \
+}                                                                                                                   \
+                                                                                                                    \
+static inline void name##Shrink(Name* vec) {                                                                        \
+  if(vec->size == 0) {                                                                                              \
+    memoryFree(vec->array, vec->memoryTag);                                                                         \
+    vec->array = NULL;                                                                                              \
+  } else if(vec->size < vec->capacity) {                                                                            \
+    vec->array = memoryRealloc(vec->array, sizeof(T)*(size_t) vec->size, vec->memoryTag);                           \
+  }                                                                                                                 \
+  vec->capacity = vec->size;                                                                                        \
+}                                                                                                                   \
+                                                                                                                    \
+static inline void name##Free(Name* vec) {                                                                          \
+  memoryFree(vec->array, vec->memoryTag);                                                                           \
+  vec->array = NULL;                                                                                                \
+  vec->size = 0;                                                                                                    \
+  vec->capacity = 0;                                                                                                \
+}
+
+TYPED_VECTOR(IntVector, intVector, int)
+
+/////////////////////////////////////////// TESTS
+
+void typedVectorTest(bool verbose);
+
+#endif //TYPEDVECTOR_H
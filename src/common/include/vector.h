@@ -2,11 +2,13 @@
 #ifndef VECTOR_H
 #define VECTOR_H
 #include <stdbool.h>
+#include "memoryTracker.h"
 
 /**
  * Vector implementation that handles all memory allocations, reallocations, and frees.
  * All the user needs to do is pass in a method for freeing complex datatypes via cbFree,
  * and call vectorCreate/vectorFree.
+ * The backing array is counted under the vector's MemoryTag, MEMORY_VECTORS unless created with vectorCreateTagged.
  */
 enum DataType {INT, INT_PTR, LONG, LONG_PTR, FLOAT, FLOAT_PTR, DOUBLE, DOUBLE_PTR, BOOL, BOOL_PTR, CHAR, CHAR_PTR, OTHER};
 typedef void(*CallbackFree)(void *, int bufSize);
@@ -17,9 +19,12 @@ typedef struct Vector {
   int size; // aka next index
   void* array;
   CallbackFree callbackFree;
+  enum MemoryTag memoryTag;
 } Vector;
 
 Vector* vectorCreate(int bytesPerElement, int initialCapacity, CallbackFree cbFree, enum DataType dt);
+Vector* vectorCreateTagged(int bytesPerElement, int initialCapacity, CallbackFree cbFree, enum DataType dt,
+                           enum MemoryTag tag);
 Vector* vectorFromArray(int bytesPerElement, int newCapacity, CallbackFree cbFree, void* initArray);
 Vector* vectorCopy(Vector* vec);
 void vectorBackingFree(Vector* vec);
@@ -0,0 +1,306 @@
+// Author(s): Matthew Speranza
+#include "../include/barostat.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/neighborList.h"
+#include "../include/philox.h"
+
+/**
+ * Finds the molecules (connected components of System->list12) and allocates the saved state of a move.
+ * System->M is used for the centers of mass, every atom weighs the same without it.
+ */
+Barostat* barostatCreate(System* system) {
+  const int nAtoms = system->nAtoms;
+  Barostat* b = calloc(1, sizeof(Barostat));
+  if(b == NULL) {
+    printf("Failed to allocate the barostat!\n");
+    exit(1);
+  }
+  b->moleculeStart = malloc(sizeof(int)*(nAtoms + 1));
+  b->moleculeAtoms = malloc(sizeof(int)*nAtoms);
+  b->moleculeMass = malloc(sizeof(REAL)*nAtoms);
+  b->XSave = malloc(sizeof(REAL)*nAtoms*3);
+  b->FSave[0] = malloc(sizeof(REAL)*nAtoms*3);
+  b->FSave[1] = system->integrator == RESPA ? malloc(sizeof(REAL)*nAtoms*3) : NULL;
+  bool* seen = calloc(nAtoms, sizeof(bool));
+  if(b->moleculeStart == NULL || b->moleculeAtoms == NULL || b->moleculeMass == NULL || b->XSave == NULL
+     || b->FSave[0] == NULL || (system->integrator == RESPA && b->FSave[1] == NULL) || seen == NULL) {
+    printf("Failed to allocate the barostat!\n");
+    exit(1);
+  }
+  // Breadth first search, moleculeAtoms doubles as the queue
+  int nSorted = 0;
+  for(int root = 0; root < nAtoms; root++) {
+    if(seen[root]) {
+      continue;
+    }
+    b->moleculeStart[b->nMolecules] = nSorted;
+    b->moleculeMass[b->nMolecules] = 0.0;
+    seen[root] = true;
+    b->moleculeAtoms[nSorted++] = root;
+    for(int q = b->moleculeStart[b->nMolecules]; q < nSorted; q++) {
+      int i = b->moleculeAtoms[q];
+      b->moleculeMass[b->nMolecules] += system->M != NULL ? system->M[i] : 1.0;
+      if(system->list12 == NULL) {
+        continue;
+      }
+      const int* bonded = system->list12[i].array;
+      for(int k = 0; k < system->list12[i].size; k++) {
+        if(!seen[bonded[k]]) {
+          seen[bonded[k]] = true;
+          b->moleculeAtoms[nSorted++] = bonded[k];
+        }
+      }
+    }
+    b->nMolecules++;
+  }
+  b->moleculeStart[b->nMolecules] = nSorted;
+  free(seen);
+  b->volumeMove = system->volumeMove;
+  return b;
+}
+
+void barostatDestroy(Barostat* b) {
+  free(b->moleculeStart);
+  free(b->moleculeAtoms);
+  free(b->moleculeMass);
+  free(b->XSave);
+  free(b->FSave[0]);
+  free(b->FSave[1]);
+  free(b);
+}
+
+/**
+ * Scales the box and every molecule's center of mass by s about the origin, each atom moves with its molecule's
+ * center. Also updates System->volume and System->density.
+ */
+void scaleMolecules(System* system, Barostat* b, REAL s) {
+  REAL* X = system->X;
+  const REAL* M = system->M;
+  const int* start = b->moleculeStart;
+  const int* atoms = b->moleculeAtoms;
+  const REAL* moleculeMass = b->moleculeMass;
+  REAL totalMass = 0.0;
+#pragma omp parallel for reduction(+:totalMass) schedule(static)
+  for(int m = 0; m < b->nMolecules; m++) {
+    REAL center[3] = {0.0, 0.0, 0.0};
+    for(int q = start[m]; q < start[m+1]; q++) {
+      int i = atoms[q];
+      REAL mass = M != NULL ? M[i] : 1.0;
+      for(int k = 0; k < 3; k++) {
+        center[k] += mass*X[i*3+k];
+      }
+    }
+    REAL shift[3];
+    for(int k = 0; k < 3; k++) {
+      shift[k] = moleculeMass[m] > 0.0 ? (s - 1.0)*center[k]/moleculeMass[m] : 0.0;
+    }
+    for(int q = start[m]; q < start[m+1]; q++) {
+      int i = atoms[q];
+      for(int k = 0; k < 3; k++) {
+        X[i*3+k] += shift[k];
+      }
+    }
+    totalMass += moleculeMass[m];
+  }
+  for(int a = 0; a < 3; a++) {
+    for(int k = 0; k < 3; k++) {
+      system->boxDim[a][k] *= s;
+    }
+  }
+  system->volume *= s*s*s;
+  system->density = totalMass/system->volume;
+}
+
+/**
+ * Counts a move into the adaptation window, after every VOLUME_ADAPT_TRIALS moves the largest volume change shrinks
+ * by 10% if fewer than a quarter were accepted and grows by 10% if more than three quarters were, up to a tenth of
+ * the volume.
+ */
+void adaptVolumeMove(Barostat* b, REAL volume) {
+  if(b->windowTrials < VOLUME_ADAPT_TRIALS) {
+    return;
+  }
+  if(4*b->windowAccepted < b->windowTrials) {
+    b->volumeMove *= 0.9;
+  } else if(4*b->windowAccepted > 3*b->windowTrials) {
+    b->volumeMove = fmin(1.1*b->volumeMove, 0.1*volume);
+  }
+  b->windowTrials = b->windowAccepted = 0;
+}
+
+/////////////////////////////////////////// TESTS
+
+/**
+ * Every pair within the cutoff (minimum image) must be in one of the two Verlet lists.
+ * @return pairs within the cutoff that are missing
+ */
+static int missingPairs(System* system) {
+  const REAL cutoff2 = system->realspaceCutoff*system->realspaceCutoff;
+  int missing = 0;
+  for(int i = 0; i < system->nAtoms; i++) {
+    for(int j = i+1; j < system->nAtoms; j++) {
+      REAL r2 = 0.0;
+      for(int k = 0; k < 3; k++) {
+        REAL dx = imageDx(system->X[j*3+k] - system->X[i*3+k], system->boxDim[k][k]);
+        r2 += dx*dx;
+      }
+      if(r2 > cutoff2) {
+        continue;
+      }
+      bool found = false;
+      const int* listI = system->verletList[i].array;
+      const int* listJ = system->verletList[j].array;
+      for(int n = 0; n < system->verletList[i].size && !found; n++) {
+        found = listI[n] == j;
+      }
+      for(int n = 0; n < system->verletList[j].size && !found; n++) {
+        found = listJ[n] == i;
+      }
+      missing += !found;
+    }
+  }
+  return missing;
+}
+
+void barostatTest(bool verbose) {
+  // 6x6x6 sites 4 ANG apart, alternately a bent triatomic (masses 16, 1, 1) and a single ion (23)
+  const int nSide = 6, nSites = nSide*nSide*nSide;
+  const REAL spacing = 4.0;
+  int nAtoms = 0;
+  for(int site = 0; site < nSites; site++) {
+    nAtoms += site % 2 == 0 ? 3 : 1;
+  }
+  System* system = calloc(1, sizeof(System));
+  system->nAtoms = nAtoms;
+  system->realspaceCutoff = 5.0;
+  system->realspaceBuffer = 2.0;
+  system->X = malloc(sizeof(REAL)*nAtoms*3);
+  system->M = malloc(sizeof(REAL)*nAtoms);
+  system->list12 = malloc(sizeof(IntVector)*nAtoms);
+  if(system->X == NULL || system->M == NULL || system->list12 == NULL) {
+    printf("Failed to allocate the system in barostatTest\n");
+    exit(1);
+  }
+  for(int k = 0; k < 3; k++) {
+    system->boxDim[k][k] = nSide*spacing;
+    system->minDim[k] = 0.0;
+  }
+  const REAL offsets[3][3] = {{0.0, 0.0, 0.0}, {0.96, 0.0, 0.0}, {-0.24, 0.93, 0.0}};
+  int i = 0;
+  for(int site = 0; site < nSites; site++) {
+    REAL u[4];
+    philoxUniforms(7, 0, 0, site, u);
+    int size = site % 2 == 0 ? 3 : 1;
+    for(int s = 0; s < size; s++, i++) {
+      system->M[i] = size == 1 ? 23.0 : (s == 0 ? 16.0 : 1.0);
+      intVectorInit(&system->list12[i], 2, MEMORY_STRUCTURE);
+      int cell[3] = {site % nSide, (site/nSide) % nSide, site/(nSide*nSide)};
+      for(int k = 0; k < 3; k++) {
+        system->X[i*3+k] = spacing*cell[k] + 0.5*(u[k] - 0.5) + offsets[s][k];
+      }
+      if(s > 0) {
+        int first = i - s;
+        intVectorPush(&system->list12[i], first);
+        intVectorPush(&system->list12[first], i);
+      }
+    }
+  }
+  buildVerlet(system);
+  const REAL volume0 = system->volume;
+  VerletCells* cells = system->verletCells;
+
+  // Molecules and their masses
+  Barostat* b = barostatCreate(system);
+  assert(b->nMolecules == nSites);
+  REAL heaviest = 0.0, lightest = INFINITY;
+  for(int m = 0; m < b->nMolecules; m++) {
+    heaviest = fmax(heaviest, b->moleculeMass[m]);
+    lightest = fmin(lightest, b->moleculeMass[m]);
+  }
+  assert(heaviest == 23.0 && lightest == 18.0);
+
+  // Scaling moves centers of mass by s and leaves the molecules rigid
+  REAL* X0 = malloc(sizeof(REAL)*nAtoms*3);
+  if(X0 == NULL) {
+    printf("Failed to allocate positions in barostatTest\n");
+    exit(1);
+  }
+  memcpy(X0, system->X, sizeof(REAL)*nAtoms*3);
+  const REAL s = cbrt(1.004);
+  scaleMolecules(system, b, s);
+  REAL worstCenter = 0.0, worstBond = 0.0;
+  for(int m = 0; m < b->nMolecules; m++) {
+    REAL before[3] = {0.0, 0.0, 0.0}, after[3] = {0.0, 0.0, 0.0};
+    for(int q = b->moleculeStart[m]; q < b->moleculeStart[m+1]; q++) {
+      int a = b->moleculeAtoms[q];
+      for(int k = 0; k < 3; k++) {
+        before[k] += system->M[a]*X0[a*3+k]/b->moleculeMass[m];
+        after[k] += system->M[a]*system->X[a*3+k]/b->moleculeMass[m];
+      }
+    }
+    for(int k = 0; k < 3; k++) {
+      worstCenter = fmax(worstCenter, fabs(after[k] - s*before[k]));
+    }
+    int first = b->moleculeAtoms[b->moleculeStart[m]];
+    for(int q = b->moleculeStart[m] + 1; q < b->moleculeStart[m+1]; q++) {
+      int a = b->moleculeAtoms[q];
+      for(int k = 0; k < 3; k++) {
+        REAL dNew = system->X[a*3+k] - system->X[first*3+k];
+        REAL dOld = X0[a*3+k] - X0[first*3+k];
+        worstBond = fmax(worstBond, fabs(dNew - dOld));
+      }
+    }
+  }
+  if(verbose) {
+    printf("Scaled volume by %.4f: center of mass error %.3e ANG, intramolecular change %.3e ANG\n",
+           system->volume/volume0, worstCenter, worstBond);
+  }
+  assert(worstCenter < 1e-12 && worstBond < 1e-12);
+  assert(fabs(system->volume/volume0 - 1.004) < 1e-12);
+  assert(fabs(system->boxDim[1][1] - s*nSide*spacing) < 1e-12);
+
+  // The lists survive small volume moves without a rebuild and stay complete
+  assert(!updateVerlet(system) && cells->nBuilds == 1);
+  assert(missingPairs(system) == 0);
+  scaleMolecules(system, b, cbrt(0.93/1.004));
+  assert(!updateVerlet(system) && cells->nBuilds == 1);
+  int missing = missingPairs(system);
+  if(verbose) {
+    printf("After volume moves to %.3f of the build volume: %d Verlet builds, %d pairs missing\n",
+           system->volume/volume0, cells->nBuilds, missing);
+  }
+  assert(missing == 0);
+  // A large compression eats the buffer and rebuilds
+  scaleMolecules(system, b, 0.75);
+  assert(updateVerlet(system) && cells->nBuilds == 2);
+  assert(missingPairs(system) == 0);
+  assert(cells->boxBuild[0] == system->boxDim[0][0]);
+
+  // Adaptation of the move size
+  b->volumeMove = 100.0;
+  b->windowTrials = VOLUME_ADAPT_TRIALS;
+  b->windowAccepted = 1;
+  adaptVolumeMove(b, system->volume);
+  assert(fabs(b->volumeMove - 90.0) < 1e-12 && b->windowTrials == 0);
+  b->windowTrials = b->windowAccepted = VOLUME_ADAPT_TRIALS;
+  adaptVolumeMove(b, system->volume);
+  assert(fabs(b->volumeMove - 99.0) < 1e-12);
+
+  barostatDestroy(b);
+  verletDestroy(system);
+  for(int a = 0; a < nAtoms; a++) {
+    intVectorFree(&system->list12[a]);
+  }
+  free(X0);
+  free(system->list12);
+  free(system->M);
+  free(system->X);
+  free(system);
+  printf("All tests of barostat.c passed!\n");
+}
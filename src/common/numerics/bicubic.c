@@ -0,0 +1,334 @@
+// Author(s): Matthew Speranza
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/bicubic.h"
+
+BicubicTable* bicubicTableCreate() {
+  BicubicTable* table = calloc(1, sizeof(BicubicTable));
+  if(table == NULL) {
+    printf("Failed to allocate bicubic table!\n");
+    exit(1);
+  }
+  return table;
+}
+
+void bicubicTableDestroy(BicubicTable* table) {
+  free(table->grids);
+  free(table->coefficients);
+  free(table);
+}
+
+/**
+ * Slopes of the cubic spline through n uniformly spaced values f[i*stride], written to slope[i*stride]. Periodic
+ * splines expect f[n-1] == f[0], natural splines have zero curvature at both ends.
+ */
+static void splineSlopes(int n, REAL h, bool periodic, const REAL* f, int stride, REAL* slope) {
+  // Second derivatives from M(i-1) + 4*M(i) + M(i+1) = 6*(f(i+1) - 2*f(i) + f(i-1))/h^2, solved densely since
+  // grids are tiny and this only runs at parse time
+  int m = periodic ? n-1 : n;
+  REAL* A = calloc(m*(m+1), sizeof(REAL));
+  REAL* M = malloc(sizeof(REAL)*n);
+  if(A == NULL || M == NULL) {
+    printf("Failed to allocate spline system!\n");
+    exit(1);
+  }
+  for(int i = 0; i < m; i++) {
+    REAL* row = A + i*(m+1);
+    if(!periodic && (i == 0 || i == m-1)) {
+      row[i] = 1.0;
+      continue;
+    }
+    int prev = (i - 1 + m) % m, next = (i + 1) % m;
+    row[prev] += 1.0;
+    row[i] += 4.0;
+    row[next] += 1.0;
+    row[m] = 6.0*(f[next*stride] - 2.0*f[i*stride] + f[prev*stride])/(h*h);
+  }
+  // Gaussian elimination with partial pivoting on the augmented matrix
+  for(int c = 0; c < m; c++) {
+    int pivot = c;
+    for(int r = c+1; r < m; r++) {
+      pivot = fabs(A[r*(m+1)+c]) > fabs(A[pivot*(m+1)+c]) ? r : pivot;
+    }
+    for(int k = 0; k <= m; k++) {
+      REAL swap = A[c*(m+1)+k];
+      A[c*(m+1)+k] = A[pivot*(m+1)+k];
+      A[pivot*(m+1)+k] = swap;
+    }
+    for(int r = c+1; r < m; r++) {
+      REAL factor = A[r*(m+1)+c]/A[c*(m+1)+c];
+      for(int k = c; k <= m; k++) {
+        A[r*(m+1)+k] -= factor*A[c*(m+1)+k];
+      }
+    }
+  }
+  for(int r = m-1; r >= 0; r--) {
+    REAL sum = A[r*(m+1)+m];
+    for(int k = r+1; k < m; k++) {
+      sum -= A[r*(m+1)+k]*M[k];
+    }
+    M[r] = sum/A[r*(m+1)+r];
+  }
+  if(periodic) {
+    M[n-1] = M[0];
+  }
+  for(int i = 0; i < n-1; i++) {
+    slope[i*stride] = (f[(i+1)*stride] - f[i*stride])/h - h*(2.0*M[i] + M[i+1])/6.0;
+  }
+  slope[(n-1)*stride] = periodic ? slope[0] : (f[(n-1)*stride] - f[(n-2)*stride])/h + h*(M[n-2] + 2.0*M[n-1])/6.0;
+  free(A);
+  free(M);
+}
+
+/**
+ * Adds one grid given as nX*nY (x, y, f) triples with x running fastest, the order of Tinker's tortors blocks.
+ * Exits if the grid isn't uniform.
+ * @return index of the grid in the table
+ */
+int bicubicTableAdd(BicubicTable* table, int nX, int nY, const REAL* x, const REAL* y, const REAL* f) {
+  if(nX < 2 || nY < 2) {
+    printf("Bicubic grids need at least 2x2 points (got %dx%d)!\n", nX, nY);
+    exit(1);
+  }
+  BicubicGrid grid;
+  grid.nX = nX;
+  grid.nY = nY;
+  grid.x0 = x[0];
+  grid.y0 = y[0];
+  grid.dx = (x[nX-1] - x[0])/(nX-1);
+  grid.dy = (y[(nY-1)*nX] - y[0])/(nY-1);
+  for(int j = 0; j < nY; j++) {
+    for(int i = 0; i < nX; i++) {
+      if(fabs(x[j*nX+i] - (grid.x0 + i*grid.dx)) > 1e-6 || fabs(y[j*nX+i] - (grid.y0 + j*grid.dy)) > 1e-6) {
+        printf("Torsion grid is not uniform at point (%f, %f)!\n", x[j*nX+i], y[j*nX+i]);
+        exit(1);
+      }
+    }
+  }
+  grid.periodicX = fabs((nX-1)*grid.dx - 360.0) < 1e-6;
+  grid.periodicY = fabs((nY-1)*grid.dy - 360.0) < 1e-6;
+  grid.offset = table->nCoefficients;
+  // Node slopes in degrees, the cross derivative is the y slope of the x slopes
+  int n = nX*nY;
+  REAL* fx = malloc(sizeof(REAL)*n);
+  REAL* fy = malloc(sizeof(REAL)*n);
+  REAL* fxy = malloc(sizeof(REAL)*n);
+  if(fx == NULL || fy == NULL || fxy == NULL) {
+    printf("Failed to allocate bicubic slopes!\n");
+    exit(1);
+  }
+  for(int j = 0; j < nY; j++) {
+    splineSlopes(nX, grid.dx, grid.periodicX, f + j*nX, 1, fx + j*nX);
+  }
+  for(int i = 0; i < nX; i++) {
+    splineSlopes(nY, grid.dy, grid.periodicY, f + i, nX, fy + i);
+    splineSlopes(nY, grid.dy, grid.periodicY, fx + i, nX, fxy + i);
+  }
+  // Grow storage
+  int nCells = (nX-1)*(nY-1);
+  if(table->nGrids == table->gridCapacity) {
+    table->gridCapacity = table->gridCapacity == 0 ? 8 : 2*table->gridCapacity;
+    table->grids = realloc(table->grids, sizeof(BicubicGrid)*table->gridCapacity);
+  }
+  if(table->nCoefficients + nCells*16 > table->coefficientCapacity) {
+    table->coefficientCapacity = 2*(table->nCoefficients + nCells*16);
+    table->coefficients = realloc(table->coefficients, sizeof(REAL)*table->coefficientCapacity);
+  }
+  if(table->grids == NULL || table->coefficients == NULL) {
+    printf("Failed to grow bicubic table!\n");
+    exit(1);
+  }
+  // c = B*F*B^T with F the corner values and slopes scaled to the unit cell
+  const REAL B[4][4] = {{1, 0, 0, 0}, {0, 0, 1, 0}, {-3, 3, -2, -1}, {2, -2, 1, 1}};
+  for(int i = 0; i < nX-1; i++) {
+    for(int j = 0; j < nY-1; j++) {
+      int p00 = j*nX + i, p10 = j*nX + i+1, p01 = (j+1)*nX + i, p11 = (j+1)*nX + i+1;
+      REAL sx = grid.dx, sy = grid.dy, sxy = grid.dx*grid.dy;
+      REAL F[4][4] = {
+        {f[p00], f[p01], sy*fy[p00], sy*fy[p01]},
+        {f[p10], f[p11], sy*fy[p10], sy*fy[p11]},
+        {sx*fx[p00], sx*fx[p01], sxy*fxy[p00], sxy*fxy[p01]},
+        {sx*fx[p10], sx*fx[p11], sxy*fxy[p10], sxy*fxy[p11]}};
+      REAL* c = table->coefficients + grid.offset + (i*(nY-1) + j)*16;
+      for(int a = 0; a < 4; a++) {
+        for(int b = 0; b < 4; b++) {
+          REAL sum = 0.0;
+          for(int k = 0; k < 4; k++) {
+            for(int l = 0; l < 4; l++) {
+              sum += B[a][k]*F[k][l]*B[b][l];
+            }
+          }
+          c[a*4+b] = sum;
+        }
+      }
+    }
+  }
+  free(fx);
+  free(fy);
+  free(fxy);
+  // Force fields repeat grids for different atom classes (e.g. the same phi/psi map for every residue type), which
+  // share one copy of the coefficients
+  for(int k = 0; k < table->nGrids; k++) {
+    BicubicGrid* other = &table->grids[k];
+    if(other->nX == nX && other->nY == nY && other->x0 == grid.x0 && other->y0 == grid.y0 && other->dx == grid.dx
+      && other->dy == grid.dy && memcmp(table->coefficients + other->offset, table->coefficients + grid.offset,
+        sizeof(REAL)*nCells*16) == 0) {
+      return k;
+    }
+  }
+  table->nCoefficients += nCells*16;
+  table->grids[table->nGrids] = grid;
+  return table->nGrids++;
+}
+
+/**
+ * Cell index and fractional position of angle along one axis. Periodic axes wrap, others hold the edge value
+ * outside the grid, which zeroes the slope along that axis.
+ */
+static int locate(REAL angle, REAL origin, REAL spacing, int n, bool periodic, REAL* t, REAL* slopeScale) {
+  REAL s = (angle - origin)/spacing;
+  *slopeScale = 1.0;
+  if(periodic) {
+    s -= (n-1)*floor(s/(n-1));
+  } else if(s < 0.0 || s > n-1) {
+    s = s < 0.0 ? 0.0 : n-1;
+    *slopeScale = 0.0;
+  }
+  int cell = (int) s;
+  cell = cell > n-2 ? n-2 : cell;
+  *t = s - cell;
+  return cell;
+}
+
+/**
+ * @param x first angle (degrees)
+ * @param y second angle (degrees)
+ * @param dfdx set to df/dx (per degree)
+ * @param dfdy set to df/dy (per degree)
+ * @return interpolated value
+ */
+REAL bicubicEvaluate(const BicubicTable* table, int grid, REAL x, REAL y, REAL* dfdx, REAL* dfdy) {
+  const BicubicGrid* g = &table->grids[grid];
+  REAL t, u, scaleX, scaleY;
+  int i = locate(x, g->x0, g->dx, g->nX, g->periodicX, &t, &scaleX);
+  int j = locate(y, g->y0, g->dy, g->nY, g->periodicY, &u, &scaleY);
+  const REAL* c = table->coefficients + g->offset + (i*(g->nY-1) + j)*16;
+  REAL f = 0.0, ft = 0.0, fu = 0.0;
+  for(int a = 3; a >= 0; a--) {
+    const REAL* row = c + a*4;
+    REAL value = ((row[3]*u + row[2])*u + row[1])*u + row[0];
+    REAL slope = (3.0*row[3]*u + 2.0*row[2])*u + row[1];
+    ft = ft*t + f;
+    f = f*t + value;
+    fu = fu*t + slope;
+  }
+  *dfdx = scaleX*ft/g->dx;
+  *dfdy = scaleY*fu/g->dy;
+  return f;
+}
+
+/////////////////////////////////////////// TESTS
+
+static REAL periodicFunction(REAL x, REAL y, REAL* dfdx, REAL* dfdy) {
+  const REAL d = M_PI/180.0;
+  *dfdx = d*(cos(x*d)*cos(2*y*d) - 0.3*sin((x+y)*d));
+  *dfdy = d*(-2*sin(x*d)*sin(2*y*d) - 0.3*sin((x+y)*d));
+  return sin(x*d)*cos(2*y*d) + 0.3*cos((x+y)*d);
+}
+
+static void fillGrid(int nX, int nY, REAL x0, REAL y0, REAL dx, REAL dy, REAL* x, REAL* y, REAL* f,
+  REAL (*function)(REAL, REAL, REAL*, REAL*)) {
+  REAL unused;
+  for(int j = 0; j < nY; j++) {
+    for(int i = 0; i < nX; i++) {
+      x[j*nX+i] = x0 + i*dx;
+      y[j*nX+i] = y0 + j*dy;
+      f[j*nX+i] = function(x[j*nX+i], y[j*nX+i], &unused, &unused);
+    }
+  }
+}
+
+static REAL bilinearFunction(REAL x, REAL y, REAL* dfdx, REAL* dfdy) {
+  *dfdx = 0.02 + 1e-4*y;
+  *dfdy = -0.03 + 1e-4*x;
+  return 1.5 + 0.02*x - 0.03*y + 1e-4*x*y;
+}
+
+void bicubicTest(bool verbose) {
+  srand(17);
+  BicubicTable* table = bicubicTableCreate();
+  // Periodic 25x25 grid at 15 degrees (amoebabio09 / CMAP layout)
+  int nX = 25, nY = 25;
+  REAL* x = malloc(sizeof(REAL)*29*29);
+  REAL* y = malloc(sizeof(REAL)*29*29);
+  REAL* f = malloc(sizeof(REAL)*29*29);
+  fillGrid(nX, nY, -180.0, -180.0, 15.0, 15.0, x, y, f, periodicFunction);
+  int periodic = bicubicTableAdd(table, nX, nY, x, y, f);
+  // Non periodic 29x29 grid over +-70 degrees (amoebabio09 proline layout) of a function it reproduces exactly
+  fillGrid(29, 29, -70.0, -70.0, 5.0, 5.0, x, y, f, bilinearFunction);
+  int natural = bicubicTableAdd(table, 29, 29, x, y, f);
+  assert(periodic == 0 && natural == 1 && table->nGrids == 2);
+  assert(table->grids[0].periodicX && table->grids[0].periodicY);
+  assert(!table->grids[1].periodicX && !table->grids[1].periodicY);
+  assert(table->nCoefficients == (24*24 + 28*28)*16);
+  // Nodes are reproduced exactly
+  REAL dfdx, dfdy, ex, ey;
+  for(int k = 0; k < nX*nY; k++) {
+    REAL fx = -180.0 + (k % nX)*15.0, fy = -180.0 + (k / nX)*15.0;
+    REAL value = bicubicEvaluate(table, periodic, fx, fy, &dfdx, &dfdy);
+    assert(fabs(value - periodicFunction(fx, fy, &ex, &ey)) < 1e-12);
+  }
+  // Interpolation error, continuity of the derivatives and periodicity at random points
+  double maxErr = 0.0, maxSlopeErr = 0.0;
+  for(int k = 0; k < 10000; k++) {
+    REAL px = -180.0 + 360.0*rand()/RAND_MAX, py = -180.0 + 360.0*rand()/RAND_MAX;
+    REAL value = bicubicEvaluate(table, periodic, px, py, &dfdx, &dfdy);
+    REAL exact = periodicFunction(px, py, &ex, &ey);
+    maxErr = fmax(maxErr, fabs(value - exact));
+    maxSlopeErr = fmax(maxSlopeErr, fmax(fabs(dfdx - ex), fabs(dfdy - ey))*180.0/M_PI);
+    REAL h = 1e-4, dx1, dy1, dx2, dy2;
+    REAL fdX = (bicubicEvaluate(table, periodic, px+h, py, &dx1, &dy1)
+      - bicubicEvaluate(table, periodic, px-h, py, &dx2, &dy2))/(2*h);
+    REAL fdY = (bicubicEvaluate(table, periodic, px, py+h, &dx1, &dy1)
+      - bicubicEvaluate(table, periodic, px, py-h, &dx2, &dy2))/(2*h);
+    assert(fabs(fdX - dfdx) < 1e-7 && fabs(fdY - dfdy) < 1e-7);
+    REAL wrapped = bicubicEvaluate(table, periodic, px + 360.0, py - 720.0, &dx1, &dy1);
+    assert(fabs(wrapped - value) < 1e-10 && fabs(dx1 - dfdx) < 1e-10 && fabs(dy1 - dfdy) < 1e-10);
+  }
+  if(verbose) {
+    printf("Periodic bicubic max error %.3e, max slope error %.3e per radian\n", maxErr, maxSlopeErr);
+  }
+  assert(maxErr < 1e-3 && maxSlopeErr < 1e-2);
+  // Natural splines are exact for bilinear data, and outside the grid hold the edge value
+  for(int k = 0; k < 1000; k++) {
+    REAL px = -90.0 + 180.0*rand()/RAND_MAX, py = -90.0 + 180.0*rand()/RAND_MAX;
+    REAL value = bicubicEvaluate(table, natural, px, py, &dfdx, &dfdy);
+    REAL cx = fmin(fmax(px, -70.0), 70.0), cy = fmin(fmax(py, -70.0), 70.0);
+    assert(fabs(value - bilinearFunction(cx, cy, &ex, &ey)) < 1e-10);
+    assert(fabs(dfdx - (cx == px)*ex) < 1e-10 && fabs(dfdy - (cy == py)*ey) < 1e-10);
+  }
+  // A repeated grid shares the stored coefficients
+  fillGrid(nX, nY, -180.0, -180.0, 15.0, 15.0, x, y, f, periodicFunction);
+  assert(bicubicTableAdd(table, nX, nY, x, y, f) == periodic && table->nGrids == 2);
+  // Lookup cost
+  int nEval = 1000000;
+  REAL sum = 0.0;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int k = 0; k < nEval; k++) {
+    sum += bicubicEvaluate(table, periodic, -180.0 + 0.00036*k, 170.0 - 0.00034*k, &dfdx, &dfdy) + dfdx + dfdy;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)*1e-9;
+  printf("Bicubic torsion grid lookup: %.1f ns per energy and gradient (checksum %.3f)\n", seconds/nEval*1e9, sum);
+  free(x);
+  free(y);
+  free(f);
+  bicubicTableDestroy(table);
+  printf("All tests of bicubic.c passed!\n");
+}
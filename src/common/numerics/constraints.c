@@ -0,0 +1,646 @@
+// Author(s): Matthew Speranza
+#include "../include/constraints.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int atomClass(ForceField* ff, int type) {
+  Atom* atoms = ff->atom.array;
+  for(int t = 0; t < ff->atom.size; t++) {
+    if(atoms[t].type == type) {
+      return atoms[t].aClass;
+    }
+  }
+  printf("No atom definition for type %d in constraints!\n", type);
+  exit(1);
+}
+
+static REAL bondDistance(ForceField* ff, int class1, int class2) {
+  Bond* bonds = ff->bond.array;
+  for(int b = 0; b < ff->bond.size; b++) {
+    int* c = bonds[b].atomClasses;
+    if((c[0] == class1 && c[1] == class2) || (c[0] == class2 && c[1] == class1)) {
+      return bonds[b].distance;
+    }
+  }
+  printf("No bond parameter for atom classes %d %d to constrain!\n", class1, class2);
+  exit(1);
+}
+
+/**
+ * @return ideal angle (degrees) of the angle parameter with the given center class
+ */
+static REAL angleValue(ForceField* ff, int class1, int center, int class3) {
+  Angle* angles = ff->angle.array;
+  for(int a = 0; a < ff->angle.size; a++) {
+    int* c = angles[a].aClasses;
+    if(c[1] == center && ((c[0] == class1 && c[2] == class3) || (c[0] == class3 && c[2] == class1))) {
+      return angles[a].angle[0];
+    }
+  }
+  printf("No angle parameter for atom classes %d %d %d to constrain!\n", class1, center, class3);
+  exit(1);
+}
+
+/**
+ * An oxygen bonded to two hydrogens that have no other bonds.
+ */
+bool isWater(System* system, int i) {
+  const IntVector* bonded = &system->list12[i];
+  if(system->protons[i] != 8 || bonded->size != 2) {
+    return false;
+  }
+  for(int k = 0; k < 2; k++) {
+    int h = ((int*) bonded->array)[k];
+    if(system->protons[h] != 1 || system->list12[h].size != 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * SHAKE (Ryckaert, Ciccotti and Berendsen, J. Comput. Phys. 23, 327 (1977)) of one cluster of bonds: each pass moves
+ * both atoms of every violated bond along its reference vector, weighted by inverse mass, until all lengths are
+ * within SHAKE_TOLERANCE. The displacement divided by dt is added to V unless it is NULL.
+ * @return passes over the cluster
+ */
+static int shakeCluster(const int* bond, const REAL* length, int nBonds, const REAL* M, const REAL* XRef,
+                        REAL* X, REAL* V, REAL invDt) {
+  for(int iter = 1; iter <= CONSTRAINT_MAX_ITERATIONS; iter++) {
+    bool done = true;
+    for(int b = 0; b < nBonds; b++) {
+      int i = bond[b*2], j = bond[b*2+1];
+      REAL d2 = length[b]*length[b];
+      REAL s[3], r[3];
+      REAL s2 = 0.0, sr = 0.0;
+      for(int k = 0; k < 3; k++) {
+        s[k] = X[j*3+k] - X[i*3+k];
+        r[k] = XRef[j*3+k] - XRef[i*3+k];
+        s2 += s[k]*s[k];
+        sr += s[k]*r[k];
+      }
+      REAL diff = d2 - s2;
+      if(fabs(diff) <= 2.0*SHAKE_TOLERANCE*d2) {
+        continue;
+      }
+      done = false;
+      REAL wi = 1.0/M[i], wj = 1.0/M[j];
+      REAL g = diff/(2.0*sr*(wi + wj));
+      for(int k = 0; k < 3; k++) {
+        X[i*3+k] -= g*wi*r[k];
+        X[j*3+k] += g*wj*r[k];
+        if(V != NULL) {
+          V[i*3+k] -= g*wi*r[k]*invDt;
+          V[j*3+k] += g*wj*r[k]*invDt;
+        }
+      }
+    }
+    if(done) {
+      return iter;
+    }
+  }
+  printf("SHAKE failed to converge in %d iterations!\n", CONSTRAINT_MAX_ITERATIONS);
+  exit(1);
+}
+
+/**
+ * RATTLE velocity half of one cluster: removes the relative velocity along every bond until none is above
+ * RATTLE_TOLERANCE.
+ * @return passes over the cluster
+ */
+static int rattleCluster(const int* bond, int nBonds, const REAL* M, const REAL* X, REAL* V) {
+  for(int iter = 1; iter <= CONSTRAINT_MAX_ITERATIONS; iter++) {
+    bool done = true;
+    for(int b = 0; b < nBonds; b++) {
+      int i = bond[b*2], j = bond[b*2+1];
+      REAL r[3];
+      REAL r2 = 0.0, rv = 0.0;
+      for(int k = 0; k < 3; k++) {
+        r[k] = X[j*3+k] - X[i*3+k];
+        r2 += r[k]*r[k];
+        rv += r[k]*(V[j*3+k] - V[i*3+k]);
+      }
+      if(fabs(rv) <= RATTLE_TOLERANCE*sqrt(r2)) {
+        continue;
+      }
+      done = false;
+      REAL wi = 1.0/M[i], wj = 1.0/M[j];
+      REAL g = -rv/(r2*(wi + wj));
+      for(int k = 0; k < 3; k++) {
+        V[i*3+k] -= g*wi*r[k];
+        V[j*3+k] += g*wj*r[k];
+      }
+    }
+    if(done) {
+      return iter;
+    }
+  }
+  printf("RATTLE failed to converge in %d iterations!\n", CONSTRAINT_MAX_ITERATIONS);
+  exit(1);
+}
+
+/**
+ * Finds the constrained waters and bonds of System->constraints, then moves the positions onto the constraints and
+ * removes the velocity along them (if System->V is set). System->M, System->protons and System->list12 must be set.
+ */
+Constraints* constraintsCreate(System* system) {
+  const int nAtoms = system->nAtoms;
+  if(system->M == NULL || system->protons == NULL || system->list12 == NULL) {
+    printf("Constraints need masses, atomic numbers and bonds!\n");
+    exit(1);
+  }
+  ForceField* ff = system->forceField;
+  Constraints* c = calloc(1, sizeof(Constraints));
+  if(c == NULL) {
+    printf("Failed to allocate constraints!\n");
+    exit(1);
+  }
+  c->nAtoms = nAtoms;
+  // Every hydrogen is in at most one constraint, so nAtoms bounds both lists
+  c->water = malloc(sizeof(int)*nAtoms);
+  c->bond = malloc(sizeof(int)*nAtoms*2);
+  c->bondLength = malloc(sizeof(REAL)*nAtoms);
+  c->clusterStart = malloc(sizeof(int)*(nAtoms + 1));
+  c->XRef = malloc(sizeof(REAL)*nAtoms*3);
+  bool* inWater = calloc(nAtoms, sizeof(bool));
+  if(c->water == NULL || c->bond == NULL || c->bondLength == NULL || c->clusterStart == NULL || c->XRef == NULL
+     || inWater == NULL) {
+    printf("Failed to allocate constraints!\n");
+    exit(1);
+  }
+  for(int i = 0; i < nAtoms && system->constraints != NO_CONSTRAINTS; i++) {
+    if(!isWater(system, i)) {
+      continue;
+    }
+    int* bonded = system->list12[i].array;
+    int h1 = bonded[0] < bonded[1] ? bonded[0] : bonded[1];
+    int h2 = bonded[0] < bonded[1] ? bonded[1] : bonded[0];
+    int oClass = atomClass(ff, system->atomTypes[i]);
+    int hClass = atomClass(ff, system->atomTypes[h1]);
+    if(atomClass(ff, system->atomTypes[h2]) != hClass || system->M[h1] != system->M[h2]) {
+      printf("Both hydrogens of water %d must have the same class and mass for SETTLE!\n", i+1);
+      exit(1);
+    }
+    REAL oh = bondDistance(ff, oClass, hClass);
+    REAL hh = 2.0*oh*sin(0.5*angleValue(ff, hClass, oClass, hClass)*M_PI/180.0);
+    if(c->nWaters > 0 && (oh != c->waterOH || hh != c->waterHH)) {
+      printf("Water %d has a different geometry, SETTLE supports one water model!\n", i+1);
+      exit(1);
+    }
+    c->waterOH = oh;
+    c->waterHH = hh;
+    c->water[c->nWaters*3] = i;
+    c->water[c->nWaters*3+1] = h1;
+    c->water[c->nWaters*3+2] = h2;
+    inWater[i] = inWater[h1] = inWater[h2] = true;
+    c->nWaters++;
+  }
+  for(int i = 0; i < nAtoms && system->constraints == HBONDS; i++) {
+    if(inWater[i]) {
+      continue;
+    }
+    int start = c->nBonds;
+    int* bonded = system->list12[i].array;
+    for(int k = 0; k < system->list12[i].size; k++) {
+      int h = bonded[k];
+      // A hydrogen belongs to its heavy atom's cluster, H2 to its first atom
+      if(system->protons[h] != 1 || (system->protons[i] == 1 && h < i)) {
+        continue;
+      }
+      if(system->list12[h].size != 1) {
+        printf("Hydrogen %d has %d bonds, RATTLE clusters need one!\n", h+1, system->list12[h].size);
+        exit(1);
+      }
+      c->bond[c->nBonds*2] = i;
+      c->bond[c->nBonds*2+1] = h;
+      c->bondLength[c->nBonds] = bondDistance(ff, atomClass(ff, system->atomTypes[i]),
+                                              atomClass(ff, system->atomTypes[h]));
+      c->nBonds++;
+    }
+    if(c->nBonds > start) {
+      c->clusterStart[c->nClusters++] = start;
+    }
+  }
+  c->clusterStart[c->nClusters] = c->nBonds;
+  c->nConstraints = 3*c->nWaters + c->nBonds;
+  free(inWater);
+
+  // The starting structure is only near the constraints, so SHAKE everything against itself
+  memcpy(c->XRef, system->X, sizeof(REAL)*nAtoms*3);
+  for(int w = 0; w < c->nWaters; w++) {
+    const int* water = &c->water[w*3];
+    int pairs[6] = {water[0], water[1], water[0], water[2], water[1], water[2]};
+    REAL lengths[3] = {c->waterOH, c->waterOH, c->waterHH};
+    shakeCluster(pairs, lengths, 3, system->M, c->XRef, system->X, NULL, 0.0);
+  }
+  for(int k = 0; k < c->nClusters; k++) {
+    int start = c->clusterStart[k];
+    shakeCluster(&c->bond[start*2], &c->bondLength[start], c->clusterStart[k+1] - start, system->M, c->XRef,
+                 system->X, NULL, 0.0);
+  }
+  if(system->V != NULL) {
+    constrainVelocities(system, c);
+  }
+  return c;
+}
+
+void constraintsDestroy(Constraints* c) {
+  free(c->water);
+  free(c->bond);
+  free(c->bondLength);
+  free(c->clusterStart);
+  free(c->XRef);
+  free(c);
+}
+
+/**
+ * SETTLE positions of every water. The new orientation follows from the old one (XRef) and the unconstrained
+ * positions in a frame with z normal to the old molecular plane, in the notation of Miyamoto and Kollman.
+ */
+static void settlePositions(Constraints* c, const REAL* M, const REAL* XRef, REAL* X, REAL* V, REAL invDt) {
+  const int* water = c->water;
+  const REAL dOH = c->waterOH;
+  const REAL rc = 0.5*c->waterHH;
+  const REAL height = sqrt(dOH*dOH - rc*rc);
+#pragma omp parallel for simd schedule(static)
+  for(int w = 0; w < c->nWaters; w++) {
+    const int a = water[w*3]*3, b = water[w*3+1]*3, cc = water[w*3+2]*3;
+    const REAL mO = M[a/3], mH = M[b/3];
+    const REAL total = mO + 2.0*mH;
+    const REAL ra = 2.0*mH*height/total;
+    const REAL rb = height - ra;
+    // Old bonds from the oxygen, new positions from the new center of mass
+    REAL b0[3], c0[3], com[3], a1[3], b1[3], c1[3];
+    for(int k = 0; k < 3; k++) {
+      b0[k] = XRef[b+k] - XRef[a+k];
+      c0[k] = XRef[cc+k] - XRef[a+k];
+      com[k] = (mO*X[a+k] + mH*(X[b+k] + X[cc+k]))/total;
+      a1[k] = X[a+k] - com[k];
+      b1[k] = X[b+k] - com[k];
+      c1[k] = X[cc+k] - com[k];
+    }
+    // Frame: z normal to the old plane, x perpendicular to z and the new oxygen, y = z cross x
+    REAL ez[3] = {b0[1]*c0[2] - b0[2]*c0[1], b0[2]*c0[0] - b0[0]*c0[2], b0[0]*c0[1] - b0[1]*c0[0]};
+    REAL ex[3] = {a1[1]*ez[2] - a1[2]*ez[1], a1[2]*ez[0] - a1[0]*ez[2], a1[0]*ez[1] - a1[1]*ez[0]};
+    REAL ey[3] = {ez[1]*ex[2] - ez[2]*ex[1], ez[2]*ex[0] - ez[0]*ex[2], ez[0]*ex[1] - ez[1]*ex[0]};
+    REAL nx = 1.0/sqrt(ex[0]*ex[0] + ex[1]*ex[1] + ex[2]*ex[2]);
+    REAL ny = 1.0/sqrt(ey[0]*ey[0] + ey[1]*ey[1] + ey[2]*ey[2]);
+    REAL nz = 1.0/sqrt(ez[0]*ez[0] + ez[1]*ez[1] + ez[2]*ez[2]);
+    for(int k = 0; k < 3; k++) {
+      ex[k] *= nx;
+      ey[k] *= ny;
+      ez[k] *= nz;
+    }
+    REAL xb0 = ex[0]*b0[0] + ex[1]*b0[1] + ex[2]*b0[2];
+    REAL yb0 = ey[0]*b0[0] + ey[1]*b0[1] + ey[2]*b0[2];
+    REAL xc0 = ex[0]*c0[0] + ex[1]*c0[1] + ex[2]*c0[2];
+    REAL yc0 = ey[0]*c0[0] + ey[1]*c0[1] + ey[2]*c0[2];
+    REAL za1 = ez[0]*a1[0] + ez[1]*a1[1] + ez[2]*a1[2];
+    REAL xb1 = ex[0]*b1[0] + ex[1]*b1[1] + ex[2]*b1[2];
+    REAL yb1 = ey[0]*b1[0] + ey[1]*b1[1] + ey[2]*b1[2];
+    REAL zb1 = ez[0]*b1[0] + ez[1]*b1[1] + ez[2]*b1[2];
+    REAL xc1 = ex[0]*c1[0] + ex[1]*c1[1] + ex[2]*c1[2];
+    REAL yc1 = ey[0]*c1[0] + ey[1]*c1[1] + ey[2]*c1[2];
+    REAL zc1 = ez[0]*c1[0] + ez[1]*c1[1] + ez[2]*c1[2];
+    // Tilt of the molecule out of the old plane (phi, psi), then the rotation in it (theta)
+    REAL sinPhi = za1/ra;
+    REAL cosPhi = sqrt(1.0 - sinPhi*sinPhi);
+    REAL sinPsi = (zb1 - zc1)/(2.0*rc*cosPhi);
+    REAL cosPsi = sqrt(1.0 - sinPsi*sinPsi);
+    REAL ya2 = ra*cosPhi;
+    REAL xb2 = -rc*cosPsi;
+    REAL t1 = -rb*cosPhi;
+    REAL t2 = rc*sinPsi*sinPhi;
+    REAL yb2 = t1 - t2;
+    REAL yc2 = t1 + t2;
+    REAL alpha = xb2*(xb0 - xc0) + yb0*yb2 + yc0*yc2;
+    REAL beta = xb2*(yc0 - yb0) + xb0*yb2 + xc0*yc2;
+    REAL gamma = xb0*yb1 - xb1*yb0 + xc0*yc1 - xc1*yc0;
+    REAL a2b2 = alpha*alpha + beta*beta;
+    REAL sinTheta = (alpha*gamma - beta*sqrt(a2b2 - gamma*gamma))/a2b2;
+    REAL cosTheta = sqrt(1.0 - sinTheta*sinTheta);
+    REAL local[3][3] = {
+      {-ya2*sinTheta, ya2*cosTheta, za1},
+      {xb2*cosTheta - yb2*sinTheta, xb2*sinTheta + yb2*cosTheta, zb1},
+      {-xb2*cosTheta - yc2*sinTheta, -xb2*sinTheta + yc2*cosTheta, zc1}};
+    const int atom[3] = {a, b, cc};
+    for(int s = 0; s < 3; s++) {
+      for(int k = 0; k < 3; k++) {
+        REAL x = com[k] + ex[k]*local[s][0] + ey[k]*local[s][1] + ez[k]*local[s][2];
+        V[atom[s]+k] += (x - X[atom[s]+k])*invDt;
+        X[atom[s]+k] = x;
+      }
+    }
+  }
+}
+
+/**
+ * Velocity constraint of every water: the three bond impulses that remove the relative velocity along the O-H1,
+ * O-H2 and H1-H2 bonds are the solution of a symmetric 3x3 system, solved by cofactors.
+ */
+static void settleVelocities(Constraints* c, const REAL* M, const REAL* X, REAL* V) {
+  const int* water = c->water;
+#pragma omp parallel for simd schedule(static)
+  for(int w = 0; w < c->nWaters; w++) {
+    const int a = water[w*3]*3, b = water[w*3+1]*3, cc = water[w*3+2]*3;
+    const REAL wa = 1.0/M[a/3], wb = 1.0/M[b/3], wc = 1.0/M[cc/3];
+    REAL eab[3], eac[3], ebc[3];
+    REAL lab = 0.0, lac = 0.0, lbc = 0.0;
+    for(int k = 0; k < 3; k++) {
+      eab[k] = X[b+k] - X[a+k];
+      eac[k] = X[cc+k] - X[a+k];
+      ebc[k] = X[cc+k] - X[b+k];
+      lab += eab[k]*eab[k];
+      lac += eac[k]*eac[k];
+      lbc += ebc[k]*ebc[k];
+    }
+    lab = 1.0/sqrt(lab);
+    lac = 1.0/sqrt(lac);
+    lbc = 1.0/sqrt(lbc);
+    REAL vab = 0.0, vac = 0.0, vbc = 0.0, abac = 0.0, abbc = 0.0, acbc = 0.0;
+    for(int k = 0; k < 3; k++) {
+      eab[k] *= lab;
+      eac[k] *= lac;
+      ebc[k] *= lbc;
+      vab += eab[k]*(V[b+k] - V[a+k]);
+      vac += eac[k]*(V[cc+k] - V[a+k]);
+      vbc += ebc[k]*(V[cc+k] - V[b+k]);
+      abac += eab[k]*eac[k];
+      abbc += eab[k]*ebc[k];
+      acbc += eac[k]*ebc[k];
+    }
+    REAL A11 = wa + wb, A12 = wa*abac, A13 = -wb*abbc;
+    REAL A22 = wa + wc, A23 = wc*acbc, A33 = wb + wc;
+    REAL C11 = A22*A33 - A23*A23, C12 = A13*A23 - A12*A33, C13 = A12*A23 - A13*A22;
+    REAL C22 = A11*A33 - A13*A13, C23 = A12*A13 - A11*A23, C33 = A11*A22 - A12*A12;
+    REAL invDet = -1.0/(A11*C11 + A12*C12 + A13*C13);
+    REAL tab = (C11*vab + C12*vac + C13*vbc)*invDet;
+    REAL tac = (C12*vab + C22*vac + C23*vbc)*invDet;
+    REAL tbc = (C13*vab + C23*vac + C33*vbc)*invDet;
+    for(int k = 0; k < 3; k++) {
+      V[a+k] -= wa*(tab*eab[k] + tac*eac[k]);
+      V[b+k] += wb*(tab*eab[k] - tbc*ebc[k]);
+      V[cc+k] += wc*(tac*eac[k] + tbc*ebc[k]);
+    }
+  }
+}
+
+/**
+ * Moves the unconstrained positions System->X back onto the constraints, starting from Constraints->XRef, and adds
+ * each correction divided by dt (ns) to System->V.
+ */
+void constrainPositions(System* system, Constraints* c, REAL dt) {
+  const REAL invDt = 1.0/dt;
+  settlePositions(c, system->M, c->XRef, system->X, system->V, invDt);
+  int most = 0;
+#pragma omp parallel for reduction(max:most) schedule(static)
+  for(int k = 0; k < c->nClusters; k++) {
+    int start = c->clusterStart[k];
+    int iterations = shakeCluster(&c->bond[start*2], &c->bondLength[start], c->clusterStart[k+1] - start,
+                                  system->M, c->XRef, system->X, system->V, invDt);
+    most = iterations > most ? iterations : most;
+  }
+  c->positionIterations = most;
+}
+
+/**
+ * Removes the relative velocity along every constraint from System->V.
+ */
+void constrainVelocities(System* system, Constraints* c) {
+  settleVelocities(c, system->M, system->X, system->V);
+  int most = 0;
+#pragma omp parallel for reduction(max:most) schedule(static)
+  for(int k = 0; k < c->nClusters; k++) {
+    int start = c->clusterStart[k];
+    int iterations = rattleCluster(&c->bond[start*2], c->clusterStart[k+1] - start, system->M, system->X,
+                                   system->V);
+    most = iterations > most ? iterations : most;
+  }
+  c->velocityIterations = most;
+}
+
+/////////////////////////////////////////// TESTS
+
+static REAL randomUnit() {
+  return 2.0*rand()/RAND_MAX - 1.0;
+}
+
+static REAL distance(const REAL* X, int i, int j) {
+  REAL r2 = 0.0;
+  for(int k = 0; k < 3; k++) {
+    r2 += (X[j*3+k] - X[i*3+k])*(X[j*3+k] - X[i*3+k]);
+  }
+  return sqrt(r2);
+}
+
+/**
+ * Largest relative length error and largest velocity along a constraint (ANG/ns).
+ */
+static void constraintErrors(System* system, Constraints* c, REAL* lengthError, REAL* velocityError) {
+  *lengthError = *velocityError = 0.0;
+  int n = 3*c->nWaters + c->nBonds;
+  for(int k = 0; k < n; k++) {
+    int i, j;
+    REAL d;
+    if(k < 3*c->nWaters) {
+      const int* water = &c->water[(k/3)*3];
+      i = k % 3 == 2 ? water[1] : water[0];
+      j = k % 3 == 0 ? water[1] : water[2];
+      d = k % 3 == 2 ? c->waterHH : c->waterOH;
+    } else {
+      i = c->bond[(k - 3*c->nWaters)*2];
+      j = c->bond[(k - 3*c->nWaters)*2+1];
+      d = c->bondLength[k - 3*c->nWaters];
+    }
+    REAL r = distance(system->X, i, j);
+    REAL rv = 0.0;
+    for(int x = 0; x < 3; x++) {
+      rv += (system->X[j*3+x] - system->X[i*3+x])*(system->V[j*3+x] - system->V[i*3+x]);
+    }
+    *lengthError = fmax(*lengthError, fabs(r - d)/d);
+    *velocityError = fmax(*velocityError, fabs(rv)/r);
+  }
+}
+
+/**
+ * Waters and methanols (CH3-OH) in a box: detection, SETTLE against the conditions that define the SHAKE solution,
+ * and velocity constraints.
+ */
+void constraintsTest(bool verbose) {
+  srand(11);
+  // Types: 1 water O, 2 water H, 3 methyl C, 4 methyl H, 5 hydroxyl O, 6 hydroxyl H (class = type)
+  const int numbers[7] = {0, 8, 1, 6, 1, 8, 1};
+  const REAL masses[7] = {0.0, 15.999, 1.008, 12.011, 1.008, 15.999, 1.008};
+  const int bondClasses[4][2] = {{1, 2}, {3, 4}, {5, 6}, {3, 5}};
+  const REAL bondLengths[4] = {0.9572, 1.0900, 0.9470, 1.4300};
+  const int nWaters = 40, nMethanols = 12, nAtoms = 3*nWaters + 6*nMethanols;
+  System* system = calloc(1, sizeof(System));
+  ForceField* ff = calloc(1, sizeof(ForceField));
+  system->forceField = ff;
+  system->nAtoms = nAtoms;
+  system->constraints = HBONDS;
+  atomVectorInit(&ff->atom, 6, MEMORY_FORCE_FIELD);
+  bondVectorInit(&ff->bond, 4, MEMORY_FORCE_FIELD);
+  angleVectorInit(&ff->angle, 1, MEMORY_FORCE_FIELD);
+  for(int t = 1; t < 7; t++) {
+    Atom* atom = atomVectorEmplace(&ff->atom);
+    atom->type = atom->aClass = t;
+    atom->atomicNum = numbers[t];
+    atom->atomicMass = masses[t];
+  }
+  for(int b = 0; b < 4; b++) {
+    Bond* bond = bondVectorEmplace(&ff->bond);
+    bond->atomClasses[0] = bondClasses[b][0];
+    bond->atomClasses[1] = bondClasses[b][1];
+    bond->distance = bondLengths[b];
+  }
+  Angle* angle = angleVectorEmplace(&ff->angle);
+  angle->aClasses[0] = 2;
+  angle->aClasses[1] = 1;
+  angle->aClasses[2] = 2;
+  angle->angle[0] = 104.52;
+  system->X = malloc(sizeof(REAL)*nAtoms*3);
+  system->V = malloc(sizeof(REAL)*nAtoms*3);
+  system->M = malloc(sizeof(REAL)*nAtoms);
+  system->protons = malloc(sizeof(REAL)*nAtoms);
+  system->atomTypes = malloc(sizeof(int)*nAtoms);
+  system->list12 = malloc(sizeof(IntVector)*nAtoms);
+  // Each molecule is its first atom at a lattice site plus the others within ~1 ANG, bonded to their parent
+  const int waterParents[3] = {-1, 0, 0}, methanolParents[6] = {-1, 0, 0, 0, 0, 4};
+  const int waterTypes[3] = {1, 2, 2}, methanolTypes[6] = {3, 4, 4, 4, 5, 6};
+  int i = 0;
+  for(int m = 0; m < nWaters + nMethanols; m++) {
+    bool water = m < nWaters;
+    int size = water ? 3 : 6;
+    int first = i;
+    for(int s = 0; s < size; s++, i++) {
+      int parent = water ? waterParents[s] : methanolParents[s];
+      system->atomTypes[i] = water ? waterTypes[s] : methanolTypes[s];
+      system->M[i] = masses[system->atomTypes[i]];
+      system->protons[i] = numbers[system->atomTypes[i]];
+      intVectorInit(&system->list12[i], 4, MEMORY_STRUCTURE);
+      for(int k = 0; k < 3; k++) {
+        system->X[i*3+k] = parent < 0 ? 4.0*((m >> (2*k)) & 3) : system->X[(first + parent)*3+k] + randomUnit();
+        system->V[i*3+k] = 1e4*randomUnit();
+      }
+      if(parent >= 0) {
+        int p = first + parent;
+        intVectorPush(&system->list12[i], p);
+        intVectorPush(&system->list12[p], i);
+      }
+    }
+  }
+
+  // Detection and the initial projection
+  Constraints* c = constraintsCreate(system);
+  assert(c->nWaters == nWaters && c->nBonds == 4*nMethanols && c->nClusters == 2*nMethanols);
+  assert(c->nConstraints == 3*nWaters + 4*nMethanols);
+  assert(fabs(c->waterHH - 2*0.9572*sin(52.26*M_PI/180.0)) < 1e-12);
+  REAL lengthError, velocityError;
+  constraintErrors(system, c, &lengthError, &velocityError);
+  assert(lengthError < 2*SHAKE_TOLERANCE && velocityError < 2*RATTLE_TOLERANCE);
+
+  // One 1 fs drift: back on the constraints, and SETTLE's corrections are the SHAKE solution. Constraint forces along
+  // the old bonds conserve momentum and angular momentum and keep m*dx in the old molecular plane.
+  const int n3 = nAtoms*3;
+  const REAL dt = 1e-6;
+  REAL* XUnconstrained = malloc(sizeof(REAL)*n3);
+  REAL* VUnconstrained = malloc(sizeof(REAL)*n3);
+  memcpy(c->XRef, system->X, sizeof(REAL)*n3);
+  for(int a = 0; a < n3; a++) {
+    system->X[a] += dt*system->V[a];
+  }
+  memcpy(XUnconstrained, system->X, sizeof(REAL)*n3);
+  memcpy(VUnconstrained, system->V, sizeof(REAL)*n3);
+  constrainPositions(system, c, dt);
+  REAL worst = 0.0;
+  for(int w = 0; w < c->nWaters; w++) {
+    const int* water = &c->water[w*3];
+    REAL b0[3], c0[3], normal[3], momentum[3] = {0.0, 0.0, 0.0}, angular[3] = {0.0, 0.0, 0.0};
+    for(int k = 0; k < 3; k++) {
+      b0[k] = c->XRef[water[1]*3+k] - c->XRef[water[0]*3+k];
+      c0[k] = c->XRef[water[2]*3+k] - c->XRef[water[0]*3+k];
+    }
+    normal[0] = b0[1]*c0[2] - b0[2]*c0[1];
+    normal[1] = b0[2]*c0[0] - b0[0]*c0[2];
+    normal[2] = b0[0]*c0[1] - b0[1]*c0[0];
+    for(int s = 0; s < 3; s++) {
+      int atom = water[s];
+      REAL p[3], along = 0.0;
+      for(int k = 0; k < 3; k++) {
+        p[k] = system->M[atom]*(system->X[atom*3+k] - XUnconstrained[atom*3+k]);
+        momentum[k] += p[k];
+        along += p[k]*normal[k];
+      }
+      const REAL* r = &c->XRef[atom*3];
+      angular[0] += r[1]*p[2] - r[2]*p[1];
+      angular[1] += r[2]*p[0] - r[0]*p[2];
+      angular[2] += r[0]*p[1] - r[1]*p[0];
+      worst = fmax(worst, fabs(along));
+      for(int k = 0; k < 3; k++) {
+        REAL dv = system->V[atom*3+k] - VUnconstrained[atom*3+k];
+        assert(fabs(dv*dt - (system->X[atom*3+k] - XUnconstrained[atom*3+k])) < 1e-12);
+      }
+    }
+    for(int k = 0; k < 3; k++) {
+      worst = fmax(worst, fmax(fabs(momentum[k]), fabs(angular[k])));
+    }
+  }
+  constraintErrors(system, c, &lengthError, &velocityError);
+  if(verbose) {
+    printf("After a 1 fs drift: relative length error %.3e, SETTLE conservation error %.3e, %d SHAKE iterations\n",
+           lengthError, worst, c->positionIterations);
+  }
+  assert(lengthError < 2*SHAKE_TOLERANCE);
+  assert(worst < 1e-9);
+  assert(c->positionIterations > 1);
+
+  // Velocities: nothing left along the constraints, momentum unchanged
+  REAL before[3] = {0.0, 0.0, 0.0}, after[3] = {0.0, 0.0, 0.0};
+  for(int a = 0; a < n3; a++) {
+    system->V[a] += 1e3*randomUnit();
+    before[a % 3] += system->M[a/3]*system->V[a];
+  }
+  constrainVelocities(system, c);
+  for(int a = 0; a < n3; a++) {
+    after[a % 3] += system->M[a/3]*system->V[a];
+  }
+  constraintErrors(system, c, &lengthError, &velocityError);
+  if(verbose) {
+    printf("Velocity along constraints %.3e ANG/ns after %d RATTLE iterations\n", velocityError,
+           c->velocityIterations);
+  }
+  assert(velocityError < 2*RATTLE_TOLERANCE);
+  for(int k = 0; k < 3; k++) {
+    assert(fabs(after[k] - before[k]) < 1e-6);
+  }
+
+  // Only waters
+  constraintsDestroy(c);
+  system->constraints = RIGID_WATER;
+  c = constraintsCreate(system);
+  assert(c->nWaters == nWaters && c->nBonds == 0 && c->nConstraints == 3*nWaters);
+  constraintsDestroy(c);
+
+  free(XUnconstrained);
+  free(VUnconstrained);
+  for(int a = 0; a < nAtoms; a++) {
+    intVectorFree(&system->list12[a]);
+  }
+  atomVectorFree(&ff->atom);
+  bondVectorFree(&ff->bond);
+  angleVectorFree(&ff->angle);
+  free(ff);
+  free(system->list12);
+  free(system->atomTypes);
+  free(system->protons);
+  free(system->M);
+  free(system->V);
+  free(system->X);
+  free(system);
+  printf("All tests of constraints.c passed!\n");
+}
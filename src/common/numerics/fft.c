@@ -0,0 +1,639 @@
+// Author(s): Matthew Speranza
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../include/fft.h"
+
+static int threadID() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Splits n into radices with as many radix-4 passes as possible.
+ * @return false if n has a prime factor other than 2, 3, or 5
+ */
+static bool factorize(int n, int* factors, int* nFactors) {
+  int count = 0;
+  while(n % 4 == 0) { factors[count++] = 4; n /= 4; }
+  while(n % 2 == 0) { factors[count++] = 2; n /= 2; }
+  while(n % 3 == 0) { factors[count++] = 3; n /= 3; }
+  while(n % 5 == 0) { factors[count++] = 5; n /= 5; }
+  *nFactors = count;
+  return n == 1;
+}
+
+/**
+ * Smallest grid size >= n that the FFT supports (only factors of 2, 3 and 5).
+ */
+int fftGoodSize(int n) {
+  int factors[32];
+  int nFactors;
+  if(n < 1) {
+    return 1;
+  }
+  while(!factorize(n, factors, &nFactors)) {
+    n++;
+  }
+  return n;
+}
+
+FFTPlan* fftPlanCreate(int n) {
+  assert(n > 0);
+  FFTPlan* plan = malloc(sizeof(FFTPlan));
+  if(plan == NULL) {
+    printf("Failed to allocate FFT plan!\n");
+    exit(1);
+  }
+  plan->n = n;
+  if(!factorize(n, plan->factors, &plan->nFactors)) {
+    printf("FFT length %d is not a product of 2, 3, and 5!\n", n);
+    exit(1);
+  }
+  plan->twiddleOffset = malloc(sizeof(int)*(plan->nFactors+1));
+  int total = 0;
+  int nStage = n;
+  for(int s = 0; s < plan->nFactors; s++) {
+    int p = plan->factors[s];
+    int m = nStage / p;
+    plan->twiddleOffset[s] = total;
+    total += m*(p-1)*2;
+    nStage = m;
+  }
+  plan->twiddles = malloc(sizeof(REAL)*(total+2));
+  if(plan->twiddleOffset == NULL || plan->twiddles == NULL) {
+    printf("Failed to allocate FFT twiddles!\n");
+    exit(1);
+  }
+  // Twiddles are always computed in double so that a float REAL only loses precision in the butterflies
+  nStage = n;
+  for(int s = 0; s < plan->nFactors; s++) {
+    int p = plan->factors[s];
+    int m = nStage / p;
+    REAL* tw = plan->twiddles + plan->twiddleOffset[s];
+    for(int j = 0; j < m; j++) {
+      for(int k = 1; k < p; k++) {
+        double theta = 2.0 * M_PI * (double) j * k / nStage;
+        tw[(j*(p-1) + k-1)*2] = cos(theta);
+        tw[(j*(p-1) + k-1)*2+1] = sin(theta);
+      }
+    }
+    nStage = m;
+  }
+  return plan;
+}
+
+void fftPlanDestroy(FFTPlan* plan) {
+  free(plan->twiddleOffset);
+  free(plan->twiddles);
+  free(plan);
+}
+
+/*
+ * Stockham butterflies. Each pass reads sub-sequences of length p*m with stride s from x, does a length p DFT,
+ * multiplies by the twiddle w_{pm}^{jk} and writes to y so that the output is already in natural order.
+ * The q loop is contiguous in memory once s > 1 and is the one that gets vectorized.
+ */
+static void radix2(const REAL* restrict x, REAL* restrict y, int m, int s, const REAL* tw, REAL sign) {
+  for(int j = 0; j < m; j++) {
+    REAL w1r = tw[2*j], w1i = sign*tw[2*j+1];
+    const REAL* x0 = x + 2*s*j;
+    const REAL* x1 = x + 2*s*(j+m);
+    REAL* y0 = y + 2*s*(2*j);
+    REAL* y1 = y + 2*s*(2*j+1);
+#pragma omp simd
+    for(int q = 0; q < s; q++) {
+      REAL ar = x0[2*q], ai = x0[2*q+1];
+      REAL br = x1[2*q], bi = x1[2*q+1];
+      y0[2*q] = ar + br;
+      y0[2*q+1] = ai + bi;
+      REAL dr = ar - br, di = ai - bi;
+      y1[2*q] = dr*w1r - di*w1i;
+      y1[2*q+1] = dr*w1i + di*w1r;
+    }
+  }
+}
+
+static void radix3(const REAL* restrict x, REAL* restrict y, int m, int s, const REAL* tw, REAL sign) {
+  const REAL sin60 = sign * 0.86602540378443864676;
+  for(int j = 0; j < m; j++) {
+    REAL w1r = tw[4*j], w1i = sign*tw[4*j+1];
+    REAL w2r = tw[4*j+2], w2i = sign*tw[4*j+3];
+    const REAL* x0 = x + 2*s*j;
+    const REAL* x1 = x + 2*s*(j+m);
+    const REAL* x2 = x + 2*s*(j+2*m);
+    REAL* y0 = y + 2*s*(3*j);
+    REAL* y1 = y + 2*s*(3*j+1);
+    REAL* y2 = y + 2*s*(3*j+2);
+#pragma omp simd
+    for(int q = 0; q < s; q++) {
+      REAL ar = x0[2*q], ai = x0[2*q+1];
+      REAL br = x1[2*q], bi = x1[2*q+1];
+      REAL cr = x2[2*q], ci = x2[2*q+1];
+      REAL t1r = br + cr, t1i = bi + ci;
+      REAL t2r = ar - 0.5*t1r, t2i = ai - 0.5*t1i;
+      REAL t3r = sin60*(br - cr), t3i = sin60*(bi - ci);
+      y0[2*q] = ar + t1r;
+      y0[2*q+1] = ai + t1i;
+      REAL b1r = t2r - t3i, b1i = t2i + t3r;
+      REAL b2r = t2r + t3i, b2i = t2i - t3r;
+      y1[2*q] = b1r*w1r - b1i*w1i;
+      y1[2*q+1] = b1r*w1i + b1i*w1r;
+      y2[2*q] = b2r*w2r - b2i*w2i;
+      y2[2*q+1] = b2r*w2i + b2i*w2r;
+    }
+  }
+}
+
+static void radix4(const REAL* restrict x, REAL* restrict y, int m, int s, const REAL* tw, REAL sign) {
+  for(int j = 0; j < m; j++) {
+    REAL w1r = tw[6*j], w1i = sign*tw[6*j+1];
+    REAL w2r = tw[6*j+2], w2i = sign*tw[6*j+3];
+    REAL w3r = tw[6*j+4], w3i = sign*tw[6*j+5];
+    const REAL* x0 = x + 2*s*j;
+    const REAL* x1 = x + 2*s*(j+m);
+    const REAL* x2 = x + 2*s*(j+2*m);
+    const REAL* x3 = x + 2*s*(j+3*m);
+    REAL* y0 = y + 2*s*(4*j);
+    REAL* y1 = y + 2*s*(4*j+1);
+    REAL* y2 = y + 2*s*(4*j+2);
+    REAL* y3 = y + 2*s*(4*j+3);
+#pragma omp simd
+    for(int q = 0; q < s; q++) {
+      REAL ar = x0[2*q], ai = x0[2*q+1];
+      REAL br = x1[2*q], bi = x1[2*q+1];
+      REAL cr = x2[2*q], ci = x2[2*q+1];
+      REAL dr = x3[2*q], di = x3[2*q+1];
+      REAL s02r = ar + cr, s02i = ai + ci;
+      REAL d02r = ar - cr, d02i = ai - ci;
+      REAL s13r = br + dr, s13i = bi + di;
+      // sign*i*(b - d)
+      REAL r13r = -sign*(bi - di), r13i = sign*(br - dr);
+      y0[2*q] = s02r + s13r;
+      y0[2*q+1] = s02i + s13i;
+      REAL b1r = d02r + r13r, b1i = d02i + r13i;
+      REAL b2r = s02r - s13r, b2i = s02i - s13i;
+      REAL b3r = d02r - r13r, b3i = d02i - r13i;
+      y1[2*q] = b1r*w1r - b1i*w1i;
+      y1[2*q+1] = b1r*w1i + b1i*w1r;
+      y2[2*q] = b2r*w2r - b2i*w2i;
+      y2[2*q+1] = b2r*w2i + b2i*w2r;
+      y3[2*q] = b3r*w3r - b3i*w3i;
+      y3[2*q+1] = b3r*w3i + b3i*w3r;
+    }
+  }
+}
+
+static void radix5(const REAL* restrict x, REAL* restrict y, int m, int s, const REAL* tw, REAL sign) {
+  const REAL c1 = 0.30901699437494742410; // cos(2pi/5)
+  const REAL c2 = -0.80901699437494742410; // cos(4pi/5)
+  const REAL s1 = sign * 0.95105651629515357212; // sin(2pi/5)
+  const REAL s2 = sign * 0.58778525229247312917; // sin(4pi/5)
+  for(int j = 0; j < m; j++) {
+    const REAL* w = tw + 8*j;
+    REAL w1r = w[0], w1i = sign*w[1], w2r = w[2], w2i = sign*w[3];
+    REAL w3r = w[4], w3i = sign*w[5], w4r = w[6], w4i = sign*w[7];
+    const REAL* x0 = x + 2*s*j;
+    const REAL* x1 = x + 2*s*(j+m);
+    const REAL* x2 = x + 2*s*(j+2*m);
+    const REAL* x3 = x + 2*s*(j+3*m);
+    const REAL* x4 = x + 2*s*(j+4*m);
+    REAL* y0 = y + 2*s*(5*j);
+    REAL* y1 = y + 2*s*(5*j+1);
+    REAL* y2 = y + 2*s*(5*j+2);
+    REAL* y3 = y + 2*s*(5*j+3);
+    REAL* y4 = y + 2*s*(5*j+4);
+#pragma omp simd
+    for(int q = 0; q < s; q++) {
+      REAL ar = x0[2*q], ai = x0[2*q+1];
+      REAL t1r = x1[2*q] + x4[2*q], t1i = x1[2*q+1] + x4[2*q+1];
+      REAL t2r = x2[2*q] + x3[2*q], t2i = x2[2*q+1] + x3[2*q+1];
+      REAL t3r = x1[2*q] - x4[2*q], t3i = x1[2*q+1] - x4[2*q+1];
+      REAL t4r = x2[2*q] - x3[2*q], t4i = x2[2*q+1] - x3[2*q+1];
+      y0[2*q] = ar + t1r + t2r;
+      y0[2*q+1] = ai + t1i + t2i;
+      REAL e1r = ar + c1*t1r + c2*t2r, e1i = ai + c1*t1i + c2*t2i;
+      REAL e2r = ar + c2*t1r + c1*t2r, e2i = ai + c2*t1i + c1*t2i;
+      // Rotated odd parts: i*(s1*t3 + s2*t4) and i*(s2*t3 - s1*t4)
+      REAL o1r = -(s1*t3i + s2*t4i), o1i = s1*t3r + s2*t4r;
+      REAL o2r = -(s2*t3i - s1*t4i), o2i = s2*t3r - s1*t4r;
+      REAL b1r = e1r + o1r, b1i = e1i + o1i;
+      REAL b4r = e1r - o1r, b4i = e1i - o1i;
+      REAL b2r = e2r + o2r, b2i = e2i + o2i;
+      REAL b3r = e2r - o2r, b3i = e2i - o2i;
+      y1[2*q] = b1r*w1r - b1i*w1i;
+      y1[2*q+1] = b1r*w1i + b1i*w1r;
+      y2[2*q] = b2r*w2r - b2i*w2i;
+      y2[2*q+1] = b2r*w2i + b2i*w2r;
+      y3[2*q] = b3r*w3r - b3i*w3i;
+      y3[2*q+1] = b3r*w3i + b3i*w3r;
+      y4[2*q] = b4r*w4r - b4i*w4i;
+      y4[2*q+1] = b4r*w4i + b4i*w4r;
+    }
+  }
+}
+
+/**
+ * In-place (from the caller's point of view) complex transform of plan->n interleaved points.
+ * @param data interleaved complex data [n*2], overwritten with its transform
+ * @param work scratch space of the same size as data
+ * @param direction FFT_FORWARD uses exp(-2 pi i jk/n), FFT_BACKWARD uses exp(+2 pi i jk/n)
+ */
+void fft(FFTPlan* plan, REAL* data, REAL* work, enum FFTDirection direction) {
+  REAL sign = (REAL) direction;
+  REAL* x = data;
+  REAL* y = work;
+  int nStage = plan->n;
+  int stride = 1;
+  for(int s = 0; s < plan->nFactors; s++) {
+    int p = plan->factors[s];
+    int m = nStage / p;
+    const REAL* tw = plan->twiddles + plan->twiddleOffset[s];
+    switch(p) {
+      case 2: radix2(x, y, m, stride, tw, sign);
+        break;
+      case 3: radix3(x, y, m, stride, tw, sign);
+        break;
+      case 4: radix4(x, y, m, stride, tw, sign);
+        break;
+      case 5: radix5(x, y, m, stride, tw, sign);
+        break;
+      default:
+        printf("Unsupported radix %d in fft.c\n", p);
+        exit(1);
+    }
+    REAL* tmp = x;
+    x = y;
+    y = tmp;
+    nStage = m;
+    stride *= p;
+  }
+  if(x != data) {
+    memcpy(data, x, sizeof(REAL)*plan->n*2);
+  }
+}
+
+FFTPlan3D* fftPlan3DCreate(int nX, int nY, int nZ) {
+  FFTPlan3D* plan = malloc(sizeof(FFTPlan3D));
+  if(plan == NULL) {
+    printf("Failed to allocate 3D FFT plan!\n");
+    exit(1);
+  }
+  plan->nX = nX;
+  plan->nY = nY;
+  plan->nZ = nZ;
+  plan->nZComplex = nZ/2 + 1;
+  plan->packedZ = nZ % 2 == 0;
+  plan->planX = fftPlanCreate(nX);
+  plan->planY = fftPlanCreate(nY);
+  plan->planZ = fftPlanCreate(plan->packedZ ? nZ/2 : nZ);
+  plan->zTwiddles = malloc(sizeof(REAL)*plan->nZComplex*2);
+  for(int k = 0; k < plan->nZComplex; k++) {
+    double theta = 2.0 * M_PI * k / nZ;
+    plan->zTwiddles[2*k] = cos(theta);
+    plan->zTwiddles[2*k+1] = sin(theta);
+  }
+#ifdef _OPENMP
+  plan->nThreads = omp_get_max_threads();
+#else
+  plan->nThreads = 1;
+#endif
+  int maxN = nX > nY ? nX : nY;
+  maxN = maxN > nZ ? maxN : nZ;
+  // Pencil and Stockham work array, rounded up to a 64 byte line so threads don't share cache lines
+  plan->scratchSize = ((4*maxN*sizeof(REAL) + 63) / 64) * 64 / sizeof(REAL);
+  plan->scratch = aligned_alloc(64, sizeof(REAL)*plan->scratchSize*plan->nThreads);
+  if(plan->zTwiddles == NULL || plan->scratch == NULL) {
+    printf("Failed to allocate 3D FFT work space!\n");
+    exit(1);
+  }
+  return plan;
+}
+
+void fftPlan3DDestroy(FFTPlan3D* plan) {
+  fftPlanDestroy(plan->planX);
+  fftPlanDestroy(plan->planY);
+  fftPlanDestroy(plan->planZ);
+  free(plan->zTwiddles);
+  free(plan->scratch);
+  free(plan);
+}
+
+/**
+ * Turns the length nZ/2 complex transform of a packed real row (z_k = x_2k + i x_2k+1) into the nZ/2+1 non-redundant
+ * points of the real transform: X_k = E_k + w^k O_k with E and O the transforms of the even and odd samples.
+ */
+static void zUnpack(const REAL* restrict z, REAL* restrict out, int m, const REAL* tw) {
+  for(int k = 0; k <= m; k++) {
+    int a = k == m ? 0 : k;
+    int b = k == 0 ? 0 : m - k;
+    REAL zr = z[2*a], zi = z[2*a+1];
+    REAL cr = z[2*b], ci = -z[2*b+1];
+    REAL er = 0.5*(zr + cr), ei = 0.5*(zi + ci);
+    REAL odr = 0.5*(zi - ci), odi = -0.5*(zr - cr); // -i*(z - conj)/2
+    REAL wr = tw[2*k], wi = -tw[2*k+1];
+    out[2*k] = er + odr*wr - odi*wi;
+    out[2*k+1] = ei + odr*wi + odi*wr;
+  }
+}
+
+/**
+ * Inverse of zUnpack, scaled by two so the half-length backward transform gives the unnormalized real result.
+ */
+static void zPack(const REAL* restrict in, REAL* restrict z, int m, const REAL* tw) {
+  for(int k = 0; k < m; k++) {
+    REAL xr = in[2*k], xi = in[2*k+1];
+    REAL cr = in[2*(m-k)], ci = -in[2*(m-k)+1];
+    REAL sr = xr + cr, si = xi + ci;
+    REAL dr = xr - cr, di = xi - ci;
+    REAL wr = tw[2*k], wi = tw[2*k+1];
+    REAL tr = dr*wr - di*wi, ti = dr*wi + di*wr;
+    z[2*k] = sr - ti;
+    z[2*k+1] = si + tr;
+  }
+}
+
+/**
+ * Transforms every pencil along y (stride nZComplex) and x (stride nY*nZComplex) of a complex grid in place.
+ */
+static void fft3DPencils(FFTPlan3D* plan, REAL* grid, enum FFTDirection direction) {
+  int nX = plan->nX, nY = plan->nY, nZc = plan->nZComplex;
+  // y pencils - one x slab per thread
+#pragma omp parallel for schedule(static)
+  for(int x = 0; x < nX; x++) {
+    REAL* pencil = plan->scratch + (long) threadID()*plan->scratchSize;
+    REAL* work = pencil + plan->scratchSize/2;
+    REAL* slab = grid + (long) x*nY*nZc*2;
+    for(int z = 0; z < nZc; z++) {
+      for(int y = 0; y < nY; y++) {
+        pencil[2*y] = slab[(y*nZc + z)*2];
+        pencil[2*y+1] = slab[(y*nZc + z)*2+1];
+      }
+      fft(plan->planY, pencil, work, direction);
+      for(int y = 0; y < nY; y++) {
+        slab[(y*nZc + z)*2] = pencil[2*y];
+        slab[(y*nZc + z)*2+1] = pencil[2*y+1];
+      }
+    }
+  }
+  // x pencils - split over y
+  long xStride = (long) nY*nZc*2;
+#pragma omp parallel for schedule(static)
+  for(int y = 0; y < nY; y++) {
+    REAL* pencil = plan->scratch + (long) threadID()*plan->scratchSize;
+    REAL* work = pencil + plan->scratchSize/2;
+    for(int z = 0; z < nZc; z++) {
+      REAL* col = grid + ((long) y*nZc + z)*2;
+      for(int x = 0; x < nX; x++) {
+        pencil[2*x] = col[x*xStride];
+        pencil[2*x+1] = col[x*xStride+1];
+      }
+      fft(plan->planX, pencil, work, direction);
+      for(int x = 0; x < nX; x++) {
+        col[x*xStride] = pencil[2*x];
+        col[x*xStride+1] = pencil[2*x+1];
+      }
+    }
+  }
+}
+
+/**
+ * Forward real to complex transform.
+ * @param in real grid [nX][nY][nZ] (not modified)
+ * @param out complex grid [nX][nY][nZ/2+1][2]
+ */
+void fft3DR2C(FFTPlan3D* plan, REAL* in, REAL* out) {
+  int nX = plan->nX, nY = plan->nY, nZ = plan->nZ, nZc = plan->nZComplex;
+  // z rows - one x slab per thread
+#pragma omp parallel for schedule(static)
+  for(int x = 0; x < nX; x++) {
+    REAL* pencil = plan->scratch + (long) threadID()*plan->scratchSize;
+    REAL* work = pencil + plan->scratchSize/2;
+    for(int y = 0; y < nY; y++) {
+      const REAL* row = in + ((long) x*nY + y)*nZ;
+      REAL* outRow = out + ((long) x*nY + y)*nZc*2;
+      if(plan->packedZ) {
+        memcpy(pencil, row, sizeof(REAL)*nZ);
+        fft(plan->planZ, pencil, work, FFT_FORWARD);
+        zUnpack(pencil, outRow, nZ/2, plan->zTwiddles);
+      } else {
+        for(int z = 0; z < nZ; z++) {
+          pencil[2*z] = row[z];
+          pencil[2*z+1] = 0.0;
+        }
+        fft(plan->planZ, pencil, work, FFT_FORWARD);
+        memcpy(outRow, pencil, sizeof(REAL)*nZc*2);
+      }
+    }
+  }
+  fft3DPencils(plan, out, FFT_FORWARD);
+}
+
+/**
+ * Backward (unnormalized) complex to real transform.
+ * @param in complex grid [nX][nY][nZ/2+1][2] (overwritten)
+ * @param out real grid [nX][nY][nZ]
+ */
+void fft3DC2R(FFTPlan3D* plan, REAL* in, REAL* out) {
+  int nX = plan->nX, nY = plan->nY, nZ = plan->nZ, nZc = plan->nZComplex;
+  fft3DPencils(plan, in, FFT_BACKWARD);
+#pragma omp parallel for schedule(static)
+  for(int x = 0; x < nX; x++) {
+    REAL* pencil = plan->scratch + (long) threadID()*plan->scratchSize;
+    REAL* work = pencil + plan->scratchSize/2;
+    for(int y = 0; y < nY; y++) {
+      const REAL* row = in + ((long) x*nY + y)*nZc*2;
+      REAL* outRow = out + ((long) x*nY + y)*nZ;
+      if(plan->packedZ) {
+        zPack(row, pencil, nZ/2, plan->zTwiddles);
+        fft(plan->planZ, pencil, work, FFT_BACKWARD);
+        memcpy(outRow, pencil, sizeof(REAL)*nZ);
+      } else {
+        memcpy(pencil, row, sizeof(REAL)*nZc*2);
+        for(int z = nZc; z < nZ; z++) { // Hermitian symmetry fills the rest of the row
+          pencil[2*z] = row[2*(nZ-z)];
+          pencil[2*z+1] = -row[2*(nZ-z)+1];
+        }
+        fft(plan->planZ, pencil, work, FFT_BACKWARD);
+        for(int z = 0; z < nZ; z++) {
+          outRow[z] = pencil[2*z];
+        }
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////// TESTS
+
+static double elapsed(struct timespec start, struct timespec end) {
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+static void naiveDFT(const REAL* in, REAL* out, int n, int sign) {
+  for(int k = 0; k < n; k++) {
+    double re = 0.0, im = 0.0;
+    for(int j = 0; j < n; j++) {
+      double theta = sign * 2.0 * M_PI * (double) ((long) j*k % n) / n;
+      re += in[2*j]*cos(theta) - in[2*j+1]*sin(theta);
+      im += in[2*j]*sin(theta) + in[2*j+1]*cos(theta);
+    }
+    out[2*k] = re;
+    out[2*k+1] = im;
+  }
+}
+
+static void naiveDFT3D(const REAL* in, REAL* out, int nX, int nY, int nZ) {
+  int nZc = nZ/2 + 1;
+  for(int kx = 0; kx < nX; kx++) {
+    for(int ky = 0; ky < nY; ky++) {
+      for(int kz = 0; kz < nZc; kz++) {
+        double re = 0.0, im = 0.0;
+        for(int x = 0; x < nX; x++) {
+          for(int y = 0; y < nY; y++) {
+            for(int z = 0; z < nZ; z++) {
+              double theta = -2.0 * M_PI * ((double) kx*x/nX + (double) ky*y/nY + (double) kz*z/nZ);
+              REAL v = in[(x*nY + y)*nZ + z];
+              re += v*cos(theta);
+              im += v*sin(theta);
+            }
+          }
+        }
+        out[((kx*nY + ky)*nZc + kz)*2] = re;
+        out[((kx*nY + ky)*nZc + kz)*2+1] = im;
+      }
+    }
+  }
+}
+
+static double maxRelativeError(const REAL* a, const REAL* b, long n) {
+  double maxDiff = 0.0, maxVal = 0.0;
+  for(long i = 0; i < n; i++) {
+    maxDiff = fmax(maxDiff, fabs(a[i] - b[i]));
+    maxVal = fmax(maxVal, fabs(b[i]));
+  }
+  return maxDiff / (maxVal > 0.0 ? maxVal : 1.0);
+}
+
+void fftTest(bool verbose) {
+  double tolerance = sizeof(REAL) == sizeof(float) ? 1e-4 : 1e-10;
+  assert(fftGoodSize(7) == 8 && fftGoodSize(61) == 64 && fftGoodSize(49) == 50);
+  srand(7);
+  // 1D complex against the naive DFT
+  int sizes1D[12] = {1, 2, 3, 4, 5, 6, 8, 12, 15, 30, 64, 1000};
+  for(int t = 0; t < 12; t++) {
+    int n = sizes1D[t];
+    REAL* in = malloc(sizeof(REAL)*n*2);
+    REAL* data = malloc(sizeof(REAL)*n*2);
+    REAL* work = malloc(sizeof(REAL)*n*2);
+    REAL* ref = malloc(sizeof(REAL)*n*2);
+    for(int i = 0; i < 2*n; i++) {
+      in[i] = (REAL) rand() / RAND_MAX - 0.5;
+    }
+    FFTPlan* plan = fftPlanCreate(n);
+    memcpy(data, in, sizeof(REAL)*n*2);
+    fft(plan, data, work, FFT_FORWARD);
+    naiveDFT(in, ref, n, -1);
+    double err = maxRelativeError(data, ref, 2*n);
+    if(verbose) {
+      printf("1D FFT n=%5d forward error %.3e\n", n, err);
+    }
+    assert(err < tolerance);
+    fft(plan, data, work, FFT_BACKWARD);
+    for(int i = 0; i < 2*n; i++) {
+      data[i] /= n;
+    }
+    assert(maxRelativeError(data, in, 2*n) < tolerance);
+    fftPlanDestroy(plan);
+    free(in);
+    free(data);
+    free(work);
+    free(ref);
+  }
+  // 3D real to complex against the naive DFT, even and odd z
+  int sizes3D[4][3] = {{4, 6, 8}, {5, 3, 9}, {10, 12, 6}, {3, 5, 15}};
+  for(int t = 0; t < 4; t++) {
+    int nX = sizes3D[t][0], nY = sizes3D[t][1], nZ = sizes3D[t][2];
+    long nReal = (long) nX*nY*nZ;
+    long nComplex = (long) nX*nY*(nZ/2+1)*2;
+    REAL* in = malloc(sizeof(REAL)*nReal);
+    REAL* back = malloc(sizeof(REAL)*nReal);
+    REAL* out = malloc(sizeof(REAL)*nComplex);
+    REAL* ref = malloc(sizeof(REAL)*nComplex);
+    for(long i = 0; i < nReal; i++) {
+      in[i] = (REAL) rand() / RAND_MAX - 0.5;
+    }
+    FFTPlan3D* plan = fftPlan3DCreate(nX, nY, nZ);
+    fft3DR2C(plan, in, out);
+    naiveDFT3D(in, ref, nX, nY, nZ);
+    double err = maxRelativeError(out, ref, nComplex);
+    fft3DC2R(plan, out, back);
+    for(long i = 0; i < nReal; i++) {
+      back[i] /= nReal;
+    }
+    double errBack = maxRelativeError(back, in, nReal);
+    if(verbose) {
+      printf("3D R2C %dx%dx%d forward error %.3e round trip error %.3e\n", nX, nY, nZ, err, errBack);
+    }
+    assert(err < tolerance && errBack < tolerance);
+    fftPlan3DDestroy(plan);
+    free(in);
+    free(back);
+    free(out);
+    free(ref);
+  }
+  // Timing: naive DFT against FFT for one long 1D transform and a PME sized 3D grid
+  struct timespec start, end;
+  int n = 1000;
+  REAL* data = calloc(n*2, sizeof(REAL));
+  REAL* work = calloc(n*2, sizeof(REAL));
+  REAL* ref = calloc(n*2, sizeof(REAL));
+  data[2] = 1.0;
+  FFTPlan* plan = fftPlanCreate(n);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  naiveDFT(data, ref, n, -1);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double tNaive = elapsed(start, end);
+  int reps = 1000;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int r = 0; r < reps; r++) {
+    fft(plan, data, work, r % 2 == 0 ? FFT_FORWARD : FFT_BACKWARD);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double tFFT = elapsed(start, end) / reps;
+  fftPlanDestroy(plan);
+  free(data);
+  free(work);
+  free(ref);
+  int nGrid = 64;
+  long nReal = (long) nGrid*nGrid*nGrid;
+  REAL* grid = malloc(sizeof(REAL)*nReal);
+  REAL* spectrum = malloc(sizeof(REAL)*nGrid*nGrid*(nGrid/2+1)*2);
+  for(long i = 0; i < nReal; i++) {
+    grid[i] = (REAL) rand() / RAND_MAX;
+  }
+  FFTPlan3D* plan3D = fftPlan3DCreate(nGrid, nGrid, nGrid);
+  reps = 10;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int r = 0; r < reps; r++) {
+    fft3DR2C(plan3D, grid, spectrum);
+    fft3DC2R(plan3D, spectrum, grid);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double t3D = elapsed(start, end) / reps;
+  printf("FFT timing: n=%d naive DFT %.3e s, FFT %.3e s (%.0fx); %d^3 R2C+C2R %.3e s on %d thread(s)\n",
+    n, tNaive, tFFT, tNaive / tFFT, nGrid, t3D, plan3D->nThreads);
+  fftPlan3DDestroy(plan3D);
+  free(grid);
+  free(spectrum);
+  printf("All tests of fft.c passed!\n");
+}
@@ -0,0 +1,895 @@
+// Author(s): Matthew Speranza
+#include "../include/mbar.h"
+
+#include <assert.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/philox.h"
+#include "../include/timers.h"
+
+static int threadID() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+static int maxThreads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+/**
+ * Opens a sample file for writing, the header is filled in by mbarWriterClose.
+ */
+MBARWriter* mbarWriterCreate(const char* path, int nStates) {
+  if(nStates < 1) {
+    printf("An MBAR file needs at least one state!\n");
+    exit(1);
+  }
+  MBARWriter* writer = calloc(1, sizeof(MBARWriter));
+  if(writer == NULL) {
+    printf("Failed to allocate the MBAR writer!\n");
+    exit(1);
+  }
+  writer->nStates = nStates;
+  writer->counts = calloc(nStates, sizeof(long));
+  writer->row = malloc(sizeof(double)*(nStates + 1));
+  if(writer->counts == NULL || writer->row == NULL) {
+    printf("Failed to allocate the MBAR writer!\n");
+    exit(1);
+  }
+  writer->file = fopen(path, "wb");
+  if(writer->file == NULL) {
+    printf("Could not open %s for MBAR samples!\n", path);
+    exit(1);
+  }
+  // Placeholder header
+  int32_t head[2] = {MBAR_MAGIC, nStates};
+  int64_t zero = 0;
+  fwrite(head, sizeof(int32_t), 2, writer->file);
+  for(int k = 0; k <= nStates; k++) {
+    fwrite(&zero, sizeof(int64_t), 1, writer->file);
+  }
+  return writer;
+}
+
+/**
+ * Appends one sample drawn from state, its reduced potentials are beta times the energies [nStates].
+ */
+void mbarWrite(MBARWriter* writer, int state, const REAL* energy, REAL beta) {
+  if(state < 0 || state >= writer->nStates) {
+    printf("MBAR sample from state %d, there are %d states!\n", state, writer->nStates);
+    exit(1);
+  }
+  writer->row[0] = state;
+  for(int k = 0; k < writer->nStates; k++) {
+    writer->row[k+1] = beta*energy[k];
+  }
+  if(fwrite(writer->row, sizeof(double), writer->nStates + 1, writer->file) != (size_t) writer->nStates + 1) {
+    printf("Failed to write an MBAR sample!\n");
+    exit(1);
+  }
+  writer->counts[state]++;
+  writer->nSamples++;
+}
+
+/**
+ * Writes the sample counts into the header, closes the file and frees the writer.
+ */
+void mbarWriterClose(MBARWriter* writer) {
+  int64_t n = writer->nSamples;
+  fseek(writer->file, 2*sizeof(int32_t), SEEK_SET);
+  fwrite(&n, sizeof(int64_t), 1, writer->file);
+  for(int k = 0; k < writer->nStates; k++) {
+    n = writer->counts[k];
+    fwrite(&n, sizeof(int64_t), 1, writer->file);
+  }
+  fclose(writer->file);
+  free(writer->counts);
+  free(writer->row);
+  free(writer);
+}
+
+/**
+ * Reads the header and leaves the file at the first row.
+ */
+static FILE* openSamples(const char* path, int* nStates, long* nSamples, long** counts) {
+  FILE* file = fopen(path, "rb");
+  if(file == NULL) {
+    printf("Could not open the MBAR samples %s!\n", path);
+    exit(1);
+  }
+  int32_t head[2];
+  int64_t n;
+  if(fread(head, sizeof(int32_t), 2, file) != 2 || head[0] != MBAR_MAGIC || head[1] < 1
+     || fread(&n, sizeof(int64_t), 1, file) != 1 || n < 1) {
+    printf("%s is not an MBAR sample file or has no samples!\n", path);
+    exit(1);
+  }
+  *nStates = head[1];
+  *nSamples = n;
+  *counts = malloc(sizeof(long)*head[1]);
+  if(*counts == NULL) {
+    printf("Failed to allocate the MBAR counts!\n");
+    exit(1);
+  }
+  for(int k = 0; k < head[1]; k++) {
+    if(fread(&n, sizeof(int64_t), 1, file) != 1) {
+      printf("%s has a truncated header!\n", path);
+      exit(1);
+    }
+    (*counts)[k] = n;
+  }
+  return file;
+}
+
+/**
+ * Reads the next rows (at most MBAR_CHUNK_ROWS) into chunk and returns how many.
+ */
+static int readChunk(FILE* file, double* chunk, int nStates, long remaining) {
+  int rows = remaining < MBAR_CHUNK_ROWS ? (int) remaining : MBAR_CHUNK_ROWS;
+  if(fread(chunk, sizeof(double)*(nStates + 1), rows, file) != (size_t) rows) {
+    printf("The MBAR samples end before the header says!\n");
+    exit(1);
+  }
+  return rows;
+}
+
+static void rewindSamples(FILE* file, int nStates) {
+  fseek(file, 2*sizeof(int32_t) + (nStates + 1)*sizeof(int64_t), SEEK_SET);
+}
+
+/**
+ * 1/(1 + e^x) without overflow.
+ */
+static REAL fermi(REAL x) {
+  if(x > 0) {
+    REAL e = exp(-x);
+    return e/(1.0 + e);
+  }
+  return 1.0/(1.0 + exp(x));
+}
+
+/**
+ * h(df) = sum_F fermi(M + w - df) - sum_R fermi(-M + w + df) of the BAR equation, and its derivative in dh.
+ */
+static REAL barFunction(const REAL* forward, long nForward, const REAL* reverse, long nReverse, REAL M, REAL x,
+                        REAL* dh) {
+  REAL h = 0.0;
+  *dh = 0.0;
+  for(long n = 0; n < nForward; n++) {
+    REAL fn = fermi(M + forward[n] - x);
+    h += fn;
+    *dh += fn*(1.0 - fn);
+  }
+  for(long n = 0; n < nReverse; n++) {
+    REAL fn = fermi(-M + reverse[n] + x);
+    h -= fn;
+    *dh += fn*(1.0 - fn);
+  }
+  return h;
+}
+
+/**
+ * BAR (Bennett, J. Comput. Phys. 22, 245 (1976)) free energy of B relative to A from the forward work values
+ * u_B - u_A of samples from A and the reverse ones u_A - u_B of samples from B. h(df) increases with df, so its
+ * root is bracketed around the mean work and found with Newton steps that fall back to bisection.
+ */
+static REAL barSolve(const REAL* forward, long nForward, const REAL* reverse, long nReverse) {
+  const REAL M = log((REAL) nForward/nReverse);
+  REAL x = 0.0, dh;
+  for(long n = 0; n < nForward; n++) {
+    x += 0.5*forward[n]/nForward;
+  }
+  for(long n = 0; n < nReverse; n++) {
+    x -= 0.5*reverse[n]/nReverse;
+  }
+  REAL lo = x - 1.0, hi = x + 1.0;
+  for(REAL width = 2.0; barFunction(forward, nForward, reverse, nReverse, M, lo, &dh) > 0; width *= 2) {
+    lo -= width;
+  }
+  for(REAL width = 2.0; barFunction(forward, nForward, reverse, nReverse, M, hi, &dh) < 0; width *= 2) {
+    hi += width;
+  }
+  for(int it = 0; it < 200 && hi - lo > 1e-12*(1.0 + fabs(x)); it++) {
+    REAL h = barFunction(forward, nForward, reverse, nReverse, M, x, &dh);
+    if(h == 0.0) {
+      break;
+    }
+    if(h > 0) {
+      hi = x;
+    }
+    else {
+      lo = x;
+    }
+    REAL next = dh > 0 ? x - h/dh : 0.5*(lo + hi);
+    if(!(next > lo && next < hi)) {
+      next = 0.5*(lo + hi);
+    }
+    if(fabs(next - x) < 1e-12*(1.0 + fabs(x))) {
+      return next;
+    }
+    x = next;
+  }
+  return x;
+}
+
+/**
+ * Solves A x = b for a symmetric positive definite A [n*n], overwriting both. Returns false if A is not.
+ */
+static bool choleskySolve(int n, REAL* A, REAL* b) {
+  for(int j = 0; j < n; j++) {
+    REAL d = A[j*n+j];
+    for(int k = 0; k < j; k++) {
+      d -= A[j*n+k]*A[j*n+k];
+    }
+    if(!(d > 0.0)) {
+      return false;
+    }
+    A[j*n+j] = sqrt(d);
+    for(int i = j + 1; i < n; i++) {
+      REAL s = A[i*n+j];
+      for(int k = 0; k < j; k++) {
+        s -= A[i*n+k]*A[j*n+k];
+      }
+      A[i*n+j] = s/A[j*n+j];
+    }
+  }
+  for(int i = 0; i < n; i++) {
+    for(int k = 0; k < i; k++) {
+      b[i] -= A[i*n+k]*b[k];
+    }
+    b[i] /= A[i*n+i];
+  }
+  for(int i = n - 1; i >= 0; i--) {
+    for(int k = i + 1; k < n; k++) {
+      b[i] -= A[k*n+i]*b[k];
+    }
+    b[i] /= A[i*n+i];
+  }
+  return true;
+}
+
+/**
+ * Cyclic Jacobi eigenvalues and column eigenvectors V of the symmetric A [n*n], which is destroyed.
+ */
+static void jacobiEigen(int n, REAL* A, REAL* V, REAL* values) {
+  for(int i = 0; i < n*n; i++) {
+    V[i] = 0.0;
+  }
+  for(int i = 0; i < n; i++) {
+    V[i*n+i] = 1.0;
+  }
+  for(int sweep = 0; sweep < 100; sweep++) {
+    REAL off = 0.0, diagonal = 0.0;
+    for(int i = 0; i < n; i++) {
+      diagonal += A[i*n+i]*A[i*n+i];
+      for(int j = i + 1; j < n; j++) {
+        off += A[i*n+j]*A[i*n+j];
+      }
+    }
+    if(off <= 1e-30*diagonal) {
+      break;
+    }
+    for(int p = 0; p < n; p++) {
+      for(int q = p + 1; q < n; q++) {
+        if(A[p*n+q] == 0.0) {
+          continue;
+        }
+        REAL theta = 0.5*(A[q*n+q] - A[p*n+p])/A[p*n+q];
+        REAL t = (theta >= 0 ? 1.0 : -1.0)/(fabs(theta) + sqrt(theta*theta + 1.0));
+        REAL c = 1.0/sqrt(t*t + 1.0), s = t*c;
+        for(int k = 0; k < n; k++) {
+          REAL akp = A[k*n+p], akq = A[k*n+q];
+          A[k*n+p] = c*akp - s*akq;
+          A[k*n+q] = s*akp + c*akq;
+        }
+        for(int k = 0; k < n; k++) {
+          REAL apk = A[p*n+k], aqk = A[q*n+k];
+          A[p*n+k] = c*apk - s*aqk;
+          A[q*n+k] = s*apk + c*aqk;
+        }
+        for(int k = 0; k < n; k++) {
+          REAL vkp = V[k*n+p], vkq = V[k*n+q];
+          V[k*n+p] = c*vkp - s*vkq;
+          V[k*n+q] = s*vkp + c*vkq;
+        }
+      }
+    }
+  }
+  for(int i = 0; i < n; i++) {
+    values[i] = A[i*n+i];
+  }
+}
+
+/**
+ * One pass over the samples at the free energies f of the nSampled states with samples. Each thread adds
+ * ln sum_k N_k exp(f_k - u_kn), p_nk and p_nk p_nj (upper triangle) of its rows into its own stride of work, and the
+ * sums are reduced in thread order so a pass gives the same numbers every time. Returns F(f) and fills
+ * P = sum_n p_n and PP = sum_n p_n p_n^T [nSampled*nSampled].
+ */
+static REAL newtonPass(FILE* file, int nStates, long nSamples, int nSampled, const int* sampled, const REAL* logN,
+                       const REAL* f, double* chunk, REAL* work, int stride, REAL* P, REAL* PP) {
+  const int S = nSampled;
+  rewindSamples(file, nStates);
+  int nThreads = 1;
+  int rows = 0;
+#pragma omp parallel
+  {
+#ifdef _OPENMP
+#pragma omp single
+    nThreads = omp_get_num_threads();
+#endif
+    REAL* acc = &work[threadID()*stride];
+    REAL* a = &acc[1 + S + S*S];
+    memset(acc, 0, sizeof(REAL)*(1 + S + S*S));
+    for(long start = 0; start < nSamples; start += MBAR_CHUNK_ROWS) {
+#pragma omp single
+      rows = readChunk(file, chunk, nStates, nSamples - start);
+#pragma omp for schedule(static)
+      for(int r = 0; r < rows; r++) {
+        const double* u = &chunk[(long) r*(nStates + 1) + 1];
+        for(int j = 0; j < S; j++) {
+          a[j] = f[j] + logN[j] - u[sampled[j]];
+        }
+        REAL max = a[0];
+        for(int j = 1; j < S; j++) {
+          max = a[j] > max ? a[j] : max;
+        }
+        REAL sum = 0.0;
+#pragma omp simd reduction(+:sum)
+        for(int j = 0; j < S; j++) {
+          a[j] = exp(a[j] - max);
+          sum += a[j];
+        }
+        REAL inverse = 1.0/sum;
+        acc[0] += max + log(sum);
+        REAL* p = &acc[1];
+        REAL* pp = &acc[1 + S];
+#pragma omp simd
+        for(int j = 0; j < S; j++) {
+          a[j] *= inverse;
+          p[j] += a[j];
+        }
+        for(int j = 0; j < S; j++) {
+          const REAL aj = a[j];
+#pragma omp simd
+          for(int k = j; k < S; k++) {
+            pp[j*S+k] += aj*a[k];
+          }
+        }
+      }
+    }
+  }
+  REAL F = 0.0;
+  for(int j = 0; j < S; j++) {
+    F -= exp(logN[j])*f[j];
+  }
+  memset(P, 0, sizeof(REAL)*S);
+  memset(PP, 0, sizeof(REAL)*S*S);
+  for(int t = 0; t < nThreads; t++) {
+    const REAL* acc = &work[t*stride];
+    F += acc[0];
+    for(int j = 0; j < S; j++) {
+      P[j] += acc[1+j];
+    }
+    for(int j = 0; j < S*S; j++) {
+      PP[j] += acc[1+S+j];
+    }
+  }
+  for(int j = 0; j < S; j++) {
+    for(int k = 0; k < j; k++) {
+      PP[j*S+k] = PP[k*S+j];
+    }
+  }
+  return F;
+}
+
+/**
+ * Final pass over the samples: the free energies of the unsampled states come from
+ * f_i = -ln sum_n exp(-u_in - lse_n), and the overlap matrix W^T W [nStates*nStates] from
+ * W_ni = exp(f_i - u_in - lse_n), where lse_n = ln sum_k N_k exp(f_k - u_kn) over the sampled states. The first sum
+ * is only needed when a state has no samples; the running maximum per thread keeps it from overflowing.
+ */
+static void overlapPass(FILE* file, MBAR* m, int nSampled, const int* sampled, const REAL* logN, double* chunk,
+                        REAL* overlap) {
+  const int K = m->nStates, S = nSampled;
+  const long N = m->nSamples;
+  int nThreads = maxThreads();
+  // Per thread: lse scratch [S], w [K], running log sums (max and scaled sum) [2K], overlap [K*K]
+  const int stride = ((S + 3*K + K*K + 7)/8)*8;
+  REAL* work = malloc(sizeof(REAL)*stride*nThreads);
+  if(work == NULL) {
+    printf("Failed to allocate the MBAR overlap!\n");
+    exit(1);
+  }
+  REAL* f = m->f;
+  for(int pass = S < K ? 0 : 1; pass < 2; pass++) {
+    rewindSamples(file, K);
+    m->passes++;
+    int rows = 0;
+#pragma omp parallel num_threads(nThreads)
+    {
+      REAL* a = &work[threadID()*stride];
+      REAL* w = &a[S];
+      REAL* logMax = &w[K];
+      REAL* logSum = &logMax[K];
+      REAL* acc = &logSum[K];
+      for(int i = 0; i < K; i++) {
+        logMax[i] = 0.0;
+        logSum[i] = 0.0;
+      }
+      memset(acc, 0, sizeof(REAL)*K*K);
+      for(long start = 0; start < N; start += MBAR_CHUNK_ROWS) {
+#pragma omp single
+        rows = readChunk(file, chunk, K, N - start);
+#pragma omp for schedule(static)
+        for(int r = 0; r < rows; r++) {
+          const double* u = &chunk[(long) r*(K + 1) + 1];
+          for(int j = 0; j < S; j++) {
+            a[j] = f[sampled[j]] + logN[j] - u[sampled[j]];
+          }
+          REAL max = a[0];
+          for(int j = 1; j < S; j++) {
+            max = a[j] > max ? a[j] : max;
+          }
+          REAL sum = 0.0;
+#pragma omp simd reduction(+:sum)
+          for(int j = 0; j < S; j++) {
+            sum += exp(a[j] - max);
+          }
+          const REAL lse = max + log(sum);
+          if(pass == 0) {
+            for(int i = 0; i < K; i++) {
+              REAL x = -u[i] - lse;
+              if(logSum[i] == 0.0 || x > logMax[i]) {
+                logSum[i] = logSum[i] == 0.0 ? 1.0 : logSum[i]*exp(logMax[i] - x) + 1.0;
+                logMax[i] = x;
+              }
+              else {
+                logSum[i] += exp(x - logMax[i]);
+              }
+            }
+            continue;
+          }
+#pragma omp simd
+          for(int i = 0; i < K; i++) {
+            w[i] = exp(f[i] - u[i] - lse);
+          }
+          for(int i = 0; i < K; i++) {
+            const REAL wi = w[i];
+#pragma omp simd
+            for(int j = i; j < K; j++) {
+              acc[i*K+j] += wi*w[j];
+            }
+          }
+        }
+      }
+    }
+    if(pass == 0) {
+      // Combine the threads' log sums for the unsampled states
+      for(int i = 0; i < K; i++) {
+        if(m->counts[i] > 0) {
+          continue;
+        }
+        // Threads without rows have an empty sum
+        REAL max = 0.0;
+        bool first = true;
+        for(int t = 0; t < nThreads; t++) {
+          if(work[t*stride + S + 2*K + i] > 0.0 && (first || work[t*stride + S + K + i] > max)) {
+            max = work[t*stride + S + K + i];
+            first = false;
+          }
+        }
+        REAL sum = 0.0;
+        for(int t = 0; t < nThreads; t++) {
+          if(work[t*stride + S + 2*K + i] > 0.0) {
+            sum += work[t*stride + S + 2*K + i]*exp(work[t*stride + S + K + i] - max);
+          }
+        }
+        f[i] = -(max + log(sum));
+      }
+      continue;
+    }
+    memset(overlap, 0, sizeof(REAL)*K*K);
+    for(int t = 0; t < nThreads; t++) {
+      const REAL* acc = &work[t*stride + S + 3*K];
+      for(int i = 0; i < K*K; i++) {
+        overlap[i] += acc[i];
+      }
+    }
+    for(int i = 0; i < K; i++) {
+      for(int j = 0; j < i; j++) {
+        overlap[i*K+j] = overlap[j*K+i];
+      }
+    }
+  }
+  free(work);
+}
+
+/**
+ * Asymptotic covariance Theta = V S (I - S V^T N V S)^+ S V^T from the overlap W^T W = V S^2 V^T. The one zero
+ * eigenvalue of I - S V^T N V S (adding a constant to every f changes nothing) and any below it from round off
+ * are left out of the pseudoinverse.
+ */
+static void covariance(MBAR* m, REAL* overlap) {
+  const int K = m->nStates;
+  REAL* V = malloc(sizeof(REAL)*K*K);
+  REAL* U = malloc(sizeof(REAL)*K*K);
+  REAL* B = malloc(sizeof(REAL)*K*K);
+  REAL* s = malloc(sizeof(REAL)*K);
+  REAL* mu = malloc(sizeof(REAL)*K);
+  if(V == NULL || U == NULL || B == NULL || s == NULL || mu == NULL) {
+    printf("Failed to allocate the MBAR covariance!\n");
+    exit(1);
+  }
+  jacobiEigen(K, overlap, V, s);
+  for(int i = 0; i < K; i++) {
+    s[i] = s[i] > 0.0 ? sqrt(s[i]) : 0.0;
+  }
+  // B = I - S V^T N V S
+  for(int i = 0; i < K; i++) {
+    for(int j = 0; j <= i; j++) {
+      REAL x = 0.0;
+      for(int k = 0; k < K; k++) {
+        x += V[k*K+i]*m->counts[k]*V[k*K+j];
+      }
+      B[i*K+j] = B[j*K+i] = (i == j ? 1.0 : 0.0) - s[i]*x*s[j];
+    }
+  }
+  jacobiEigen(K, B, U, mu);
+  REAL largest = 0.0;
+  for(int i = 0; i < K; i++) {
+    largest = fabs(mu[i]) > largest ? fabs(mu[i]) : largest;
+  }
+  // B = S B^+ S, then theta = V B V^T
+  for(int i = 0; i < K; i++) {
+    for(int j = 0; j <= i; j++) {
+      REAL x = 0.0;
+      for(int k = 0; k < K; k++) {
+        if(fabs(mu[k]) > 1e-10*largest) {
+          x += U[i*K+k]*U[j*K+k]/mu[k];
+        }
+      }
+      B[i*K+j] = B[j*K+i] = s[i]*x*s[j];
+    }
+  }
+  for(int i = 0; i < K; i++) {
+    for(int k = 0; k < K; k++) {
+      REAL x = 0.0;
+      for(int l = 0; l < K; l++) {
+        x += B[k*K+l]*V[i*K+l];
+      }
+      U[i*K+k] = x;
+    }
+  }
+  for(int i = 0; i < K; i++) {
+    for(int j = 0; j < K; j++) {
+      REAL x = 0.0;
+      for(int k = 0; k < K; k++) {
+        x += U[i*K+k]*V[j*K+k];
+      }
+      m->theta[i*K+j] = x;
+    }
+  }
+  free(V);
+  free(U);
+  free(B);
+  free(s);
+  free(mu);
+}
+
+/**
+ * Free energies and their covariance from the samples in path. Exits if the file is malformed or the Newton
+ * iterations do not converge.
+ */
+MBAR* mbarSolve(const char* path) {
+  TIMER_START(TIMER_BAR);
+  MBAR* m = calloc(1, sizeof(MBAR));
+  if(m == NULL) {
+    printf("Failed to allocate MBAR!\n");
+    exit(1);
+  }
+  FILE* file = openSamples(path, &m->nStates, &m->nSamples, &m->counts);
+  const int K = m->nStates;
+  const long N = m->nSamples;
+  m->f = calloc(K, sizeof(REAL));
+  m->theta = calloc((size_t) K*K, sizeof(REAL));
+  int* sampled = malloc(sizeof(int)*K);
+  REAL* logN = malloc(sizeof(REAL)*K);
+  double* chunk = malloc(sizeof(double)*MBAR_CHUNK_ROWS*(K + 1));
+  if(m->f == NULL || m->theta == NULL || sampled == NULL || logN == NULL || chunk == NULL) {
+    printf("Failed to allocate MBAR!\n");
+    exit(1);
+  }
+  int S = 0;
+  long total = 0;
+  for(int k = 0; k < K; k++) {
+    if(m->counts[k] < 0) {
+      printf("%s has a negative sample count!\n", path);
+      exit(1);
+    }
+    if(m->counts[k] > 0) {
+      sampled[S] = k;
+      logN[S++] = log((REAL) m->counts[k]);
+    }
+    total += m->counts[k];
+  }
+  if(total != N) {
+    printf("%s has %ld samples but its state counts add up to %ld!\n", path, N, total);
+    exit(1);
+  }
+
+  // BAR between neighboring sampled states: forward[j] from sampled[j] to sampled[j+1], reverse[j] back
+  REAL** forward = malloc(sizeof(REAL*)*S);
+  REAL** reverse = malloc(sizeof(REAL*)*S);
+  long* nForward = calloc(S, sizeof(long));
+  long* nReverse = calloc(S, sizeof(long));
+  int* position = malloc(sizeof(int)*K);
+  if(forward == NULL || reverse == NULL || nForward == NULL || nReverse == NULL || position == NULL) {
+    printf("Failed to allocate BAR!\n");
+    exit(1);
+  }
+  for(int j = 0; j < S; j++) {
+    position[sampled[j]] = j;
+    forward[j] = j + 1 < S ? malloc(sizeof(REAL)*m->counts[sampled[j]]) : NULL;
+    reverse[j] = j + 1 < S ? malloc(sizeof(REAL)*m->counts[sampled[j+1]]) : NULL;
+    if(j + 1 < S && (forward[j] == NULL || reverse[j] == NULL)) {
+      printf("Failed to allocate BAR!\n");
+      exit(1);
+    }
+  }
+  for(long start = 0; start < N; start += MBAR_CHUNK_ROWS) {
+    int rows = readChunk(file, chunk, K, N - start);
+    for(int r = 0; r < rows; r++) {
+      const double* row = &chunk[(long) r*(K + 1)];
+      int state = (int) row[0];
+      if(state < 0 || state >= K || m->counts[state] == 0 || row[0] != state) {
+        printf("%s has a sample from state %g, which the header does not count!\n", path, row[0]);
+        exit(1);
+      }
+      const double* u = &row[1];
+      int j = position[state];
+      if(j + 1 < S) {
+        if(nForward[j] == m->counts[state]) {
+          printf("%s has more samples from state %d than the header says!\n", path, state);
+          exit(1);
+        }
+        forward[j][nForward[j]++] = u[sampled[j+1]] - u[state];
+      }
+      if(j > 0) {
+        if(nReverse[j-1] == m->counts[state]) {
+          printf("%s has more samples from state %d than the header says!\n", path, state);
+          exit(1);
+        }
+        reverse[j-1][nReverse[j-1]++] = u[sampled[j-1]] - u[state];
+      }
+    }
+  }
+  m->passes = 1;
+  REAL* f = malloc(sizeof(REAL)*S);
+  if(f == NULL) {
+    printf("Failed to allocate MBAR!\n");
+    exit(1);
+  }
+  f[0] = 0.0;
+#pragma omp parallel for schedule(dynamic)
+  for(int j = 0; j < S - 1; j++) {
+    f[j+1] = barSolve(forward[j], nForward[j], reverse[j], nReverse[j]);
+  }
+  for(int j = 1; j < S; j++) {
+    f[j] += f[j-1];
+  }
+  for(int j = 0; j < S; j++) {
+    free(forward[j]);
+    free(reverse[j]);
+  }
+  free(forward);
+  free(reverse);
+  free(nForward);
+  free(nReverse);
+  free(position);
+  TIMER_STOP(TIMER_BAR);
+
+  // Newton on the S-1 free energies other than the first sampled state's
+  TIMER_START(TIMER_NEWTON);
+  const int nThreads = maxThreads();
+  const int stride = ((1 + S + S*S + S + 7)/8)*8;
+  const int n = S - 1;
+  REAL* work = malloc(sizeof(REAL)*stride*nThreads);
+  REAL* P = malloc(sizeof(REAL)*S);
+  REAL* PP = malloc(sizeof(REAL)*S*S);
+  REAL* H = malloc(sizeof(REAL)*(n*n + 1));
+  REAL* step = malloc(sizeof(REAL)*(n + 1));
+  REAL* fTrial = malloc(sizeof(REAL)*S);
+  if(work == NULL || P == NULL || PP == NULL || H == NULL || step == NULL || fTrial == NULL) {
+    printf("Failed to allocate MBAR!\n");
+    exit(1);
+  }
+  REAL F = newtonPass(file, K, N, S, sampled, logN, f, chunk, work, stride, P, PP);
+  m->passes++;
+  for(m->iterations = 0; ; m->iterations++) {
+    // g_j = sum_n p_nj - N_j, H_jk = delta_jk sum_n p_nj - sum_n p_nj p_nk
+    REAL largest = 0.0;
+    for(int j = 0; j < S; j++) {
+      REAL g = (P[j] - m->counts[sampled[j]])/m->counts[sampled[j]];
+      largest = fabs(g) > largest ? fabs(g) : largest;
+    }
+    m->gradient = largest;
+    if(largest < MBAR_TOLERANCE) {
+      break;
+    }
+    if(m->iterations == MBAR_MAX_ITERATIONS) {
+      printf("MBAR did not converge in %d iterations, the largest relative gradient is %g!\n",
+             MBAR_MAX_ITERATIONS, largest);
+      exit(1);
+    }
+    for(REAL ridge = 0.0; ; ridge = ridge == 0.0 ? 1e-12 : ridge*100) {
+      for(int j = 0; j < n; j++) {
+        step[j] = -(P[j+1] - m->counts[sampled[j+1]]);
+        for(int k = 0; k < n; k++) {
+          H[j*n+k] = (j == k ? P[j+1]*(1.0 + ridge) : 0.0) - PP[(j+1)*S+k+1];
+        }
+      }
+      if(choleskySolve(n, H, step)) {
+        break;
+      }
+      if(ridge > 1.0) {
+        printf("The MBAR Hessian is singular, do the states overlap?\n");
+        exit(1);
+      }
+    }
+    // Newton decrement, below round off of F the full step is taken without a line search
+    REAL decrement = 0.0;
+    for(int j = 0; j < n; j++) {
+      decrement -= (P[j+1] - m->counts[sampled[j+1]])*step[j];
+    }
+    REAL scale = 1.0;
+    for(int backtrack = 0; ; backtrack++) {
+      fTrial[0] = f[0];
+      for(int j = 0; j < n; j++) {
+        fTrial[j+1] = f[j+1] + scale*step[j];
+      }
+      REAL FTrial = newtonPass(file, K, N, S, sampled, logN, fTrial, chunk, work, stride, P, PP);
+      m->passes++;
+      if(decrement < 1e-6 || FTrial <= F - 1e-4*scale*decrement || backtrack == 30) {
+        F = FTrial;
+        memcpy(f, fTrial, sizeof(REAL)*S);
+        break;
+      }
+      scale *= 0.5;
+    }
+  }
+  for(int j = 0; j < S; j++) {
+    m->f[sampled[j]] = f[j];
+  }
+  free(work);
+  free(P);
+  free(PP);
+  free(H);
+  free(step);
+  free(fTrial);
+  free(f);
+  TIMER_STOP(TIMER_NEWTON);
+
+  TIMER_START(TIMER_COVARIANCE);
+  REAL* overlap = malloc(sizeof(REAL)*K*K);
+  if(overlap == NULL) {
+    printf("Failed to allocate the MBAR overlap!\n");
+    exit(1);
+  }
+  overlapPass(file, m, S, sampled, logN, chunk, overlap);
+  covariance(m, overlap);
+  const REAL f0 = m->f[0];
+  for(int k = 0; k < K; k++) {
+    m->f[k] -= f0;
+  }
+  free(overlap);
+  free(sampled);
+  free(logN);
+  free(chunk);
+  fclose(file);
+  TIMER_STOP(TIMER_COVARIANCE);
+  return m;
+}
+
+void mbarDestroy(MBAR* mbar) {
+  free(mbar->counts);
+  free(mbar->f);
+  free(mbar->theta);
+  free(mbar);
+}
+
+/**
+ * Standard deviation of f_j - f_i (kT).
+ */
+REAL mbarUncertainty(MBAR* mbar, int i, int j) {
+  const int K = mbar->nStates;
+  REAL var = mbar->theta[i*K+i] + mbar->theta[j*K+j] - 2.0*mbar->theta[i*K+j];
+  return var > 0.0 ? sqrt(var) : 0.0;
+}
+
+void mbarPrint(MBAR* mbar) {
+  printf("MBAR: %d states, %ld samples, %d Newton iterations, %d passes, relative gradient %.2e\n",
+         mbar->nStates, mbar->nSamples, mbar->iterations, mbar->passes, mbar->gradient);
+  printf(" State  Samples         f (kT)        +/-    f-f_prev (kT)        +/-\n");
+  for(int k = 0; k < mbar->nStates; k++) {
+    printf(" %5d %8ld %14.6f %10.6f", k, mbar->counts[k], mbar->f[k], mbarUncertainty(mbar, 0, k));
+    if(k > 0) {
+      printf(" %16.6f %10.6f", mbar->f[k] - mbar->f[k-1], mbarUncertainty(mbar, k - 1, k));
+    }
+    printf("\n");
+  }
+}
+
+/////////////////////////////////////////// TESTS
+
+void mbarTest(bool verbose) {
+  // Harmonic states u_k = kappa_k (x - mu_k)^2 / 2 with f_k - f_0 = ln(kappa_k/kappa_0)/2, sampled exactly. State 4
+  // has no samples and gets its free energy from the others.
+  const int K = 10, empty = 4;
+  const char* path = "mbarTest.mbar";
+  REAL kappa[10], mu[10], u[10];
+  for(int k = 0; k < K; k++) {
+    kappa[k] = 1.0 + 0.5*k;
+    mu[k] = 0.3*k;
+  }
+  MBARWriter* writer = mbarWriterCreate(path, K);
+  long written = 0;
+  for(int s = 0; s < K; s++) {
+    const int samples = s == empty ? 0 : 4000 + 1000*s;
+    for(int i = 0; i < samples; i += 4) {
+      REAL normals[4];
+      philoxNormals(7, 0, s, i/4, normals);
+      for(int l = 0; l < 4; l++) {
+        REAL x = mu[s] + normals[l]/sqrt(kappa[s]);
+        for(int k = 0; k < K; k++) {
+          u[k] = 0.5*kappa[k]*(x - mu[k])*(x - mu[k]);
+        }
+        mbarWrite(writer, s, u, 1.0);
+        written++;
+      }
+    }
+  }
+  mbarWriterClose(writer);
+  MBAR* m = mbarSolve(path);
+  if(verbose) {
+    mbarPrint(m);
+  }
+  assert(m->nStates == K && m->nSamples == written && m->counts[empty] == 0);
+  assert(m->gradient < MBAR_TOLERANCE && m->iterations <= 10);
+  REAL worst = 0.0;
+  for(int k = 1; k < K; k++) {
+    REAL exact = 0.5*log(kappa[k]/kappa[0]);
+    REAL sigma = mbarUncertainty(m, 0, k);
+    assert(sigma > 1e-3 && sigma < 0.1);
+    REAL z = fabs(m->f[k] - exact)/sigma;
+    worst = z > worst ? z : worst;
+    if(verbose) {
+      printf("State %d: f %.5f exact %.5f, %.2f sigma\n", k, m->f[k], exact, z);
+    }
+  }
+  assert(worst < 4.0);
+  // Passes are reduced in thread order, so solving again gives the same numbers
+  MBAR* again = mbarSolve(path);
+  for(int k = 0; k < K; k++) {
+    assert(again->f[k] == m->f[k]);
+  }
+  // The unsampled state is less certain than its sampled neighbors
+  assert(mbarUncertainty(m, 0, empty) > mbarUncertainty(m, 0, empty - 1));
+  mbarDestroy(again);
+  mbarDestroy(m);
+  remove(path);
+  printf("All tests of mbar.c passed!\n");
+}
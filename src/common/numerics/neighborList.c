@@ -1,4 +1,6 @@
 #include "../include/neighborList.h"
+#include "../include/arena.h"
+#include "../include/timers.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -6,77 +8,78 @@
 #include <math.h>
 #include <string.h>
 
-// Use bfs to build 1-3 and 1-4 lists
+/**
+ * Breadth first search over System->list12 for the 1-3 and 1-4 lists of every atom. visited holds the atom whose
+ * lists are being built (+1) for the atoms it already excludes, so one array of nAtoms serves every atom. The lists
+ * are gathered in two reused vectors and copied at their final size into System->bondedArena.
+ */
 void buildBonded(System* system) {
-  system->list13 = malloc(sizeof(Vector)*system->nAtoms);
-  system->list14 = malloc(sizeof(Vector)*system->nAtoms);
-  if(system->list13 == NULL || system->list14 == NULL) {
-    printf("Failed to allocate memory for list13 or list14 in buildBonded\n");
-    exit(1);
-  }
-  int** visited = malloc(sizeof(int*)*system->nAtoms);
-  if(visited == NULL) {
-    printf("Failed to allocate memory for visited array in buildBonded\n");
-    exit(1);
-  }
-  // 1-3 atoms
+  TIMER_START(TIMER_BONDED);
+  bondedDestroy(system);
+  system->bondedArena = arenaCreate(1 << 20, MEMORY_BONDED_LISTS);
+  system->list13 = arenaAlloc(system->bondedArena, sizeof(IntVector)*system->nAtoms);
+  system->list14 = arenaAlloc(system->bondedArena, sizeof(IntVector)*system->nAtoms);
+  int* visited = memoryCalloc(system->nAtoms, sizeof(int), MEMORY_BONDED_LISTS);
+  IntVector list13, list14;
+  intVectorInit(&list13, 16, MEMORY_BONDED_LISTS);
+  intVectorInit(&list14, 16, MEMORY_BONDED_LISTS);
   for(int i = 0; i < system->nAtoms; i++) {
-    Vector* list13 = vectorCreate(sizeof(int), 10, NULL, INT);
-    // Mark all atoms as unvisited - 0=false
-    visited[i] = malloc(sizeof(int)*system->nAtoms);
-    if(visited[i] == NULL) {
-      printf("Failed to allocate memory for visited array in buildBonded\n");
-      exit(1);
-    }
-    // Mark unwanted atoms as visited
-    visited[i][i] = 1; // the atom itself
-    Vector ilist12 = system->list12[i];
+    const int mark = i + 1;
+    // 1-3 atoms
+    list13.size = 0;
+    visited[i] = mark; // the atom itself
+    IntVector ilist12 = system->list12[i];
     for(int j = 0; j < ilist12.size; j++) {
-      int atomID = ((int*)ilist12.array)[j];
-      visited[i][atomID] = 1; // the atoms 12 atoms
-      Vector bfsList = system->list12[atomID];
+      int atomID = ilist12.array[j];
+      visited[atomID] = mark; // the atoms 12 atoms
+      IntVector bfsList = system->list12[atomID];
       for(int k = 0; k < bfsList.size; k++) {
-        int atomID2 = ((int*)bfsList.array)[k];
-        if(visited[i][atomID2] == 0) {
-          vectorAppend(list13, &atomID2); // add the atoms 12 atoms 12 atoms to 13 list
+        int atomID2 = bfsList.array[k];
+        if(visited[atomID2] != mark) {
+          intVectorPush(&list13, atomID2); // add the atoms 12 atoms 12 atoms to 13 list
         }
-        visited[i][atomID2] = 1; // the atoms 13 atoms
+        visited[atomID2] = mark; // the atoms 13 atoms
       }
     }
-    system->list13[i] = *list13;
-  }
-  // 1-4 atoms
-  for(int i = 0; i < system->nAtoms; i++) {
-    Vector* list14 = vectorCreate(sizeof(int), 10, NULL, INT);
-    // Loop over 1-3 atoms
-    Vector ilist13 = system->list13[i];
-    for(int j = 0; j < ilist13.size; j++) {
-      int atomID = ((int*)ilist13.array)[j];
-      Vector bfsList = system->list12[atomID];
+    // 1-4 atoms
+    list14.size = 0;
+    for(int j = 0; j < list13.size; j++) {
+      int atomID = list13.array[j];
+      IntVector bfsList = system->list12[atomID];
       for(int k = 0; k < bfsList.size; k++) {
-        int atomID2 = ((int*)bfsList.array)[k];
-        if(visited[i][atomID2] == 0) {
-          vectorAppend(list14, &atomID2); // add the atoms 13 atoms 12 atoms to 14 list
+        int atomID2 = bfsList.array[k];
+        if(visited[atomID2] != mark) {
+          intVectorPush(&list14, atomID2); // add the atoms 13 atoms 12 atoms to 14 list
         }
-        visited[i][atomID2] = 1; // mark the atoms 14 atoms
+        visited[atomID2] = mark; // mark the atoms 14 atoms
       }
     }
-    system->list14[i] = *list14;
-    free(visited[i]);
+    system->list13[i] = arenaIntVectorCopy(system->bondedArena, &list13);
+    system->list14[i] = arenaIntVectorCopy(system->bondedArena, &list14);
   }
-  free(visited);
+  intVectorFree(&list13);
+  intVectorFree(&list14);
+  memoryFree(visited, MEMORY_BONDED_LISTS);
+  TIMER_STOP(TIMER_BONDED);
+}
+
+/**
+ * Frees the 1-3 and 1-4 lists with their arena.
+ */
+void bondedDestroy(System* system) {
+  arenaDestroy(system->bondedArena);
+  system->bondedArena = NULL;
+  system->list13 = NULL;
+  system->list14 = NULL;
 }
 
 int indexGrid(int x, int y, int z, int nx, int ny, int nz) {
-  // Shift the index to the correct cell inside box
-  if(x >= nx) { x -= nx; }
-  else if(x < 0) { x += nx; }
-  if(y >= ny) { y -= ny; }
-  else if(y < 0) { y += ny; }
-  if(z >= nz) { z -= nz; }
-  else if(z < 0) { z += nz; }
-  int index = nx * x + ny * y + z;
-  assert(index >= 0 && index <= nx*ny*nz);
+  // Shift the index to the correct cell inside box (search ranges can wrap more than once in small boxes)
+  x = ((x % nx) + nx) % nx;
+  y = ((y % ny) + ny) % ny;
+  z = ((z % nz) + nz) % nz;
+  int index = (x * ny + y) * nz + z;
+  assert(index >= 0 && index < nx*ny*nz);
   return index;
 }
 
@@ -90,39 +93,113 @@ extern REAL imageDx(REAL dx, REAL axisLen) {
  return dx;
 };
 
-void addCellToList(Vector* cell, Vector* list, System* system, int atomID, REAL aLen, REAL bLen, REAL cLen) {
+/**
+ * Adds every atom of the cell with a larger index than atomID that is within cutoff+buffer, so each pair is
+ * stored exactly once (half list) and atoms are never in their own list.
+ */
+void addCellToList(IntVector* cell, IntVector* list, System* system, int atomID, REAL aLen, REAL bLen, REAL cLen) {
   REAL* pos = system->X;
   REAL rCut2 = system->realspaceCutoff + system->realspaceBuffer;
   rCut2 *= rCut2;
   for(int i = 0; i < cell->size; i++) {
-    int atomID2 = ((int*)cell->array)[i];
+    int atomID2 = cell->array[i];
+    if(atomID2 <= atomID) {
+      continue;
+    }
     REAL dx = imageDx(pos[atomID*3] - pos[atomID2*3], aLen);
     REAL dy = imageDx(pos[atomID*3+1] - pos[atomID2*3+1], bLen);
     REAL dz = imageDx(pos[atomID*3+2] - pos[atomID2*3+2], cLen);
     REAL r2 = dx*dx + dy*dy + dz*dz;
     if(r2 < rCut2) {
-      vectorAppend(list, &atomID2);
+      intVectorPush(list, atomID2);
     }
   }
 }
 
-void addCellToListSelf(Vector* cell, Vector* list, System* system, int atomID, REAL aLen, REAL bLen, REAL cLen) {
-  REAL* pos = system->X;
-  REAL rCut2 = system->realspaceCutoff + system->realspaceBuffer;
-  rCut2 *= rCut2;
-  for(int i = 0; i < cell->size; i++) {
-    int atomID2 = ((int*)cell->array)[i];
-    REAL dx = imageDx(pos[atomID*3] - pos[atomID2*3], aLen);
-    REAL dy = imageDx(pos[atomID*3+1] - pos[atomID2*3+1], bLen);
-    REAL dz = imageDx(pos[atomID*3+2] - pos[atomID2*3+2], cLen);
-    REAL r2 = dx*dx + dy*dy + dz*dz;
-    if(r2 < rCut2 && atomID <= atomID2) {
-      vectorAppend(list, &atomID2);
+/**
+ * (Re)allocates the cell grid when its shape changes, otherwise empties the cells so a rebuild doesn't allocate.
+ */
+static VerletCells* prepareCells(System* system, int nX, int nY, int nZ) {
+  VerletCells* grid = system->verletCells;
+  if(grid != NULL && grid->nX == nX && grid->nY == nY && grid->nZ == nZ) {
+    for(int c = 0; c < grid->nCells; c++) {
+      grid->cells[c].size = 0;
     }
+    return grid;
   }
+  int nBuilds = 0;
+  if(grid != NULL) {
+    nBuilds = grid->nBuilds;
+    for(int c = 0; c < grid->nCells; c++) {
+      intVectorFree(&grid->cells[c]);
+    }
+    memoryFree(grid->cells, MEMORY_NEIGHBOR_LISTS);
+    memoryFree(grid->visited, MEMORY_NEIGHBOR_LISTS);
+  } else {
+    grid = memoryMalloc(sizeof(VerletCells), MEMORY_NEIGHBOR_LISTS);
+    grid->atomCell = memoryMalloc(sizeof(int)*system->nAtoms*3, MEMORY_NEIGHBOR_LISTS);
+    grid->XBuild = memoryMalloc(sizeof(REAL)*system->nAtoms*3, MEMORY_NEIGHBOR_LISTS);
+    grid->lambdaAtom = NULL;
+  }
+  grid->nX = nX;
+  grid->nY = nY;
+  grid->nZ = nZ;
+  grid->nCells = nX*nY*nZ;
+  grid->nBuilds = nBuilds;
+  grid->cells = memoryMalloc(sizeof(IntVector)*grid->nCells, MEMORY_NEIGHBOR_LISTS);
+  grid->visited = memoryCalloc(grid->nCells, sizeof(int), MEMORY_NEIGHBOR_LISTS);
+  for(int c = 0; c < grid->nCells; c++) {
+    intVectorInit(&grid->cells[c], 32, MEMORY_NEIGHBOR_LISTS);
+  }
+  system->verletCells = grid;
+  return grid;
 }
 
+/**
+ * Splits every Verlet list into plain pairs followed by the perturbed pairs with a System->activeLambdas atom, and
+ * counts the plain ones in System->verletPlain. A lambda atom's own list is all perturbed. The real space kernels
+ * then run the bulk of the pairs without looking at lambdas at all. Called by every build while there are lambda
+ * atoms, the first one marks them in VerletCells->lambdaAtom.
+ */
+static void partitionVerlet(System* system) {
+  const int nAtoms = system->nAtoms;
+  if(system->verletPlain == NULL) {
+    system->verletPlain = memoryMalloc(sizeof(int)*nAtoms, MEMORY_NEIGHBOR_LISTS);
+  }
+  VerletCells* cells = system->verletCells;
+  if(cells->lambdaAtom == NULL) {
+    cells->lambdaAtom = memoryCalloc(nAtoms, sizeof(bool), MEMORY_NEIGHBOR_LISTS);
+    for(int l = 0; l < system->nActiveLambdas; l++) {
+      cells->lambdaAtom[system->activeLambdas[l]] = true;
+    }
+  }
+  const bool* lambdaAtom = cells->lambdaAtom;
+#pragma omp parallel for schedule(static)
+  for(int i = 0; i < nAtoms; i++) {
+    int* list = system->verletList[i].array;
+    const int size = system->verletList[i].size;
+    if(lambdaAtom[i]) {
+      system->verletPlain[i] = 0;
+      continue;
+    }
+    int nPlain = 0;
+    for(int n = 0; n < size; n++) {
+      if(!lambdaAtom[list[n]]) {
+        int k = list[n];
+        list[n] = list[nPlain];
+        list[nPlain++] = k;
+      }
+    }
+    system->verletPlain[i] = nPlain;
+  }
+}
+
+/**
+ * Half Verlet list of every pair within cutoff+buffer from a cell grid. Rebuilding reuses the lists and the grid
+ * of the previous build (they only grow), so dynamics doesn't allocate once the lists reach their size.
+ */
 void buildVerlet(System* system) {
+  TIMER_START(TIMER_VERLET_BUILD);
   // Find axis lengths and grid spacing
   REAL* a = system->boxDim[0];
   // len(vec) = sqrt(dot(vec, vec))
@@ -134,8 +211,21 @@ void buildVerlet(System* system) {
   // a dot (b cross c) = volume
   system->volume = a[0]*(b[1]*c[2] - b[2]*c[1]) - a[1]*(b[0]*c[2] - b[2]*c[0]) + a[2]*(b[0]*c[1] - b[1]*c[0]);
   system->particleDensity = system->nAtoms / system->volume;
-  system->verletList = malloc(sizeof(Vector)*system->nAtoms);
-  system->realspaceBuffer = 2;
+  if(system->verletList == NULL) {
+    // Start each list at the expected half sphere of neighbors with some room, denser spots grow their own
+    const REAL rList = system->realspaceCutoff + system->realspaceBuffer;
+    const REAL expected = system->particleDensity*2.0/3.0*M_PI*rList*rList*rList;
+    int capacity = 1.25*expected + 16;
+    capacity = capacity < 16 ? 16 : capacity > system->nAtoms ? system->nAtoms : capacity;
+    system->verletList = memoryMalloc(sizeof(IntVector)*system->nAtoms, MEMORY_NEIGHBOR_LISTS);
+    for(int i = 0; i < system->nAtoms; i++) {
+      intVectorInit(&system->verletList[i], capacity, MEMORY_NEIGHBOR_LISTS);
+    }
+  } else { // Rebuild
+    for(int i = 0; i < system->nAtoms; i++) {
+      system->verletList[i].size = 0;
+    }
+  }
   float num = 16 / (aLen + bLen + cLen);
   // Set number of grid cells in each direction
   int nX = num * aLen + 1;
@@ -153,66 +243,40 @@ void buildVerlet(System* system) {
     nZ = 2;
   }
   float zCubeLen = cLen / nZ;
-  int nCells = nX * nY * nZ;
+  VerletCells* cells = prepareCells(system, nX, nY, nZ);
+  IntVector* grid = cells->cells;
+  int* atomCell = cells->atomCell;
+  int* visitedCells = cells->visited;
   // Loop over all atoms and assign them to grid cells
-  Vector* grid = calloc(sizeof(Vector), nX*nY*nZ);
   for(int i = 0; i < system->nAtoms; i++) {
     REAL x = system->X[i*3] - system->minDim[0]; // shift unit cell into +x, +y, +z octant
     REAL y = system->X[i*3+1] - system->minDim[1];
     REAL z = system->X[i*3+2] - system->minDim[2];
-    int gridX = x / xCubeLen;
-    int gridY = y / yCubeLen;
-    int gridZ = z / zCubeLen;
-    int index = indexGrid(gridX, gridY, gridZ, nX, nY, nZ);
-    if(grid[index].array == NULL) {
-      grid[index] = *vectorCreate(sizeof(int), 32, NULL, INT);
-    }
-    int atomID = i;
-    vectorAppend(&grid[index], &atomID);
+    atomCell[i*3] = floor(x / xCubeLen);
+    atomCell[i*3+1] = floor(y / yCubeLen);
+    atomCell[i*3+2] = floor(z / zCubeLen);
+    int index = indexGrid(atomCell[i*3], atomCell[i*3+1], atomCell[i*3+2], nX, nY, nZ);
+    intVectorPush(&grid[index], i);
   }
-  // Loop over all atoms again and loop over half of the neighboring cells to build list
+  // Loop over all atoms again and every cell that can hold a neighbor to build the half list
   REAL rCut = system->realspaceCutoff + system->realspaceBuffer;
+  int searchX = rCut/xCubeLen+1;
+  int searchY = rCut/yCubeLen+1;
+  int searchZ = rCut/zCubeLen+1;
+  // Don't search further than the box itself (visitedCells catches the one overlap for even counts)
+  searchX = searchX > nX/2 ? nX/2 : searchX;
+  searchY = searchY > nY/2 ? nY/2 : searchY;
+  searchZ = searchZ > nZ/2 ? nZ/2 : searchZ;
   long interactionsCell = 0;
-  int* visitedCells = calloc(sizeof(int), nCells);
   for(int i = 0; i < system->nAtoms; i++) {
-    system->verletList[i] = *vectorCreate(sizeof(int), 1e3, NULL, INT);
-    REAL x = system->X[i*3] - system->minDim[0];
-    REAL y = system->X[i*3+1] - system->minDim[1];
-    REAL z = system->X[i*3+2] - system->minDim[2];
-    int gridX = x / xCubeLen;
-    int searchX = rCut/xCubeLen+1;
-    int gridY = y / yCubeLen;
-    int searchY = rCut/yCubeLen+1;
-    int gridZ = z / zCubeLen;
-    int searchZ = rCut/zCubeLen+1;
-    // Add atoms from the current cell
-    int cellID = indexGrid(gridX, gridY, gridZ, nX, nY, nZ);
-    visitedCells[cellID] = 1;
-    addCellToListSelf(&grid[cellID], &system->verletList[i], system, i, aLen, bLen, cLen);
-    // Add atoms from y-direction line of cells
-    for(int j = gridY+1; j <= gridY+searchY; j++) {
-      int index = indexGrid(gridX, j, gridZ, nX, nY, nZ);
-      if(visitedCells[index] != 1) {
-        addCellToList(&grid[index], &system->verletList[i], system, i, aLen, bLen, cLen);
-      }
-      visitedCells[index] = 1;
-    }
-    // Add atoms from z-direction half-plane of cells
-    for(int j = gridY-searchY; j <= gridY+searchY; j++) {
-      for(int k = gridZ+1; k <= gridZ+searchZ; k++) {
-        int index = indexGrid(gridX, j, k, nX, nY, nZ);
-        if(visitedCells[index] != 1) {
-          addCellToList(&grid[index], &system->verletList[i], system, i, aLen, bLen, cLen);
-        }
-        visitedCells[index] = 1;
-      }
-    }
-    // Add atoms from x-direction half-cube of cells
-    for(int j = gridY-searchY; j <= gridY+searchY; j++) {
-      for(int k = gridZ-searchZ; k <= gridZ+searchZ; k++) {
-        for(int l = gridX+1; l <= gridX+searchX; l++) {
+    int gridX = atomCell[i*3];
+    int gridY = atomCell[i*3+1];
+    int gridZ = atomCell[i*3+2];
+    for(int j = gridX-searchX; j <= gridX+searchX; j++) {
+      for(int k = gridY-searchY; k <= gridY+searchY; k++) {
+        for(int l = gridZ-searchZ; l <= gridZ+searchZ; l++) {
           int index = indexGrid(j, k, l, nX, nY, nZ);
-          if(visitedCells[index] != 1) {
+          if(visitedCells[index] != 1 && grid[index].size > 0) {
             addCellToList(&grid[index], &system->verletList[i], system, i, aLen, bLen, cLen);
           }
           visitedCells[index] = 1;
@@ -220,19 +284,103 @@ void buildVerlet(System* system) {
       }
     }
     interactionsCell+=system->verletList[i].size;
-    memset(visitedCells, 0, sizeof(int)*nCells);
+    memset(visitedCells, 0, sizeof(int)*cells->nCells);
   }
-  free(visitedCells);
-  printf("Interactions: %ld\n", interactionsCell);
-  printf("Vector: ");
-  vectorPrint(&system->verletList[0], system->verletList[0].size);
-  for(int i = 0; i < nCells; i++) {
-    vectorBackingFree(&grid[i]);
+  memcpy(cells->XBuild, system->X, sizeof(REAL)*system->nAtoms*3);
+  cells->boxBuild[0] = aLen;
+  cells->boxBuild[1] = bLen;
+  cells->boxBuild[2] = cLen;
+  cells->nBuilds++;
+  if(system->nActiveLambdas > 0) {
+    partitionVerlet(system);
   }
-  free(grid);
+  if(system->verbose) {
+    printf("Verlet list interactions: %ld\n", interactionsCell);
+  }
+  COUNTER_ADD(COUNTER_VERLET_BUILDS, 1);
+  COUNTER_ADD(COUNTER_VERLET_PAIRS, interactionsCell);
+  TIMER_ITEMS(interactionsCell);
+  TIMER_STOP(TIMER_VERLET_BUILD);
+}
 
+/**
+ * Lazy neighbor list update: rebuilds the Verlet lists only once some atom has moved more than half the buffer
+ * since the last build, the first point at which a pair could have crossed into the cutoff unseen.
+ * <p>
+ * The box may have been scaled since the build (barostat). Displacements are then measured in the build box, with
+ * positions scaled back by boxBuild/box per axis, where every pair distance is the current one divided by at most
+ * s = min(box/boxBuild). A pair left out at the build was further than cutoff+buffer there, so it stays outside the
+ * cutoff while no atom has moved more than (cutoff + buffer - cutoff/s)/2. For s = 1 that is half the buffer, small
+ * volume moves only shrink (or grow) the allowance and keep the lists.
+ * @return true if the lists were rebuilt
+ */
+bool updateVerlet(System* system) {
+  TIMER_START(TIMER_VERLET_UPDATE);
+  const REAL* X = system->X;
+  const REAL* X0 = system->verletCells->XBuild;
+  const REAL* boxBuild = system->verletCells->boxBuild;
+  REAL ratio[3];
+  REAL s = INFINITY;
+  for(int k = 0; k < 3; k++) {
+    REAL* axis = system->boxDim[k];
+    REAL len = sqrt(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+    ratio[k] = boxBuild[k]/len;
+    s = fmin(s, len/boxBuild[k]);
+  }
+  const REAL cutoff = system->realspaceCutoff;
+  const REAL allowed = 0.5*(cutoff + system->realspaceBuffer - cutoff/s);
+  if(allowed <= 0.0) {
+    buildVerlet(system);
+    TIMER_STOP(TIMER_VERLET_UPDATE);
+    return true;
+  }
+  const REAL limit = allowed*allowed;
+  const REAL rx = ratio[0], ry = ratio[1], rz = ratio[2];
+  REAL maxMove = 0.0;
+#pragma omp parallel for simd reduction(max:maxMove) schedule(static)
+  for(int i = 0; i < system->nAtoms; i++) {
+    REAL dx = rx*X[i*3] - X0[i*3];
+    REAL dy = ry*X[i*3+1] - X0[i*3+1];
+    REAL dz = rz*X[i*3+2] - X0[i*3+2];
+    REAL r2 = dx*dx + dy*dy + dz*dz;
+    maxMove = r2 > maxMove ? r2 : maxMove;
+  }
+  if(maxMove <= limit) {
+    TIMER_STOP(TIMER_VERLET_UPDATE);
+    return false;
+  }
+  buildVerlet(system);
+  TIMER_STOP(TIMER_VERLET_UPDATE);
+  return true;
 }
 
+/**
+ * Frees the Verlet lists and the cell grid.
+ */
+void verletDestroy(System* system) {
+  if(system->verletList != NULL) {
+    for(int i = 0; i < system->nAtoms; i++) {
+      intVectorFree(&system->verletList[i]);
+    }
+    memoryFree(system->verletList, MEMORY_NEIGHBOR_LISTS);
+    system->verletList = NULL;
+  }
+  memoryFree(system->verletPlain, MEMORY_NEIGHBOR_LISTS);
+  system->verletPlain = NULL;
+  VerletCells* cells = system->verletCells;
+  if(cells != NULL) {
+    for(int c = 0; c < cells->nCells; c++) {
+      intVectorFree(&cells->cells[c]);
+    }
+    memoryFree(cells->cells, MEMORY_NEIGHBOR_LISTS);
+    memoryFree(cells->visited, MEMORY_NEIGHBOR_LISTS);
+    memoryFree(cells->atomCell, MEMORY_NEIGHBOR_LISTS);
+    memoryFree(cells->XBuild, MEMORY_NEIGHBOR_LISTS);
+    memoryFree(cells->lambdaAtom, MEMORY_NEIGHBOR_LISTS);
+    memoryFree(cells, MEMORY_NEIGHBOR_LISTS);
+    system->verletCells = NULL;
+  }
+}
 
 void buildLists(System* system) {
   buildBonded(system);
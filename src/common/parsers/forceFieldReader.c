@@ -1,5 +1,6 @@
 // Author(s): Matthew Speranza
 #include "../include/forceFieldReader.h"
+#include "../include/arena.h"
 
 #include <assert.h>
 #include <string.h>
@@ -20,12 +21,7 @@ enum ForceFieldParams stringToFFTermEnum(char* ffTerm) {
   return param;
 }
 
-Atom* atomLine(char** words, int size) {
-  Atom* atom = malloc(sizeof(Atom));
-  if(atom == NULL) {
-    printf("Couldn't read atom line.");
-    exit(1);
-  }
+void atomLine(char** words, int size, Atom* atom) {
   if(size < 8) {
     printf("Incorrect number of arguments for atom line: ");
     for(int i = 0; i < size; i++) {
@@ -52,15 +48,9 @@ Atom* atomLine(char** words, int size) {
   atom->atomicNum = atoi(words[end++]);
   atom->atomicMass = atof(words[end++]);
   atom->valence = atoi(words[end]);
-  return atom;
 }
 
-Angle* angleLine(char** words, int size) {
-  Angle* angle = malloc(sizeof(Angle));
-  if(angle == NULL) {
-    printf("Couldn't allocate angle line.");
-    exit(1);
-  }
+void angleLine(char** words, int size, Angle* angle) {
   if (size < 5) {
     printf("Couldn't read angle line: ");
     for(int i = 0; i < size; i++) {
@@ -77,15 +67,9 @@ Angle* angleLine(char** words, int size) {
   for(int i = 0; i < size-5; i++) {
     angle->angle[i] = atof(words[i+5]);
   }
-  return angle;
 }
 
-AngTors* angtorsLine(char** words, int size) {
-  AngTors* angtors = malloc(sizeof(Angle));
-  if(angtors == NULL) {
-    printf("Couldn't allocate angle line.");
-    exit(1);
-  }
+void angtorsLine(char** words, int size, AngTors* angtors) {
   if (size != 11) {
     printf("Couldn't read angle line: ");
     for(int i = 0; i < size; i++) {
@@ -100,15 +84,9 @@ AngTors* angtorsLine(char** words, int size) {
   for(int i = 0; i < 6; i++) {
     angtors->forceConstants[i] = atof(words[i+5]);
   }
-  return angtors;
 }
 
-BioType* biotypeLine(char** words, int size) {
-  BioType* biotype = malloc(sizeof(BioType));
-  if (biotype == NULL) {
-    printf("Couldn't allocate biotype line.");
-    exit(1);
-  }
+void biotypeLine(char** words, int size, BioType* biotype) {
   if(size < 5) {
     printf("Too few arguments for biotype line: ");
     for(int i = 0; i < size; i++) {
@@ -134,15 +112,9 @@ BioType* biotypeLine(char** words, int size) {
   }
   biotype->moleculeName[count] = '\0';
   biotype->atomType = atof(words[end]);
-  return biotype;
 }
 
-Bond* bondLine(char** words, int size) {
-  Bond* bond = malloc(sizeof(Bond));
-  if(bond == NULL) {
-    printf("Couldn't allocate bond line.");
-    exit(1);
-  }
+void bondLine(char** words, int size, Bond* bond) {
   if(size != 5) {
     printf("Too few arguments for bond line: ");
     for(int i = 0; i < size; i++) {
@@ -155,15 +127,9 @@ Bond* bondLine(char** words, int size) {
   bond->atomClasses[1] = atoi(words[2]);
   bond->forceConstant = atof(words[3]);
   bond->distance = atof(words[4]);
-  return bond;
 }
 
-Multipole* multipoleLines(char** words, int size, char* line, FILE* file) {
-  Multipole* mpole = malloc(sizeof(Multipole));
-  if (mpole == NULL) {
-    printf("Couldn't allocate multipole line.");
-    exit(1);
-  }
+void multipoleLines(char** words, int size, char* line, FILE* file, Multipole* mpole) {
   if(strcasecmp(words[0], "charge") == 0) {
     if(size != 3) {
       printf("Couldn't parse charge line: ");
@@ -191,52 +157,40 @@ Multipole* multipoleLines(char** words, int size, char* line, FILE* file) {
     if(size != 5) {
       mpole->frameAtomTypes[3] = atoi(words[next++]);
     }
-    if(next == 4) { // 3 atom classes
-      if(mpole->frameAtomTypes[1] < 0 || mpole->frameAtomTypes[2] < 0) {
-        mpole->frameDef = BISECTOR;
-      } else {
-        mpole->frameDef = ZTHENX;
-      }
-    } else if(next == 5) { // 4 atom classes
-      if(mpole->frameAtomTypes[2] < 0 || mpole->frameAtomTypes[3] < 0) {
-        mpole->frameDef = ZTHENBISECTOR;
-      } else {
-        mpole->frameDef = THREEFOLD;
-      }
+    // Frame from the signs of the frame atom types (Tinker's kmpole)
+    int kz = mpole->frameAtomTypes[1], kx = mpole->frameAtomTypes[2], ky = mpole->frameAtomTypes[3];
+    if(kz == 0) {
+      mpole->frameDef = MPOL_NONE;
+    } else if(kx == 0) {
+      mpole->frameDef = ZONLY;
+    } else if(kz < 0 && kx < 0 && ky < 0) {
+      mpole->frameDef = THREEFOLD;
+    } else if(kx < 0 && ky < 0) {
+      mpole->frameDef = ZTHENBISECTOR;
+    } else if(kz < 0 || kx < 0) {
+      mpole->frameDef = BISECTOR;
+    } else {
+      mpole->frameDef = ZTHENX;
     }
-    if(mpole->frameDef == NONE) {
-      printf("Frame definition not defined for multipole line: ");
-      for(int i = 0; i < size; i++) {
-        printf("%s ", words[i]);
-      }
-      printf("\n");
-      exit(1);
-    }
-    // mpole = [q, dx, dy, dz, qxx, qyy, qzz, 2*qxy, 2*qxz, 2*qyz]
+    // mpole = [q, dx, dy, dz, qxx, qyy, qzz, 2*qxy, 2*qxz, 2*qyz] converted from bohr to ANG
     mpole->multipole[0] = atof(words[next++]); // charge
     fgets(line, 1e3, file);
-    mpole->multipole[1] = atof(strtok(line, " ")); // dx
-    mpole->multipole[2] = atof(strtok(NULL, " ")); // dy
-    mpole->multipole[3] = atof(strtok(NULL, " ")); // dz
+    mpole->multipole[1] = BOHR*atof(strtok(line, " ")); // dx
+    mpole->multipole[2] = BOHR*atof(strtok(NULL, " ")); // dy
+    mpole->multipole[3] = BOHR*atof(strtok(NULL, " ")); // dz
     fgets(line, 1e3, file);
-    mpole->multipole[4] = atof(strtok(line, " "))/3; // qxx
+    mpole->multipole[4] = BOHR*BOHR*atof(strtok(line, " "))/3; // qxx
     fgets(line, 1e3, file);
-    mpole->multipole[7] = 2*atof(strtok(line, " "))/3; // qxy
-    mpole->multipole[5] = atof(strtok(NULL, " "))/3; // qyy
+    mpole->multipole[7] = BOHR*BOHR*2*atof(strtok(line, " "))/3; // 2*qxy
+    mpole->multipole[5] = BOHR*BOHR*atof(strtok(NULL, " "))/3; // qyy
     fgets(line, 1e3, file);
-    mpole->multipole[8] = 2*atof(strtok(line, " "))/3; // 2*qxz
-    mpole->multipole[9] = 2*atof(strtok(NULL, " "))/3; // 2*qyz
-    mpole->multipole[6] = atof(strtok(NULL, " "))/3; // qzz
+    mpole->multipole[8] = BOHR*BOHR*2*atof(strtok(line, " "))/3; // 2*qxz
+    mpole->multipole[9] = BOHR*BOHR*2*atof(strtok(NULL, " "))/3; // 2*qyz
+    mpole->multipole[6] = BOHR*BOHR*atof(strtok(NULL, " "))/3; // qzz
   }
-  return mpole;
 }
 
-OPBend* opbendLine(char** words, int size) {
-  OPBend* opbend = malloc(sizeof(OPBend));
-  if(opbend == NULL) {
-    printf("Couldn't allocate opbend line.");
-    exit(1);
-  }
+void opbendLine(char** words, int size, OPBend* opbend) {
   if(size != 6) {
     printf("Couldn't parse opbend line: ");
     for(int i = 0; i < size; i++) {
@@ -249,15 +203,9 @@ OPBend* opbendLine(char** words, int size) {
     opbend->atomClasses[i] = atoi(words[i+1]);
   }
   opbend->forceConstant = atof(words[5]);
-  return opbend;
 }
 
-StrBend* strbendLine(char** words, int size) {
-  StrBend* strbend = malloc(sizeof(StrBend));
-  if(strbend == NULL) {
-    printf("Couldn't allocate strbend line.");
-    exit(1);
-  }
+void strbendLine(char** words, int size, StrBend* strbend) {
   if(size != 6) {
     printf("Couldn't parse strbend line: ");
     for(int i = 0; i < size; i++) {
@@ -272,15 +220,9 @@ StrBend* strbendLine(char** words, int size) {
   for(int i = 0; i < 2; i++) {
     strbend->forceConstants[i] = atof(words[i+4]);
   }
-  return strbend;
 }
 
-PiTors* pitorsLine(char** words, int size) {
-  PiTors* pitors = malloc(sizeof(PiTors));
-  if(pitors == NULL) {
-    printf("Couldn't allocate pitors line.");
-    exit(1);
-  }
+void pitorsLine(char** words, int size, PiTors* pitors) {
   if(size != 4) {
     printf("Couldn't parse pitors line: ");
     for(int i = 0; i < size; i++) {
@@ -293,15 +235,9 @@ PiTors* pitorsLine(char** words, int size) {
     pitors->atomClasses[i] = atoi(words[i+1]);
   }
   pitors->forceConstant = atof(words[3]);
-  return pitors;
 }
 
-ImpTors* imptorsLine(char** words, int size) {
-  ImpTors* imptors = malloc(sizeof(ImpTors));
-  if(imptors == NULL) {
-    printf("Couldn't allocate imptors line.");
-    exit(1);
-  }
+void imptorsLine(char** words, int size, ImpTors* imptors) {
   if(size != 7) {
     printf("Couldn't parse imptors line: ");
     for(int i = 0; i < size; i++) {
@@ -316,15 +252,9 @@ ImpTors* imptorsLine(char** words, int size) {
   imptors->forceConstant = atof(words[5]);
   imptors->phase = atof(words[6]);
   imptors->periodicity = atof(words[7]);
-  return imptors;
 }
 
-StrTors* strtorsLine(char** words, int size) {
-  StrTors* strtors = malloc(sizeof(StrTors));
-  if(strtors == NULL) {
-    printf("Couldn't allocate strtors line.");
-    exit(1);
-  }
+void strtorsLine(char** words, int size, StrTors* strtors) {
   if(size != 14) {
     printf("Couldn't parse strtors line: ");
     for(int i = 0; i < size; i++) {
@@ -339,15 +269,9 @@ StrTors* strtorsLine(char** words, int size) {
   for(int i = 0; i < 9; i++) {
     strtors->forceConstants[i] = atof(words[i+5]);
   }
-  return strtors;
 }
 
-Torsion* torsionLine(char** words, int size, enum TorsionMode param) {
-  Torsion* torsion = malloc(sizeof(Torsion));
-  if(torsion == NULL) {
-    printf("Couldn't allocate torsion line.");
-    exit(1);
-  }
+void torsionLine(char** words, int size, enum TorsionMode param, Torsion* torsion) {
   if(size < 5) {
     printf("Couldn't parse torsion line: ");
     for(int i = 0; i < size; i++) {
@@ -360,28 +284,57 @@ Torsion* torsionLine(char** words, int size, enum TorsionMode param) {
     torsion->atomClasses[i] = atoi(words[i+1]);
   }
   torsion->terms = 0;
-  for(int i = 0; i < 3; i++) {
+  memset(torsion->amplitude, 0, sizeof(torsion->amplitude));
+  memset(torsion->phase, 0, sizeof(torsion->phase));
+  memset(torsion->periodicity, 0, sizeof(torsion->periodicity));
+  // Only the (amplitude, phase, periodicity) triples present on the line, CHARMM lists zero-term torsions
+  for(int i = 0; i < 3 && 3*i+7 < size; i++) {
     torsion->amplitude[i] = atof(words[3*i+5]);
     if(torsion->amplitude[i] != 0.0) {torsion->terms++;}
     torsion->phase[i] = atof(words[3*i+6]);
     torsion->periodicity[i] = atoi(words[3*i+7]);
   }
   torsion->torsionMode = param;
-  return torsion;
-}
-
-TorTors* tortorsLines(char** words, int size, char* line, FILE* file) {
-  TorTors* tortors = malloc(sizeof(TorTors));
-  // not implemented
-  return tortors;
 }
 
-UReyBrad* uraybradLine(char** words, int size) {
-  UReyBrad* uraybrad = malloc(sizeof(UReyBrad));
-  if(uraybrad == NULL) {
-    printf("Couldn't allocate uraybrad line.");
+void tortorsLines(char** words, int size, char* line, FILE* file, BicubicTable* grids, TorTors* tortors,
+                  Arena* scratch) {
+  if(size < 8) {
+    printf("Failed to parse tortors line: ");
+    for(int i = 0; i < size; i++) {
+      printf("%s ", words[i]);
+    }
+    printf("\n");
     exit(1);
   }
+  for(int i = 0; i < 5; i++) {
+    tortors->atomClasses[i] = atoi(words[i+1]);
+  }
+  tortors->gridPoints[0] = atoi(words[6]);
+  tortors->gridPoints[1] = atoi(words[7]);
+  // Grid lines (torsion1, torsion2, energy) go straight into the shared spline table
+  int n = tortors->gridPoints[0]*tortors->gridPoints[1];
+  REAL* torsion1 = arenaAlloc(scratch, sizeof(REAL)*n);
+  REAL* torsion2 = arenaAlloc(scratch, sizeof(REAL)*n);
+  REAL* energy = arenaAlloc(scratch, sizeof(REAL)*n);
+  for(int i = 0; i < n; i++) {
+    char* token = fgets(line, 1e3, file) != NULL ? strtok(line, " \t") : NULL;
+    char* t2 = token != NULL ? strtok(NULL, " \t") : NULL;
+    char* e = t2 != NULL ? strtok(NULL, " \t") : NULL;
+    if(e == NULL) {
+      printf("Tortors grid %d %d %d %d %d ended after %d of %d points!\n", tortors->atomClasses[0],
+        tortors->atomClasses[1], tortors->atomClasses[2], tortors->atomClasses[3], tortors->atomClasses[4], i, n);
+      exit(1);
+    }
+    torsion1[i] = atof(token);
+    torsion2[i] = atof(t2);
+    energy[i] = atof(e);
+  }
+  tortors->grid = bicubicTableAdd(grids, tortors->gridPoints[0], tortors->gridPoints[1], torsion1, torsion2,
+    energy);
+}
+
+void uraybradLine(char** words, int size, UReyBrad* uraybrad) {
   if(size != 6) {
     printf("Couldn't parse uraybrad line: ");
     for(int i = 0; i < size; i++) {
@@ -395,15 +348,9 @@ UReyBrad* uraybradLine(char** words, int size) {
   }
   uraybrad->forceConstant = atof(words[4]);
   uraybrad->distance = atof(words[5]);
-  return uraybrad;
 }
 
-VdW* vdwLine(char** words, int size, enum VdWType param) {
-  VdW* vdw = malloc(sizeof(VdW));
-  if(vdw == NULL) {
-    printf("Couldn't allocate memory for vdw line!");
-    exit(1);
-  }
+void vdwLine(char** words, int size, enum VdWType param, VdW* vdw) {
   if(size == 4 || size == 5) {
     vdw->atomClass = atoi(words[1]);
     vdw->radius = atof(words[2]);
@@ -418,15 +365,9 @@ VdW* vdwLine(char** words, int size, enum VdWType param) {
     printf("\n");
     exit(1);
   }
-  return vdw;
 }
 
-VdWPair* vdwpairLine(char** words, int size) {
-  VdWPair* vdwpair = malloc(sizeof(VdWPair));
-  if(vdwpair == NULL) {
-    printf("Couldn't allocate memory for vdwpair line!");
-    exit(1);
-  }
+void vdwpairLine(char** words, int size, VdWPair* vdwpair) {
   if(size != 5) {
     printf("Couldn't parse vdwpair line: ");
     for(int i = 0; i < size; i++) {
@@ -440,48 +381,31 @@ VdWPair* vdwpairLine(char** words, int size) {
   }
   vdwpair->radius = atof(words[3]);
   vdwpair->wellDepth = atof(words[4]);
-  return vdwpair;
 }
 
-Polarize* polarizeLine(char** words, int size) {
-  Polarize* polarize = malloc(sizeof(Polarize));
-  if(polarize == NULL) {
-    printf("Couldn't allocate memory for polarize line!");
-    exit(1);
-  }
+void polarizeLine(char** words, int size, Polarize* polarize) {
   if(size < 4) {
     printf("Failed to parse polarize line: ");
     for(int i = 0; i < size; i++) {
       printf("%s ", words[i]);
     }
     printf("\n");
+    exit(1);
   }
   polarize->atomType = atoi(words[1]);
   for(int i = 0; i < 3; i++) {
     polarize->polarizabilityTensor[i][i] = atof(words[2]);
   }
   polarize->thole = atof(words[3]);
-  for(int i = 4; i < size; i++) {
+  for(int i = 4; i < size && i < 10; i++) {
     polarize->polarizationGroup[i-4] = atoi(words[i]);
   }
-  return polarize;
 }
 
-RelativeSolv* relativesolvLine(char** words, int size) {
-  RelativeSolv* relativesolv = malloc(sizeof(RelativeSolv));
-  if(relativesolv == NULL) {
-    printf("Couldn't allocate memory for relativesolv line!");
-    exit(1);
-  }
-  return relativesolv;
+void relativesolvLine(char** words, int size, RelativeSolv* relativesolv) {
 }
 
-Solute* soluteLine(char** words, int size) {
-  Solute* solute = malloc(sizeof(Solute));
-  if(solute == NULL) {
-    printf("Could not allocate memory for solute line!");
-    exit(1);
-  }
+void soluteLine(char** words, int size, Solute* solute) {
   if(size != 6) {
     printf("Couldn't parse solute line: ");
     for(int i = 0; i < size; i++) {
@@ -495,63 +419,63 @@ Solute* soluteLine(char** words, int size) {
     solute->diameters[i] = atof(words[i+2]);
   }
   solute->sneck = atof(words[5]);
-  return solute;
 }
 
-void readFFLine(Vector* vec, ForceField* ff, char* line, FILE* file) {
+void readFFLine(Vector* vec, ForceField* ff, char* line, FILE* file, Arena* scratch) {
   assert(vec != NULL);
   assert(vec->size > 0);
   char** words = vec->array;
   char* command = words[0];
   enum ForceFieldParams param = stringToFFTermEnum(command);
   switch (param) {
-    case ATOM: vectorAppend(ff->atom, atomLine(words, vec->size));
+    case ATOM: atomLine(words, vec->size, atomVectorEmplace(&ff->atom));
       break;
-    case ANGLE: vectorAppend(ff->angle, angleLine(words, vec->size));
+    case ANGLE: angleLine(words, vec->size, angleVectorEmplace(&ff->angle));
       break;
-    case ANGLEP: vectorAppend(ff->angle, angleLine(words, vec->size));
+    case ANGLEP: angleLine(words, vec->size, angleVectorEmplace(&ff->angle));
       break;
-    case ANGTORS: vectorAppend(ff->angTors, angtorsLine(words, vec->size));
+    case ANGTORS: angtorsLine(words, vec->size, angTorsVectorEmplace(&ff->angTors));
       break;
-    case BIOTYPE: vectorAppend(ff->bioType, biotypeLine(words, vec->size));
+    case BIOTYPE: biotypeLine(words, vec->size, bioTypeVectorEmplace(&ff->bioType));
       break;
-    case BOND: vectorAppend(ff->bond, bondLine(words, vec->size));
+    case BOND: bondLine(words, vec->size, bondVectorEmplace(&ff->bond));
       break;
-    case CHARGE: vectorAppend(ff->multipole, multipoleLines(words, vec->size, line, file));
+    case CHARGE: multipoleLines(words, vec->size, line, file, multipoleVectorEmplace(&ff->multipole));
       break;
-    case MULTIPOLE: vectorAppend(ff->multipole, multipoleLines(words, vec->size, line, file));
+    case MULTIPOLE: multipoleLines(words, vec->size, line, file, multipoleVectorEmplace(&ff->multipole));
       break;
-    case OPBEND: vectorAppend(ff->opBend, opbendLine(words, vec->size));
+    case OPBEND: opbendLine(words, vec->size, opBendVectorEmplace(&ff->opBend));
       break;
-    case STRBND: vectorAppend(ff->strBend, strbendLine(words, vec->size));
+    case STRBND: strbendLine(words, vec->size, strBendVectorEmplace(&ff->strBend));
       break;
-    case PITORS: vectorAppend(ff->piTors, pitorsLine(words, vec->size));
+    case PITORS: pitorsLine(words, vec->size, piTorsVectorEmplace(&ff->piTors));
       break;
-    case IMPTORS: vectorAppend(ff->impTors, imptorsLine(words, vec->size));
+    case IMPTORS: imptorsLine(words, vec->size, impTorsVectorEmplace(&ff->impTors));
       break;
-    case STRTORS: vectorAppend(ff->strTors, strtorsLine(words, vec->size));
+    case STRTORS: strtorsLine(words, vec->size, strTorsVectorEmplace(&ff->strTors));
       break;
-    case TORSION: vectorAppend(ff->torsion, torsionLine(words, vec->size, TORS_NORMAL));
+    case TORSION: torsionLine(words, vec->size, TORS_NORMAL, torsionVectorEmplace(&ff->torsion));
       break;
-    case IMPROPER: vectorAppend(ff->torsion, torsionLine(words, vec->size, TORS_IMPROPER));
+    case IMPROPER: torsionLine(words, vec->size, TORS_IMPROPER, torsionVectorEmplace(&ff->torsion));
       break;
-    case TORTORS: vectorAppend(ff->torTors, tortorsLines(words, vec->size, line, file));
+    case TORTORS:
+      tortorsLines(words, vec->size, line, file, ff->torTorGrids, torTorsVectorEmplace(&ff->torTors), scratch);
       break;
-    case UREYBRAD: vectorAppend(ff->uRayBrad, uraybradLine(words, vec->size));
+    case UREYBRAD: uraybradLine(words, vec->size, uReyBradVectorEmplace(&ff->uRayBrad));
       break;
-    case VDW: vectorAppend(ff->vdw, vdwLine(words, vec->size, VDW_NORMAL));
+    case VDW: vdwLine(words, vec->size, VDW_NORMAL, vdwVectorEmplace(&ff->vdw));
       break;
-    case VDW14: vectorAppend(ff->vdw, vdwLine(words, vec->size, VDW_14));
+    case VDW14: vdwLine(words, vec->size, VDW_14, vdwVectorEmplace(&ff->vdw));
       break;
-    case VDWPR: vectorAppend(ff->vdwPair, vdwpairLine(words, vec->size));
+    case VDWPR: vdwpairLine(words, vec->size, vdwPairVectorEmplace(&ff->vdwPair));
       break;
-    case VDWPAIR: vectorAppend(ff->vdwPair, vdwpairLine(words, vec->size));
+    case VDWPAIR: vdwpairLine(words, vec->size, vdwPairVectorEmplace(&ff->vdwPair));
       break;
-    case POLARIZE: vectorAppend(ff->polarize, polarizeLine(words, vec->size));
+    case POLARIZE: polarizeLine(words, vec->size, polarizeVectorEmplace(&ff->polarize));
       break;
-    case RELATIVESOLV: vectorAppend(ff->relativeSolv, relativesolvLine(words, vec->size));
+    case RELATIVESOLV: relativesolvLine(words, vec->size, relativeSolvVectorEmplace(&ff->relativeSolv));
       break;
-    case SOLUTE: vectorAppend(ff->solute, soluteLine(words, vec->size));
+    case SOLUTE: soluteLine(words, vec->size, soluteVectorEmplace(&ff->solute));
       break;
     default:
       break;
@@ -560,49 +484,78 @@ void readFFLine(Vector* vec, ForceField* ff, char* line, FILE* file) {
 
 void initForceField(ForceField* ff) {
   assert(ff != NULL);
-  ff->atom = vectorCreate(sizeof(Atom), 20, NULL, OTHER);
-  ff->angle = vectorCreate(sizeof(Angle), 20, NULL, OTHER);
-  ff->angTors = vectorCreate(sizeof(AngTors), 20, NULL, OTHER);
-  ff->bioType = vectorCreate(sizeof(BioType), 20, NULL, OTHER);
-  ff->bond = vectorCreate(sizeof(Bond), 20, NULL, OTHER);
-  ff->multipole = vectorCreate(sizeof(Multipole), 20, NULL, OTHER);
-  ff->opBend = vectorCreate(sizeof(OPBend), 20, NULL, OTHER);
-  ff->strBend = vectorCreate(sizeof(StrBend), 20, NULL, OTHER);
-  ff->piTors = vectorCreate(sizeof(PiTors), 20, NULL, OTHER);
-  ff->impTors = vectorCreate(sizeof(ImpTors), 20, NULL, OTHER);
-  ff->strTors = vectorCreate(sizeof(StrTors), 20, NULL, OTHER);
-  ff->torsion = vectorCreate(sizeof(Torsion), 20, NULL, OTHER);
-  ff->torTors = vectorCreate(sizeof(TorTors), 20, NULL, OTHER);
-  ff->uRayBrad = vectorCreate(sizeof(UReyBrad), 20, NULL, OTHER);
-  ff->vdw = vectorCreate(sizeof(VdW), 20, NULL, OTHER);
-  ff->vdwPair = vectorCreate(sizeof(VdWPair), 20, NULL, OTHER);
-  ff->polarize = vectorCreate(sizeof(Polarize), 20, NULL, OTHER);
-  ff->relativeSolv = vectorCreate(sizeof(RelativeSolv), 20, NULL, OTHER);
-  ff->solute = vectorCreate(sizeof(Solute), 20, NULL, OTHER);
+  atomVectorInit(&ff->atom, 0, MEMORY_FORCE_FIELD);
+  angleVectorInit(&ff->angle, 0, MEMORY_FORCE_FIELD);
+  angTorsVectorInit(&ff->angTors, 0, MEMORY_FORCE_FIELD);
+  bioTypeVectorInit(&ff->bioType, 0, MEMORY_FORCE_FIELD);
+  bondVectorInit(&ff->bond, 0, MEMORY_FORCE_FIELD);
+  multipoleVectorInit(&ff->multipole, 0, MEMORY_FORCE_FIELD);
+  opBendVectorInit(&ff->opBend, 0, MEMORY_FORCE_FIELD);
+  strBendVectorInit(&ff->strBend, 0, MEMORY_FORCE_FIELD);
+  piTorsVectorInit(&ff->piTors, 0, MEMORY_FORCE_FIELD);
+  impTorsVectorInit(&ff->impTors, 0, MEMORY_FORCE_FIELD);
+  strTorsVectorInit(&ff->strTors, 0, MEMORY_FORCE_FIELD);
+  torsionVectorInit(&ff->torsion, 0, MEMORY_FORCE_FIELD);
+  torTorsVectorInit(&ff->torTors, 0, MEMORY_FORCE_FIELD);
+  ff->torTorGrids = bicubicTableCreate();
+  uReyBradVectorInit(&ff->uRayBrad, 0, MEMORY_FORCE_FIELD);
+  vdwVectorInit(&ff->vdw, 0, MEMORY_FORCE_FIELD);
+  vdwPairVectorInit(&ff->vdwPair, 0, MEMORY_FORCE_FIELD);
+  polarizeVectorInit(&ff->polarize, 0, MEMORY_FORCE_FIELD);
+  relativeSolvVectorInit(&ff->relativeSolv, 0, MEMORY_FORCE_FIELD);
+  soluteVectorInit(&ff->solute, 0, MEMORY_FORCE_FIELD);
 }
 
+/**
+ * Frees the entries, the ForceField itself included.
+ */
 void forceFieldFree(ForceField* ff) {
-  vectorBackingFree(ff->atom);
-  vectorBackingFree(ff->angle);
-  vectorBackingFree(ff->angTors);
-  vectorBackingFree(ff->bioType);
-  vectorBackingFree(ff->bond);
-  vectorBackingFree(ff->multipole);
-  vectorBackingFree(ff->opBend);
-  vectorBackingFree(ff->strBend);
-  vectorBackingFree(ff->piTors);
-  vectorBackingFree(ff->impTors);
-  vectorBackingFree(ff->strTors);
-  vectorBackingFree(ff->torsion);
-  vectorBackingFree(ff->torTors);
-  vectorBackingFree(ff->uRayBrad);
-  vectorBackingFree(ff->vdw);
-  vectorBackingFree(ff->vdwPair);
-  vectorBackingFree(ff->polarize);
-  vectorBackingFree(ff->relativeSolv);
-  vectorBackingFree(ff->solute);
-  // Free the rest
-  free(ff);
+  atomVectorFree(&ff->atom);
+  angleVectorFree(&ff->angle);
+  angTorsVectorFree(&ff->angTors);
+  bioTypeVectorFree(&ff->bioType);
+  bondVectorFree(&ff->bond);
+  multipoleVectorFree(&ff->multipole);
+  opBendVectorFree(&ff->opBend);
+  strBendVectorFree(&ff->strBend);
+  piTorsVectorFree(&ff->piTors);
+  impTorsVectorFree(&ff->impTors);
+  strTorsVectorFree(&ff->strTors);
+  torsionVectorFree(&ff->torsion);
+  torTorsVectorFree(&ff->torTors);
+  bicubicTableDestroy(ff->torTorGrids);
+  uReyBradVectorFree(&ff->uRayBrad);
+  vdwVectorFree(&ff->vdw);
+  vdwPairVectorFree(&ff->vdwPair);
+  polarizeVectorFree(&ff->polarize);
+  relativeSolvVectorFree(&ff->relativeSolv);
+  soluteVectorFree(&ff->solute);
+  memoryFree(ff, MEMORY_FORCE_FIELD);
+}
+
+/**
+ * Gives back the room the entry vectors grew into beyond the entries read.
+ */
+static void forceFieldShrink(ForceField* ff) {
+  atomVectorShrink(&ff->atom);
+  angleVectorShrink(&ff->angle);
+  angTorsVectorShrink(&ff->angTors);
+  bioTypeVectorShrink(&ff->bioType);
+  bondVectorShrink(&ff->bond);
+  multipoleVectorShrink(&ff->multipole);
+  opBendVectorShrink(&ff->opBend);
+  strBendVectorShrink(&ff->strBend);
+  piTorsVectorShrink(&ff->piTors);
+  impTorsVectorShrink(&ff->impTors);
+  strTorsVectorShrink(&ff->strTors);
+  torsionVectorShrink(&ff->torsion);
+  torTorsVectorShrink(&ff->torTors);
+  uReyBradVectorShrink(&ff->uRayBrad);
+  vdwVectorShrink(&ff->vdw);
+  vdwPairVectorShrink(&ff->vdwPair);
+  polarizeVectorShrink(&ff->polarize);
+  relativeSolvVectorShrink(&ff->relativeSolv);
+  soluteVectorShrink(&ff->solute);
 }
 
 void readForceFieldFile(ForceField* forcefield, char* forceFieldFile) {
@@ -617,6 +570,7 @@ void readForceFieldFile(ForceField* forcefield, char* forceFieldFile) {
     exit(1);
   }
   initForceField(forcefield);
+  Arena* scratch = arenaCreate(1 << 16, MEMORY_FORCE_FIELD); // Tokens of the current line and tortors grids
   int lineSize = 1e3;
   char line[lineSize];
   fgets(line, lineSize, file);
@@ -630,13 +584,58 @@ void readForceFieldFile(ForceField* forcefield, char* forceFieldFile) {
        break;
      }
     }
+    arenaReset(scratch);
     char* str = strtok(line, " ");
-    Vector* args = vectorCreate(sizeof(char*), 3, NULL, CHAR_PTR);
+    Vector args = arenaVector(scratch, sizeof(char*), lineSize/2 + 1, CHAR_PTR); // Can't hold more tokens
     // Ignore comments & tokenize
     while(str != NULL && strcasecmp("#", &str[0]) != 0 && strcasecmp("/", &str[0]) != 0) {
-      vectorAppend(args, &str);
+      vectorAppend(&args, &str);
       str = strtok(NULL, " ");
     }
-    readFFLine(args, forcefield, line, file);
+    readFFLine(&args, forcefield, line, file, scratch);
+  }
+  arenaDestroy(scratch);
+  fclose(file);
+  forceFieldShrink(forcefield);
+}
+
+ForceFieldCache* forceFieldCacheCreate() {
+  ForceFieldCache* cache = memoryCalloc(1, sizeof(ForceFieldCache), MEMORY_FORCE_FIELD);
+  cachedForceFieldVectorInit(&cache->entries, 0, MEMORY_FORCE_FIELD);
+  return cache;
+}
+
+/**
+ * The force field of a file, read on the first lookup of its path.
+ */
+ForceField* forceFieldCacheGet(ForceFieldCache* cache, char* forceFieldFile) {
+  const int len = strlen(forceFieldFile);
+  if(len > 0 && forceFieldFile[len-1] == '\n') {
+    forceFieldFile[len-1] = 0;
+  }
+  char* path = realpath(forceFieldFile, NULL);
+  if(path == NULL) {
+    path = strdup(forceFieldFile); // readForceFieldFile reports the missing file
+  }
+  for(int e = 0; e < cache->entries.size; e++) {
+    if(strcmp(cache->entries.array[e].path, path) == 0) {
+      free(path);
+      cache->hits++;
+      return cache->entries.array[e].forceField;
+    }
+  }
+  CachedForceField* entry = cachedForceFieldVectorEmplace(&cache->entries);
+  entry->path = path;
+  entry->forceField = memoryMalloc(sizeof(ForceField), MEMORY_FORCE_FIELD);
+  readForceFieldFile(entry->forceField, path);
+  return entry->forceField;
+}
+
+void forceFieldCacheDestroy(ForceFieldCache* cache) {
+  for(int e = 0; e < cache->entries.size; e++) {
+    forceFieldFree(cache->entries.array[e].forceField);
+    free(cache->entries.array[e].path);
   }
+  cachedForceFieldVectorFree(&cache->entries);
+  memoryFree(cache, MEMORY_FORCE_FIELD);
 }
@@ -24,7 +24,7 @@ void handleArgs(Vector* args, System* system) {
    exit(1);
   }
   system->dtFemto = atof(words[1]);
-  system->dtAtto = (int) system->dtFemto * 1e3; // truncate
+  system->dtAtto = (int) (system->dtFemto * 1e3); // truncate
  } else if (strcasecmp(MD_C_Keywords[3], command) == 0) {
   // timestep in attoseconds
   if(size != 2) {
@@ -85,8 +85,8 @@ void handleArgs(Vector* args, System* system) {
     }
    }
    system->boxDim[0][0] = atof(words[1]);
-   system->boxDim[1][0] = atof(words[1]);
-   system->boxDim[2][0] = atof(words[1]);
+   system->boxDim[1][1] = atof(words[1]);
+   system->boxDim[2][2] = atof(words[1]);
   } else if(size == 4) { // three dim given
    if(strcasecmp(MD_C_Keywords[11], command) == 0) { // a-axis
     system->boxDim[0][0] = atof(words[1]); // x
@@ -160,12 +160,16 @@ void handleArgs(Vector* args, System* system) {
    printf("Incorrect args for polarization!");
    exit(1);
   }
-  if(strcasecmp("NONE", words[1]) == 0) {
+  char* name = strtok(words[1], "\n");
+  if(strcasecmp("NONE", name) == 0) {
    system->polarization = NONE;
-  } else if (strcasecmp("DIRECT", words[1]) == 0) {
+  } else if (strcasecmp("DIRECT", name) == 0) {
    system->polarization = DIRECT;
-  } else if (strcasecmp("MUTUAL", words[1]) == 0) {
+  } else if (strcasecmp("MUTUAL", name) == 0) {
    system->polarization = MUTUAL;
+  } else {
+   printf("Unknown polarization type: %s", name);
+   exit(1);
   }
  } else if (strcasecmp(MD_C_Keywords[20], command) == 0 || strcasecmp(MD_C_Keywords[21], command) == 0
   || strcasecmp(MD_C_Keywords[22], command) == 0) {
@@ -174,14 +178,20 @@ void handleArgs(Vector* args, System* system) {
    printf("Incorrect args for forcefield/parameters!");
    exit(1);
   }
+  free(system->forceFieldFile);
   system->forceFieldFile = strdup(words[1]);
   // Set force field
   printf("Reading forcefield file: %s", system->forceFieldFile);
-  if(system->forceField != NULL) {
-   free(system->forceField);
+  if(system->forceFieldCache != NULL) {
+   // Borrowed, read by the first system that asked for it
+   system->forceField = forceFieldCacheGet(system->forceFieldCache, system->forceFieldFile);
+  } else {
+   if(system->forceField != NULL) {
+    forceFieldFree(system->forceField);
+   }
+   system->forceField = memoryMalloc(sizeof(ForceField), MEMORY_FORCE_FIELD);
+   readForceFieldFile(system->forceField, system->forceFieldFile);
   }
-  system->forceField = malloc(sizeof(ForceField));
-  readForceFieldFile(system->forceField, system->forceFieldFile);
  } else if (strcasecmp(MD_C_Keywords[23], command) == 0) {
   // patch -- vector created in struct file reader
   if(size != 2) {
@@ -196,6 +206,249 @@ void handleArgs(Vector* args, System* system) {
    exit(1);
   }
   system->printArchiveEvery = atol(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[25], command) == 0) {
+  // polar-eps
+  if(size != 2) {
+   printf("Incorrect args for polar-eps!");
+   exit(1);
+  }
+  system->polarEps = atof(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[26], command) == 0) {
+  // polar-predict
+  if(size != 2) {
+   printf("Incorrect args for polar-predict!");
+   exit(1);
+  }
+  system->polarPredict = atoi(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[27], command) == 0) {
+  // integrator
+  if(size != 2) {
+   printf("Incorrect args for integrator!");
+   exit(1);
+  }
+  char* name = strtok(words[1], "\n");
+  if(strcasecmp("VERLET", name) == 0) {
+   system->integrator = VERLET;
+  } else if (strcasecmp("RESPA", name) == 0) {
+   system->integrator = RESPA;
+  } else {
+   printf("Unknown integrator: %s", name);
+   exit(1);
+  }
+ } else if (strcasecmp(MD_C_Keywords[28], command) == 0) {
+  // dtInnerAtto
+  if(size != 2) {
+   printf("Incorrect args for dtInnerAtto!");
+   exit(1);
+  }
+  system->dtInnerAtto = atoi(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[29], command) == 0) {
+  // respa-cutoff
+  if(size != 2) {
+   printf("Incorrect args for respa-cutoff!");
+   exit(1);
+  }
+  system->respaCutoff = atof(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[30], command) == 0) {
+  // respa-switch
+  if(size != 2) {
+   printf("Incorrect args for respa-switch!");
+   exit(1);
+  }
+  system->respaSwitch = atof(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[31], command) == 0) {
+  // constraints
+  if(size != 2) {
+   printf("Incorrect args for constraints!");
+   exit(1);
+  }
+  char* name = strtok(words[1], "\n");
+  if(strcasecmp("NONE", name) == 0) {
+   system->constraints = NO_CONSTRAINTS;
+  } else if (strcasecmp("WATER", name) == 0) {
+   system->constraints = RIGID_WATER;
+  } else if (strcasecmp("HBONDS", name) == 0) {
+   system->constraints = HBONDS;
+  } else {
+   printf("Unknown constraints: %s", name);
+   exit(1);
+  }
+ } else if (strcasecmp(MD_C_Keywords[32], command) == 0) {
+  // hydrogen-mass
+  if(size != 2) {
+   printf("Incorrect args for hydrogen-mass!");
+   exit(1);
+  }
+  system->hydrogenMass = atof(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[33], command) == 0) {
+  // thermostat
+  if(size != 2) {
+   printf("Incorrect args for thermostat!");
+   exit(1);
+  }
+  char* name = strtok(words[1], "\n");
+  if(strcasecmp("NONE", name) == 0) {
+   system->thermostat = NO_THERMOSTAT;
+  } else if (strcasecmp("LANGEVIN", name) == 0) {
+   system->thermostat = LANGEVIN;
+  } else if (strcasecmp("BUSSI", name) == 0) {
+   system->thermostat = BUSSI;
+  } else {
+   printf("Unknown thermostat: %s", name);
+   exit(1);
+  }
+ } else if (strcasecmp(MD_C_Keywords[34], command) == 0) {
+  // friction
+  if(size != 2) {
+   printf("Incorrect args for friction!");
+   exit(1);
+  }
+  system->friction = atof(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[35], command) == 0) {
+  // tau-temperature
+  if(size != 2) {
+   printf("Incorrect args for tau-temperature!");
+   exit(1);
+  }
+  system->tauTemperature = atof(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[36], command) == 0) {
+  // randomseed
+  if(size != 2) {
+   printf("Incorrect args for randomseed!");
+   exit(1);
+  }
+  system->randomSeed = strtoull(words[1], NULL, 10);
+ } else if (strcasecmp(MD_C_Keywords[37], command) == 0) {
+  // barostat
+  if(size != 2) {
+   printf("Incorrect args for barostat!");
+   exit(1);
+  }
+  char* name = strtok(words[1], "\n");
+  if(strcasecmp("NONE", name) == 0) {
+   system->barostat = NO_BAROSTAT;
+  } else if (strcasecmp("MONTECARLO", name) == 0) {
+   system->barostat = MONTE_CARLO;
+  } else {
+   printf("Unknown barostat: %s", name);
+   exit(1);
+  }
+ } else if (strcasecmp(MD_C_Keywords[38], command) == 0) {
+  // pressure
+  if(size != 2) {
+   printf("Incorrect args for pressure!");
+   exit(1);
+  }
+  system->pressure = atof(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[39], command) == 0) {
+  // volume-trial
+  if(size != 2) {
+   printf("Incorrect args for volume-trial!");
+   exit(1);
+  }
+  system->volumeTrial = atoi(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[40], command) == 0) {
+  // volume-move
+  if(size != 2) {
+   printf("Incorrect args for volume-move!");
+   exit(1);
+  }
+  system->volumeMove = atof(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[41], command) == 0) {
+  // lambda
+  if(size != 2) {
+   printf("Incorrect args for lambda!");
+   exit(1);
+  }
+  system->lambda = atof(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[42], command) == 0) {
+  // lambda-atoms
+  if(size < 2) {
+   printf("Incorrect args for lambda-atoms!");
+   exit(1);
+  }
+  for(int w = 1; w < size; w++) {
+   char* range = strtok(words[w], "\n");
+   if(range == NULL) { // trailing space
+    continue;
+   }
+   char* dash = strchr(range, '-');
+   int first = atoi(range);
+   int last = dash != NULL ? atoi(dash + 1) : first;
+   if(first < 1 || last < first) {
+    printf("Incorrect lambda-atoms range: %s", range);
+    exit(1);
+   }
+   system->activeLambdas = memoryRealloc(system->activeLambdas,
+                                         sizeof(int)*(system->nActiveLambdas + last - first + 1), MEMORY_STRUCTURE);
+   for(int a = first; a <= last; a++) {
+    system->activeLambdas[system->nActiveLambdas++] = a - 1;
+   }
+  }
+ } else if (strcasecmp(MD_C_Keywords[43], command) == 0) {
+  // lambda-states
+  if(size < 2) {
+   printf("Incorrect args for lambda-states!");
+   exit(1);
+  }
+  memoryFree(system->lambdaStates, MEMORY_STRUCTURE);
+  system->nLambdaStates = 0;
+  system->lambdaStates = memoryMalloc(sizeof(REAL)*(size - 1), MEMORY_STRUCTURE);
+  for(int w = 1; w < size; w++) {
+   char* value = strtok(words[w], "\n");
+   if(value != NULL) { // trailing space
+    system->lambdaStates[system->nLambdaStates++] = atof(value);
+   }
+  }
+ } else if (strcasecmp(MD_C_Keywords[44], command) == 0) {
+  // printMBAREvery
+  if(size != 2) {
+   printf("Incorrect args for printMBAREvery!");
+   exit(1);
+  }
+  system->printMBAREvery = atol(words[1]);
+ } else if (strcasecmp(MD_C_Keywords[45], command) == 0) {
+  // timer-json
+  if(size != 2) {
+   printf("Incorrect args for timer-json!");
+   exit(1);
+  }
+  free(system->timerJSON);
+  system->timerJSON = strdup(strtok(words[1], "\n"));
+ } else if (strcasecmp(MD_C_Keywords[46], command) == 0) {
+  // trace-json
+  if(size != 2) {
+   printf("Incorrect args for trace-json!");
+   exit(1);
+  }
+  free(system->traceJSON);
+  system->traceJSON = strdup(strtok(words[1], "\n"));
+ } else if (strcasecmp(MD_C_Keywords[47], command) == 0) {
+  // perf-counters
+  system->perfCounters = true;
+ } else if (strcasecmp(MD_C_Keywords[48], command) == 0 || strcasecmp(MD_C_Keywords[49], command) == 0) {
+  // replica-temperatures, replica-lambdas
+  if(size < 2) {
+   printf("Incorrect args for %s!", command);
+   exit(1);
+  }
+  system->replicaLadder = strcasecmp(MD_C_Keywords[48], command) == 0 ? TEMPERATURE_LADDER : LAMBDA_LADDER;
+  memoryFree(system->replicaValues, MEMORY_STRUCTURE);
+  system->nReplicas = 0;
+  system->replicaValues = memoryMalloc(sizeof(REAL)*(size - 1), MEMORY_STRUCTURE);
+  for(int w = 1; w < size; w++) {
+   char* value = strtok(words[w], "\n");
+   if(value != NULL) { // trailing space
+    system->replicaValues[system->nReplicas++] = atof(value);
+   }
+  }
+ } else if (strcasecmp(MD_C_Keywords[50], command) == 0) {
+  // exchange-every
+  if(size != 2) {
+   printf("Incorrect args for exchange-every!");
+   exit(1);
+  }
+  system->exchangeEvery = atol(words[1]);
  }
 }
 
@@ -203,6 +456,7 @@ void readKeyFile(System* system, char* keyFile) {
  FILE* file = fopen(keyFile, "r");
  if(file == NULL) {
   printf("Failed to read file: %s", keyFile);
+  exit(1);
  }
  system->keyFileName = keyFile;
  int lineSize = 1e3;
@@ -227,6 +481,7 @@ void readKeyFile(System* system, char* keyFile) {
   handleArgs(args, system);
   // Read new line
   vectorBackingFree(args); // No deep free needed
+  memoryFree(args, MEMORY_VECTORS);
   check = fgets(line, lineSize, file);
  }
  if(system->forceField == NULL) {
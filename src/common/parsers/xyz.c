@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <vector.h>
+#include "../include/arena.h"
 #include "../include/xyz.h"
 
 #include <limits.h>
@@ -28,7 +29,7 @@ void readXYZ(System* system, char* structureFileName) {
  }
  system->structureFileName = structureFileName;
  system->patchFiles = *vectorCreate(sizeof(char*), 1, NULL, CHAR_PTR);
- system->forceFieldFile = malloc(sizeof(char)*1000);
+ system->forceFieldFile = NULL; // strdup'ed by the forcefield key
  // Read whitespace and first line
  int lineSize = 1e3;
  char line[lineSize];
@@ -47,7 +48,8 @@ void readXYZ(System* system, char* structureFileName) {
   printf("Error reading line from file: %s", structureFileName);
   exit(1);
  }
- system->remark = strdup(line);
+ system->arena = arenaCreate(1 << 20, MEMORY_STRUCTURE);
+ system->remark = arenaStrdup(system->arena, line);
  nAtoms = atoi(strtok(line, " "));
  if(nAtoms == -1) {
   printf("Failed to find number of atoms in file %s", structureFileName);
@@ -55,19 +57,19 @@ void readXYZ(System* system, char* structureFileName) {
  }
  system->nAtoms = nAtoms;
  // 2d arrays
- system->multipoles = malloc(sizeof(REAL*)*nAtoms);
- system->list12 = malloc(sizeof(Vector)*nAtoms);
- system->atomNames = malloc(sizeof(char*)*nAtoms);
+ system->multipoles = memoryMalloc(sizeof(REAL*)*nAtoms, MEMORY_STRUCTURE);
+ system->list12 = arenaAlloc(system->arena, sizeof(IntVector)*nAtoms);
+ system->atomNames = arenaAlloc(system->arena, sizeof(char*)*nAtoms);
  // 1d arrays
- system->atomTypes = malloc(sizeof(int)*nAtoms*3);
- system->X = malloc(sizeof(REAL)*nAtoms*3);
- system->M = malloc(sizeof(REAL)*nAtoms);
- system->V = malloc(sizeof(REAL)*nAtoms*3);
- system->A = malloc(sizeof(REAL)*nAtoms*3);
- system->F = malloc(sizeof(REAL)*nAtoms*3);
- system->lambdas = malloc(sizeof(REAL)*nAtoms*3);
- system->protons = malloc(sizeof(REAL)*nAtoms*3);
- system->valence = malloc(sizeof(REAL)*nAtoms*3);
+ system->atomTypes = memoryMalloc(sizeof(int)*nAtoms, MEMORY_STRUCTURE);
+ system->X = memoryMalloc(sizeof(REAL)*nAtoms*3, MEMORY_STRUCTURE);
+ system->M = memoryMalloc(sizeof(REAL)*nAtoms, MEMORY_STRUCTURE);
+ system->V = memoryMalloc(sizeof(REAL)*nAtoms*3, MEMORY_STRUCTURE);
+ system->A = memoryMalloc(sizeof(REAL)*nAtoms*3, MEMORY_STRUCTURE);
+ system->F = memoryMalloc(sizeof(REAL)*nAtoms*3, MEMORY_STRUCTURE);
+ system->lambdas = memoryMalloc(sizeof(REAL)*nAtoms, MEMORY_STRUCTURE);
+ system->protons = memoryMalloc(sizeof(REAL)*nAtoms, MEMORY_STRUCTURE);
+ system->valence = memoryMalloc(sizeof(REAL)*nAtoms, MEMORY_STRUCTURE);
  // Spatial
  for(int i = 0; i < 3; i++) {
   system->minDim[i] = INT_MAX;
@@ -75,16 +77,17 @@ void readXYZ(System* system, char* structureFileName) {
    system->boxDim[i][j] = -1.0f; // check later to see if box dim was set
   }
  }
- system->pmeGridspace = malloc(sizeof(int)*3);
+ system->pmeGridspace = memoryMalloc(sizeof(int)*3, MEMORY_STRUCTURE);
  // Read atom lines
- Vector* bonded = vectorCreate(sizeof(int), 10, NULL, INT);
+ IntVector bonded;
+ intVectorInit(&bonded, 16, MEMORY_STRUCTURE);
  for(int i = 0; i < nAtoms; i++) {
   if(fgets(line, lineSize, f) == NULL) {
    printf("Failed to read on line %d of %s!", i, structureFileName);
    exit(1);
   }
   int atomIndex = atoi(strtok(line, " "))-1;
-  system->atomNames[atomIndex] = strdup(strtok(NULL, " "));
+  system->atomNames[atomIndex] = arenaStrdup(system->arena, strtok(NULL, " "));
   system->X[atomIndex*3] = atof(strtok(NULL, " "));
   if(system->X[atomIndex*3] < system->minDim[0]) {
    system->minDim[0] = system->X[atomIndex*3];
@@ -100,16 +103,16 @@ void readXYZ(System* system, char* structureFileName) {
   system->atomTypes[atomIndex] = atoi(strtok(NULL, " "));
   char* str = strtok(NULL, " ");
   while(str != NULL) {
-   int bondedID = atoi(str)-1; // allocate new address
-   vectorAppend(bonded, &bondedID);
+   int bondedID = atoi(str)-1;
+   intVectorPush(&bonded, bondedID);
    str = strtok(NULL, " ");
   }
-  system->list12[atomIndex] = *vectorCopy(bonded);
-  vectorClear(bonded);
+  system->list12[atomIndex] = arenaIntVectorCopy(system->arena, &bonded);
+  bonded.size = 0;
   assert(atomIndex == i);
  }
  //printXYZ(system);
- vectorBackingFree(bonded);
+ intVectorFree(&bonded);
  fclose(f);
 };
 
@@ -121,7 +124,7 @@ void printXYZ(System* system) {
   double y = system->X[i*3+1];
   double z = system->X[i*3+2];
   printf("Atom %d Name %s Type %d R=(%lf,%lf,%lf) Bonded=[", i+1, system->atomNames[i], system->atomTypes[i], x, y, z);
-  Vector bonded = system->list12[i];
+  IntVector bonded = system->list12[i];
   for(int j = 0; j < bonded.size; j++) {
    int bondedAtomID = ((int*)bonded.array)[j];
    printf("%d,", bondedAtomID);
@@ -0,0 +1,163 @@
+// Author(s): Matthew Speranza
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/batch.h"
+#include "../include/commandInterpreter.h"
+#include "../include/dynamics.h"
+#include "../include/energy.h"
+#include "../include/memoryTracker.h"
+#include "../include/neighborList.h"
+#include "../include/timers.h"
+
+static const char* commandNames[2] = {"energy", "dynamics"};
+
+/**
+ * Reads the jobs of a manifest and checks their commands, nothing is parsed or run yet.
+ */
+Batch* batchRead(char* manifest) {
+  FILE* file = fopen(manifest, "r");
+  if(file == NULL) {
+    printf("Failed to read batch manifest: %s\n", manifest);
+    exit(1);
+  }
+  Batch* batch = memoryCalloc(1, sizeof(Batch), MEMORY_STRUCTURE);
+  batchJobVectorInit(&batch->jobs, 16, MEMORY_STRUCTURE);
+  batch->cache = forceFieldCacheCreate();
+  char line[4096];
+  int lineNumber = 0;
+  while(fgets(line, sizeof(line), file) != NULL) {
+    lineNumber++;
+    char* save = NULL;
+    char* command = strtok_r(line, " \t\r\n", &save);
+    if(command == NULL || command[0] == '#') {
+      continue;
+    }
+    char* structure = strtok_r(NULL, " \t\r\n", &save);
+    char* key = strtok_r(NULL, " \t\r\n", &save);
+    if(structure == NULL || key == NULL || strtok_r(NULL, " \t\r\n", &save) != NULL) {
+      printf("Line %d of %s should be \"command structure key\"!\n", lineNumber, manifest);
+      exit(1);
+    }
+    BatchJob* job = batchJobVectorEmplace(&batch->jobs);
+    if(strcasecmp(command, commandNames[BATCH_ENERGY]) == 0) {
+      job->command = BATCH_ENERGY;
+    } else if(strcasecmp(command, commandNames[BATCH_DYNAMICS]) == 0) {
+      job->command = BATCH_DYNAMICS;
+    } else {
+      printf("Unsupported batch command on line %d of %s: %s (energy or dynamics)\n", lineNumber, manifest, command);
+      exit(1);
+    }
+    job->structure = strdup(structure);
+    job->key = strdup(key);
+    job->line = lineNumber;
+  }
+  fclose(file);
+  if(batch->jobs.size == 0) {
+    printf("No jobs in batch manifest: %s\n", manifest);
+    exit(1);
+  }
+  return batch;
+}
+
+/**
+ * Runs every job, omp_get_max_threads()/threadsPerSystem of them at a time, or one at a time without OpenMP.
+ * @param threadsPerSystem OpenMP threads each system's command runs with
+ */
+void batchRun(Batch* batch, int threadsPerSystem) {
+#ifdef _OPENMP
+  const int maxThreads = omp_get_max_threads();
+#else
+  const int maxThreads = 1;
+#endif
+  if(threadsPerSystem < 1 || threadsPerSystem > maxThreads) {
+    printf("Threads per system must be from 1 to %d, not %d!\n", maxThreads, threadsPerSystem);
+    exit(1);
+  }
+  batch->threadsPerSystem = threadsPerSystem;
+  batch->concurrent = maxThreads/threadsPerSystem;
+  if(batch->concurrent > batch->jobs.size) {
+    batch->concurrent = batch->jobs.size;
+  }
+#ifdef _OPENMP
+  const int maxActiveLevels = omp_get_max_active_levels();
+  if(threadsPerSystem > 1) {
+    omp_set_max_active_levels(2);
+  }
+#endif
+  const unsigned long long baseSeed = (unsigned long long) time(NULL);
+  printf("Running %d jobs, %d at a time with %d threads each\n", batch->jobs.size, batch->concurrent,
+         threadsPerSystem);
+  const double start = timerNow();
+#pragma omp parallel for schedule(dynamic, 1) num_threads(batch->concurrent)
+  for(int j = 0; j < batch->jobs.size; j++) {
+    BatchJob* job = &batch->jobs.array[j];
+#ifdef _OPENMP
+    omp_set_num_threads(threadsPerSystem);
+#endif
+    const double jobStart = timerNow();
+    System* system;
+#pragma omp critical(batchParse)
+    system = systemParse(job->structure, job->key, batch->cache);
+    if(system->timerJSON != NULL || system->traceJSON != NULL || system->perfCounters) {
+      printf("%s sets timer-json, trace-json or perf-counters, which apply to the whole process: set MDC_TIMER_JSON, "
+             "MDC_TRACE_JSON or MDC_PERF_COUNTERS for a batch instead!\n", job->key);
+      exit(1);
+    }
+    buildLists(system);
+    system->nThreads = threadsPerSystem;
+    if(system->randomSeed == 0) {
+      system->randomSeed = baseSeed + job->line;
+    }
+    job->atoms = system->nAtoms;
+    job->energy = job->command == BATCH_ENERGY ? energy(system) : dynamics(system);
+    systemDestroy(system);
+    job->seconds = timerNow() - jobStart;
+  }
+  batch->seconds = timerNow() - start;
+#ifdef _OPENMP
+  omp_set_max_active_levels(maxActiveLevels);
+#endif
+}
+
+/**
+ * Summary of the jobs in manifest order.
+ */
+void batchPrint(Batch* batch) {
+  printf("\n %6s %8s %8s %18s %10s  %s\n", "Job", "Command", "Atoms", "Energy", "Seconds", "Structure");
+  double serial = 0.0;
+  for(int j = 0; j < batch->jobs.size; j++) {
+    const BatchJob* job = &batch->jobs.array[j];
+    printf(" %6d %8s %8d %18.8f %10.4f  %s\n", j + 1, commandNames[job->command], job->atoms, job->energy,
+           job->seconds, job->structure);
+    serial += job->seconds;
+  }
+  printf("\n %d jobs in %.4f s (%.4f s of jobs), %d force fields read, %d shared\n", batch->jobs.size,
+         batch->seconds, serial, batch->cache->entries.size, batch->cache->hits);
+}
+
+void batchDestroy(Batch* batch) {
+  for(int j = 0; j < batch->jobs.size; j++) {
+    free(batch->jobs.array[j].structure);
+    free(batch->jobs.array[j].key);
+  }
+  batchJobVectorFree(&batch->jobs);
+  forceFieldCacheDestroy(batch->cache);
+  memoryFree(batch, MEMORY_STRUCTURE);
+}
+
+/**
+ * Batch command: runs the jobs of a manifest and prints their summary.
+ */
+void batch(char* manifest, int threadsPerSystem) {
+  Batch* jobs = batchRead(manifest);
+  batchRun(jobs, threadsPerSystem);
+  batchPrint(jobs);
+  memoryReport();
+  batchDestroy(jobs);
+}
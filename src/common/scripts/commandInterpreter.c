@@ -5,15 +5,38 @@
 #include <assert.h>
 
 #include "../include/commandInterpreter.h"
+#include "../include/dynamics.h"
+#include "../include/energy.h"
 #include "../include/xyz.h"
 #include "../include/keyReader.h"
+#include "../include/arena.h"
+#include "../include/batch.h"
+#include "../include/mbar.h"
+#include "../include/memoryTracker.h"
 #include "../include/neighborList.h"
+#include "../include/replicaExchange.h"
+#include "../include/timers.h"
 
 int nSupStructExt = 3;
 char* supportedStructureExtensions[3] = {"xyz", "arc", "pdb"};
 int nSupKeyExt = 2;
 char* supportedKeyExtensions[2] = {"key", "properties"};
 
+/**
+ * Hands the timer keys of a run's only key file to timers.h, whose settings are global to the process.
+ */
+static void applyTimerKeys(System* system) {
+    if(system->timerJSON != NULL) {
+        timersSetJSON(system->timerJSON);
+    }
+    if(system->traceJSON != NULL) {
+        timersSetTrace(system->traceJSON);
+    }
+    if(system->perfCounters) {
+        timersSetHardware(true);
+    }
+}
+
 /**
  * @param argc number of arguments, must be four
  * @param argv array of arguments - expects [${PATH}/molecular_dynamics_c, command, [supported structure file], key file]
@@ -48,12 +71,36 @@ void commandInterpreter(int argc, char *argv[]){
     } else if(strcasecmp(command, "energy") == 0 && argc == 4) {
         printf("Preparing to calculate the energy of the system.\n");
         System* system = systemCreate(argv[2], argv[3]);
-        //energy(system);
+        applyTimerKeys(system);
+        energy(system);
+        memoryReport();
         systemDestroy(system);
     } else if(strcasecmp(command, "dynamics") == 0 && argc == 4) {
         printf("Preparing to run molecular dynamics on the system.\n");
         System* system = systemCreate(argv[2], argv[3]);
-        //dynamics(system); // calls energy many times
+        applyTimerKeys(system);
+        dynamics(system); // calls energy many times
+        memoryReport();
+        systemDestroy(system);
+    } else if(strcasecmp(command, "mbar") == 0 && argc == 3) {
+        printf("Solving MBAR for the samples in %s.\n", argv[2]);
+        TIMER_START(TIMER_MBAR);
+        MBAR* mbar = mbarSolve(argv[2]);
+        TIMER_STOP(TIMER_MBAR);
+        mbarPrint(mbar);
+        mbarDestroy(mbar);
+    } else if(strcasecmp(command, "batch") == 0 && (argc == 3 || argc == 4)) {
+        int threadsPerSystem = argc == 4 ? atoi(argv[3]) : 1;
+        printf("Running the jobs of %s with %d threads per system.\n", argv[2], threadsPerSystem);
+        batch(argv[2], threadsPerSystem);
+    } else if(strcasecmp(command, "replica") == 0 && (argc == 4 || argc == 5)) {
+        int threadsPerReplica = argc == 5 ? atoi(argv[4]) : 1;
+        printf("Preparing to run replica exchange dynamics with %d threads per replica.\n", threadsPerReplica);
+        System* system = systemParse(argv[2], argv[3], NULL);
+        applyTimerKeys(system);
+        buildBonded(system);
+        replicaExchange(system, threadsPerReplica);
+        memoryReport();
         systemDestroy(system);
     } else if (argc != 4){
         printf("Program expects 3 arguments in addition to command if help isn't requested!\n");
@@ -96,12 +143,27 @@ char* getFileExtension(char* fileName, int extForceLen) {
 }
 
 System* systemCreate(char* structureFile, char* keyFile) {
+    System* system = systemParse(structureFile, keyFile, NULL);
+    // Neighbors & 13 & 14 lists
+    buildLists(system);
+    return system;
+}
+
+/**
+ * Reads the structure and key file (and the force field it names) without building any lists. The parsers use
+ * strtok, so only one thread may parse at a time.
+ * @param cache force fields to share with other systems, NULL to read one for this system alone
+ */
+System* systemParse(char* structureFile, char* keyFile, ForceFieldCache* cache) {
     // Get structure file extension and read it in
-    System* system = malloc(sizeof(System));
+    System* system = calloc(1, sizeof(System));
     if(system == NULL) {
-        printf("malloc() failed to allocate memory in systemCreate()!");
+        printf("calloc() failed to allocate memory in systemParse()!");
         exit(1);
     }
+    systemDefaults(system);
+    system->forceFieldCache = cache;
+    TIMER_START(TIMER_PARSE);
     char* sExt = getFileExtension(structureFile, 3);
     assert(sExt != NULL);
     if(strcasecmp(sExt, supportedStructureExtensions[0]) == 0) { // xyz
@@ -132,13 +194,77 @@ System* systemCreate(char* structureFile, char* keyFile) {
         exit(1);
     }
     free(kExt);
+    TIMER_STOP(TIMER_PARSE);
+    return system;
+}
 
-    // Neighbors & 13 & 14 lists
-    buildLists(system);
-
-    // Set defaults if not set and check system for a complete description of molecular system
+/**
+ * Defaults from keyReader.h for anything the key file doesn't set. Everything else starts zeroed.
+ * @param system freshly allocated system
+ */
+void systemDefaults(System* system) {
+    system->dtAtto = 1e3;
+    system->dtFemto = 1.0;
+    system->steps = 1e9;
+    system->printThermoEvery = 1e4;
+    system->printRestartEvery = 1e4;
+    system->printArchiveEvery = 1e4;
+    system->printMBAREvery = 0;
+    system->temperature = 298.0;
+    system->realspaceCutoff = 9.0;
+    system->realspaceBuffer = 2.0;
+    system->ewaldOrder = 5;
+    system->mpoleScale[0] = 0.0; // AMOEBA mpole-12-scale
+    system->mpoleScale[1] = 0.0; // mpole-13-scale
+    system->mpoleScale[2] = 0.4; // mpole-14-scale
+    system->polarization = NONE;
+    system->polarEps = 1e-6; // Tinker polar-eps default (Debye)
+    system->polarPredict = 6; // ASPC history length
+    system->integrator = VERLET;
+    system->dtInnerAtto = 250;
+    system->respaCutoff = 5.0;
+    system->respaSwitch = 1.0;
+    system->constraints = NO_CONSTRAINTS;
+    system->hydrogenMass = 0.0;
+    system->thermostat = NO_THERMOSTAT;
+    system->friction = 1.0;
+    system->tauTemperature = 0.2;
+    system->barostat = NO_BAROSTAT;
+    system->pressure = 1.0;
+    system->volumeTrial = 25;
+    system->volumeMove = 100.0;
+    system->lambda = 1.0;
+    system->randomSeed = 0;
+    system->replicaLadder = NO_LADDER;
+    system->exchangeEvery = 100;
+    system->nThreads = 1;
+}
 
-    return system;
+/**
+ * A copy of a system that shares its topology, bonded lists, masses and force field (System->topology) and only
+ * owns its coordinates, forces, neighbor lists and rotated multipoles, which start out as a copy of the positions
+ * and unset.
+ * @param system owner of the topology, must outlive the replica
+ */
+System* systemReplica(System* system) {
+    System* replica = malloc(sizeof(System));
+    if(replica == NULL) {
+        printf("malloc() failed to allocate memory in systemReplica()!");
+        exit(1);
+    }
+    *replica = *system;
+    replica->topology = system;
+    replica->X = memoryMalloc(sizeof(REAL)*system->nAtoms*3, MEMORY_STRUCTURE);
+    memcpy(replica->X, system->X, sizeof(REAL)*system->nAtoms*3);
+    replica->V = NULL;
+    replica->A = NULL;
+    replica->F = NULL;
+    replica->lambdas = NULL;
+    replica->multipoles = NULL; // Rows of its own potential's frames
+    replica->verletList = NULL;
+    replica->verletPlain = NULL;
+    replica->verletCells = NULL;
+    return replica;
 }
 
 /**
@@ -146,23 +272,26 @@ System* systemCreate(char* structureFile, char* keyFile) {
  * @param system system to have all of its memory freed
  */
 void systemDestroy(System* system) {
-    for(int i = 0; i < system->nAtoms; i++) {
-        //free(system->multipoles[i]);
-        free(system->atomNames[i]);
-        vectorBackingFree(&system->list12[i]);
-        vectorBackingFree(&system->list13[i]);
-        vectorBackingFree(&system->list14[i]);
-        //vectorBackingFree(&system->verletList[i]);
-    }
-    free(system->atomTypes);
-    free(system->multipoles);
-    free(system->atomNames);
-    free(system->list12);
-    free(system->list13);
-    free(system->list14);
-    free(system->verletList);
-    free(system->protons);
-    free(system->valence);
+    if(system->topology != NULL) {
+        // A replica only owns its coordinates and lists
+        verletDestroy(system);
+        memoryFree(system->X, MEMORY_STRUCTURE);
+        memoryFree(system->V, MEMORY_STRUCTURE);
+        memoryFree(system->A, MEMORY_STRUCTURE);
+        memoryFree(system->F, MEMORY_STRUCTURE);
+        memoryFree(system->lambdas, MEMORY_STRUCTURE);
+        free(system->multipoles); // From multipoleFramesCreate
+        free(system);
+        return;
+    }
+    // Atom names, 1-2 lists and the remark
+    arenaDestroy(system->arena);
+    bondedDestroy(system);
+    memoryFree(system->atomTypes, MEMORY_STRUCTURE);
+    memoryFree(system->multipoles, MEMORY_STRUCTURE);
+    verletDestroy(system);
+    memoryFree(system->protons, MEMORY_STRUCTURE);
+    memoryFree(system->valence, MEMORY_STRUCTURE);
     //for(int i = 0; i < system->pmeGridspace[0]; i++) {
     //    for(int j = 0; j < system->pmeGridspace[1]; j++) {
     //        free(system->pmeGrid[i][j]);
@@ -170,25 +299,30 @@ void systemDestroy(System* system) {
     //    free(system->pmeGrid[i]);
     //}
     //free(system->pmeGrid);
-    free(system->pmeGridspace);
-    forceFieldFree(system->forceField);
+    memoryFree(system->pmeGridspace, MEMORY_STRUCTURE);
+    if(system->forceFieldCache == NULL) {
+        forceFieldFree(system->forceField);
+    }
     //free(system->pmeGridFlat);
     //free(system->DOF);
     //free(system->DOFFrc);
-    free(system->X);
-    free(system->M);
-    free(system->V);
-    free(system->A);
-    free(system->F);
-    free(system->lambdas);
+    memoryFree(system->X, MEMORY_STRUCTURE);
+    memoryFree(system->M, MEMORY_STRUCTURE);
+    memoryFree(system->V, MEMORY_STRUCTURE);
+    memoryFree(system->A, MEMORY_STRUCTURE);
+    memoryFree(system->F, MEMORY_STRUCTURE);
+    memoryFree(system->lambdas, MEMORY_STRUCTURE);
     //free(system->thetas);
     //free(system->thetaM);
     //free(system->thetaV);
     //free(system->thetaA);
     //free(system->thetaF);
-    //free(system->activeLambdas);
-    free(system->remark);
+    memoryFree(system->activeLambdas, MEMORY_STRUCTURE);
+    memoryFree(system->lambdaStates, MEMORY_STRUCTURE);
+    memoryFree(system->replicaValues, MEMORY_STRUCTURE);
     free(system->forceFieldFile);
+    free(system->timerJSON);
+    free(system->traceJSON);
     vectorBackingFree(&system->patchFiles);
     //free(system->keyFileName);
     //free(system->threadIDs);
@@ -196,8 +330,8 @@ void systemDestroy(System* system) {
 }
 
 void printSupportedCommands() {
-    int nCommands = 3;
-    char* commands[3] = {"help", "energy", "dynamics"};
+    int nCommands = 6;
+    char* commands[6] = {"help", "energy", "dynamics", "mbar", "batch", "replica"};
     printf("[ ");
     for(int i = 0; i < nCommands; i++) {
         printf("%s ", commands[i]);
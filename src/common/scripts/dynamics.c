@@ -0,0 +1,786 @@
+// Author(s): Matthew Speranza
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/dynamics.h"
+#include "../include/memoryTracker.h"
+#include "../include/neighborList.h"
+#include "../include/philox.h"
+#include "../include/timers.h"
+
+#ifdef TIMERS
+// The timers of each ReportPhase below TIMER_DYNAMICS, so the forces and neighbor list updates of a barostat move
+// are only barostat time
+static const struct {
+  int depth;
+  enum TimerID path[2];
+} reportPaths[N_REPORT_PHASES] = {
+  [PHASE_INTEGRATE] = {1, {TIMER_INTEGRATE}},
+  [PHASE_NEIGHBORS] = {1, {TIMER_VERLET_UPDATE}},
+  [PHASE_FORCES] = {1, {TIMER_FORCE}},
+  [PHASE_ROTATE] = {2, {TIMER_FORCE, TIMER_ROTATE}},
+  [PHASE_REAL_SPACE] = {2, {TIMER_FORCE, TIMER_REAL_SPACE}},
+  [PHASE_TORQUE] = {2, {TIMER_FORCE, TIMER_TORQUE}},
+  [PHASE_THERMOSTAT] = {1, {TIMER_THERMOSTAT}},
+  [PHASE_CONSTRAIN] = {1, {TIMER_CONSTRAIN}},
+  [PHASE_BAROSTAT] = {1, {TIMER_BAROSTAT}},
+};
+#endif
+
+/**
+ * Fills System->M (amu) and System->protons from the force field atom definitions of each atom's type.
+ */
+void assignMasses(System* system) {
+  if(system->forceField == NULL || system->forceField->atom.size == 0) {
+    printf("Atom definitions are needed to assign masses!\n");
+    exit(1);
+  }
+  if(system->M == NULL) {
+    system->M = memoryMalloc(sizeof(REAL)*system->nAtoms, MEMORY_STRUCTURE);
+  }
+  if(system->protons == NULL) {
+    system->protons = memoryMalloc(sizeof(REAL)*system->nAtoms, MEMORY_STRUCTURE);
+  }
+  Atom* atoms = system->forceField->atom.array;
+  int nTypes = system->forceField->atom.size;
+  for(int i = 0; i < system->nAtoms; i++) {
+    Atom* match = NULL;
+    for(int t = 0; t < nTypes && match == NULL; t++) {
+      if(atoms[t].type == system->atomTypes[i]) {
+        match = &atoms[t];
+      }
+    }
+    if(match == NULL) {
+      printf("No atom definition for type %d of atom %d!\n", system->atomTypes[i], i+1);
+      exit(1);
+    }
+    system->M[i] = match->atomicMass;
+    system->protons[i] = match->atomicNum;
+  }
+}
+
+/**
+ * Hydrogen mass repartitioning: every hydrogen bonded to a heavy atom (System->list12) is set to hydrogenMass (amu)
+ * and the difference is taken from that heavy atom, so each molecule keeps its mass. Heavier hydrogens slow the
+ * fastest angle and torsion motions, which together with constraints on the bonds to hydrogen allows ~4 fs steps.
+ * Waters SETTLE keeps rigid (any System->constraints) are left alone, for them it would only change the moment of
+ * inertia. Masses must already be assigned.
+ * @param nWatersSkipped set to the number of rigid waters left alone
+ * @return number of hydrogens changed
+ */
+int repartitionMasses(System* system, REAL hydrogenMass, int* nWatersSkipped) {
+  if(system->M == NULL || system->protons == NULL || system->list12 == NULL) {
+    printf("Mass repartitioning needs masses, atomic numbers and bonds!\n");
+    exit(1);
+  }
+  int nChanged = 0, nSkipped = 0;
+  for(int h = 0; h < system->nAtoms; h++) {
+    if(system->protons[h] != 1 || system->list12[h].size != 1) {
+      continue;
+    }
+    int heavy = ((int*) system->list12[h].array)[0];
+    if(system->protons[heavy] == 1) {
+      continue;
+    }
+    if(system->constraints != NO_CONSTRAINTS && isWater(system, heavy)) {
+      nSkipped++;
+      continue;
+    }
+    system->M[heavy] -= hydrogenMass - system->M[h];
+    system->M[h] = hydrogenMass;
+    nChanged++;
+  }
+  for(int i = 0; i < system->nAtoms; i++) {
+    if(system->protons[i] != 1 && system->M[i] < hydrogenMass) {
+      printf("Repartitioning to %.3f amu hydrogens leaves atom %d with %.3f amu!\n", hydrogenMass, i+1,
+             system->M[i]);
+      exit(1);
+    }
+  }
+  *nWatersSkipped = nSkipped/2;
+  return nChanged;
+}
+
+/**
+ * Maxwell-Boltzmann velocities at the given temperature with the center of mass momentum removed, scaled so the
+ * instantaneous temperature is exact. The normal deviates are keyed by System->randomSeed and atom. Massless atoms
+ * stay at rest.
+ */
+void initVelocities(System* system, REAL temperature) {
+  const int nAtoms = system->nAtoms;
+  if(system->V == NULL) {
+    system->V = memoryMalloc(sizeof(REAL)*nAtoms*3, MEMORY_STRUCTURE);
+  }
+  REAL momentum[3] = {0.0, 0.0, 0.0};
+  REAL totalMass = 0.0;
+  for(int i = 0; i < nAtoms; i++) {
+    REAL m = system->M[i];
+    REAL normal[4];
+    philoxNormals(system->randomSeed, STREAM_VELOCITIES, 0, i, normal);
+    for(int j = 0; j < 3; j++) {
+      if(m <= 0.0) {
+        system->V[i*3+j] = 0.0;
+        continue;
+      }
+      // sigma^2 = kT/m in (ANG/ns)^2
+      system->V[i*3+j] = normal[j]*sqrt(BOLTZMANN*temperature*KCAL_TO_ACCEL/m);
+      momentum[j] += m*system->V[i*3+j];
+    }
+    totalMass += m > 0.0 ? m : 0.0;
+  }
+  REAL kinetic = 0.0;
+  for(int i = 0; i < nAtoms; i++) {
+    if(system->M[i] <= 0.0) {
+      continue;
+    }
+    for(int j = 0; j < 3; j++) {
+      system->V[i*3+j] -= momentum[j]/totalMass;
+      kinetic += 0.5*system->M[i]*system->V[i*3+j]*system->V[i*3+j];
+    }
+  }
+  int nDOF = 3*nAtoms - 3;
+  REAL current = 2.0*kinetic/KCAL_TO_ACCEL/(nDOF*BOLTZMANN);
+  REAL scale = current > 0.0 ? sqrt(temperature/current) : 0.0;
+  for(int a = 0; a < nAtoms*3; a++) {
+    system->V[a] *= scale;
+  }
+}
+
+/**
+ * Opens <structure>.mbar for the energies of System->lambdaStates. They are only summed by full force evaluations,
+ * and are converted to kT at the thermostat temperature, so velocity Verlet with a thermostat is needed and
+ * System->lambda must be one of the states.
+ */
+static void openMBARSamples(System* system, Dynamics* md) {
+  if(system->nLambdaStates == 0 || system->thermostat == NO_THERMOSTAT || system->integrator != VERLET) {
+    printf("printMBAREvery needs lambda-states, a thermostat and the verlet integrator!\n");
+    exit(1);
+  }
+  md->mbarState = -1;
+  for(int s = 0; s < system->nLambdaStates; s++) {
+    if(fabs(system->lambdaStates[s] - system->lambda) < 1e-10) {
+      md->mbarState = s;
+    }
+  }
+  if(md->mbarState < 0) {
+    printf("lambda %.6f is not one of the lambda-states, its samples would not belong to a state!\n",
+           system->lambda);
+    exit(1);
+  }
+  const char* name = system->structureFileName;
+  const char* dot = strrchr(name, '.');
+  size_t length = dot != NULL ? (size_t) (dot - name) : strlen(name);
+  char* path = malloc(length + 6);
+  if(path == NULL) {
+    printf("Failed to allocate the MBAR file name!\n");
+    exit(1);
+  }
+  memcpy(path, name, length);
+  strcpy(&path[length], ".mbar");
+  md->mbar = mbarWriterCreate(path, system->nLambdaStates);
+  free(path);
+}
+
+/**
+ * Appends the last force evaluation's state energies in kT. The PV term is the same for every state and cancels.
+ */
+static void mbarSample(System* system, Dynamics* md) {
+  mbarWrite(md->mbar, md->mbarState, md->potential->stateEnergy, 1.0/(BOLTZMANN*system->temperature));
+}
+
+/**
+ * Allocates the integrator state and evaluates the forces at the starting positions. System->M and System->V must
+ * be set, the Verlet lists are built if they don't exist yet. Constrained positions and velocities are projected
+ * onto the constraints first.
+ */
+Dynamics* dynamicsCreate(System* system) {
+  TIMER_START(TIMER_SETUP);
+  const int n3 = system->nAtoms*3;
+  if(system->polarization != NONE) {
+    printf("Polarization forces are not implemented yet, set polarization to none for dynamics!\n");
+    exit(1);
+  }
+  Dynamics* md = calloc(1, sizeof(Dynamics));
+  if(md == NULL) {
+    printf("Failed to allocate dynamics!\n");
+    exit(1);
+  }
+  md->invMass = malloc(sizeof(REAL)*n3);
+  if(system->A == NULL) {
+    system->A = memoryMalloc(sizeof(REAL)*n3, MEMORY_STRUCTURE);
+  }
+  if(md->invMass == NULL || system->A == NULL) {
+    printf("Failed to allocate dynamics!\n");
+    exit(1);
+  }
+  for(int i = 0; i < system->nAtoms; i++) {
+    REAL inv = system->M[i] > 0.0 ? 1.0/system->M[i] : 0.0;
+    for(int j = 0; j < 3; j++) {
+      md->invMass[i*3+j] = inv;
+    }
+  }
+  md->dt = system->dtAtto*1e-9;
+  md->nDOF = 3*system->nAtoms - 3;
+  if(system->thermostat == LANGEVIN && system->friction <= 0.0) {
+    printf("The Langevin thermostat needs a positive friction!\n");
+    exit(1);
+  }
+  if(system->thermostat == BUSSI && system->tauTemperature <= 0.0) {
+    printf("The Bussi thermostat needs a positive tau-temperature!\n");
+    exit(1);
+  }
+  if(system->barostat != NO_BAROSTAT && (system->thermostat == NO_THERMOSTAT || system->volumeTrial <= 0
+                                          || system->volumeMove <= 0.0)) {
+    printf("The Monte Carlo barostat needs a thermostat, volume-trial > 0 and volume-move > 0!\n");
+    exit(1);
+  }
+  if(system->constraints != NO_CONSTRAINTS) {
+    md->constraints = constraintsCreate(system);
+    md->nDOF -= md->constraints->nConstraints;
+  }
+  if(system->verletList == NULL) {
+    buildVerlet(system);
+  } else if(md->constraints != NULL) {
+    updateVerlet(system);
+  }
+  if(system->barostat == MONTE_CARLO) {
+    md->barostat = barostatCreate(system);
+    scaleMolecules(system, md->barostat, 1.0); // Sets the density
+  }
+  md->potential = potentialCreate(system);
+  if(system->printMBAREvery > 0) {
+    openMBARSamples(system, md);
+  }
+  if(system->integrator == RESPA) {
+    if(system->dtInnerAtto <= 0 || system->dtAtto % system->dtInnerAtto != 0) {
+      printf("The RESPA inner timestep (%d as) must divide the timestep (%d as)!\n", system->dtInnerAtto,
+             system->dtAtto);
+      exit(1);
+    }
+    if(system->respaSwitch <= 0.0 || system->respaSwitch > system->respaCutoff
+       || system->respaCutoff > system->realspaceCutoff) {
+      printf("RESPA needs 0 < respa-switch <= respa-cutoff <= cutoff!\n");
+      exit(1);
+    }
+    md->nInner = system->dtAtto/system->dtInnerAtto;
+    md->fastF = malloc(sizeof(REAL)*n3);
+    md->slowF = malloc(sizeof(REAL)*n3);
+    if(md->fastF == NULL || md->slowF == NULL) {
+      printf("Failed to allocate dynamics!\n");
+      exit(1);
+    }
+  } else {
+    md->nInner = 1;
+  }
+  dynamicsRefresh(system, md);
+  md->kinetic = kineticEnergy(system, md);
+  TIMER_STOP(TIMER_SETUP);
+  return md;
+}
+
+/**
+ * Evaluates the forces (both levels with RESPA) and accelerations at the current positions, for a start or after
+ * something the potential depends on changed between steps, like System->lambda.
+ */
+void dynamicsRefresh(System* system, Dynamics* md) {
+  const int n3 = system->nAtoms*3;
+  if(system->integrator == RESPA) {
+    md->fastEnergy = potentialLevel(system, md->potential, FORCE_FAST, md->fastF);
+    md->slowEnergy = potentialLevel(system, md->potential, FORCE_SLOW, md->slowF);
+    md->potentialEnergy = md->fastEnergy + md->slowEnergy;
+    for(int a = 0; a < n3; a++) {
+      system->F[a] = md->fastF[a] + md->slowF[a];
+    }
+  } else {
+    md->potentialEnergy = potentialEnergy(system, md->potential);
+  }
+  for(int a = 0; a < n3; a++) {
+    system->A[a] = KCAL_TO_ACCEL*md->invMass[a]*system->F[a];
+  }
+}
+
+void dynamicsDestroy(Dynamics* md) {
+  potentialDestroy(md->potential);
+  if(md->constraints != NULL) {
+    constraintsDestroy(md->constraints);
+  }
+  if(md->barostat != NULL) {
+    barostatDestroy(md->barostat);
+  }
+  if(md->mbar != NULL) {
+    mbarWriterClose(md->mbar);
+  }
+  free(md->invMass);
+  free(md->fastF);
+  free(md->slowF);
+  free(md);
+}
+
+/**
+ * Kinetic energy (kcal/mol), also sets Dynamics->temperature.
+ */
+REAL kineticEnergy(System* system, Dynamics* md) {
+  const REAL* restrict V = system->V;
+  const REAL* restrict invMass = md->invMass;
+  REAL sum = 0.0;
+#pragma omp parallel for simd reduction(+:sum) schedule(static)
+  for(int a = 0; a < system->nAtoms*3; a++) {
+    sum += invMass[a] > 0.0 ? V[a]*V[a]/invMass[a] : 0.0;
+  }
+  md->kinetic = 0.5*sum/KCAL_TO_ACCEL;
+  md->temperature = 2.0*md->kinetic/(md->nDOF*BOLTZMANN);
+  return md->kinetic;
+}
+
+/**
+ * Adds the wall time, and built with TIMERS the time of each ReportPhase, since the last call to the report. Called
+ * inside TIMER_DYNAMICS.
+ * @param add false to only start counting, at the start of dynamicsRun
+ */
+static void reportPhases(Dynamics* md, bool add) {
+  const double now = timerNow();
+  md->reportSeconds += add ? now - md->markSeconds : 0.0;
+  md->markSeconds = now;
+#ifdef TIMERS
+  for(int p = 0; p < N_REPORT_PHASES; p++) {
+    const double seconds = timerPathSeconds(TIMER_DYNAMICS, reportPaths[p].path, reportPaths[p].depth);
+    md->phaseSeconds[p] += add ? seconds - md->phaseMark[p] : 0.0;
+    md->phaseMark[p] = seconds;
+  }
+#endif
+}
+
+/**
+ * One line of energies and throughput, then where the time of the steps since the last report went by the timers
+ * (only built with TIMERS), neighbor list rebuilds, constraint iterations and the barostat.
+ */
+static void thermoReport(System* system, Dynamics* md) {
+  REAL kinetic = kineticEnergy(system, md);
+  long nSteps = md->reportSteps;
+  double nsPerDay = md->reportSeconds > 0.0 ? nSteps*md->dt/md->reportSeconds*86400.0 : 0.0;
+  printf(" %10ld %12.4f %16.6f %16.6f %16.6f %10.3f %12.3f\n", md->step, md->step*md->dt*1e3, kinetic,
+         md->potentialEnergy, kinetic + md->potentialEnergy, md->temperature, nsPerDay);
+#ifdef TIMERS
+  double ms[N_REPORT_PHASES];
+  for(int p = 0; p < N_REPORT_PHASES; p++) {
+    ms[p] = md->phaseSeconds[p]*1e3/nSteps;
+  }
+  printf("   ms/step: integrate %.4f, neighbors %.4f (%d rebuilds), forces %.4f [rotate %.4f, real space %.4f, "
+         "torque %.4f]", ms[PHASE_INTEGRATE], ms[PHASE_NEIGHBORS], md->nRebuilds, ms[PHASE_FORCES],
+         ms[PHASE_ROTATE], ms[PHASE_REAL_SPACE], ms[PHASE_TORQUE]);
+  if(system->integrator == RESPA) {
+    printf(", %d fast force steps", md->nInner);
+  }
+  if(system->thermostat != NO_THERMOSTAT) {
+    printf(", thermostat %.4f", ms[PHASE_THERMOSTAT]);
+  }
+  if(md->constraints != NULL) {
+    printf(", constraints %.4f", ms[PHASE_CONSTRAIN]);
+  }
+#else
+  printf("   %d neighbor list rebuilds", md->nRebuilds);
+#endif
+  if(md->constraints != NULL && md->constraints->nClusters > 0) {
+    printf(" (%.1f SHAKE, %.1f RATTLE iterations)", (double) md->shakeIterations/(nSteps*md->nInner),
+           (double) md->rattleIterations/nSteps);
+  }
+  if(md->barostat != NULL) {
+    Barostat* b = md->barostat;
+#ifdef TIMERS
+    printf(", barostat %.4f", ms[PHASE_BAROSTAT]);
+#endif
+    printf("\n   volume %.2f ANG^3, density %.5f g/cm^3, %ld of %ld volume moves accepted (largest %.2f ANG^3)",
+           system->volume, system->density*AMU_PER_ANG3_TO_G_PER_CM3, b->accepted, b->trials, b->volumeMove);
+    b->accepted = b->trials = 0;
+  }
+  printf("\n");
+  md->reportSteps = 0;
+  md->reportSeconds = 0.0;
+  memset(md->phaseSeconds, 0, sizeof(md->phaseSeconds));
+  md->nRebuilds = 0;
+  md->shakeIterations = md->rattleIterations = 0;
+}
+
+/**
+ * V += dt*c*F/M with c converting kcal/mol/ANG/amu to ANG/ns^2.
+ */
+static void kick(REAL* V, const REAL* F, const REAL* invMass, REAL dt, int n3) {
+  TIMER_START(TIMER_INTEGRATE);
+  const REAL c = dt*KCAL_TO_ACCEL;
+#pragma omp parallel for simd schedule(static)
+  for(int a = 0; a < n3; a++) {
+    V[a] += c*invMass[a]*F[a];
+  }
+  TIMER_STOP(TIMER_INTEGRATE);
+}
+
+/**
+ * Exact Ornstein-Uhlenbeck update of the velocities over h (ns), the O of BAOAB: V = c*V + sqrt((1 - c^2)*kT/m)*R
+ * with c = exp(-friction*h). R is keyed by atom, stream and step, so no generator state is kept and the loop over
+ * atoms is split freely over threads and simd lanes.
+ */
+static void langevinVelocities(System* system, Dynamics* md, REAL h, uint32_t stream) {
+  TIMER_START(TIMER_THERMOSTAT);
+  const REAL c = exp(-system->friction*1e3*h);
+  const REAL scale = sqrt((1.0 - c*c)*BOLTZMANN*system->temperature*KCAL_TO_ACCEL);
+  const uint64_t seed = system->randomSeed;
+  const uint64_t step = md->step;
+  REAL* V = system->V;
+  const REAL* invMass = md->invMass;
+#pragma omp parallel for simd schedule(static)
+  for(int i = 0; i < system->nAtoms; i++) {
+    REAL normal[4];
+    philoxNormals(seed, stream, step, i, normal);
+    for(int k = 0; k < 3; k++) {
+      V[i*3+k] = c*V[i*3+k] + scale*sqrt(invMass[i*3+k])*normal[k];
+    }
+  }
+  TIMER_STOP(TIMER_THERMOSTAT);
+}
+
+/**
+ * Bussi, Donadio and Parrinello velocity rescaling (J. Chem. Phys. 126, 014101 (2007)) after a step of dt: the
+ * kinetic energy K is replaced by an exact draw from its relaxation towards the canonical distribution with
+ * coupling time tau-temperature, c = exp(-dt/tau),
+ * <p>
+ * K' = K + (1 - c)*(K0*(R^2 + S)/nDOF - K) + 2*R*sqrt(c*(1 - c)*K0*K/nDOF)
+ * <p>
+ * with K0 = nDOF*kT/2, R normal and S chi-squared with nDOF - 1 degrees of freedom. Only two draws per step.
+ */
+static void bussiRescale(System* system, Dynamics* md) {
+  TIMER_START(TIMER_THERMOSTAT);
+  const REAL kinetic = kineticEnergy(system, md);
+  if(kinetic > 0.0) {
+    const REAL c = exp(-md->dt/(system->tauTemperature*1e-3));
+    const REAL target = 0.5*md->nDOF*BOLTZMANN*system->temperature;
+    REAL r[4];
+    philoxNormals(system->randomSeed, STREAM_BUSSI, md->step, 0, r);
+    REAL chi = philoxChiSquared(system->randomSeed, STREAM_BUSSI_CHI, md->step, md->nDOF - 1);
+    REAL rescaled = kinetic + (1.0 - c)*(target*(r[0]*r[0] + chi)/md->nDOF - kinetic)
+                    + 2.0*r[0]*sqrt(c*(1.0 - c)*target*kinetic/md->nDOF);
+    const REAL alpha = sqrt(rescaled/kinetic);
+    REAL* V = system->V;
+#pragma omp parallel for simd schedule(static)
+    for(int a = 0; a < system->nAtoms*3; a++) {
+      V[a] *= alpha;
+    }
+  }
+  TIMER_STOP(TIMER_THERMOSTAT);
+}
+
+/**
+ * Monte Carlo volume move (barostat.h) at the current step. The trial energy is evaluated on the existing neighbor
+ * lists, which updateVerlet only rebuilds if the move used up the buffer. A rejected move restores the positions,
+ * box and forces, an accepted one keeps the trial forces and updates the accelerations.
+ */
+static void monteCarloVolume(System* system, Dynamics* md) {
+  TIMER_START(TIMER_BAROSTAT);
+  Barostat* b = md->barostat;
+  const int n3 = system->nAtoms*3;
+  const bool respa = system->integrator == RESPA;
+  REAL* force[2] = {respa ? md->fastF : system->F, md->slowF};
+  const int nForces = respa ? 2 : 1;
+  REAL u[4];
+  philoxUniforms(system->randomSeed, STREAM_BAROSTAT, md->step, 0, u);
+  const REAL volume = system->volume;
+  const REAL trialVolume = volume + (2.0*u[0] - 1.0)*b->volumeMove;
+  b->trials++;
+  b->windowTrials++;
+  if(trialVolume > 0.0) {
+    const REAL energy = md->potentialEnergy, fastEnergy = md->fastEnergy, slowEnergy = md->slowEnergy;
+    const REAL density = system->density;
+    REAL box[3][3];
+    memcpy(box, system->boxDim, sizeof(box));
+    memcpy(b->XSave, system->X, sizeof(REAL)*n3);
+    for(int f = 0; f < nForces; f++) {
+      memcpy(b->FSave[f], force[f], sizeof(REAL)*n3);
+    }
+    scaleMolecules(system, b, cbrt(trialVolume/volume));
+    if(updateVerlet(system)) {
+      md->nRebuilds++;
+    }
+    REAL trialEnergy;
+    if(respa) {
+      md->fastEnergy = potentialLevel(system, md->potential, FORCE_FAST, md->fastF);
+      md->slowEnergy = potentialLevel(system, md->potential, FORCE_SLOW, md->slowF);
+      trialEnergy = md->fastEnergy + md->slowEnergy;
+    } else {
+      trialEnergy = potentialEnergy(system, md->potential);
+    }
+    const REAL kT = BOLTZMANN*system->temperature;
+    const REAL w = trialEnergy - energy + system->pressure*ATM_TO_KCAL*(trialVolume - volume)
+                   - b->nMolecules*kT*log(trialVolume/volume);
+    if(w <= 0.0 || u[1] < exp(-w/kT)) {
+      md->potentialEnergy = trialEnergy;
+      REAL* A = system->A;
+      const REAL* invMass = md->invMass;
+      const REAL* F0 = force[0];
+      const REAL* F1 = respa ? md->slowF : NULL;
+#pragma omp parallel for simd schedule(static)
+      for(int a = 0; a < n3; a++) {
+        A[a] = KCAL_TO_ACCEL*invMass[a]*(respa ? F0[a] + F1[a] : F0[a]);
+      }
+      b->accepted++;
+      b->windowAccepted++;
+      COUNTER_ADD(COUNTER_VOLUME_ACCEPTED, 1);
+    } else {
+      memcpy(system->X, b->XSave, sizeof(REAL)*n3);
+      for(int f = 0; f < nForces; f++) {
+        memcpy(force[f], b->FSave[f], sizeof(REAL)*n3);
+      }
+      memcpy(system->boxDim, box, sizeof(box));
+      system->volume = volume;
+      system->density = density;
+      md->fastEnergy = fastEnergy;
+      md->slowEnergy = slowEnergy;
+    }
+  }
+  adaptVolumeMove(b, system->volume);
+  COUNTER_ADD(COUNTER_VOLUME_MOVES, 1);
+  TIMER_STOP(TIMER_BAROSTAT);
+}
+
+/**
+ * Position constraints after a drift of dt from Constraints->XRef.
+ */
+static void constrainDrift(System* system, Dynamics* md, REAL dt) {
+  TIMER_START(TIMER_CONSTRAIN);
+  constrainPositions(system, md->constraints, dt);
+  md->shakeIterations += md->constraints->positionIterations;
+  COUNTER_ADD(COUNTER_SHAKE_ITERATIONS, md->constraints->positionIterations);
+  TIMER_STOP(TIMER_CONSTRAIN);
+}
+
+static void constrainEnd(System* system, Dynamics* md) {
+  TIMER_START(TIMER_CONSTRAIN);
+  constrainVelocities(system, md->constraints);
+  md->rattleIterations += md->constraints->velocityIterations;
+  COUNTER_ADD(COUNTER_RATTLE_ITERATIONS, md->constraints->velocityIterations);
+  TIMER_STOP(TIMER_CONSTRAIN);
+}
+
+/**
+ * One velocity Verlet step: V += dt/2*A, X += dt*V, forces, A = F/M, V += dt/2*A. With constraints the drift is
+ * followed by SHAKE and the step ends with RATTLE. The Langevin thermostat splits the drift in two halves around
+ * the friction and noise (BAOAB, Leimkuhler and Matthews, J. Chem. Phys. 138, 174102 (2013)).
+ */
+static void verletStep(System* system, Dynamics* md) {
+  const int n3 = system->nAtoms*3;
+  const REAL dt = md->dt;
+  const REAL halfDt = 0.5*md->dt;
+  REAL* X = system->X;
+  REAL* V = system->V;
+  REAL* A = system->A;
+  const REAL* F = system->F;
+  const REAL* invMass = md->invMass;
+  TIMER_START(TIMER_INTEGRATE);
+  if(md->constraints != NULL) {
+    memcpy(md->constraints->XRef, X, sizeof(REAL)*n3);
+  }
+  if(system->thermostat == LANGEVIN) {
+#pragma omp parallel for simd schedule(static)
+    for(int a = 0; a < n3; a++) {
+      V[a] += halfDt*A[a];
+      X[a] += halfDt*V[a];
+    }
+    TIMER_STOP(TIMER_INTEGRATE); // The O step is thermostat time
+    langevinVelocities(system, md, dt, STREAM_LANGEVIN);
+    TIMER_START(TIMER_INTEGRATE);
+#pragma omp parallel for simd schedule(static)
+    for(int a = 0; a < n3; a++) {
+      X[a] += halfDt*V[a];
+    }
+  } else {
+#pragma omp parallel for simd schedule(static)
+    for(int a = 0; a < n3; a++) {
+      V[a] += halfDt*A[a];
+      X[a] += dt*V[a];
+    }
+  }
+  TIMER_STOP(TIMER_INTEGRATE);
+  if(md->constraints != NULL) {
+    constrainDrift(system, md, dt);
+  }
+  if(updateVerlet(system)) {
+    md->nRebuilds++;
+  }
+  md->potentialEnergy = potentialEnergy(system, md->potential);
+  TIMER_START(TIMER_INTEGRATE);
+#pragma omp parallel for simd schedule(static)
+  for(int a = 0; a < n3; a++) {
+    A[a] = KCAL_TO_ACCEL*invMass[a]*F[a];
+    V[a] += halfDt*A[a];
+  }
+  TIMER_STOP(TIMER_INTEGRATE);
+  if(md->constraints != NULL) {
+    constrainEnd(system, md);
+  }
+}
+
+/**
+ * One r-RESPA step (Tuckerman, Berne and Martyna, J. Chem. Phys. 97, 1990 (1992)): a half kick from the slow
+ * forces, nInner velocity Verlet steps of dt/nInner with the fast forces only, then the slow forces at the new
+ * positions and their second half kick. System->A holds the total acceleration afterwards. With constraints every
+ * inner drift is followed by SHAKE, and RATTLE ends the step. The Langevin thermostat acts for dt/2 before and
+ * after the whole step.
+ */
+static void respaStep(System* system, Dynamics* md) {
+  const int n3 = system->nAtoms*3;
+  const REAL dtInner = md->dt/md->nInner;
+  REAL* X = system->X;
+  REAL* V = system->V;
+  REAL* A = system->A;
+  const REAL* invMass = md->invMass;
+  if(system->thermostat == LANGEVIN) {
+    langevinVelocities(system, md, 0.5*md->dt, STREAM_LANGEVIN);
+    if(md->constraints != NULL) {
+      constrainEnd(system, md);
+    }
+  }
+  kick(V, md->slowF, invMass, 0.5*md->dt, n3);
+  for(int j = 0; j < md->nInner; j++) {
+    kick(V, md->fastF, invMass, 0.5*dtInner, n3);
+    if(md->constraints != NULL) {
+      memcpy(md->constraints->XRef, X, sizeof(REAL)*n3);
+    }
+    TIMER_START(TIMER_INTEGRATE);
+#pragma omp parallel for simd schedule(static)
+    for(int a = 0; a < n3; a++) {
+      X[a] += dtInner*V[a];
+    }
+    TIMER_STOP(TIMER_INTEGRATE);
+    if(md->constraints != NULL) {
+      constrainDrift(system, md, dtInner);
+    }
+    if(updateVerlet(system)) {
+      md->nRebuilds++;
+    }
+    md->fastEnergy = potentialLevel(system, md->potential, FORCE_FAST, md->fastF);
+    kick(V, md->fastF, invMass, 0.5*dtInner, n3);
+  }
+  md->slowEnergy = potentialLevel(system, md->potential, FORCE_SLOW, md->slowF);
+  const REAL* fastF = md->fastF;
+  const REAL* slowF = md->slowF;
+  const REAL halfDt = 0.5*md->dt;
+  TIMER_START(TIMER_INTEGRATE);
+#pragma omp parallel for simd schedule(static)
+  for(int a = 0; a < n3; a++) {
+    V[a] += halfDt*KCAL_TO_ACCEL*invMass[a]*slowF[a];
+    A[a] = KCAL_TO_ACCEL*invMass[a]*(fastF[a] + slowF[a]);
+  }
+  TIMER_STOP(TIMER_INTEGRATE);
+  md->potentialEnergy = md->fastEnergy + md->slowEnergy;
+  if(system->thermostat == LANGEVIN) {
+    langevinVelocities(system, md, 0.5*md->dt, STREAM_LANGEVIN_END);
+  }
+  if(md->constraints != NULL) {
+    constrainEnd(system, md);
+  }
+}
+
+/**
+ * Takes the given number of steps of System->integrator, printing thermodynamics every System->printThermoEvery
+ * steps.
+ */
+void dynamicsRun(System* system, Dynamics* md, long steps) {
+  long every = system->printThermoEvery;
+  if(every > 0 && md->step == 0) {
+    printf("\n %10s %12s %16s %16s %16s %10s %12s\n", "Step", "Time (ps)", "Kinetic", "Potential", "Total",
+           "Temp (K)", "ns/day");
+  }
+  TIMER_START(TIMER_DYNAMICS);
+  reportPhases(md, false);
+  for(long s = 0; s < steps; s++) {
+    if(system->integrator == RESPA) {
+      respaStep(system, md);
+    } else {
+      verletStep(system, md);
+    }
+    if(system->thermostat == BUSSI) {
+      bussiRescale(system, md);
+    }
+    md->step++;
+    md->reportSteps++;
+    COUNTER_ADD(COUNTER_STEPS, 1);
+    if(md->mbar != NULL && md->step % system->printMBAREvery == 0) {
+      TIMER_START(TIMER_OUTPUT);
+      mbarSample(system, md);
+      TIMER_STOP(TIMER_OUTPUT);
+    }
+    if(md->barostat != NULL && md->step % system->volumeTrial == 0) {
+      monteCarloVolume(system, md);
+    }
+    if(every > 0 && md->step % every == 0) {
+      TIMER_START(TIMER_OUTPUT);
+      reportPhases(md, true);
+      thermoReport(system, md);
+      TIMER_STOP(TIMER_OUTPUT);
+    }
+  }
+  reportPhases(md, true);
+  TIMER_STOP(TIMER_DYNAMICS);
+  kineticEnergy(system, md);
+}
+
+/**
+ * Dynamics command: NVE, NVT or NPT dynamics for System->steps steps from Maxwell-Boltzmann velocities at
+ * System->temperature.
+ * @return potential energy (kcal/mol) of the last step
+ */
+REAL dynamics(System* system) {
+  if(system->randomSeed == 0) {
+    system->randomSeed = (unsigned long long) time(NULL);
+  }
+  printf("Random seed %llu\n", system->randomSeed);
+  assignMasses(system);
+  if(system->hydrogenMass > 0.0) {
+    REAL before = 0.0, after = 0.0;
+    for(int i = 0; i < system->nAtoms; i++) {
+      before += system->M[i];
+    }
+    int nSkipped;
+    int nChanged = repartitionMasses(system, system->hydrogenMass, &nSkipped);
+    REAL lightest = INFINITY;
+    for(int i = 0; i < system->nAtoms; i++) {
+      after += system->M[i];
+      if(system->protons[i] != 1) {
+        lightest = fmin(lightest, system->M[i]);
+      }
+    }
+    printf("Repartitioned mass to %d hydrogens of %.3f amu: total mass %.6f amu before, %.6f after, lightest heavy "
+           "atom %.3f amu, %d rigid waters skipped\n", nChanged, system->hydrogenMass, before, after, lightest,
+           nSkipped);
+  }
+  initVelocities(system, system->temperature);
+  Dynamics* md = dynamicsCreate(system);
+  if(system->integrator == RESPA) {
+    printf("Running %ld steps of %.3f fs RESPA dynamics, %d fast force steps of %.3f fs\n", system->steps,
+           system->dtAtto*1e-3, md->nInner, system->dtInnerAtto*1e-3);
+  } else {
+    printf("Running %ld steps of %.3f fs velocity Verlet dynamics\n", system->steps, system->dtAtto*1e-3);
+  }
+  if(system->thermostat == LANGEVIN) {
+    printf("Langevin thermostat at %.2f K, friction %.3f/ps\n", system->temperature, system->friction);
+  } else if(system->thermostat == BUSSI) {
+    printf("Bussi thermostat at %.2f K, coupling time %.3f ps\n", system->temperature, system->tauTemperature);
+  }
+  if(md->barostat != NULL) {
+    printf("Monte Carlo barostat at %.3f atm, volume moves of %d molecules every %d steps\n", system->pressure,
+           md->barostat->nMolecules, system->volumeTrial);
+  }
+  if(md->mbar != NULL) {
+    printf("Writing the energies of %d lambda states every %ld steps, sampling lambda %.4f\n", system->nLambdaStates,
+           system->printMBAREvery, system->lambda);
+  }
+  if(md->constraints != NULL) {
+    printf("Constraining %d rigid waters and %d bonds to hydrogen\n", md->constraints->nWaters,
+           md->constraints->nBonds);
+  }
+  dynamicsRun(system, md, system->steps);
+  const REAL potential = md->potentialEnergy;
+  dynamicsDestroy(md);
+  return potential;
+}
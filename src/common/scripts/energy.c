@@ -0,0 +1,178 @@
+// Author(s): Matthew Speranza
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/energy.h"
+#include "../include/memoryTracker.h"
+#include "../include/timers.h"
+
+/**
+ * Sets System->lambdas to System->lambda for the lambda atoms and 1 for every other atom. Call again after changing
+ * System->lambda.
+ */
+void assignLambdas(System* system) {
+  if(system->lambda < 0.0 || system->lambda > 1.0) {
+    printf("Lambda must be between 0 and 1, not %f!\n", system->lambda);
+    exit(1);
+  }
+  if(system->lambdas == NULL) {
+    system->lambdas = memoryMalloc(sizeof(REAL)*system->nAtoms, MEMORY_STRUCTURE);
+  }
+  for(int i = 0; i < system->nAtoms; i++) {
+    system->lambdas[i] = 1.0;
+  }
+  for(int l = 0; l < system->nActiveLambdas; l++) {
+    int i = system->activeLambdas[l];
+    if(i < 0 || i >= system->nAtoms) {
+      printf("Lambda atom %d is not in the system!\n", i+1);
+      exit(1);
+    }
+    system->lambdas[i] = system->lambda;
+  }
+}
+
+/**
+ * Allocates every term of the potential for the System's force field. The Verlet lists must already exist.
+ */
+Potential* potentialCreate(System* system) {
+  TIMER_START(TIMER_SETUP);
+  const int n3 = system->nAtoms*3;
+  Potential* pot = calloc(1, sizeof(Potential));
+  if(pot == NULL) {
+    printf("Failed to allocate potential!\n");
+    exit(1);
+  }
+  if(system->nLambdaStates > 0 && system->nActiveLambdas == 0) {
+    printf("Lambda states need lambda atoms!\n");
+    exit(1);
+  }
+  if(system->nActiveLambdas > 0) {
+    if(system->polarization != NONE) {
+      printf("Lambda atoms are not implemented with polarization yet, set polarization to none!\n");
+      exit(1);
+    }
+    assignLambdas(system);
+  }
+  pot->frames = multipoleFramesCreate(system);
+  pot->direct = directWorkspaceCreate(system);
+  if(system->nLambdaStates > 0) {
+    directWorkspaceStates(pot->direct, system->nLambdaStates, system->lambdaStates);
+    pot->stateEnergy = calloc(system->nLambdaStates, sizeof(REAL));
+    if(pot->stateEnergy == NULL) {
+      printf("Failed to allocate potential!\n");
+      exit(1);
+    }
+  }
+  pot->direct->switchStart = system->respaCutoff - system->respaSwitch;
+  pot->direct->switchEnd = system->respaCutoff;
+  if(system->polarization != NONE) {
+    pot->induced = inducedDipolesCreate(system);
+  }
+  pot->grad = calloc(n3, sizeof(REAL));
+  pot->torque = calloc(n3, sizeof(REAL));
+  if(system->F == NULL) {
+    system->F = memoryCalloc(n3, sizeof(REAL), MEMORY_STRUCTURE);
+  }
+  if(pot->grad == NULL || pot->torque == NULL || system->F == NULL) {
+    printf("Failed to allocate potential!\n");
+    exit(1);
+  }
+  TIMER_STOP(TIMER_SETUP);
+  return pot;
+}
+
+void potentialDestroy(Potential* pot) {
+  if(pot->induced != NULL) {
+    inducedDipolesDestroy(pot->induced);
+  }
+  directWorkspaceDestroy(pot->direct);
+  multipoleFramesDestroy(pot->frames);
+  free(pot->grad);
+  free(pot->torque);
+  free(pot->stateEnergy);
+  free(pot);
+}
+
+/**
+ * Evaluates the potential at the current positions and writes the forces -dE/dx into System->F.
+ * @return total potential energy (kcal/mol)
+ */
+REAL potentialEnergy(System* system, Potential* pot) {
+  return potentialLevel(system, pot, FORCE_ALL, system->F);
+}
+
+/**
+ * Evaluates the terms of one force level at the current positions and writes their forces -dE/dx into force
+ * [nAtoms*3]. The fast and slow levels add up to FORCE_ALL.
+ * @return potential energy of the level (kcal/mol)
+ */
+REAL potentialLevel(System* system, Potential* pot, enum ForceLevel level, REAL* force) {
+  const enum RealSpacePart parts[3] = {REAL_SPACE_ALL, REAL_SPACE_NEAR, REAL_SPACE_FAR};
+  const int n3 = system->nAtoms*3;
+  TIMER_START(TIMER_FORCE);
+  TIMER_START(TIMER_ROTATE);
+  rotateMultipoles(system, pot->frames);
+  TIMER_ITEMS(system->nAtoms);
+  TIMER_STOP(TIMER_ROTATE);
+  TIMER_START(TIMER_REAL_SPACE);
+  memset(pot->grad, 0, sizeof(REAL)*n3);
+  memset(pot->torque, 0, sizeof(REAL)*n3);
+  memset(pot->virial, 0, sizeof(pot->virial));
+  pot->direct->part = parts[level];
+  pot->realSpace = multipoleRealSpace(system, pot->direct, pot->grad, pot->torque, pot->virial);
+  pot->direct->part = REAL_SPACE_ALL;
+  pot->self = level != FORCE_FAST ? multipoleSelfEnergy(system) : 0.0;
+  if(level == FORCE_ALL && pot->stateEnergy != NULL) {
+    multipoleSelfStates(system, system->nLambdaStates, system->lambdaStates, pot->stateEnergy);
+    for(int s = 0; s < system->nLambdaStates; s++) {
+      pot->stateEnergy[s] += pot->direct->stateEnergy[s];
+    }
+  }
+  TIMER_STOP(TIMER_REAL_SPACE);
+  pot->polarization = 0.0;
+  if(pot->induced != NULL && level != FORCE_FAST) {
+    TIMER_START(TIMER_POLARIZE);
+    pot->polarization = induceDipoles(system, pot->induced, pot->direct);
+    COUNTER_ADD(COUNTER_POLARIZATION_ITERATIONS, pot->induced->iterations);
+    TIMER_STOP(TIMER_POLARIZE);
+  }
+  TIMER_START(TIMER_TORQUE);
+  torqueToGradient(system, pot->frames, pot->torque, pot->grad, pot->virial);
+  const REAL* restrict grad = pot->grad;
+#pragma omp simd
+  for(int a = 0; a < n3; a++) {
+    force[a] = -grad[a];
+  }
+  TIMER_ITEMS(system->nAtoms);
+  TIMER_STOP(TIMER_TORQUE);
+  TIMER_STOP(TIMER_FORCE);
+  COUNTER_ADD(COUNTER_FORCE_EVALUATIONS, 1);
+  pot->total = pot->realSpace + pot->self + pot->polarization;
+  return pot->total;
+}
+
+/**
+ * Energy command: prints each term of the potential at the input coordinates.
+ * @return total potential energy (kcal/mol)
+ */
+REAL energy(System* system) {
+  Potential* pot = potentialCreate(system);
+  potentialEnergy(system, pot);
+  printf("\n Energy Component          kcal/mol\n");
+  printf(" Multipole (real space)  %16.8f\n", pot->realSpace);
+  printf(" Multipole (self)        %16.8f\n", pot->self);
+  if(pot->induced != NULL) {
+    printf(" Polarization            %16.8f\n", pot->polarization);
+  }
+  printf(" Total Potential         %16.8f\n", pot->total);
+  if(system->nActiveLambdas > 0) {
+    printf("\n %d lambda atoms at lambda %.4f\n", system->nActiveLambdas, system->lambda);
+  }
+  for(int s = 0; s < system->nLambdaStates; s++) {
+    printf(" Lambda %8.4f          %16.8f\n", system->lambdaStates[s], pot->stateEnergy[s]);
+  }
+  const REAL total = pot->total;
+  potentialDestroy(pot);
+  return total;
+}
@@ -0,0 +1,294 @@
+// Author(s): Matthew Speranza
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../include/replicaExchange.h"
+#include "../include/commandInterpreter.h"
+#include "../include/philox.h"
+#include "../include/timers.h"
+
+static const char* ladderNames[3] = {"none", "temperature", "lambda"};
+
+/**
+ * Puts a replica at a slot of the ladder: its thermostat temperature or lambda becomes the slot's.
+ */
+static void moveToSlot(ReplicaExchange* rex, Replica* replica, int slot) {
+  replica->slot = slot;
+  rex->slots[slot] = replica;
+  if(rex->ladder == TEMPERATURE_LADDER) {
+    replica->system->temperature = rex->values[slot];
+  } else {
+    replica->system->lambda = rex->values[slot];
+  }
+}
+
+static void checkLadder(System* system) {
+  if(system->replicaLadder == NO_LADDER || system->nReplicas < 2) {
+    printf("Replica exchange needs replica-temperatures or replica-lambdas with at least two values!\n");
+    exit(1);
+  }
+  for(int s = 0; s < system->nReplicas; s++) {
+    const REAL value = system->replicaValues[s];
+    if(system->replicaLadder == TEMPERATURE_LADDER ? value <= 0.0 : value < 0.0 || value > 1.0) {
+      printf("Replica %d has %s %f, out of range!\n", s + 1, ladderNames[system->replicaLadder], value);
+      exit(1);
+    }
+  }
+  if(system->exchangeEvery < 1) {
+    printf("exchange-every must be at least 1, not %ld!\n", system->exchangeEvery);
+    exit(1);
+  }
+  if(system->thermostat == NO_THERMOSTAT) {
+    printf("Replica exchange needs a thermostat!\n");
+    exit(1);
+  }
+  if(system->barostat != NO_BAROSTAT || system->printMBAREvery > 0) {
+    printf("Replica exchange doesn't support the barostat or printMBAREvery yet!\n");
+    exit(1);
+  }
+  if(system->replicaLadder == LAMBDA_LADDER && (system->nActiveLambdas == 0 || system->integrator != VERLET)) {
+    printf("Lambda replica exchange needs lambda-atoms and the verlet integrator!\n");
+    exit(1);
+  }
+}
+
+/**
+ * Lets each replica's team nest inside the team over replicas when it has more than one thread.
+ * @return the previous max active levels, for restoreActiveLevels
+ */
+static int nestReplicaTeams(int threadsPerReplica) {
+#ifdef _OPENMP
+  const int maxActiveLevels = omp_get_max_active_levels();
+  if(threadsPerReplica > 1) {
+    omp_set_max_active_levels(2);
+  }
+  return maxActiveLevels;
+#else
+  (void) threadsPerReplica;
+  return 1;
+#endif
+}
+
+static void restoreActiveLevels(int maxActiveLevels) {
+#ifdef _OPENMP
+  omp_set_max_active_levels(maxActiveLevels);
+#else
+  (void) maxActiveLevels;
+#endif
+}
+
+/**
+ * Replicas of a system read with its bonded lists, each placed at the slot of its index with Maxwell-Boltzmann
+ * velocities at the slot's temperature (or System->temperature) and its forces evaluated.
+ * @param threadsPerReplica OpenMP threads each replica runs with
+ */
+ReplicaExchange* replicaExchangeCreate(System* system, int threadsPerReplica) {
+  checkLadder(system);
+#ifdef _OPENMP
+  const int maxThreads = omp_get_max_threads();
+#else
+  const int maxThreads = 1;
+#endif
+  if(threadsPerReplica < 1 || threadsPerReplica > maxThreads) {
+    printf("Threads per replica must be from 1 to %d, not %d!\n", maxThreads, threadsPerReplica);
+    exit(1);
+  }
+  if(system->randomSeed == 0) {
+    system->randomSeed = (unsigned long long) time(NULL);
+  }
+  assignMasses(system);
+  if(system->hydrogenMass > 0.0) {
+    int nSkipped;
+    repartitionMasses(system, system->hydrogenMass, &nSkipped);
+  }
+  const int n = system->nReplicas;
+  if(system->replicaLadder == LAMBDA_LADDER) {
+    // Every evaluation sums the energy at each window, the exchanges need the neighbors'
+    memoryFree(system->lambdaStates, MEMORY_STRUCTURE);
+    system->lambdaStates = memoryMalloc(sizeof(REAL)*n, MEMORY_STRUCTURE);
+    for(int s = 0; s < n; s++) {
+      system->lambdaStates[s] = system->replicaValues[s];
+    }
+    system->nLambdaStates = n;
+  }
+  ReplicaExchange* rex = calloc(1, sizeof(ReplicaExchange));
+  if(rex == NULL) {
+    printf("Failed to allocate replica exchange!\n");
+    exit(1);
+  }
+  rex->topology = system;
+  rex->ladder = system->replicaLadder;
+  rex->nReplicas = n;
+  rex->values = system->replicaValues;
+  rex->exchangeEvery = system->exchangeEvery;
+  rex->threadsPerReplica = threadsPerReplica;
+  rex->concurrent = maxThreads/threadsPerReplica < n ? maxThreads/threadsPerReplica : n;
+  rex->replicas = calloc(n, sizeof(Replica));
+  rex->slots = calloc(n, sizeof(Replica*));
+  rex->attempts = calloc(n - 1, sizeof(long));
+  rex->accepted = calloc(n - 1, sizeof(long));
+  if(rex->replicas == NULL || rex->slots == NULL || rex->attempts == NULL || rex->accepted == NULL) {
+    printf("Failed to allocate replica exchange!\n");
+    exit(1);
+  }
+  for(int r = 0; r < n; r++) {
+    Replica* replica = &rex->replicas[r];
+    replica->system = systemReplica(system);
+    replica->system->randomSeed = system->randomSeed + r;
+    replica->system->nThreads = threadsPerReplica;
+    moveToSlot(rex, replica, r);
+    initVelocities(replica->system, replica->system->temperature);
+  }
+  // Workspaces are sized for the threads of the team that creates them
+  const int maxActiveLevels = nestReplicaTeams(threadsPerReplica);
+#pragma omp parallel for schedule(dynamic, 1) num_threads(rex->concurrent)
+  for(int r = 0; r < n; r++) {
+#ifdef _OPENMP
+    omp_set_num_threads(threadsPerReplica);
+#endif
+    rex->replicas[r].md = dynamicsCreate(rex->replicas[r].system);
+  }
+  restoreActiveLevels(maxActiveLevels);
+  return rex;
+}
+
+/**
+ * Exchange attempts between the even (or, every other round, odd) neighboring slots.
+ */
+static void attemptExchanges(ReplicaExchange* rex) {
+  const int first = rex->rounds % 2;
+  for(int s = first; s + 1 < rex->nReplicas; s += 2) {
+    Replica* a = rex->slots[s];
+    Replica* b = rex->slots[s + 1];
+    REAL delta;
+    if(rex->ladder == TEMPERATURE_LADDER) {
+      const REAL betaA = 1.0/(BOLTZMANN*rex->values[s]), betaB = 1.0/(BOLTZMANN*rex->values[s + 1]);
+      delta = (betaA - betaB)*(a->md->potentialEnergy - b->md->potentialEnergy);
+    } else {
+      const REAL* uA = a->md->potential->stateEnergy;
+      const REAL* uB = b->md->potential->stateEnergy;
+      delta = -(uA[s + 1] + uB[s] - uA[s] - uB[s + 1])/(BOLTZMANN*rex->topology->temperature);
+    }
+    REAL u[4];
+    philoxUniforms(rex->topology->randomSeed, STREAM_EXCHANGE, rex->rounds, s, u);
+    rex->attempts[s]++;
+    if(delta < 0.0 && u[0] >= exp(delta)) {
+      continue;
+    }
+    rex->accepted[s]++;
+    moveToSlot(rex, a, s + 1);
+    moveToSlot(rex, b, s);
+    if(rex->ladder == TEMPERATURE_LADDER) {
+      const REAL scale = sqrt(rex->values[s + 1]/rex->values[s]);
+      REAL* VA = a->system->V;
+      REAL* VB = b->system->V;
+      for(int i = 0; i < a->system->nAtoms*3; i++) {
+        VA[i] *= scale;
+        VB[i] /= scale;
+      }
+    } else {
+      assignLambdas(a->system);
+      assignLambdas(b->system);
+      a->refresh = b->refresh = true;
+    }
+  }
+  rex->rounds++;
+}
+
+/**
+ * Advances every replica by steps, attempting exchanges after each System->exchangeEvery of them.
+ */
+void replicaExchangeRun(ReplicaExchange* rex, long steps) {
+  const int threadsPerReplica = rex->threadsPerReplica;
+  const int maxActiveLevels = nestReplicaTeams(threadsPerReplica);
+  for(long done = 0; done < steps; ) {
+    const long round = steps - done < rex->exchangeEvery ? steps - done : rex->exchangeEvery;
+    double start = timerNow();
+#pragma omp parallel for schedule(dynamic, 1) num_threads(rex->concurrent)
+    for(int r = 0; r < rex->nReplicas; r++) {
+      Replica* replica = &rex->replicas[r];
+#ifdef _OPENMP
+      omp_set_num_threads(threadsPerReplica);
+#endif
+      if(replica->refresh) {
+        const double refreshStart = timerNow();
+        dynamicsRefresh(replica->system, replica->md);
+        replica->refresh = false;
+        const double seconds = timerNow() - refreshStart;
+#pragma omp atomic
+        rex->tRefresh += seconds;
+      }
+      dynamicsRun(replica->system, replica->md, round);
+    }
+    rex->tDynamics += timerNow() - start;
+    done += round;
+    rex->steps += round;
+    if(round == rex->exchangeEvery) {
+      start = timerNow();
+      attemptExchanges(rex);
+      rex->tExchange += timerNow() - start;
+    }
+  }
+  restoreActiveLevels(maxActiveLevels);
+}
+
+/**
+ * The ladder with the replica at each slot and the acceptance of exchanges with the next slot, then throughput.
+ */
+void replicaExchangePrint(ReplicaExchange* rex) {
+  printf("\n %6s %12s %8s %16s %12s\n", "Slot", rex->ladder == TEMPERATURE_LADDER ? "Temp (K)" : "Lambda", "Replica",
+         "Potential", "Accepted");
+  for(int s = 0; s < rex->nReplicas; s++) {
+    const Replica* replica = rex->slots[s];
+    printf(" %6d %12.4f %8d %16.6f", s + 1, rex->values[s], (int) (replica - rex->replicas) + 1,
+           replica->md->potentialEnergy);
+    if(s + 1 < rex->nReplicas) {
+      printf(" %11.1f%% of %ld", rex->attempts[s] > 0 ? 100.0*rex->accepted[s]/rex->attempts[s] : 0.0,
+             rex->attempts[s]);
+    }
+    printf("\n");
+  }
+  const double dt = rex->replicas[0].md->dt;
+  const double total = rex->tDynamics + rex->tExchange;
+  const double nsPerDay = total > 0.0 ? rex->steps*dt/total*86400.0 : 0.0;
+  printf("\n %ld steps of %d replicas, %d at a time with %d threads each, in %.4f s: %.3f ns/day per replica, %.3f "
+         "ns/day in total\n", rex->steps, rex->nReplicas, rex->concurrent, rex->threadsPerReplica, total, nsPerDay,
+         nsPerDay*rex->nReplicas);
+  printf(" %ld exchange rounds took %.4f s (%.3f%% of the run)", rex->rounds, rex->tExchange,
+         total > 0.0 ? 100.0*rex->tExchange/total : 0.0);
+  if(rex->ladder == LAMBDA_LADDER) {
+    printf(", force evaluations after lambda swaps %.4f s", rex->tRefresh);
+  }
+  printf("\n");
+}
+
+void replicaExchangeDestroy(ReplicaExchange* rex) {
+  for(int r = 0; r < rex->nReplicas; r++) {
+    dynamicsDestroy(rex->replicas[r].md);
+    systemDestroy(rex->replicas[r].system);
+  }
+  free(rex->replicas);
+  free(rex->slots);
+  free(rex->attempts);
+  free(rex->accepted);
+  free(rex);
+}
+
+/**
+ * Replica command: System->steps steps of replica exchange dynamics over the key file's ladder.
+ * @param system read with its bonded lists, owns what the replicas share
+ */
+void replicaExchange(System* system, int threadsPerReplica) {
+  ReplicaExchange* rex = replicaExchangeCreate(system, threadsPerReplica);
+  printf("Random seed %llu\n", system->randomSeed);
+  printf("Running %ld steps of %d replicas over a %s ladder, exchanges every %ld steps\n", system->steps,
+         rex->nReplicas, ladderNames[rex->ladder], rex->exchangeEvery);
+  replicaExchangeRun(rex, system->steps);
+  replicaExchangePrint(rex);
+  replicaExchangeDestroy(rex);
+}
@@ -4,5 +4,11 @@
 
 // Try not to include anythin in this file
 typedef double REAL;
+// Pair kernel arithmetic, single precision when built with -DMIXED_PRECISION=ON (accumulators stay REAL)
+#ifdef MIXED_PRECISION
+typedef float PREAL;
+#else
+typedef double PREAL;
+#endif
 
 #endif //DEFINES_H
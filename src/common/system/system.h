@@ -5,6 +5,7 @@
 #include <forceFieldReader.h>
 #include <stdbool.h>
 #include <vector.h>
+#include <typedVector.h>
 
 #include "defines.h"
 
@@ -13,6 +14,11 @@
  * Pointer to the system struct is passed essentially everywhere.
  */
 enum Polarization {NONE, DIRECT, MUTUAL};
+enum Integrator {VERLET, RESPA};
+enum ConstraintType {NO_CONSTRAINTS, RIGID_WATER, HBONDS};
+enum Thermostat {NO_THERMOSTAT, LANGEVIN, BUSSI};
+enum BarostatType {NO_BAROSTAT, MONTE_CARLO};
+enum ReplicaLadder {NO_LADDER, TEMPERATURE_LADDER, LAMBDA_LADDER};
 typedef struct System {
  // Molecular System
  int nAtoms;
@@ -23,10 +29,14 @@ typedef struct System {
  REAL temperature; // Kelvin
  REAL** multipoles; // Force field definitions of multipolar charge distribution [nAtoms][cartesian multipole d.o.f. - 10 for now]
  int* atomTypes; // Atom forcefield type
- Vector* list12; // Indices in X of atoms every atom is bonded to vector of ints --> 1-2 lists
- Vector* list13; // Indices in X of atoms every atom is 1-3 bonded to vector of ints
- Vector* list14; // Indices in X of atoms every atom is 1-4 bonded to vector of ints
- Vector* verletList; // Indices in X of atoms within cutoff+buffer distance
+ IntVector* list12; // Indices in X of atoms every atom is bonded to --> 1-2 lists
+ IntVector* list13; // Indices in X of atoms every atom is 1-3 bonded to
+ IntVector* list14; // Indices in X of atoms every atom is 1-4 bonded to
+ struct Arena* arena; // Topology read from the structure file: atom names, 1-2 lists, remark (arena.h)
+ struct Arena* bondedArena; // 1-3 and 1-4 lists, owned by buildBonded
+ IntVector* verletList; // Indices in X of atoms within cutoff+buffer distance
+ int* verletPlain; // Leading neighbors in each Verlet list without a lambda atom, the rest are perturbed pairs [nAtoms]
+ struct VerletCells* verletCells; // Cell grid and positions of the last Verlet list build (neighborList.h)
  REAL boxDim[3][3]; // Box axis definitions (ATM) [A,B,C][x,y,z]
  REAL minDim[3]; // Minimum box dimensions (ANG) [x,y,z]
  char** atomNames; // Atom periodic table name [nAtoms][name]
@@ -41,6 +51,20 @@ typedef struct System {
  long printThermoEvery; // Print energy information
  long printRestartEvery; // Print restart *.dyn
  long printArchiveEvery; // Print snap into *.arc
+ long printMBAREvery; // Write the reduced energies of the lambda states into *.mbar, 0 is off
+ enum Integrator integrator; // Dynamics integrator
+ int dtInnerAtto; // RESPA inner timestep for the fast forces (attoseconds), must divide dtAtto
+ REAL respaCutoff; // RESPA real space pairs beyond this are all slow forces (ANG)
+ REAL respaSwitch; // Width of the switch from fast to slow real space pairs below respaCutoff (ANG)
+ enum ConstraintType constraints; // Bonds held rigid during dynamics (constraints.h)
+ REAL hydrogenMass; // Hydrogen mass after repartitioning from bonded heavy atoms (amu), 0 keeps force field masses
+ enum Thermostat thermostat; // Holds the temperature during dynamics, NVE without
+ REAL friction; // Langevin friction (1/ps)
+ REAL tauTemperature; // Bussi coupling time (ps)
+ enum BarostatType barostat; // Holds the pressure during dynamics, NVT/NVE without
+ int volumeTrial; // Steps between Monte Carlo volume moves
+ REAL volumeMove; // Largest Monte Carlo volume change (ANG^3), adapted to the acceptance during dynamics
+ unsigned long long randomSeed; // Key of the counter-based random numbers (philox.h), 0 picks one from the clock
  REAL ewaldAlpha; // Gaussian parameter
  REAL ewaldBeta; // Gaussian parameter
  REAL ewaldOrder; // Order of b-splines
@@ -49,8 +73,12 @@ typedef struct System {
  REAL* pmeGridFlat; // Grid of splined multipoles [nX*nY*nZ]
  REAL realspaceCutoff; // Neighborlist cutoff in angstroms
  REAL realspaceBuffer; // Addtion to cutoff to buffer neighborlist builds
+ REAL mpoleScale[3]; // Scale factors for 1-2, 1-3, 1-4 permanent multipole interactions
  ForceField* forceField; // Force field definitions
+ ForceFieldCache* forceFieldCache; // Force fields shared between systems (batch.h), NULL if forceField is owned
  enum Polarization polarization; // Polarization for amoeba
+ REAL polarEps; // Induced dipole convergence, RMS dipole change (Debye)
+ int polarPredict; // Previous induced dipole solutions used to predict the next guess
 
  // Integeration Variables
  int nDOF; // nAtoms + nActiveLambdas;
@@ -60,8 +88,8 @@ typedef struct System {
  REAL* M; // Atomic masses [nAtoms]
  REAL* V; // Interleaved atomic velocity (ANG/ns) (Vx, Vy, Vz) [nAtoms*3]
  REAL* A; // Interleaved atomic accelerations (ANG/ns^2) (Ax, Ay, Az) [nAtoms*3]
- REAL* F; // Interleaved atomic forces (Fx,Fy,Fz) (kcal/mol/ANG) [nThread][nAtoms*3]
- REAL* lambdas; // Atom lambdas between 0-1 [nAtoms]
+ REAL* F; // Interleaved atomic forces (Fx,Fy,Fz) (kcal/mol/ANG) [nAtoms*3], threads accumulate in ThreadBuffers
+ REAL* lambdas; // Atom lambdas between 0-1, 1 outside the active lambda atoms [nAtoms]
  REAL* thetas; // Atom thetas - converted into lambda 0-1 [nLambdaVariables]
  REAL* thetaM; // Theta masses
  REAL* thetaV; // Atom theta velocities
@@ -69,6 +97,18 @@ typedef struct System {
  REAL* thetaF; // Force on theta
  int* activeLambdas; // which atom index have important lambda values (-1 if all)
  int nActiveLambdas; // Length of previous array
+ REAL lambda; // Alchemical state of the active lambda atoms, their multipoles are scaled by it (0 decoupled, 1 on)
+ REAL* lambdaStates; // Lambda values whose energies every evaluation also sums, e.g. for MBAR [nLambdaStates]
+ int nLambdaStates;
+ enum ReplicaLadder replicaLadder; // What the replica exchange command's replicas differ in
+ REAL* replicaValues; // Temperature (K) or lambda of each replica [nReplicas]
+ int nReplicas;
+ long exchangeEvery; // Steps between replica exchange attempts
+ const struct System* topology; // System whose topology, masses and force field this replica borrows, NULL if owned
+ // Timer output of the whole run (timers.h), only applied by the commands that run a single key file
+ char* timerJSON; // NULL for none
+ char* traceJSON; // NULL for none
+ bool perfCounters;
 
  // Computer definitions
  bool verbose;
@@ -0,0 +1,228 @@
+// Author(s): Matthew Speranza
+#include "../include/arena.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+#define ARENA_ROUND(bytes) (((bytes) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+#define ARENA_HEADER ARENA_ROUND(sizeof(ArenaBlock))
+
+static ArenaBlock* blockCreate(size_t size, enum MemoryTag tag) {
+  ArenaBlock* block = memoryMalloc(ARENA_HEADER + size, tag);
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+/**
+ * @param blockSize bytes per block, the arena only mallocs once something is allocated from it
+ * @param tag what the blocks are counted as
+ */
+Arena* arenaCreate(size_t blockSize, enum MemoryTag tag) {
+  Arena* arena = memoryMalloc(sizeof(Arena), tag);
+  arena->first = NULL;
+  arena->current = NULL;
+  arena->blockSize = ARENA_ROUND(blockSize > 0 ? blockSize : 1);
+  arena->tag = tag;
+  arena->allocations = 0;
+  return arena;
+}
+
+/**
+ * Takes the next aligned bytes of the current block, moving on to the next (kept by a reset) or a new block when
+ * they don't fit.
+ */
+void* arenaAlloc(Arena* arena, size_t bytes) {
+  assert(arena != NULL);
+  const size_t need = ARENA_ROUND(bytes > 0 ? bytes : 1);
+  ArenaBlock* block = arena->current;
+  while(block != NULL && block->size - block->used < need) {
+    if(block->next == NULL) {
+      block = NULL;
+      break;
+    }
+    block = block->next;
+  }
+  if(block == NULL) {
+    block = blockCreate(need > arena->blockSize ? need : arena->blockSize, arena->tag);
+    if(arena->current == NULL) {
+      arena->first = block;
+    } else {
+      // Keep the blocks the reset freed up behind the new one
+      ArenaBlock* last = arena->current;
+      while(last->next != NULL) {
+        last = last->next;
+      }
+      last->next = block;
+    }
+  }
+  arena->current = block;
+  void* piece = (char*) block + ARENA_HEADER + block->used;
+  block->used += need;
+  arena->allocations++;
+  return piece;
+}
+
+void* arenaCalloc(Arena* arena, size_t n, size_t bytes) {
+  if(bytes > 0 && n > SIZE_MAX/bytes) {
+    printf("Arena allocation of %zu x %zu bytes overflows!\n", n, bytes);
+    exit(1);
+  }
+  void* piece = arenaAlloc(arena, n*bytes);
+  memset(piece, 0, n*bytes);
+  return piece;
+}
+
+char* arenaStrdup(Arena* arena, const char* str) {
+  const size_t length = strlen(str) + 1;
+  char* copy = arenaAlloc(arena, length);
+  memcpy(copy, str, length);
+  return copy;
+}
+
+/**
+ * Empty vector with room for capacity elements in the arena, returned by value.
+ */
+Vector arenaVector(Arena* arena, int bytesPerElement, int capacity, enum DataType dt) {
+  Vector vec;
+  vec.dataType = dt;
+  vec.bytesPerElement = bytesPerElement;
+  vec.bufSize = capacity > 0 ? capacity : 1;
+  vec.size = 0;
+  vec.array = arenaAlloc(arena, (size_t) vec.bufSize*bytesPerElement);
+  vec.callbackFree = NULL;
+  vec.memoryTag = arena->tag;
+  return vec;
+}
+
+/**
+ * Copy of vec whose array is exactly vec->size ints in the arena, returned by value like System->list12.
+ */
+IntVector arenaIntVectorCopy(Arena* arena, const IntVector* vec) {
+  IntVector copy;
+  copy.size = vec->size;
+  copy.capacity = vec->size;
+  copy.array = arenaAlloc(arena, sizeof(int)*(size_t) vec->size);
+  memcpy(copy.array, vec->array, sizeof(int)*(size_t) vec->size);
+  copy.memoryTag = arena->tag;
+  return copy;
+}
+
+/**
+ * Forgets every allocation but keeps the blocks for the next ones.
+ */
+void arenaReset(Arena* arena) {
+  assert(arena != NULL);
+  for(ArenaBlock* block = arena->first; block != NULL; block = block->next) {
+    block->used = 0;
+  }
+  arena->current = arena->first;
+  arena->allocations = 0;
+}
+
+void arenaDestroy(Arena* arena) {
+  if(arena == NULL) {
+    return;
+  }
+  ArenaBlock* block = arena->first;
+  while(block != NULL) {
+    ArenaBlock* next = block->next;
+    memoryFree(block, arena->tag);
+    block = next;
+  }
+  memoryFree(arena, arena->tag);
+}
+
+/**
+ * Bytes handed out (rounded up to the alignment).
+ */
+size_t arenaUsed(const Arena* arena) {
+  size_t used = 0;
+  for(ArenaBlock* block = arena->first; block != NULL; block = block->next) {
+    used += block->used;
+  }
+  return used;
+}
+
+/**
+ * Bytes of all blocks.
+ */
+size_t arenaReserved(const Arena* arena) {
+  size_t reserved = 0;
+  for(ArenaBlock* block = arena->first; block != NULL; block = block->next) {
+    reserved += block->size;
+  }
+  return reserved;
+}
+
+/////////////////////////////////////////// TESTS
+
+void arenaTest(bool verbose) {
+  const long long before = memoryCurrent(MEMORY_VECTORS);
+  Arena* arena = arenaCreate(4096, MEMORY_VECTORS);
+  assert(arenaReserved(arena) == 0);
+  // Pieces of odd sizes are aligned, don't overlap and spill into new blocks
+  const int n = 1000;
+  unsigned char* pieces[n];
+  for(int i = 0; i < n; i++) {
+    size_t size = 1 + i % 37;
+    pieces[i] = arenaAlloc(arena, size);
+    assert((uintptr_t) pieces[i] % ARENA_ALIGN == 0);
+    memset(pieces[i], i % 251, size);
+  }
+  for(int i = 0; i < n; i++) {
+    for(size_t b = 0; b < 1 + (size_t) i % 37; b++) {
+      assert(pieces[i][b] == i % 251);
+    }
+  }
+  assert(arenaReserved(arena) > 4096);
+  // A piece bigger than a block gets its own
+  double* big = arenaCalloc(arena, 10000, sizeof(double));
+  char* name = arenaStrdup(arena, "CA");
+  Vector tokens = arenaVector(arena, sizeof(int), 4, INT);
+  IntVector bonded;
+  intVectorInit(&bonded, 8, MEMORY_VECTORS);
+  for(int i = 0; i < 4; i++) {
+    vectorAppend(&tokens, &i);
+    intVectorPush(&bonded, i);
+  }
+  IntVector copy = arenaIntVectorCopy(arena, &bonded);
+  intVectorFree(&bonded);
+  bool ok = strcmp(name, "CA") == 0 && tokens.size == 4 && ((int*) tokens.array)[3] == 3;
+  ok = ok && copy.size == 4 && copy.capacity == 4 && copy.array[3] == 3;
+  for(int i = 0; i < 10000; i++) {
+    ok = ok && big[i] == 0.0;
+  }
+  if(!ok) {
+    printf("arenaTest: calloc, strdup or vectors came back wrong!\n");
+    exit(1);
+  }
+  // Reset reuses the blocks: the same allocations reserve nothing more
+  const size_t reserved = arenaReserved(arena);
+  for(int pass = 0; pass < 3; pass++) {
+    arenaReset(arena);
+    assert(arenaUsed(arena) == 0);
+    for(int i = 0; i < n; i++) {
+      arenaAlloc(arena, 1 + i % 37);
+    }
+    if(arenaReserved(arena) != reserved) {
+      printf("arenaTest: reset arena grew from %zu to %zu bytes!\n", reserved, arenaReserved(arena));
+      exit(1);
+    }
+  }
+  if(verbose) {
+    printf("Arena: %zu of %zu bytes used after %ld allocations\n", arenaUsed(arena), arenaReserved(arena),
+           arena->allocations);
+  }
+  arenaDestroy(arena);
+  if(memoryCurrent(MEMORY_VECTORS) != before) {
+    printf("arenaTest: destroying the arena left %lld bytes!\n", memoryCurrent(MEMORY_VECTORS) - before);
+    exit(1);
+  }
+  printf("All tests of arena.c passed!\n");
+}
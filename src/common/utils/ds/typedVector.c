@@ -0,0 +1,131 @@
+// Author(s): Matthew Speranza
+#include "../../include/typedVector.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../../include/vector.h"
+
+typedef struct TestRecord {
+  int type;
+  double values[12]; // About the size of a force field entry
+} TestRecord;
+
+TYPED_VECTOR(TestRecordVector, testRecordVector, TestRecord)
+
+static double seconds(struct timespec start, struct timespec end) {
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)*1e-9;
+}
+
+/**
+ * Appends of ints and of records through Vector (a heap block per record, as the force field reader did) and
+ * through typed vectors, in ns per element.
+ */
+static void typedVectorBenchmark(bool verbose) {
+  const int n = 1 << 22;
+  const int nRecords = 1 << 18;
+  struct timespec start, end;
+  long check = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  Vector* ints = vectorCreate(sizeof(int), 16, NULL, INT);
+  for(int i = 0; i < n; i++) {
+    vectorAppend(ints, &i);
+  }
+  check += ((int*) ints->array)[n - 1];
+  vectorBackingFree(ints);
+  memoryFree(ints, MEMORY_VECTORS);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double tVector = seconds(start, end)/n;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  IntVector typed;
+  intVectorInit(&typed, 16, MEMORY_VECTORS);
+  for(int i = 0; i < n; i++) {
+    intVectorPush(&typed, i);
+  }
+  check += typed.array[n - 1];
+  intVectorFree(&typed);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double tTyped = seconds(start, end)/n;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  Vector* pointers = vectorCreate(sizeof(TestRecord*), 16, NULL, OTHER);
+  for(int i = 0; i < nRecords; i++) {
+    TestRecord* record = memoryMalloc(sizeof(TestRecord), MEMORY_VECTORS);
+    record->type = i;
+    vectorAppend(pointers, record);
+  }
+  TestRecord** records = pointers->array;
+  for(int i = 0; i < nRecords; i++) {
+    check += records[i]->type;
+    memoryFree(records[i], MEMORY_VECTORS);
+  }
+  vectorBackingFree(pointers);
+  memoryFree(pointers, MEMORY_VECTORS);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double tPointers = seconds(start, end)/nRecords;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  TestRecordVector values;
+  testRecordVectorInit(&values, 16, MEMORY_VECTORS);
+  for(int i = 0; i < nRecords; i++) {
+    testRecordVectorEmplace(&values)->type = i;
+  }
+  for(int i = 0; i < nRecords; i++) {
+    check += values.array[i].type;
+  }
+  testRecordVectorFree(&values);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double tValues = seconds(start, end)/nRecords;
+  printf("Append %d ints: Vector %.2f ns, IntVector %.2f ns. %d records: Vector of pointers %.1f ns, by value "
+         "%.1f ns\n", n, tVector*1e9, tTyped*1e9, nRecords, tPointers*1e9, tValues*1e9);
+  if(verbose) {
+    printf("Checksum %ld\n", check);
+  }
+}
+
+/////////////////////////////////////////// TESTS
+
+void typedVectorTest(bool verbose) {
+  const long long before = memoryCurrent(MEMORY_VECTORS);
+  IntVector vec = {0};
+  vec.memoryTag = MEMORY_VECTORS;
+  for(int i = 0; i < 1000; i++) {
+    intVectorPush(&vec, i);
+  }
+  assert(vec.size == 1000 && vec.capacity >= 1000);
+  for(int i = 0; i < 1000; i++) {
+    assert(vec.array[i] == i);
+  }
+  intVectorShrink(&vec);
+  assert(vec.capacity == 1000 && vec.array[999] == 999);
+  intVectorReserve(&vec, 1500);
+  assert(vec.capacity == 1500 && vec.size == 1000);
+  intVectorReserve(&vec, 10); // Never shrinks
+  assert(vec.capacity == 1500);
+  vec.size = 0;
+  intVectorShrink(&vec);
+  assert(vec.array == NULL && vec.capacity == 0);
+  intVectorPush(&vec, 7);
+  assert(vec.size == 1 && vec.array[0] == 7);
+  intVectorFree(&vec);
+  // Records are stored in place and zeroed
+  TestRecordVector records;
+  testRecordVectorInit(&records, 2, MEMORY_VECTORS);
+  for(int i = 0; i < 100; i++) {
+    TestRecord* record = testRecordVectorEmplace(&records);
+    if(record->type != 0 || record->values[11] != 0.0) {
+      printf("typedVectorTest: emplaced record %d isn't zeroed!\n", i);
+      exit(1);
+    }
+    record->type = i;
+    record->values[11] = i;
+  }
+  assert(records.size == 100 && records.array[42].type == 42 && records.array[99].values[11] == 99.0);
+  testRecordVectorFree(&records);
+  if(memoryCurrent(MEMORY_VECTORS) != before) {
+    printf("typedVectorTest: %lld bytes still allocated!\n", memoryCurrent(MEMORY_VECTORS) - before);
+    exit(1);
+  }
+  typedVectorBenchmark(verbose);
+  printf("All tests of typedVector.c passed!\n");
+}
@@ -9,23 +9,34 @@
 int BUFFER_FACTOR = 2; // Minimum size that works for all cases
 
 Vector *vectorCreate(int bytesPerElement, int initialCapacity, CallbackFree cbFree, enum DataType dt) {
-  Vector* vec = malloc(sizeof(Vector));
+  return vectorCreateTagged(bytesPerElement, initialCapacity, cbFree, dt, MEMORY_VECTORS);
+}
+
+/**
+ * vectorCreate with the vector and its backing array counted under tag.
+ */
+Vector* vectorCreateTagged(int bytesPerElement, int initialCapacity, CallbackFree cbFree, enum DataType dt,
+                           enum MemoryTag tag) {
+  Vector* vec = memoryMalloc(sizeof(Vector), tag);
   vec->size = 0;
   vec->bufSize = initialCapacity == 0 ? 1 : initialCapacity; // zero breaks resizing
   vec->bytesPerElement = bytesPerElement;
   vec->dataType = dt;
-  vec->array = malloc(initialCapacity * bytesPerElement);
+  vec->array = memoryMalloc((size_t) vec->bufSize * bytesPerElement, tag);
   vec->callbackFree = cbFree;
+  vec->memoryTag = tag;
   return vec;
 }
 
 Vector* vectorCopy(Vector* vec) {
-  Vector* retVec = malloc(sizeof(Vector));
+  Vector* retVec = memoryMalloc(sizeof(Vector), vec->memoryTag);
   retVec->size = vec->size;
   retVec->bufSize = vec->bufSize;
   retVec->callbackFree = vec->callbackFree;
   retVec->bytesPerElement = vec->bytesPerElement;
-  retVec->array = malloc(vec->bufSize*vec->bytesPerElement);
+  retVec->dataType = vec->dataType;
+  retVec->memoryTag = vec->memoryTag;
+  retVec->array = memoryMalloc((size_t) vec->bufSize*vec->bytesPerElement, vec->memoryTag);
   memcpy(retVec->array, vec->array, vec->bufSize*vec->bytesPerElement);
   return retVec;
 }
@@ -40,7 +51,7 @@ void vectorBackingFree(Vector* vec) {
   if(vec->callbackFree != NULL) {
     vec->callbackFree(vec->array, vec->bufSize);
   } else {
-    free(vec->array);
+    memoryFree(vec->array, vec->memoryTag);
   }
 }
 
@@ -48,21 +59,19 @@ void vectorBackingFree(Vector* vec) {
  * @param bytesPerElement Number of bytes per element of underlying data
  * @param newCapacity Capacity of backing array
  * @param cbFree Method called to free memory
- * @param initArray Inital array that gets reallocated. This pointer is freed.
+ * @param initArray Inital array that gets reallocated (malloc'd untracked). It must not be used afterwards.
  * @return pointer to vector
  */
 Vector *vectorFromArray(int bytesPerElement, int newCapacity, CallbackFree cbFree, void *initArray) {
-  Vector *vec = malloc(sizeof(Vector));
+  Vector *vec = memoryMalloc(sizeof(Vector), MEMORY_VECTORS);
   vec->size = 0;
   vec->bufSize = newCapacity;
   vec->bytesPerElement = bytesPerElement;
-  vec->array = reallocarray(initArray, newCapacity, bytesPerElement);
-  if(vec->array != NULL) {
-    free(initArray);
-  } else {
-    printf("Reallocation of array from init array failed in vector.c.");
-    exit(1);
-  }
+  vec->dataType = OTHER;
+  vec->memoryTag = MEMORY_VECTORS;
+  vec->array = memoryMalloc((size_t) newCapacity*bytesPerElement, MEMORY_VECTORS);
+  memcpy(vec->array, initArray, (size_t) newCapacity*bytesPerElement);
+  free(initArray);
   vec->callbackFree = cbFree;
   return vec;
 }
@@ -110,14 +119,7 @@ void vectorAppend(Vector *vec, void *elem) {
 void vectorResize(Vector *vec) {
   assert(vec != NULL);
   vec->bufSize = BUFFER_FACTOR * vec->bufSize;
-  void *arr = reallocarray(vec->array, vec->bufSize, vec->bytesPerElement);
-  if (arr != NULL) {
-    vec->array = arr;
-  } else {
-    free(vec->array);
-    printf("Failed realloc in vector.c");
-    exit(1);
-  }
+  vec->array = memoryRealloc(vec->array, (size_t) vec->bufSize * vec->bytesPerElement, vec->memoryTag);
 }
 
 /**
@@ -140,12 +142,12 @@ void vectorTrim(Vector *vec) {
   if(vec->bufSize == 0) {
     vec->bufSize++;
   }
-  void *arr = malloc(vec->bufSize * vec->bytesPerElement);
-  memcpy(arr, vec->array, vec->bufSize * vec->bytesPerElement);;
+  void *arr = memoryMalloc((size_t) vec->bufSize * vec->bytesPerElement, vec->memoryTag);
+  memcpy(arr, vec->array, vec->bufSize * vec->bytesPerElement);
   if (vec->callbackFree) {
     vec->callbackFree(vec->array, vec->size);
   } else {
-    free(vec->array);
+    memoryFree(vec->array, vec->memoryTag);
   }
   vec->array = arr;
 }
@@ -0,0 +1,185 @@
+// Author(s): Matthew Speranza
+#include "../include/memoryTracker.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#endif
+
+static const char* tagNames[N_MEMORY_TAGS] = {"structure", "force field", "bonded lists", "neighbor lists",
+                                              "vectors"};
+static long long current[N_MEMORY_TAGS];
+static long long peak[N_MEMORY_TAGS];
+static long long total = 0;
+static long long totalPeak = 0;
+
+/**
+ * Bytes the allocator reserved for a block, 0 where it can't tell.
+ */
+static long long blockSize(void* block) {
+  if(block == NULL) {
+    return 0;
+  }
+#if defined(__GLIBC__)
+  return malloc_usable_size(block);
+#elif defined(__APPLE__)
+  return malloc_size(block);
+#else
+  return 0;
+#endif
+}
+
+static void account(enum MemoryTag tag, long long bytes) {
+#pragma omp critical(memoryTracker)
+  {
+    current[tag] += bytes;
+    peak[tag] = current[tag] > peak[tag] ? current[tag] : peak[tag];
+    total += bytes;
+    totalPeak = total > totalPeak ? total : totalPeak;
+  }
+}
+
+static void failed(size_t bytes, enum MemoryTag tag) {
+  printf("Failed to allocate %zu bytes of %s!\n", bytes, tagNames[tag]);
+  exit(1);
+}
+
+void* memoryMalloc(size_t bytes, enum MemoryTag tag) {
+  void* block = malloc(bytes);
+  if(block == NULL && bytes > 0) {
+    failed(bytes, tag);
+  }
+  account(tag, blockSize(block));
+  return block;
+}
+
+void* memoryCalloc(size_t n, size_t bytes, enum MemoryTag tag) {
+  void* block = calloc(n, bytes);
+  if(block == NULL && n*bytes > 0) {
+    failed(n*bytes, tag);
+  }
+  account(tag, blockSize(block));
+  return block;
+}
+
+/**
+ * realloc under a tag, the block must have been allocated under the same one (or be NULL).
+ */
+void* memoryRealloc(void* block, size_t bytes, enum MemoryTag tag) {
+  const long long before = blockSize(block);
+  void* grown = realloc(block, bytes);
+  if(grown == NULL && bytes > 0) {
+    failed(bytes, tag);
+  }
+  account(tag, blockSize(grown) - before);
+  return grown;
+}
+
+void memoryFree(void* block, enum MemoryTag tag) {
+  if(block == NULL) {
+    return;
+  }
+  account(tag, -blockSize(block));
+  free(block);
+}
+
+long long memoryCurrent(enum MemoryTag tag) {
+  return current[tag];
+}
+
+long long memoryPeak(enum MemoryTag tag) {
+  return peak[tag];
+}
+
+/**
+ * Largest number of tracked bytes live at once, over every tag.
+ */
+long long memoryTotalPeak() {
+  return totalPeak;
+}
+
+/**
+ * Starts the peaks over from what is allocated now, to measure the peak of one phase or run.
+ */
+void memoryResetPeaks() {
+#pragma omp critical(memoryTracker)
+  {
+    for(int t = 0; t < N_MEMORY_TAGS; t++) {
+      peak[t] = current[t];
+    }
+    totalPeak = total;
+  }
+}
+
+/**
+ * Current and peak MB of every tag, the peak of their sum and the process' peak resident set.
+ */
+void memoryReport() {
+  printf("\n %-28s %14s %14s\n", "Memory", "Current (MB)", "Peak (MB)");
+  for(int t = 0; t < N_MEMORY_TAGS; t++) {
+    printf(" %-28s %14.3f %14.3f\n", tagNames[t], current[t]/1048576.0, peak[t]/1048576.0);
+  }
+  printf(" %-28s %14.3f %14.3f\n", "tracked", total/1048576.0, totalPeak/1048576.0);
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) == 0) {
+    printf(" %-28s %14s %14.3f\n", "process resident set", "", usage.ru_maxrss/1024.0); // ru_maxrss is in KB
+  }
+}
+
+/////////////////////////////////////////// TESTS
+
+void memoryTrackerTest(bool verbose) {
+  long long before[N_MEMORY_TAGS];
+  for(int t = 0; t < N_MEMORY_TAGS; t++) {
+    before[t] = memoryCurrent(t);
+  }
+  const size_t n = 1 << 20;
+  int* a = memoryMalloc(sizeof(int)*n, MEMORY_NEIGHBOR_LISTS);
+  double* b = memoryCalloc(n, sizeof(double), MEMORY_STRUCTURE);
+  for(size_t i = 0; i < n; i++) {
+    assert(b[i] == 0.0);
+    a[i] = i;
+  }
+#if defined(__GLIBC__) || defined(__APPLE__)
+  assert(memoryCurrent(MEMORY_NEIGHBOR_LISTS) - before[MEMORY_NEIGHBOR_LISTS] >= (long long) (sizeof(int)*n));
+  assert(memoryCurrent(MEMORY_STRUCTURE) - before[MEMORY_STRUCTURE] >= (long long) (sizeof(double)*n));
+#endif
+  // Growing keeps the contents and moves the count along
+  a = memoryRealloc(a, sizeof(int)*2*n, MEMORY_NEIGHBOR_LISTS);
+  assert(a[n-1] == (int) (n-1));
+#if defined(__GLIBC__) || defined(__APPLE__)
+  assert(memoryCurrent(MEMORY_NEIGHBOR_LISTS) - before[MEMORY_NEIGHBOR_LISTS] >= (long long) (sizeof(int)*2*n));
+  assert(memoryPeak(MEMORY_NEIGHBOR_LISTS) >= memoryCurrent(MEMORY_NEIGHBOR_LISTS));
+#endif
+  const long long peakBoth = memoryTotalPeak();
+  memoryFree(a, MEMORY_NEIGHBOR_LISTS);
+  memoryFree(b, MEMORY_STRUCTURE);
+  memoryFree(NULL, MEMORY_STRUCTURE);
+  for(int t = 0; t < N_MEMORY_TAGS; t++) {
+    if(memoryCurrent(t) != before[t]) {
+      printf("memoryTrackerTest: %s ended at %lld bytes, not %lld!\n", tagNames[t], memoryCurrent(t), before[t]);
+      exit(1);
+    }
+  }
+  if(memoryTotalPeak() != peakBoth) {
+    printf("memoryTrackerTest: freeing moved the peak!\n");
+    exit(1);
+  }
+  memoryResetPeaks();
+  for(int t = 0; t < N_MEMORY_TAGS; t++) {
+    if(memoryPeak(t) != memoryCurrent(t)) {
+      printf("memoryTrackerTest: reset left the %s peak at %lld bytes!\n", tagNames[t], memoryPeak(t));
+      exit(1);
+    }
+  }
+  if(verbose) {
+    memoryReport();
+  }
+  printf("All tests of memoryTracker.c passed!\n");
+}
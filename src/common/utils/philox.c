@@ -0,0 +1,115 @@
+// Author(s): Matthew Speranza
+#include "../include/philox.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Sum of nDOF squared standard normals, drawn as 2*Gamma(nDOF/2) with Marsaglia and Tsang's rejection method
+ * (ACM Trans. Math. Softw. 26, 363 (2000)) so the cost does not grow with nDOF. Uses the counters (0..., stream,
+ * step), one per trial.
+ */
+REAL philoxChiSquared(uint64_t seed, uint32_t stream, uint64_t step, int nDOF) {
+  if(nDOF <= 0) {
+    return 0.0;
+  }
+  REAL u[4];
+  if(nDOF == 1) {
+    REAL n[4];
+    philoxNormals(seed, stream, step, 0, n);
+    return n[0]*n[0];
+  }
+  const REAL d = 0.5*nDOF - 1.0/3.0;
+  const REAL c = 1.0/sqrt(9.0*d);
+  for(uint32_t index = 0; ; index++) {
+    philoxUniforms(seed, stream, step, index, u);
+    REAL x = sqrt(-2.0*log(u[0]))*cos(2.0*M_PI*u[1]);
+    REAL v = 1.0 + c*x;
+    if(v <= 0.0) {
+      continue;
+    }
+    v = v*v*v;
+    if(log(u[2]) < 0.5*x*x + d - d*v + d*log(v)) {
+      return 2.0*d*v;
+    }
+  }
+}
+
+/////////////////////////////////////////// TESTS
+
+void philoxTest(bool verbose) {
+  // Known answers of the Random123 reference implementation
+  const uint32_t counters[3][4] = {{0, 0, 0, 0}, {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+                                   {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}};
+  const uint32_t keys[3][2] = {{0, 0}, {0xffffffff, 0xffffffff}, {0xa4093822, 0x299f31d0}};
+  const uint32_t answers[3][4] = {{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+                                  {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+                                  {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}};
+  int wrong = 0;
+  for(int t = 0; t < 3; t++) {
+    uint32_t out[4];
+    philox4x32(counters[t], keys[t], out);
+    for(int k = 0; k < 4; k++) {
+      wrong += out[k] != answers[t][k];
+    }
+  }
+  if(verbose) {
+    printf("Philox4x32-10 known answers: %d of 12 words differ\n", wrong);
+  }
+  assert(wrong == 0);
+
+  // Normal moments over a million draws, filled in parallel by counter
+  const int n = 1 << 18;
+  REAL* normals = malloc(sizeof(REAL)*n*4);
+  if(normals == NULL) {
+    printf("Failed to allocate normals in philoxTest\n");
+    exit(1);
+  }
+#pragma omp parallel for simd schedule(static)
+  for(int i = 0; i < n; i++) {
+    philoxNormals(42, 0, 7, i, &normals[i*4]);
+  }
+  REAL mean = 0.0, variance = 0.0, kurtosis = 0.0;
+  for(int i = 0; i < n*4; i++) {
+    mean += normals[i];
+  }
+  mean /= n*4;
+  for(int i = 0; i < n*4; i++) {
+    REAL d2 = (normals[i] - mean)*(normals[i] - mean);
+    variance += d2;
+    kurtosis += d2*d2;
+  }
+  variance /= n*4;
+  kurtosis /= n*4*variance*variance;
+  if(verbose) {
+    printf("%d normals: mean %.5f, variance %.5f, kurtosis %.5f\n", n*4, mean, variance, kurtosis);
+  }
+  assert(fabs(mean) < 5e-3 && fabs(variance - 1.0) < 5e-3 && fabs(kurtosis - 3.0) < 2e-2);
+  // Same counter, same numbers; any other counter word or the key changes them
+  REAL again[4], other[4];
+  philoxNormals(42, 0, 7, 12345, again);
+  assert(again[0] == normals[12345*4] && again[3] == normals[12345*4+3]);
+  philoxNormals(43, 0, 7, 12345, other);
+  assert(other[0] != again[0]);
+  philoxNormals(42, 1, 7, 12345, other);
+  assert(other[0] != again[0]);
+  philoxNormals(42, 0, 8, 12345, other);
+  assert(other[0] != again[0]);
+
+  // Chi-squared with k degrees of freedom has mean k and variance 2k
+  const int k = 1000, draws = 20000;
+  REAL sum = 0.0, sum2 = 0.0;
+  for(int step = 0; step < draws; step++) {
+    REAL x = philoxChiSquared(42, 3, step, k);
+    sum += x;
+    sum2 += x*x;
+  }
+  REAL chiMean = sum/draws, chiVariance = sum2/draws - chiMean*chiMean;
+  if(verbose) {
+    printf("Chi-squared(%d): mean %.3f, variance %.3f\n", k, chiMean, chiVariance);
+  }
+  assert(fabs(chiMean - k) < 2.0 && fabs(chiVariance - 2*k) < 0.05*2*k);
+  free(normals);
+  printf("All tests of philox.c passed!\n");
+}
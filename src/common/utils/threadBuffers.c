@@ -0,0 +1,193 @@
+// Author(s): Matthew Speranza
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../include/threadBuffers.h"
+
+static int threadID() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Zeroed buffers for omp_get_max_threads() threads.
+ */
+ThreadBuffers* threadBuffersCreate(int nAtoms, int nArrays) {
+  ThreadBuffers* buffers = malloc(sizeof(ThreadBuffers));
+  if(buffers == NULL) {
+    printf("Failed to allocate thread buffers!\n");
+    exit(1);
+  }
+#ifdef _OPENMP
+  buffers->nThreads = omp_get_max_threads();
+#else
+  buffers->nThreads = 1;
+#endif
+  buffers->nAtoms = nAtoms;
+  buffers->nArrays = nArrays;
+  buffers->nBlocks = (nAtoms + BUFFER_BLOCK - 1)/BUFFER_BLOCK;
+  buffers->arrays = malloc(sizeof(REAL*)*buffers->nThreads);
+  buffers->written = malloc(sizeof(bool*)*buffers->nThreads);
+  buffers->tally = calloc(buffers->nThreads*TALLY_STRIDE, sizeof(REAL));
+  if(buffers->arrays == NULL || buffers->written == NULL || buffers->tally == NULL) {
+    printf("Failed to allocate thread buffers!\n");
+    exit(1);
+  }
+  for(int t = 0; t < buffers->nThreads; t++) {
+    buffers->arrays[t] = calloc((long) nArrays*nAtoms*3, sizeof(REAL));
+    buffers->written[t] = calloc(buffers->nBlocks, sizeof(bool));
+    if(buffers->arrays[t] == NULL || buffers->written[t] == NULL) {
+      printf("Failed to allocate thread buffers!\n");
+      exit(1);
+    }
+  }
+  return buffers;
+}
+
+void threadBuffersDestroy(ThreadBuffers* buffers) {
+  for(int t = 0; t < buffers->nThreads; t++) {
+    free(buffers->arrays[t]);
+    free(buffers->written[t]);
+  }
+  free(buffers->arrays);
+  free(buffers->written);
+  free(buffers->tally);
+  free(buffers);
+}
+
+/**
+ * Adds every thread's arrays into out[a] [nAtoms*3] and its virial into virial [9] (may be NULL), in thread
+ * order, and zeroes the buffers and tallies for the next evaluation.
+ * @return sum of the threads' energies
+ */
+REAL threadBuffersReduce(ThreadBuffers* buffers, REAL** out, REAL* virial) {
+  const int nThreads = buffers->nThreads;
+  const long n3 = (long) buffers->nAtoms*3;
+#pragma omp parallel for schedule(static) num_threads(nThreads)
+  for(int b = 0; b < buffers->nBlocks; b++) {
+    long start = (long) b*BUFFER_BLOCK*3;
+    long end = start + BUFFER_BLOCK*3 < n3 ? start + BUFFER_BLOCK*3 : n3;
+    for(int t = 0; t < nThreads; t++) {
+      if(!buffers->written[t][b]) {
+        continue;
+      }
+      buffers->written[t][b] = false;
+      for(int a = 0; a < buffers->nArrays; a++) {
+        REAL* restrict src = buffers->arrays[t] + a*n3;
+        REAL* restrict dst = out[a];
+#pragma omp simd
+        for(long j = start; j < end; j++) {
+          dst[j] += src[j];
+          src[j] = 0.0;
+        }
+      }
+    }
+  }
+  REAL energy = 0.0;
+  for(int t = 0; t < nThreads; t++) {
+    REAL* tally = buffers->tally + t*TALLY_STRIDE;
+    energy += tally[TALLY_ENERGY];
+    if(virial != NULL) {
+      for(int k = 0; k < 9; k++) {
+        virial[k] += tally[TALLY_VIRIAL+k];
+      }
+    }
+    memset(tally, 0, sizeof(REAL)*TALLY_STRIDE);
+  }
+  return energy;
+}
+
+/////////////////////////////////////////// TESTS
+
+/**
+ * Every thread adds to a strided subset of atoms and a few scattered partners, like a half neighbor list.
+ */
+static REAL scatterPattern(ThreadBuffers* buffers, int nAtoms, REAL* virial) {
+  REAL* out[2];
+  for(int a = 0; a < 2; a++) {
+    out[a] = calloc(nAtoms*3, sizeof(REAL));
+  }
+#pragma omp parallel num_threads(buffers->nThreads)
+  {
+    int t = threadID();
+    REAL* g = threadArray(buffers, t, 0);
+    REAL* h = threadArray(buffers, t, 1);
+    REAL* tally = buffers->tally + t*TALLY_STRIDE;
+#pragma omp for schedule(static, 8)
+    for(int i = 0; i < nAtoms/2; i++) {
+      for(int n = 1; n <= 5; n++) {
+        int k = (i*7 + n*131) % nAtoms;
+        REAL value = sin(0.1*i + n);
+        for(int c = 0; c < 3; c++) {
+          g[i*3+c] += value;
+          g[k*3+c] -= value;
+          h[k*3+c] += value*c;
+        }
+        threadBuffersMark(buffers, t, i);
+        threadBuffersMark(buffers, t, k);
+        tally[TALLY_ENERGY] += value;
+        tally[TALLY_VIRIAL+4] += value*value;
+      }
+    }
+  }
+  REAL energy = threadBuffersReduce(buffers, out, virial);
+  // Serial reference
+  double energyRef = 0.0, sum = 0.0;
+  for(int i = 0; i < nAtoms/2; i++) {
+    for(int n = 1; n <= 5; n++) {
+      energyRef += sin(0.1*i + n);
+    }
+  }
+  for(int a = 0; a < nAtoms*3; a++) {
+    sum += out[0][a];
+  }
+  assert(fabs(energy - energyRef) < 1e-10);
+  assert(fabs(sum) < 1e-10);
+  REAL checksum = 0.0;
+  for(int a = 0; a < nAtoms*3; a++) {
+    checksum += out[0][a]*(a + 1) + out[1][a];
+  }
+  free(out[0]);
+  free(out[1]);
+  return checksum;
+}
+
+void threadBuffersTest(bool verbose) {
+  const int nAtoms = 1000;
+  ThreadBuffers* buffers = threadBuffersCreate(nAtoms, 2);
+  assert(buffers->nBlocks == (nAtoms + BUFFER_BLOCK - 1)/BUFFER_BLOCK);
+  REAL virial[9] = {0.0};
+  REAL first = scatterPattern(buffers, nAtoms, virial);
+  assert(virial[4] > 0.0 && virial[0] == 0.0);
+  // The reduction leaves zeroed, unmarked buffers
+  for(int t = 0; t < buffers->nThreads; t++) {
+    for(long a = 0; a < (long) 2*nAtoms*3; a++) {
+      assert(buffers->arrays[t][a] == 0.0);
+    }
+    for(int b = 0; b < buffers->nBlocks; b++) {
+      assert(!buffers->written[t][b]);
+    }
+    for(int k = 0; k < TALLY_STRIDE; k++) {
+      assert(buffers->tally[t*TALLY_STRIDE+k] == 0.0);
+    }
+  }
+  // Same thread count, same bits
+  for(int run = 0; run < 3; run++) {
+    REAL again = scatterPattern(buffers, nAtoms, virial);
+    if(verbose) {
+      printf("Run %d checksum %.17g (first %.17g)\n", run, again, first);
+    }
+    assert(again == first);
+  }
+  threadBuffersDestroy(buffers);
+  printf("All tests of threadBuffers.c passed!\n");
+}
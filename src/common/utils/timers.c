@@ -0,0 +1,786 @@
+// Author(s): Matthew Speranza
+#include "../include/timers.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char* timerNames[N_TIMERS] = {"total", "parse", "bonded lists", "neighbor update", "verlet build",
+                                           "setup", "forces", "rotate", "real space", "polarize", "torque",
+                                           "pair loop", "field pairs", "reduction", "dynamics", "integrate",
+                                           "constraints", "thermostat", "barostat", "output", "mbar", "bar",
+                                           "newton", "covariance"};
+static const char* counterNames[N_COUNTERS] = {"steps", "force evaluations", "verlet builds", "verlet pairs",
+                                               "polarization iterations", "shake iterations", "rattle iterations",
+                                               "volume moves", "volume moves accepted"};
+#ifdef TIMERS
+// What TIMER_ITEMS counts in a phase, the hardware report is per call for the others
+static const char* itemNames[N_TIMERS] = {[TIMER_VERLET_BUILD] = "pair", [TIMER_ROTATE] = "atom",
+                                          [TIMER_TORQUE] = "atom", [TIMER_PAIRS] = "pair",
+                                          [TIMER_FIELD_PAIRS] = "pair", [TIMER_REDUCE] = "atom"};
+#endif
+
+typedef struct TimerNode {
+  int id; // TimerID, -1 for the root
+  int parent;
+  int child; // First child, -1 without
+  int sibling; // Next child of the parent, -1 for the last
+  long calls;
+  double seconds;
+  double start; // Of the open call
+  long items; // TIMER_ITEMS
+  bool hardware; // The open call read the hardware counters at its start
+  long long counts[N_HW_EVENTS]; // Hardware events
+  long long countsStart[N_HW_EVENTS]; // Of the open call
+} TimerNode;
+
+typedef struct TraceEvent {
+  int id; // TimerID
+  double start;
+  double duration;
+} TraceEvent;
+
+typedef struct TimerThread {
+  TimerNode nodes[TIMER_MAX_NODES];
+  int nNodes;
+  int open; // Innermost running node, 0 (root) when none is
+  long counters[N_COUNTERS];
+  TraceEvent* trace; // Ring buffer [TRACE_MAX_EVENTS], allocated with the first event
+  long nEvents; // Recorded so far, only the last TRACE_MAX_EVENTS are kept
+  bool hardwareTried;
+  int hardwareLeader; // File descriptor of the counter group, -1 without
+  int hardwareFd[N_HW_EVENTS]; // -1 for the events that couldn't be opened
+  int hardwareSlot[N_HW_EVENTS]; // Position of each event in the group read, -1 if not open
+  int nHardware;
+} TimerThread;
+
+static TimerThread* threads[TIMER_MAX_THREADS];
+static char* jsonPath = NULL;
+static char* tracePath = NULL;
+static bool hardwareRequested = false;
+static bool hardwareWarned = false;
+
+static double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+/**
+ * The calling thread's tree, created on its first use. In nested teams (systems run side by side by batch.h) the
+ * thread numbers of every level are combined, t = sum over levels of thread number times the sizes of the teams
+ * above, so the same numbers in two inner teams don't share a tree and thread 0 of a team keeps its parent's.
+ */
+static TimerThread* timerThread() {
+#ifdef _OPENMP
+  int t = 0;
+  int stride = 1;
+  for(int level = 1; level <= omp_get_level(); level++) {
+    t += stride*omp_get_ancestor_thread_num(level);
+    stride *= omp_get_team_size(level);
+  }
+#else
+  const int t = 0;
+#endif
+  if(t >= TIMER_MAX_THREADS) {
+    printf("Timers support %d threads, thread %d asked for one!\n", TIMER_MAX_THREADS, t);
+    exit(1);
+  }
+  if(threads[t] == NULL) {
+    threads[t] = calloc(1, sizeof(TimerThread));
+    if(threads[t] == NULL) {
+      printf("Failed to allocate timers!\n");
+      exit(1);
+    }
+    TimerNode* root = &threads[t]->nodes[0];
+    root->id = -1;
+    root->parent = root->child = root->sibling = -1;
+    threads[t]->nNodes = 1;
+    threads[t]->hardwareLeader = -1;
+  }
+  return threads[t];
+}
+
+/**
+ * Opens the calling thread's counter group, every event that the CPU has. Warns once if none could be opened.
+ */
+static void hardwareOpen(TimerThread* thread) {
+  thread->hardwareTried = true;
+  thread->hardwareLeader = -1;
+  thread->nHardware = 0;
+  int error = ENOSYS;
+#ifdef __linux__
+  const uint32_t types[N_HW_EVENTS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+                                       PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE};
+  const uint64_t configs[N_HW_EVENTS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                         PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8
+                                         | PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+                                         PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+  for(int e = 0; e < N_HW_EVENTS; e++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = types[e];
+    attr.config = configs[e];
+    attr.disabled = thread->hardwareLeader < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    // This thread on any CPU
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, thread->hardwareLeader, 0);
+    thread->hardwareFd[e] = fd;
+    thread->hardwareSlot[e] = -1;
+    if(fd < 0) {
+      error = errno;
+      continue;
+    }
+    if(thread->hardwareLeader < 0) {
+      thread->hardwareLeader = fd;
+    }
+    thread->hardwareSlot[e] = thread->nHardware++;
+  }
+  if(thread->hardwareLeader >= 0) {
+    ioctl(thread->hardwareLeader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(thread->hardwareLeader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return;
+  }
+#else
+  for(int e = 0; e < N_HW_EVENTS; e++) {
+    thread->hardwareFd[e] = thread->hardwareSlot[e] = -1;
+  }
+#endif
+#pragma omp critical(hardwareWarning)
+  {
+    if(!hardwareWarned) {
+      printf("Hardware counters are not available (%s), timing without them!\n", strerror(error));
+      hardwareWarned = true;
+    }
+  }
+}
+
+/**
+ * Current value of every event of the calling thread's group, 0 for the ones that aren't open.
+ * @return false if the group couldn't be read
+ */
+static bool hardwareRead(TimerThread* thread, long long* counts) {
+#ifdef __linux__
+  uint64_t values[1 + N_HW_EVENTS]; // Number of events, then their counts
+  ssize_t size = read(thread->hardwareLeader, values, sizeof(values));
+  if(size < (ssize_t) sizeof(uint64_t) || values[0] != (uint64_t) thread->nHardware) {
+    return false;
+  }
+  for(int e = 0; e < N_HW_EVENTS; e++) {
+    counts[e] = thread->hardwareSlot[e] >= 0 ? (long long) values[1 + thread->hardwareSlot[e]] : 0;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void timerStart(enum TimerID id) {
+  TimerThread* thread = timerThread();
+  TimerNode* nodes = thread->nodes;
+  int* link = &nodes[thread->open].child;
+  while(*link >= 0 && nodes[*link].id != (int) id) {
+    link = &nodes[*link].sibling;
+  }
+  if(*link < 0) {
+    if(thread->nNodes == TIMER_MAX_NODES) {
+      printf("More than %d nested timer nodes, raise TIMER_MAX_NODES!\n", TIMER_MAX_NODES);
+      exit(1);
+    }
+    int n = thread->nNodes++;
+    nodes[n] = (TimerNode) {.id = id, .parent = thread->open, .child = -1, .sibling = -1};
+    *link = n;
+  }
+  thread->open = *link;
+  nodes[*link].calls++;
+  if(hardwareRequested && !thread->hardwareTried) {
+    hardwareOpen(thread);
+  }
+  nodes[*link].hardware = hardwareRequested && thread->hardwareLeader >= 0
+                          && hardwareRead(thread, nodes[*link].countsStart);
+  nodes[*link].start = now();
+}
+
+void timerStop(enum TimerID id) {
+  const double end = now();
+  TimerThread* thread = timerThread();
+  TimerNode* node = &thread->nodes[thread->open];
+  if(node->id != (int) id) {
+    printf("Stopped the %s timer while %s is running!\n", timerNames[id],
+           node->id < 0 ? "none" : timerNames[node->id]);
+    exit(1);
+  }
+  node->seconds += end - node->start;
+  thread->open = node->parent;
+  long long counts[N_HW_EVENTS];
+  if(node->hardware && hardwareRead(thread, counts)) {
+    for(int e = 0; e < N_HW_EVENTS; e++) {
+      node->counts[e] += counts[e] - node->countsStart[e];
+    }
+  }
+  if(tracePath != NULL) {
+    if(thread->trace == NULL) {
+      thread->trace = malloc(sizeof(TraceEvent)*TRACE_MAX_EVENTS);
+      if(thread->trace == NULL) {
+        printf("Failed to allocate the trace events!\n");
+        exit(1);
+      }
+    }
+    thread->trace[thread->nEvents++ % TRACE_MAX_EVENTS] = (TraceEvent) {id, node->start, end - node->start};
+  }
+}
+
+void counterAdd(enum CounterID id, long n) {
+  timerThread()->counters[id] += n;
+}
+
+/**
+ * Adds n items of work (see itemNames) to the innermost running timer of the calling thread.
+ */
+void timerItems(long n) {
+  TimerThread* thread = timerThread();
+  thread->nodes[thread->open].items += n;
+}
+
+const char* timerName(enum TimerID id) {
+  return timerNames[id];
+}
+
+/**
+ * Seconds in a timer over all threads and callers.
+ */
+double timerSeconds(enum TimerID id) {
+  double seconds = 0.0;
+  for(int t = 0; t < TIMER_MAX_THREADS; t++) {
+    for(int n = 1; threads[t] != NULL && n < threads[t]->nNodes; n++) {
+      seconds += threads[t]->nodes[n].id == (int) id ? threads[t]->nodes[n].seconds : 0.0;
+    }
+  }
+  return seconds;
+}
+
+/**
+ * Seconds in the timer reached from the calling thread's innermost running from timer through the timers nested in
+ * each other in path, so the same timer under other callers (forces of a barostat move, say) isn't included. Only
+ * stopped calls count.
+ * @param depth length of path
+ * @return 0 if from isn't running or the timer never ran there
+ */
+double timerPathSeconds(enum TimerID from, const enum TimerID* path, int depth) {
+  TimerThread* thread = timerThread();
+  const TimerNode* nodes = thread->nodes;
+  int n = thread->open;
+  while(n > 0 && nodes[n].id != (int) from) {
+    n = nodes[n].parent;
+  }
+  if(n <= 0) {
+    return 0.0;
+  }
+  for(int d = 0; d < depth && n >= 0; d++) {
+    n = nodes[n].child;
+    while(n >= 0 && nodes[n].id != (int) path[d]) {
+      n = nodes[n].sibling;
+    }
+  }
+  return n >= 0 ? nodes[n].seconds : 0.0;
+}
+
+/**
+ * CLOCK_MONOTONIC in seconds.
+ */
+double timerNow() {
+  return now();
+}
+
+long counterTotal(enum CounterID id) {
+  long total = 0;
+  for(int t = 0; t < TIMER_MAX_THREADS; t++) {
+    total += threads[t] != NULL ? threads[t]->counters[id] : 0;
+  }
+  return total;
+}
+
+/**
+ * Drops every timer and counter. No timer may be running.
+ */
+void timersReset() {
+  for(int t = 0; t < TIMER_MAX_THREADS; t++) {
+    if(threads[t] != NULL) {
+      free(threads[t]->trace);
+#ifdef __linux__
+      for(int e = 0; e < N_HW_EVENTS && threads[t]->hardwareTried; e++) {
+        if(threads[t]->hardwareFd[e] >= 0) {
+          close(threads[t]->hardwareFd[e]);
+        }
+      }
+#endif
+    }
+    free(threads[t]);
+    threads[t] = NULL;
+  }
+}
+
+#ifdef TIMERS
+static void printNode(TimerThread* thread, int n, int depth) {
+  TimerNode* node = &thread->nodes[n];
+  double parent = 0.0;
+  if(node->parent > 0) {
+    parent = thread->nodes[node->parent].seconds;
+  } else {
+    for(int c = thread->nodes[0].child; c >= 0; c = thread->nodes[c].sibling) {
+      parent += thread->nodes[c].seconds;
+    }
+  }
+  printf(" %*s%-*s %12.4f %10ld %7.1f%%\n", 2*depth, "", 28 - 2*depth, timerNames[node->id], node->seconds,
+         node->calls, parent > 0.0 ? 100.0*node->seconds/parent : 0.0);
+  for(int c = node->child; c >= 0; c = thread->nodes[c].sibling) {
+    printNode(thread, c, depth + 1);
+  }
+}
+
+static void printHardware(TimerThread* thread, int n, int depth) {
+  TimerNode* node = &thread->nodes[n];
+  const bool perItem = node->items > 0 && itemNames[node->id] != NULL;
+  const double per = perItem ? node->items : node->calls;
+  printf(" %*s%-*s", 2*depth, "", 28 - 2*depth, timerNames[node->id]);
+  if(thread->hardwareSlot[HW_CYCLES] >= 0 && thread->hardwareSlot[HW_INSTRUCTIONS] >= 0
+     && node->counts[HW_CYCLES] > 0) {
+    printf(" %6.2f", (double) node->counts[HW_INSTRUCTIONS]/node->counts[HW_CYCLES]);
+  } else {
+    printf(" %6s", "-");
+  }
+  for(int e = 0; e < N_HW_EVENTS; e++) {
+    if(e == HW_INSTRUCTIONS) {
+      continue;
+    }
+    if(thread->hardwareSlot[e] >= 0) {
+      printf(" %12.4g", node->counts[e]/per);
+    } else {
+      printf(" %12s", "-");
+    }
+  }
+  printf(" %6s\n", perItem ? itemNames[node->id] : "call");
+  for(int c = node->child; c >= 0; c = thread->nodes[c].sibling) {
+    printHardware(thread, c, depth + 1);
+  }
+}
+#endif
+
+/**
+ * Table of every timer under the callers it ran in, with its share of the parent, then the counters.
+ */
+void timersPrint() {
+#ifdef TIMERS
+  printf("\n %-28s %12s %10s %8s\n", "Timer", "Seconds", "Calls", "Parent");
+  for(int t = 0; t < TIMER_MAX_THREADS; t++) {
+    if(threads[t] == NULL || threads[t]->nNodes == 1) {
+      continue;
+    }
+    if(t > 0) {
+      printf(" Thread %d\n", t);
+    }
+    for(int c = threads[t]->nodes[0].child; c >= 0; c = threads[t]->nodes[c].sibling) {
+      printNode(threads[t], c, 0);
+    }
+  }
+  bool header = false;
+  for(int c = 0; c < N_COUNTERS; c++) {
+    long total = counterTotal(c);
+    if(total != 0) {
+      if(!header) {
+        printf("\n %-28s %12s\n", "Counter", "Total");
+        header = true;
+      }
+      printf(" %-28s %12ld\n", counterNames[c], total);
+    }
+  }
+  if(timersHardwareOpen()) {
+    printf("\n %-28s %6s %12s %12s %12s %12s %6s\n", "Hardware counters", "IPC", "Cycles", "L1D misses",
+           "LLC misses", "Br misses", "Per");
+    for(int t = 0; t < TIMER_MAX_THREADS; t++) {
+      if(threads[t] == NULL || threads[t]->hardwareLeader < 0) {
+        continue;
+      }
+      if(t > 0) {
+        printf(" Thread %d\n", t);
+      }
+      for(int c = threads[t]->nodes[0].child; c >= 0; c = threads[t]->nodes[c].sibling) {
+        printHardware(threads[t], c, 0);
+      }
+    }
+  }
+#endif
+}
+
+static void writeNode(FILE* file, TimerThread* thread, int n) {
+  TimerNode* node = &thread->nodes[n];
+  fprintf(file, "{\"name\": \"%s\", \"seconds\": %.9f, \"calls\": %ld, \"items\": %ld, ", timerNames[node->id],
+          node->seconds, node->calls, node->items);
+  if(thread->hardwareLeader >= 0) {
+    fprintf(file, "\"cycles\": %lld, \"instructions\": %lld, \"l1dMisses\": %lld, \"llcMisses\": %lld, "
+            "\"branchMisses\": %lld, ", node->counts[HW_CYCLES], node->counts[HW_INSTRUCTIONS],
+            node->counts[HW_L1_MISSES], node->counts[HW_LLC_MISSES], node->counts[HW_BRANCH_MISSES]);
+  }
+  fprintf(file, "\"children\": [");
+  for(int c = node->child; c >= 0; c = thread->nodes[c].sibling) {
+    writeNode(file, thread, c);
+    if(thread->nodes[c].sibling >= 0) {
+      fprintf(file, ", ");
+    }
+  }
+  fprintf(file, "]}");
+}
+
+/**
+ * {"threads": [{"thread": t, "timers": [nodes]}...], "counters": {name: total...}}, where a node is
+ * {"name", "seconds", "calls", "children": [nodes]}.
+ */
+void timersWriteJSON(const char* path) {
+  FILE* file = fopen(path, "w");
+  if(file == NULL) {
+    printf("Could not open %s for the timers!\n", path);
+    exit(1);
+  }
+  fprintf(file, "{\"threads\": [");
+  bool first = true;
+  for(int t = 0; t < TIMER_MAX_THREADS; t++) {
+    if(threads[t] == NULL || threads[t]->nNodes == 1) {
+      continue;
+    }
+    fprintf(file, "%s\n  {\"thread\": %d, \"timers\": [", first ? "" : ",", t);
+    first = false;
+    for(int c = threads[t]->nodes[0].child; c >= 0; c = threads[t]->nodes[c].sibling) {
+      writeNode(file, threads[t], c);
+      if(threads[t]->nodes[c].sibling >= 0) {
+        fprintf(file, ", ");
+      }
+    }
+    fprintf(file, "]}");
+  }
+  fprintf(file, "],\n \"counters\": {");
+  for(int c = 0; c < N_COUNTERS; c++) {
+    fprintf(file, "%s\"%s\": %ld", c > 0 ? ", " : "", counterNames[c], counterTotal(c));
+  }
+  fprintf(file, "}}\n");
+  fclose(file);
+}
+
+/**
+ * File timersWriteJSON writes at the end of the run, NULL for none.
+ */
+void timersSetJSON(const char* path) {
+  free(jsonPath);
+  jsonPath = NULL;
+  if(path != NULL) {
+    jsonPath = malloc(strlen(path) + 1);
+    if(jsonPath == NULL) {
+      printf("Failed to allocate the timer file name!\n");
+      exit(1);
+    }
+    strcpy(jsonPath, path);
+  }
+}
+
+const char* timersJSONPath() {
+  return jsonPath;
+}
+
+/**
+ * Chrome trace event JSON of the recorded events, one line each, with times in microseconds from the earliest.
+ */
+void timersWriteTrace(const char* path) {
+  FILE* file = fopen(path, "w");
+  if(file == NULL) {
+    printf("Could not open %s for the trace!\n", path);
+    exit(1);
+  }
+  double origin = 0.0;
+  bool first = true;
+  for(int t = 0; t < TIMER_MAX_THREADS; t++) {
+    TimerThread* thread = threads[t];
+    long start = thread == NULL ? 0 : thread->nEvents > TRACE_MAX_EVENTS ? thread->nEvents - TRACE_MAX_EVENTS : 0;
+    for(long e = start; thread != NULL && e < thread->nEvents; e++) {
+      double time = thread->trace[e % TRACE_MAX_EVENTS].start;
+      origin = first || time < origin ? time : origin;
+      first = false;
+    }
+  }
+  fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+  first = true;
+  for(int t = 0; t < TIMER_MAX_THREADS; t++) {
+    TimerThread* thread = threads[t];
+    if(thread == NULL || thread->nEvents == 0) {
+      continue;
+    }
+    fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, "
+            "\"args\": {\"name\": \"thread %d\"}}", first ? "" : ",", t, t);
+    first = false;
+    long start = 0;
+    if(thread->nEvents > TRACE_MAX_EVENTS) {
+      start = thread->nEvents - TRACE_MAX_EVENTS;
+      printf("Thread %d recorded %ld trace events, only the last %d are written!\n", t, thread->nEvents,
+             TRACE_MAX_EVENTS);
+    }
+    for(long e = start; e < thread->nEvents; e++) {
+      TraceEvent* event = &thread->trace[e % TRACE_MAX_EVENTS];
+      fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+              timerNames[event->id], t, 1e6*(event->start - origin), 1e6*event->duration);
+    }
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+}
+
+/**
+ * Starts recording trace events for timersWriteTrace at the end of the run, NULL stops.
+ */
+void timersSetTrace(const char* path) {
+  free(tracePath);
+  tracePath = NULL;
+  if(path != NULL) {
+    tracePath = malloc(strlen(path) + 1);
+    if(tracePath == NULL) {
+      printf("Failed to allocate the trace file name!\n");
+      exit(1);
+    }
+    strcpy(tracePath, path);
+  }
+}
+
+const char* timersTracePath() {
+  return tracePath;
+}
+
+/**
+ * Turns the hardware counters on or off for the timers started from now on.
+ */
+void timersSetHardware(bool enable) {
+  hardwareRequested = enable;
+}
+
+/**
+ * Timer output of the whole run from the environment, read once at the start of the program: MDC_TIMER_JSON and
+ * MDC_TRACE_JSON name the files of timersWriteJSON and timersWriteTrace, MDC_PERF_COUNTERS other than 0 turns on the
+ * hardware counters. The only way to set them for batch, whose key files each describe one job.
+ */
+void timersFromEnvironment() {
+  const char* json = getenv("MDC_TIMER_JSON");
+  if(json != NULL && json[0] != '\0') {
+    timersSetJSON(json);
+  }
+  const char* trace = getenv("MDC_TRACE_JSON");
+  if(trace != NULL && trace[0] != '\0') {
+    timersSetTrace(trace);
+  }
+  const char* perf = getenv("MDC_PERF_COUNTERS");
+  if(perf != NULL && perf[0] != '\0' && strcmp(perf, "0") != 0) {
+    timersSetHardware(true);
+  }
+}
+
+/**
+ * @return true if some thread could open its hardware counters
+ */
+bool timersHardwareOpen() {
+  for(int t = 0; t < TIMER_MAX_THREADS; t++) {
+    if(threads[t] != NULL && threads[t]->hardwareLeader >= 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Events counted in a timer over all threads and callers.
+ */
+long long timerHardware(enum TimerID id, enum HardwareEvent event) {
+  long long total = 0;
+  for(int t = 0; t < TIMER_MAX_THREADS; t++) {
+    for(int n = 1; threads[t] != NULL && n < threads[t]->nNodes; n++) {
+      total += threads[t]->nodes[n].id == (int) id ? threads[t]->nodes[n].counts[event] : 0;
+    }
+  }
+  return total;
+}
+
+/////////////////////////////////////////// TESTS
+
+static void spin(double seconds) {
+  const double end = now() + seconds;
+  while(now() < end) {
+  }
+}
+
+void timersTest(bool verbose) {
+  timersReset();
+  timerStart(TIMER_TOTAL);
+  for(int i = 0; i < 3; i++) {
+    timerStart(TIMER_FORCE);
+    timerStart(TIMER_REAL_SPACE);
+    spin(1e-3);
+    timerStop(TIMER_REAL_SPACE);
+    timerStop(TIMER_FORCE);
+  }
+  // The same timer under another caller is another node
+  timerStart(TIMER_DYNAMICS);
+  timerStart(TIMER_FORCE);
+  timerStart(TIMER_REAL_SPACE);
+  spin(1e-3);
+  timerStop(TIMER_REAL_SPACE);
+  timerStop(TIMER_FORCE);
+  // Paths only follow the running timer's own children
+  const enum TimerID realSpace[2] = {TIMER_FORCE, TIMER_REAL_SPACE};
+  const double dynamicsRealSpace = timerPathSeconds(TIMER_DYNAMICS, realSpace, 2);
+  const double totalRealSpace = timerPathSeconds(TIMER_TOTAL, realSpace, 2);
+  assert(dynamicsRealSpace >= 1e-3 && dynamicsRealSpace < 3e-3 && totalRealSpace >= 3e-3);
+  assert(dynamicsRealSpace + totalRealSpace <= timerSeconds(TIMER_REAL_SPACE) * (1 + 1e-12));
+  assert(timerPathSeconds(TIMER_TOTAL, realSpace, 1) >= totalRealSpace);
+  assert(timerPathSeconds(TIMER_BAROSTAT, realSpace, 1) == 0.0);
+  assert(timerPathSeconds(TIMER_DYNAMICS, &realSpace[1], 1) == 0.0);
+  timerStop(TIMER_DYNAMICS);
+  // Threads count and time into their own trees
+  const int n = 1000;
+#pragma omp parallel for schedule(static)
+  for(int i = 0; i < n; i++) {
+    timerStart(TIMER_INTEGRATE);
+    counterAdd(COUNTER_STEPS, 1);
+    timerStop(TIMER_INTEGRATE);
+  }
+  timerStop(TIMER_TOTAL);
+  if(verbose) {
+    timersPrint();
+  }
+  assert(threads[0] != NULL && threads[0]->open == 0);
+#define NODE(n) threads[0]->nodes[n]
+  assert(NODE(NODE(NODE(0).child).child).id == TIMER_FORCE); // total -> forces
+  assert(NODE(NODE(NODE(0).child).child).calls == 3);
+  assert(NODE(NODE(NODE(NODE(0).child).child).child).calls == 3);
+#undef NODE
+  int nForce = 0, nIntegrate = 0;
+  for(int t = 0; t < TIMER_MAX_THREADS; t++) {
+    for(int k = 1; threads[t] != NULL && k < threads[t]->nNodes; k++) {
+      nForce += threads[t]->nodes[k].id == TIMER_FORCE;
+      nIntegrate += threads[t]->nodes[k].id == TIMER_INTEGRATE ? threads[t]->nodes[k].calls : 0;
+    }
+  }
+  assert(nForce == 2 && nIntegrate == n);
+  assert(counterTotal(COUNTER_STEPS) == n);
+  assert(timerSeconds(TIMER_REAL_SPACE) >= 4e-3);
+  assert(timerSeconds(TIMER_REAL_SPACE) <= timerSeconds(TIMER_FORCE));
+  assert(timerSeconds(TIMER_FORCE) <= timerSeconds(TIMER_TOTAL));
+
+  const char* path = "timersTest.json";
+  timersWriteJSON(path);
+  FILE* file = fopen(path, "r");
+  assert(file != NULL);
+  const size_t capacity = 1 << 16;
+  char* text = malloc(capacity);
+  assert(text != NULL);
+  size_t length = fread(text, 1, capacity - 1, file);
+  text[length] = '\0';
+  fclose(file);
+  remove(path);
+  assert(strstr(text, "\"name\": \"real space\"") != NULL && strstr(text, "\"steps\": 1000") != NULL);
+  if(verbose) {
+    printf("%s", text);
+  }
+  free(text);
+  timersReset();
+  assert(counterTotal(COUNTER_STEPS) == 0);
+
+  // Trace: every thread's calls on its own track, the oldest events dropped once a ring buffer is full
+  const char* tracePath = "timersTest.trace.json";
+  timersSetTrace(tracePath);
+  timerStart(TIMER_TOTAL);
+  for(int i = 0; i < TRACE_MAX_EVENTS + 10; i++) {
+    timerStart(TIMER_INTEGRATE);
+    timerStop(TIMER_INTEGRATE);
+  }
+#pragma omp parallel
+  {
+    timerStart(TIMER_PAIRS);
+    spin(1e-4);
+    timerStop(TIMER_PAIRS);
+  }
+  timerStop(TIMER_TOTAL);
+  int nThreads = 0;
+  for(int t = 0; t < TIMER_MAX_THREADS; t++) {
+    nThreads += threads[t] != NULL;
+  }
+  assert(threads[0]->nEvents == TRACE_MAX_EVENTS + 12);
+  timersWriteTrace(tracePath);
+  file = fopen(tracePath, "r");
+  assert(file != NULL);
+  char line[256];
+  int nEvents = 0, nPairs = 0, nTotal = 0, nNames = 0;
+  while(fgets(line, sizeof(line), file) != NULL) {
+    nEvents += strstr(line, "\"ph\": \"X\", \"pid\": 0, \"tid\": 0,") != NULL;
+    nPairs += strstr(line, "\"name\": \"pair loop\"") != NULL;
+    nTotal += strstr(line, "\"name\": \"total\"") != NULL && strstr(line, "\"ts\": 0.000,") != NULL;
+    nNames += strstr(line, "thread_name") != NULL;
+  }
+  fclose(file);
+  remove(tracePath);
+  assert(nEvents == TRACE_MAX_EVENTS && nPairs == nThreads && nTotal == 1 && nNames == nThreads);
+  timersSetTrace(NULL);
+  timersReset();
+
+  // Hardware counters, only checked where the machine has them
+  timersSetHardware(true);
+  const long nItems = 1000000;
+  timerStart(TIMER_PAIRS);
+  volatile double sum = 0.0;
+  for(long i = 0; i < nItems; i++) {
+    sum += 1.0;
+  }
+  timerItems(nItems);
+  timerStop(TIMER_PAIRS);
+  assert(threads[0]->nodes[1].items == nItems);
+  if(timersHardwareOpen()) {
+    if(threads[0]->hardwareSlot[HW_INSTRUCTIONS] >= 0) {
+      assert(timerHardware(TIMER_PAIRS, HW_INSTRUCTIONS) >= nItems);
+    }
+    if(threads[0]->hardwareSlot[HW_CYCLES] >= 0) {
+      assert(timerHardware(TIMER_PAIRS, HW_CYCLES) > 0);
+    }
+  } else {
+    assert(timerHardware(TIMER_PAIRS, HW_CYCLES) == 0);
+  }
+  if(verbose) {
+    timersPrint();
+  }
+  timersSetHardware(false);
+  timersReset();
+
+  // Settings from the environment
+  setenv("MDC_TIMER_JSON", path, 1);
+  setenv("MDC_TRACE_JSON", "", 1);
+  setenv("MDC_PERF_COUNTERS", "0", 1);
+  timersFromEnvironment();
+  assert(strcmp(timersJSONPath(), path) == 0 && timersTracePath() == NULL && !hardwareRequested);
+  setenv("MDC_PERF_COUNTERS", "1", 1);
+  timersFromEnvironment();
+  assert(hardwareRequested);
+  unsetenv("MDC_TIMER_JSON");
+  unsetenv("MDC_TRACE_JSON");
+  unsetenv("MDC_PERF_COUNTERS");
+  timersSetJSON(NULL);
+  timersSetHardware(false);
+  printf("All tests of timers.c passed!\n");
+}
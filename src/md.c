@@ -3,14 +3,14 @@
 #include <time.h>
 
 #include "common/include/commandInterpreter.h"
+#include "common/include/timers.h"
 
 void reportRuntime(struct timespec start, struct timespec end) {
-    long time_nsec = end.tv_nsec - start.tv_nsec;
-    long time_msec = time_nsec / (long) 1e6;
-    float time_sec = (double) time_msec / 1e3;
-    long time_min = time_msec / ((long) 1e3 * 60);
-    long time_hr = time_min / 60;
-    long time_day = time_hr / 24;
+    long time_msec = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / (long) 1e6;
+    float time_sec = (time_msec % (60 * 1000)) / 1e3;
+    long time_min = time_msec / ((long) 1e3 * 60) % 60;
+    long time_hr = time_msec / ((long) 1e3 * 3600) % 24;
+    long time_day = time_msec / ((long) 1e3 * 86400);
     if (time_day != 0) {
         printf("\n\nExecution time day:hr:min:sec --> %3ld:%2ld:%2ld:%5.3f", time_day, time_hr, time_min, time_sec);
     } else if (time_hr != 0) {
@@ -24,14 +24,24 @@ void reportRuntime(struct timespec start, struct timespec end) {
 }
 
 /**
-    * Time the total program execution time and report.
+    * Time the total program execution time and report, with the per-phase timers and counters.
     */
 int main(int argc, char* argv[]) {
     struct timespec start, end;
     clock_gettime(CLOCK_MONOTONIC, &start);
+    timersFromEnvironment();
     // Entire mdc program
+    TIMER_START(TIMER_TOTAL);
     commandInterpreter(argc, argv);
+    TIMER_STOP(TIMER_TOTAL);
     clock_gettime(CLOCK_MONOTONIC, &end);
+    timersPrint();
+    if (timersJSONPath() != NULL) {
+        timersWriteJSON(timersJSONPath());
+    }
+    if (timersTracePath() != NULL) {
+        timersWriteTrace(timersTracePath());
+    }
     reportRuntime(start, end);
     return 0;
 }
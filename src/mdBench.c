@@ -0,0 +1,686 @@
+// Author(s): Matthew Speranza
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "common/include/commandInterpreter.h"
+#include "common/include/energy.h"
+#include "common/include/fft.h"
+#include "common/include/memoryTracker.h"
+#include "common/include/timers.h"
+
+/**
+ * End-to-end benchmarks on fixed workloads, for gating upgrades on performance.
+ * <hr>
+ * Every workload runs through the same code as the molecular_dynamics_C commands (systemCreate from a structure and
+ * key file, then the potential) at each requested thread count. Inputs are examples/dhfr.xyz and
+ * examples/waterbox.xyz, the water box also tiled into larger cubes ("-x3" is 3x3x3 boxes) with its TIP3P types
+ * mapped onto AMOEBA water. Structures and keys are written to the work directory, where every workload's own
+ * output goes to mdBench.log so the terminal only shows the results.
+ * <p>
+ * There are no bonded or vdW terms yet, without which neither DHFR nor the water box holds together under
+ * dynamics, so there is no dynamics workload (nor ns/day) until there are.
+ * <p>
+ * Each run records its wall time, the time per unit of work (median over repeats), the seconds of every timer phase
+ * (none when built without TIMERS), the peak resident set of the run (VmHWM after resetting it through
+ * /proc/self/clear_refs, the process' peak elsewhere) and the peak of the tracked memory. The speedup is against the
+ * same workload on 1 thread. Results go to one JSON object per line, so a results file can be kept as the baseline of
+ * the next run: a run whose time per unit or peak resident set grows past the tolerance of the baseline's counts as a
+ * regression and mdBench exits with 1.
+ * <p>
+ * There is no reciprocal space yet, so the fft workloads time what PME's would be built around: a forward and
+ * backward 3D FFT of DHFR's 64^3 grid (examples/dhfr.properties) and of the 128^3 grid of a box twice that size. The
+ * name pme is kept for a workload that runs the reciprocal space itself.
+ * <p>
+ * mdBench [-examples dir] [-forcefield prm] [-work dir] [-out json] [-baseline json] [-time-tolerance fraction]
+ *         [-memory-tolerance fraction] [-threads n,...|max] [-workloads name,...]
+ */
+#define MAX_RUNS 128
+#define MAX_THREAD_COUNTS 16
+#define DHFR_BOX 62.23 // examples/dhfr.properties
+#define WATER_BOX 24.662 // examples/waterbox.key
+#define FFT_GRID 64 // The PME grid of examples/dhfr.properties
+#define BENCH_CUTOFF 7.0 // The ewald-cutoff of examples/dhfr.properties
+#define AMOEBA_WATER_O 402 // amoebabio09.prm
+#define AMOEBA_WATER_H 403
+
+enum WorkloadKind {BENCH_STARTUP, BENCH_ENERGY, BENCH_POLARIZE, BENCH_FFT};
+enum BenchStructure {BENCH_DHFR, BENCH_WATER};
+
+typedef struct Workload {
+  const char* name;
+  enum WorkloadKind kind;
+  enum BenchStructure structure;
+  int replicas; // Boxes per side
+  int repeats; // Timed units
+  const char* unit;
+} Workload;
+
+static const Workload workloads[] = {
+  {"startup", BENCH_STARTUP, BENCH_DHFR, 1, 3, "startup"},
+  {"startup-water-x3", BENCH_STARTUP, BENCH_WATER, 3, 3, "startup"},
+  {"water-energy", BENCH_ENERGY, BENCH_WATER, 1, 10, "evaluation"},
+  {"water-energy-x3", BENCH_ENERGY, BENCH_WATER, 3, 5, "evaluation"},
+  {"dhfr-energy", BENCH_ENERGY, BENCH_DHFR, 1, 5, "evaluation"},
+  {"fft-64", BENCH_FFT, BENCH_DHFR, 1, 20, "transform"},
+  {"fft-128", BENCH_FFT, BENCH_DHFR, 2, 5, "transform"},
+  {"dhfr-polarization", BENCH_POLARIZE, BENCH_DHFR, 1, 3, "solve"},
+  {"water-polarization-x3", BENCH_POLARIZE, BENCH_WATER, 3, 3, "solve"},
+};
+#define N_WORKLOADS ((int) (sizeof(workloads)/sizeof(workloads[0])))
+
+typedef struct BenchRun {
+  const Workload* workload;
+  int threads;
+  int atoms; // Grid points for fft
+  int repeats;
+  double seconds; // Wall time of the timed part
+  double unitSeconds;
+  double speedup; // Against 1 thread, 0 without a 1 thread run
+  double peakRSS; // MB
+  double trackedPeak; // MB
+  double energy; // kcal/mol, 0 for startup and fft
+  double phases[N_TIMERS];
+} BenchRun;
+
+typedef struct BenchOptions {
+  char* examples;
+  char* forceField;
+  char* work;
+  char* out;
+  char* baseline;
+  double timeTolerance;
+  double memoryTolerance;
+  int threads[MAX_THREAD_COUNTS];
+  int nThreads;
+  char* only; // Comma separated workloads, NULL for all
+  bool rssReset; // Peak resident set is per run
+} BenchOptions;
+
+static int compareDoubles(const void* a, const void* b) {
+  double x = *(const double*) a, y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+static double median(double* values, int n) {
+  qsort(values, n, sizeof(double), compareDoubles);
+  return n % 2 == 1 ? values[n/2] : 0.5*(values[n/2 - 1] + values[n/2]);
+}
+
+static int maxThreads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+static void setThreads(int n) {
+#ifdef _OPENMP
+  omp_set_num_threads(n);
+#else
+  (void) n;
+#endif
+}
+
+/**
+ * Starts the peak resident set over from the current one (Linux), false where it can't be.
+ */
+static bool resetPeakRSS() {
+  FILE* file = fopen("/proc/self/clear_refs", "w");
+  if(file == NULL) {
+    return false;
+  }
+  bool reset = fputs("5", file) >= 0;
+  return fclose(file) == 0 && reset;
+}
+
+/**
+ * Peak resident set in MB: VmHWM, or the process' peak from getrusage.
+ */
+static double peakRSS() {
+  FILE* file = fopen("/proc/self/status", "r");
+  if(file != NULL) {
+    char line[256];
+    long kb = -1;
+    while(fgets(line, sizeof(line), file) != NULL && kb < 0) {
+      if(strncmp(line, "VmHWM:", 6) == 0) {
+        kb = atol(line + 6);
+      }
+    }
+    fclose(file);
+    if(kb >= 0) {
+      return kb/1024.0;
+    }
+  }
+  struct rusage usage;
+  return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss/1024.0 : 0.0;
+}
+
+/////////////////////////////////////////// INPUTS
+
+static char* joinPath(const char* dir, const char* file) {
+  char* path = malloc(strlen(dir) + strlen(file) + 2);
+  if(path == NULL) {
+    printf("Failed to allocate a path in mdBench!\n");
+    exit(1);
+  }
+  sprintf(path, "%s/%s", dir, file);
+  return path;
+}
+
+/**
+ * Tiles examples/waterbox.xyz replicas^3 times into work/water-x<replicas>.xyz with AMOEBA water types.
+ */
+static char* scaledWaterBox(BenchOptions* options, int replicas) {
+  char name[64];
+  sprintf(name, "water-x%d.xyz", replicas);
+  char* path = joinPath(options->work, name);
+  char* source = joinPath(options->examples, "waterbox.xyz");
+  FILE* in = fopen(source, "r");
+  if(in == NULL) {
+    printf("Failed to read %s!\n", source);
+    exit(1);
+  }
+  int nAtoms;
+  char line[256];
+  if(fgets(line, sizeof(line), in) == NULL || sscanf(line, "%d", &nAtoms) != 1) {
+    printf("No atom count in %s!\n", source);
+    exit(1);
+  }
+  REAL* X = malloc(sizeof(REAL)*nAtoms*3);
+  int* types = malloc(sizeof(int)*nAtoms);
+  int (*bonds)[2] = malloc(sizeof(int[2])*nAtoms);
+  char (*names)[8] = malloc(sizeof(char[8])*nAtoms);
+  if(X == NULL || types == NULL || bonds == NULL || names == NULL) {
+    printf("Failed to allocate the water box!\n");
+    exit(1);
+  }
+  for(int i = 0; i < nAtoms; i++) {
+    int index;
+    bonds[i][0] = bonds[i][1] = 0;
+    if(fgets(line, sizeof(line), in) == NULL || sscanf(line, "%d %7s %lf %lf %lf %d %d %d", &index, names[i],
+       &X[i*3], &X[i*3 + 1], &X[i*3 + 2], &types[i], &bonds[i][0], &bonds[i][1]) < 7) {
+      printf("Failed to read atom %d of %s!\n", i + 1, source);
+      exit(1);
+    }
+  }
+  fclose(in);
+  FILE* out = fopen(path, "w");
+  if(out == NULL) {
+    printf("Failed to write %s!\n", path);
+    exit(1);
+  }
+  fprintf(out, "%7d  Water box x%d (%d waters)\n", nAtoms*replicas*replicas*replicas, replicas,
+          nAtoms/3*replicas*replicas*replicas);
+  int offset = 0;
+  for(int a = 0; a < replicas; a++) {
+    for(int b = 0; b < replicas; b++) {
+      for(int c = 0; c < replicas; c++) {
+        const int shift[3] = {a, b, c};
+        for(int i = 0; i < nAtoms; i++) {
+          fprintf(out, "%7d  %-3s", offset + i + 1, names[i]);
+          for(int j = 0; j < 3; j++) {
+            fprintf(out, " %12.6f", X[i*3 + j] + shift[j]*WATER_BOX);
+          }
+          fprintf(out, " %5d", types[i] == 1 ? AMOEBA_WATER_O : AMOEBA_WATER_H);
+          for(int k = 0; k < 2 && bonds[i][k] > 0; k++) {
+            fprintf(out, " %7d", offset + bonds[i][k]);
+          }
+          fprintf(out, "\n");
+        }
+        offset += nAtoms;
+      }
+    }
+  }
+  fclose(out);
+  free(X);
+  free(types);
+  free(bonds);
+  free(names);
+  free(source);
+  return path;
+}
+
+/**
+ * Key file of a workload in the work directory.
+ */
+static char* workloadKey(BenchOptions* options, const Workload* workload) {
+  char name[96];
+  sprintf(name, "%s.key", workload->name);
+  char* path = joinPath(options->work, name);
+  FILE* file = fopen(path, "w");
+  if(file == NULL) {
+    printf("Failed to write %s!\n", path);
+    exit(1);
+  }
+  const REAL box = (workload->structure == BENCH_DHFR ? DHFR_BOX : WATER_BOX)*workload->replicas;
+  fprintf(file, "forcefield %s\n", options->forceField);
+  fprintf(file, "a-axis %.4f\n", box);
+  fprintf(file, "cutoff %.1f\n", BENCH_CUTOFF);
+  fprintf(file, "randomseed 1\n");
+  if(workload->kind == BENCH_POLARIZE) {
+    // Every solve starts from the direct dipoles, no history to extrapolate from
+    fprintf(file, "polarization mutual\npolar-eps 0.00001\npolar-predict 0\n");
+  }
+  fclose(file);
+  return path;
+}
+
+/////////////////////////////////////////// WORKLOADS
+
+static void runFFT(const Workload* workload, BenchRun* run) {
+  const int n = fftGoodSize(FFT_GRID*workload->replicas);
+  const int nComplex = n*n*(n/2 + 1)*2;
+  REAL* grid = malloc(sizeof(REAL)*n*n*n);
+  REAL* transform = malloc(sizeof(REAL)*nComplex);
+  double* times = malloc(sizeof(double)*run->repeats);
+  if(grid == NULL || transform == NULL || times == NULL) {
+    printf("Failed to allocate the %d^3 grid!\n", n);
+    exit(1);
+  }
+  for(int i = 0; i < n*n*n; i++) {
+    grid[i] = (i*7919 % 1000)*1e-3;
+  }
+  FFTPlan3D* plan = fftPlan3DCreate(n, n, n);
+  run->atoms = n*n*n;
+  for(int r = 0; r < run->repeats; r++) {
+    double start = timerNow();
+    fft3DR2C(plan, grid, transform);
+    fft3DC2R(plan, transform, grid);
+    times[r] = timerNow() - start;
+    run->seconds += times[r];
+    for(int i = 0; i < n*n*n; i++) {
+      grid[i] /= n*n*n;
+    }
+  }
+  run->unitSeconds = median(times, run->repeats);
+  fftPlan3DDestroy(plan);
+  free(grid);
+  free(transform);
+  free(times);
+}
+
+static void runSystem(const Workload* workload, BenchRun* run, char* structure, char* key) {
+  double* times = malloc(sizeof(double)*run->repeats);
+  if(times == NULL) {
+    printf("Failed to allocate the benchmark times!\n");
+    exit(1);
+  }
+  if(workload->kind == BENCH_STARTUP) {
+    for(int r = 0; r < run->repeats; r++) {
+      double start = timerNow();
+      System* system = systemCreate(structure, key);
+      run->atoms = system->nAtoms;
+      systemDestroy(system);
+      times[r] = timerNow() - start;
+      run->seconds += times[r];
+    }
+    run->unitSeconds = median(times, run->repeats);
+    free(times);
+    return;
+  }
+  System* system = systemCreate(structure, key);
+  run->atoms = system->nAtoms;
+  Potential* pot = potentialCreate(system);
+  // First evaluation rotates the multipoles and touches every workspace
+  run->energy = potentialEnergy(system, pot);
+  for(int r = 0; r < run->repeats; r++) {
+    double start = timerNow();
+    if(workload->kind == BENCH_POLARIZE) {
+      run->energy = induceDipoles(system, pot->induced, pot->direct);
+    } else {
+      run->energy = potentialEnergy(system, pot);
+    }
+    times[r] = timerNow() - start;
+    run->seconds += times[r];
+  }
+  run->unitSeconds = median(times, run->repeats);
+  potentialDestroy(pot);
+  systemDestroy(system);
+  free(times);
+}
+
+/**
+ * Runs a workload on threads threads with its output sent to the log.
+ */
+static void runWorkload(BenchOptions* options, const Workload* workload, int threads, FILE* log, BenchRun* run) {
+  memset(run, 0, sizeof(BenchRun));
+  run->workload = workload;
+  run->threads = threads;
+  run->repeats = workload->repeats;
+  char* structure = NULL;
+  char* key = NULL;
+  if(workload->kind != BENCH_FFT) {
+    structure = workload->structure == BENCH_DHFR ? joinPath(options->examples, "dhfr.xyz")
+                                                  : scaledWaterBox(options, workload->replicas);
+    key = workloadKey(options, workload);
+  }
+  fprintf(log, "\n######## %s, %d threads\n", workload->name, threads);
+  fflush(log);
+  fflush(stdout);
+  const int terminal = dup(STDOUT_FILENO);
+  dup2(fileno(log), STDOUT_FILENO);
+  setThreads(threads);
+  timersReset();
+  memoryResetPeaks();
+  options->rssReset = resetPeakRSS();
+  if(workload->kind == BENCH_FFT) {
+    runFFT(workload, run);
+  } else {
+    runSystem(workload, run, structure, key);
+  }
+  run->peakRSS = peakRSS();
+  run->trackedPeak = memoryTotalPeak()/1048576.0;
+  for(int t = 0; t < N_TIMERS; t++) {
+    run->phases[t] = timerSeconds(t);
+  }
+  fflush(stdout);
+  dup2(terminal, STDOUT_FILENO);
+  close(terminal);
+  free(structure);
+  free(key);
+}
+
+/////////////////////////////////////////// RESULTS
+
+static void writeRun(FILE* file, BenchRun* run) {
+  fprintf(file, "{\"workload\": \"%s\", \"threads\": %d, \"atoms\": %d, \"repeats\": %d, \"unit\": \"%s\", "
+          "\"seconds\": %.6f, \"unit_seconds\": %.9f, ", run->workload->name, run->threads, run->atoms,
+          run->repeats, run->workload->unit, run->seconds, run->unitSeconds);
+  if(run->speedup > 0.0) {
+    fprintf(file, "\"speedup\": %.4f, ", run->speedup);
+  }
+  fprintf(file, "\"peak_rss_mb\": %.3f, \"tracked_peak_mb\": %.3f, \"energy\": %.8f, \"phases\": {",
+          run->peakRSS, run->trackedPeak, run->energy);
+  bool first = true;
+  for(int t = 0; t < N_TIMERS; t++) {
+    if(run->phases[t] > 0.0) {
+      fprintf(file, "%s\"%s\": %.6f", first ? "" : ", ", timerName(t), run->phases[t]);
+      first = false;
+    }
+  }
+  fprintf(file, "}}");
+}
+
+/**
+ * {"mdBench": 1, "build": {...}, "results": [run, one per line]}
+ */
+static void writeResults(BenchOptions* options, BenchRun* runs, int nRuns) {
+  FILE* file = fopen(options->out, "w");
+  if(file == NULL) {
+    printf("Failed to write %s!\n", options->out);
+    exit(1);
+  }
+  bool timers = false, mixed = false, openMP = false;
+#ifdef TIMERS
+  timers = true;
+#endif
+#ifdef MIXED_PRECISION
+  mixed = true;
+#endif
+#ifdef _OPENMP
+  openMP = true;
+#endif
+  fprintf(file, "{\"mdBench\": 1, \"build\": {\"timers\": %s, \"mixed_precision\": %s, \"openmp\": %s, "
+          "\"max_threads\": %d, \"per_run_rss\": %s},\n \"results\": [\n", timers ? "true" : "false",
+          mixed ? "true" : "false", openMP ? "true" : "false", maxThreads(), options->rssReset ? "true" : "false");
+  for(int r = 0; r < nRuns; r++) {
+    fprintf(file, "  ");
+    writeRun(file, &runs[r]);
+    fprintf(file, "%s\n", r < nRuns - 1 ? "," : "");
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+}
+
+static bool jsonNumber(const char* line, const char* key, double* value) {
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  const char* at = strstr(line, pattern);
+  if(at == NULL) {
+    return false;
+  }
+  char* end;
+  *value = strtod(at + strlen(pattern), &end);
+  return end != at + strlen(pattern);
+}
+
+static bool jsonString(const char* line, const char* key, char* value, int size) {
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), "\"%s\": \"", key);
+  const char* at = strstr(line, pattern);
+  if(at == NULL) {
+    return false;
+  }
+  at += strlen(pattern);
+  int n = 0;
+  while(at[n] != '"' && at[n] != '\0' && n < size - 1) {
+    value[n] = at[n];
+    n++;
+  }
+  value[n] = '\0';
+  return at[n] == '"';
+}
+
+/**
+ * Compares every run to the baseline run of the same workload and thread count.
+ * @return number of regressions
+ */
+static int compareBaseline(BenchOptions* options, BenchRun* runs, int nRuns) {
+  FILE* file = fopen(options->baseline, "r");
+  if(file == NULL) {
+    printf("Failed to read the baseline %s!\n", options->baseline);
+    exit(1);
+  }
+  bool* found = calloc(nRuns, sizeof(bool));
+  double* baseUnit = calloc(nRuns, sizeof(double));
+  double* baseRSS = calloc(nRuns, sizeof(double));
+  if(found == NULL || baseUnit == NULL || baseRSS == NULL) {
+    printf("Failed to allocate the baseline!\n");
+    exit(1);
+  }
+  char line[4096];
+  while(fgets(line, sizeof(line), file) != NULL) {
+    char name[64];
+    double threads, unit, rss;
+    if(!jsonString(line, "workload", name, sizeof(name)) || !jsonNumber(line, "threads", &threads)
+       || !jsonNumber(line, "unit_seconds", &unit) || !jsonNumber(line, "peak_rss_mb", &rss)) {
+      continue;
+    }
+    for(int r = 0; r < nRuns; r++) {
+      if(strcmp(runs[r].workload->name, name) == 0 && runs[r].threads == (int) threads) {
+        found[r] = true;
+        baseUnit[r] = unit;
+        baseRSS[r] = rss;
+      }
+    }
+  }
+  fclose(file);
+  printf("\n Against %s (time tolerance %.1f%%, memory tolerance %.1f%%)\n", options->baseline,
+         100*options->timeTolerance, 100*options->memoryTolerance);
+  printf(" %-24s %7s %14s %14s %9s %10s %10s %9s\n", "Workload", "Threads", "Base (s)", "Now (s)", "Time",
+         "Base (MB)", "Now (MB)", "Memory");
+  int nRegressions = 0;
+  for(int r = 0; r < nRuns; r++) {
+    if(!found[r]) {
+      printf(" %-24s %7d %14s %14.6f %9s\n", runs[r].workload->name, runs[r].threads, "-", runs[r].unitSeconds,
+             "new");
+      continue;
+    }
+    const double time = runs[r].unitSeconds/baseUnit[r] - 1.0;
+    const double memory = baseRSS[r] > 0.0 ? runs[r].peakRSS/baseRSS[r] - 1.0 : 0.0;
+    const bool slower = time > options->timeTolerance;
+    const bool bigger = memory > options->memoryTolerance;
+    nRegressions += slower || bigger;
+    printf(" %-24s %7d %14.6f %14.6f %+8.1f%% %10.1f %10.1f %+8.1f%%%s\n", runs[r].workload->name,
+           runs[r].threads, baseUnit[r], runs[r].unitSeconds, 100*time, baseRSS[r], runs[r].peakRSS, 100*memory,
+           slower && bigger ? "  SLOWER, LARGER" : slower ? "  SLOWER" : bigger ? "  LARGER" : "");
+  }
+  free(found);
+  free(baseUnit);
+  free(baseRSS);
+  return nRegressions;
+}
+
+/////////////////////////////////////////// OPTIONS
+
+static void parseThreads(BenchOptions* options, char* list) {
+  options->nThreads = 0;
+  for(char* item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")) {
+    int n = strcmp(item, "max") == 0 ? maxThreads() : atoi(item);
+    if(n < 1) {
+      printf("Invalid thread count %s!\n", item);
+      exit(1);
+    }
+    bool repeated = false;
+    for(int t = 0; t < options->nThreads; t++) {
+      repeated = repeated || options->threads[t] == n;
+    }
+    if(!repeated && options->nThreads < MAX_THREAD_COUNTS) {
+      options->threads[options->nThreads++] = n;
+    }
+  }
+}
+
+static bool selected(BenchOptions* options, const Workload* workload) {
+  if(options->only == NULL) {
+    return true;
+  }
+  const size_t length = strlen(workload->name);
+  for(const char* at = strstr(options->only, workload->name); at != NULL; at = strstr(at + 1, workload->name)) {
+    bool start = at == options->only || at[-1] == ',';
+    bool end = at[length] == '\0' || at[length] == ',';
+    if(start && end) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void usage() {
+  printf("mdBench [-examples dir] [-forcefield prm] [-work dir] [-out json] [-baseline json] "
+         "[-time-tolerance fraction] [-memory-tolerance fraction] [-threads n,...|max] "
+         "[-workloads name,...]\nWorkloads:");
+  for(int w = 0; w < N_WORKLOADS; w++) {
+    printf(" %s", workloads[w].name);
+  }
+  printf("\n");
+}
+
+static void parseOptions(BenchOptions* options, int argc, char* argv[]) {
+  options->examples = "examples";
+  options->forceField = NULL;
+  options->work = "mdBench.work";
+  options->out = "mdBench.json";
+  options->baseline = NULL;
+  options->timeTolerance = 0.10;
+  options->memoryTolerance = 0.10;
+  options->only = NULL;
+  char defaultThreads[] = "1,max";
+  parseThreads(options, defaultThreads);
+  for(int a = 1; a < argc; a++) {
+    if(strcmp(argv[a], "-h") == 0 || strcmp(argv[a], "-help") == 0) {
+      usage();
+      exit(0);
+    }
+    if(a + 1 == argc) {
+      printf("No value for %s!\n", argv[a]);
+      usage();
+      exit(1);
+    }
+    char* value = argv[++a];
+    if(strcmp(argv[a - 1], "-examples") == 0) {
+      options->examples = value;
+    } else if(strcmp(argv[a - 1], "-forcefield") == 0) {
+      options->forceField = value;
+    } else if(strcmp(argv[a - 1], "-work") == 0) {
+      options->work = value;
+    } else if(strcmp(argv[a - 1], "-out") == 0) {
+      options->out = value;
+    } else if(strcmp(argv[a - 1], "-baseline") == 0) {
+      options->baseline = value;
+    } else if(strcmp(argv[a - 1], "-time-tolerance") == 0) {
+      options->timeTolerance = atof(value);
+    } else if(strcmp(argv[a - 1], "-memory-tolerance") == 0) {
+      options->memoryTolerance = atof(value);
+    } else if(strcmp(argv[a - 1], "-threads") == 0) {
+      parseThreads(options, value);
+    } else if(strcmp(argv[a - 1], "-workloads") == 0) {
+      options->only = value;
+    } else {
+      printf("Unknown option %s!\n", argv[a - 1]);
+      usage();
+      exit(1);
+    }
+  }
+  if(options->nThreads == 0) {
+    printf("Need at least one thread count!\n");
+    exit(1);
+  }
+  if(options->forceField == NULL) {
+    options->forceField = joinPath(options->examples, "../src/classical/forcefields/amoebabio09.prm");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  BenchOptions options;
+  parseOptions(&options, argc, argv);
+  if(mkdir(options.work, 0755) != 0 && access(options.work, W_OK) != 0) {
+    printf("Failed to create the work directory %s!\n", options.work);
+    exit(1);
+  }
+  char* logPath = joinPath(options.work, "mdBench.log");
+  FILE* log = fopen(logPath, "w");
+  if(log == NULL) {
+    printf("Failed to write %s!\n", logPath);
+    exit(1);
+  }
+  BenchRun runs[MAX_RUNS];
+  int nRuns = 0;
+  printf("Workload output goes to %s\n\n", logPath);
+  printf(" %-24s %7s %10s %14s %8s %10s\n", "Workload", "Threads", "Atoms", "Seconds/unit", "Speedup", "RSS (MB)");
+  for(int w = 0; w < N_WORKLOADS; w++) {
+    if(!selected(&options, &workloads[w])) {
+      continue;
+    }
+    double serial = 0.0;
+    for(int t = 0; t < options.nThreads && nRuns < MAX_RUNS; t++) {
+      BenchRun* run = &runs[nRuns++];
+      // Name first, so a workload that exits shows which one it was
+      printf(" %-24s %7d", workloads[w].name, options.threads[t]);
+      fflush(stdout);
+      runWorkload(&options, &workloads[w], options.threads[t], log, run);
+      serial = run->threads == 1 ? run->unitSeconds : serial;
+      run->speedup = serial > 0.0 ? serial/run->unitSeconds : 0.0;
+      char speedup[32] = "";
+      if(run->speedup > 0.0) {
+        sprintf(speedup, "%.2f", run->speedup);
+      }
+      printf(" %10d %14.6f %8s %10.1f\n", run->atoms, run->unitSeconds, speedup, run->peakRSS);
+      fflush(stdout);
+    }
+  }
+  fclose(log);
+  if(nRuns == 0) {
+    printf("No workload selected!\n");
+    usage();
+    exit(1);
+  }
+  writeResults(&options, runs, nRuns);
+  printf("\nWrote %d runs to %s\n", nRuns, options.out);
+  int nRegressions = options.baseline != NULL ? compareBaseline(&options, runs, nRuns) : 0;
+  free(logPath);
+  if(nRegressions > 0) {
+    printf("\n%d runs regressed!\n", nRegressions);
+    return 1;
+  }
+  return 0;
+}